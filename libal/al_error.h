@@ -16,4 +16,18 @@
 
 #define AL_ERROR_MAIN_KUBRIDGE_NOT_FOUND	-4000
 
+#define AL_ERROR_STATS_TOO_MANY_DUMPERS		-5000
+
+#define AL_ERROR_IRP_INVALID_RECORD			-6000
+
+#define AL_ERROR_DRES_INCOMPLETE_TARGET		-7000
+
+#define AL_ERROR_TEXC_UNSUPPORTED			-8000
+#define AL_ERROR_TEXC_INVALID_INDEX			-8001
+#define AL_ERROR_TEXC_INVALID_PAYLOAD		-8002
+
+#define AL_ERROR_PACK_INVALID_HEADER		-9000
+#define AL_ERROR_PACK_INVALID_DIRECTORY		-9001
+#define AL_ERROR_PACK_BLOCK_SIZE			-9002
+
 #endif
\ No newline at end of file
@@ -0,0 +1,869 @@
+/* alloc_prof.c -- attribute the game's heap calls to call sites
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// malloc, free, realloc and operator new/delete of the game are counted
+// by call site, the return address of the call into libal, and by size
+// bin, the size classes of size_class.c with one bin for larger blocks.
+// The hooks are bound after POOL_ALLOC's, so both work together and the
+// call sites are the game's.
+//
+// Live blocks are kept in an open addressed table of ALLOC_PROF_SIZE bytes
+// with their size, site, allocation time and frame, so a free is charged
+// to the site that allocated the block, with its lifetime and whether it
+// died in the frame it was born in. Blocks allocated before profiling
+// started, or while the table was full, are only counted.
+//
+// Every call takes one lock, this is a profiler and not meant to stay on.
+//
+// With ALLOC_PROF_TRACE every tracked call is also appended to a log of
+// ALLOC_PROF_TRACE_SIZE bytes, written to alloc_trace.txt in the format
+// tools/allocbench.c replays. Blocks are numbered from 0, numbers of freed
+// blocks are handed out again. Once the log is full, later calls are only
+// counted, so the trace is always a complete prefix of the run.
+//
+// On a stats dump, return addresses are mapped to the function of the
+// module containing them through its symbol index. alloc_prof.csv gets the
+// totals and tables, alloc_prof.bin the same for tools/allocprof.c, with
+// the allocations of the last APROF_FRAMES frames.
+//
+
+#include <kernel.h>
+
+#include "alloc_prof.h"
+#include "size_class.h"
+#include "open_table.h"
+#include "config.h"
+#include "al_error.h"
+
+#define APROF_NUM_BINS	(SCLS_NUM_CLASSES + 1)
+
+typedef struct {
+	void *ptr;
+	uint32_t size;
+	uint32_t time;		// low bits of the process time at allocation
+	uint16_t site;
+	uint16_t frame;		// low bits of the frame it was allocated in
+#ifdef ALLOC_PROF_TRACE
+	uint32_t id;		// number of the block in the trace
+#endif
+} AprofBlock;
+
+#ifdef ALLOC_PROF_TRACE
+typedef struct {
+	uint32_t op;		// 'm', 'r' or 'f'
+	uint32_t id;
+	uint32_t size;
+} AprofTraceOp;
+#endif
+
+typedef struct {
+	uint32_t lr;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t reallocs;
+	uint32_t frameLocal;
+	uint32_t threads;
+	uint64_t bytes;
+	uint32_t liveCount;
+	uint32_t liveBytes;
+	uint32_t peakLiveBytes;
+	StatsHist size;
+	StatsHist lifetime;
+} AprofSite;
+
+// keyed by pointer and by return address
+static OpenTable block_table;
+static OpenTable site_table;
+
+// the last one collects the calls of sites that did not fit
+static AprofSite *sites;
+static AllocProfSite *records;
+static int32_t record_syms[APROF_MAX_SITES + 1];
+
+static AllocProfBin bins[APROF_NUM_BINS];
+static AllocProfThread threads[APROF_MAX_THREADS + 1];
+static AllocProfFrame frames[APROF_FRAMES];
+static AllocProfFrame frames_out[APROF_FRAMES];
+static AllocProfFrame current;
+
+#ifdef ALLOC_PROF_TRACE
+static AprofTraceOp *trace;
+static uint32_t trace_max = 0;
+static uint32_t trace_count = 0;
+static uint32_t trace_dropped = 0;
+static uint32_t *free_ids;
+static uint32_t num_free_ids = 0;
+static uint32_t next_id = 0;
+#endif
+
+static so_module *module;
+
+static SceKernelLwMutexWork lock;
+static int running = 0;
+
+static AllocProfStats stats;
+
+static void *(* next_malloc)(size_t size);
+static void (* next_free)(void *ptr);
+static void *(* next_realloc)(void *ptr, size_t size);
+static void *(* next__Znwj)(size_t size);
+static void *(* next__Znaj)(size_t size);
+static void (* next__ZdlPv)(void *ptr);
+static void (* next__ZdaPv)(void *ptr);
+
+static uint32_t bin_index(uint32_t size)
+{
+	uint32_t lo = 0, hi = SCLS_NUM_CLASSES, mid;
+
+	if (size > SCLS_MAX_SIZE)
+		return SCLS_NUM_CLASSES;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (scls_size(mid) < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+// called with the lock held
+static uint32_t site_index(uint32_t lr)
+{
+	AprofSite *s = otab_find(&site_table, lr);
+
+	if (s != NULL)
+		return s - sites;
+
+	s = otab_insert(&site_table, lr);
+	if (s == NULL)
+		return APROF_MAX_SITES;
+
+	stats_hist_reset(&s->size);
+	stats_hist_reset(&s->lifetime);
+	stats.sites++;
+
+	return s - sites;
+}
+
+// called with the lock held, the last entry collects threads that did not fit
+static uint32_t thread_index(void)
+{
+	SceUID thid = sceKernelGetThreadId();
+	SceKernelThreadInfo info;
+	uint32_t i;
+
+	for (i = 0; i < stats.threads; i++) {
+		if (threads[i].thid == thid)
+			return i;
+	}
+
+	if (i == APROF_MAX_THREADS)
+		return APROF_MAX_THREADS;
+
+	threads[i].thid = thid;
+	info.size = sizeof(SceKernelThreadInfo);
+	if (sceKernelGetThreadInfo(thid, &info) >= 0)
+		sceClibMemcpy(threads[i].name, info.name, sizeof(threads[i].name));
+	threads[i].name[sizeof(threads[i].name) - 1] = '\0';
+	stats.threads++;
+
+	return i;
+}
+
+// called with the lock held, returns NULL if the table is full
+static AprofBlock *track(void *ptr, uint32_t size, uint32_t site, uint32_t time, uint16_t frame)
+{
+	AprofSite *s = &sites[site];
+	AllocProfBin *b = &bins[bin_index(size)];
+	AprofBlock *blk = otab_insert(&block_table, (uintptr_t)ptr);
+
+	if (blk == NULL) {
+		stats.dropped++;
+		return NULL;
+	}
+
+	blk->size = size;
+	blk->time = time;
+	blk->site = site;
+	blk->frame = frame;
+
+	s->liveCount++;
+	s->liveBytes += size;
+	if (s->liveBytes > s->peakLiveBytes)
+		s->peakLiveBytes = s->liveBytes;
+
+	b->liveCount++;
+	b->liveBytes += size;
+	if (b->liveBytes > b->peakLiveBytes)
+		b->peakLiveBytes = b->liveBytes;
+
+	stats.liveCount++;
+	stats.liveBytes += size;
+	if (stats.liveBytes > stats.peakLiveBytes) {
+		stats.peakLiveBytes = stats.liveBytes;
+		stats.peakFrame = stats.frames;
+	}
+
+	return blk;
+}
+
+// called with the lock held, copies the block out and takes it off the
+// live counters, returns 0 if ptr is not tracked
+static int untrack(void *ptr, AprofBlock *out)
+{
+	AprofBlock *blk = otab_find(&block_table, (uintptr_t)ptr);
+	AllocProfBin *b;
+	AprofSite *s;
+
+	if (blk == NULL)
+		return 0;
+
+	*out = *blk;
+	otab_remove(&block_table, blk);
+
+	s = &sites[out->site];
+	s->liveCount--;
+	s->liveBytes -= out->size;
+
+	b = &bins[bin_index(out->size)];
+	b->liveCount--;
+	b->liveBytes -= out->size;
+
+	stats.liveCount--;
+	stats.liveBytes -= out->size;
+
+	return 1;
+}
+
+#ifdef ALLOC_PROF_TRACE
+// called with the lock held
+static void trace_op(uint32_t op, uint32_t id, uint32_t size)
+{
+	if (trace_count == trace_max) {
+		trace_dropped++;
+		return;
+	}
+
+	trace[trace_count].op = op;
+	trace[trace_count].id = id;
+	trace[trace_count].size = size;
+	trace_count++;
+}
+
+// called with the lock held, blk may be NULL if it did not fit the table
+static void trace_alloc(AprofBlock *blk, uint32_t size)
+{
+	if (blk == NULL)
+		return;
+
+	blk->id = num_free_ids > 0 ? free_ids[--num_free_ids] : next_id++;
+	trace_op('m', blk->id, size);
+}
+
+// called with the lock held, blk was untracked
+static void trace_free(const AprofBlock *blk)
+{
+	free_ids[num_free_ids++] = blk->id;
+	trace_op('f', blk->id, 0);
+}
+
+// called with the lock held, old was untracked and blk is where it went,
+// NULL if it did not fit the table again
+static void trace_move(const AprofBlock *old, AprofBlock *blk)
+{
+	if (blk == NULL)
+		trace_free(old);
+	else
+		blk->id = old->id;
+}
+
+// called with the lock held
+static void trace_realloc(const AprofBlock *old, AprofBlock *blk, uint32_t size)
+{
+	trace_move(old, blk);
+	if (blk != NULL)
+		trace_op('r', blk->id, size);
+}
+#else
+static inline void trace_alloc(AprofBlock *blk, uint32_t size) { (void)blk; (void)size; }
+static inline void trace_free(const AprofBlock *blk) { (void)blk; }
+static inline void trace_move(const AprofBlock *old, AprofBlock *blk) { (void)old; (void)blk; }
+static inline void trace_realloc(const AprofBlock *old, AprofBlock *blk, uint32_t size) { (void)old; (void)blk; (void)size; }
+#endif
+
+static void on_alloc(void *ptr, uint32_t size, uint32_t lr)
+{
+	uint32_t site, thread;
+	AllocProfBin *b = &bins[bin_index(size)];
+	AprofBlock *blk;
+	AprofSite *s;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	site = site_index(lr);
+	thread = thread_index();
+	s = &sites[site];
+
+	s->allocs++;
+	s->bytes += size;
+	if (thread < 32)
+		s->threads |= 1 << thread;
+	stats_hist_add(&s->size, size);
+
+	b->allocs++;
+	b->bytes += size;
+
+	threads[thread].allocs++;
+	threads[thread].bytes += size;
+
+	stats.allocs++;
+	stats.bytes += size;
+	stats_hist_add(&stats.size, size);
+	current.allocs++;
+	current.bytes += size;
+
+	blk = track(ptr, size, site, sceKernelGetProcessTimeLow(), stats.frames);
+	trace_alloc(blk, size);
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+static void on_free(void *ptr)
+{
+	uint32_t lifetime;
+	AprofBlock blk;
+	AprofSite *s;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	threads[thread_index()].frees++;
+	stats.frees++;
+	current.frees++;
+
+	if (untrack(ptr, &blk)) {
+		lifetime = sceKernelGetProcessTimeLow() - blk.time;
+
+		s = &sites[blk.site];
+		s->frees++;
+		stats_hist_add(&s->lifetime, lifetime);
+		stats_hist_add(&stats.lifetime, lifetime);
+
+		if (blk.frame == (uint16_t)stats.frames) {
+			s->frameLocal++;
+			bins[bin_index(blk.size)].frameLocal++;
+		}
+		trace_free(&blk);
+	} else {
+		stats.untrackedFrees++;
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+// the block keeps the age of old, which realloc_aprof took off the table,
+// but is charged to the site that resized it
+static void on_realloc(void *ptr, uint32_t size, uint32_t lr, const AprofBlock *old)
+{
+	uint32_t site, thread;
+	AprofBlock *blk;
+	AprofSite *s;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	site = site_index(lr);
+	thread = thread_index();
+	s = &sites[site];
+
+	s->reallocs++;
+	s->bytes += size;
+	if (thread < 32)
+		s->threads |= 1 << thread;
+	stats_hist_add(&s->size, size);
+
+	threads[thread].reallocs++;
+	threads[thread].bytes += size;
+
+	stats.reallocs++;
+	stats.bytes += size;
+	stats_hist_add(&stats.size, size);
+	current.bytes += size;
+
+	if (old != NULL) {
+		blk = track(ptr, size, site, old->time, old->frame);
+		trace_realloc(old, blk, size);
+	} else {
+		blk = track(ptr, size, site, sceKernelGetProcessTimeLow(), stats.frames);
+		trace_alloc(blk, size);
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+static void *malloc_aprof(size_t size)
+{
+	uint32_t lr = (uintptr_t)__builtin_return_address(0);
+	void *ptr = next_malloc(size);
+
+	if (running && ptr != NULL)
+		on_alloc(ptr, size, lr);
+
+	return ptr;
+}
+
+static void free_aprof(void *ptr)
+{
+	if (running && ptr != NULL)
+		on_free(ptr);
+
+	next_free(ptr);
+}
+
+static void *realloc_aprof(void *ptr, size_t size)
+{
+	uint32_t lr = (uintptr_t)__builtin_return_address(0);
+	AprofBlock blk, *back;
+	int tracked = 0;
+	void *ret;
+
+	// the old block may be handed out to another thread as soon as realloc
+	// frees it, so it leaves the table first and comes back if it stays
+	if (running && ptr != NULL) {
+		if (size == 0) {
+			on_free(ptr);
+		} else {
+			sceKernelLockLwMutex(&lock, 1, NULL);
+			tracked = untrack(ptr, &blk);
+			sceKernelUnlockLwMutex(&lock, 1);
+		}
+	}
+
+	ret = next_realloc(ptr, size);
+
+	if (ret == NULL) {
+		if (tracked) {
+			sceKernelLockLwMutex(&lock, 1, NULL);
+			back = track(ptr, blk.size, blk.site, blk.time, blk.frame);
+			trace_move(&blk, back);
+			sceKernelUnlockLwMutex(&lock, 1);
+		}
+		return ret;
+	}
+
+	if (!running)
+		return ret;
+
+	if (ptr == NULL)
+		on_alloc(ret, size, lr);
+	else
+		on_realloc(ret, size, lr, tracked ? &blk : NULL);
+
+	return ret;
+}
+
+static void *_Znwj_aprof(size_t size)
+{
+	uint32_t lr = (uintptr_t)__builtin_return_address(0);
+	void *ptr = next__Znwj(size);
+
+	if (running && ptr != NULL)
+		on_alloc(ptr, size, lr);
+
+	return ptr;
+}
+
+static void *_Znaj_aprof(size_t size)
+{
+	uint32_t lr = (uintptr_t)__builtin_return_address(0);
+	void *ptr = next__Znaj(size);
+
+	if (running && ptr != NULL)
+		on_alloc(ptr, size, lr);
+
+	return ptr;
+}
+
+static void _ZdlPv_aprof(void *ptr)
+{
+	if (running && ptr != NULL)
+		on_free(ptr);
+
+	next__ZdlPv(ptr);
+}
+
+static void _ZdaPv_aprof(void *ptr)
+{
+	if (running && ptr != NULL)
+		on_free(ptr);
+
+	next__ZdaPv(ptr);
+}
+
+#define APROF_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_aprof, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int aprof_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	APROF_HOOK(malloc);
+	APROF_HOOK(free);
+	APROF_HOOK(realloc);
+	APROF_HOOK(_Znwj);
+	APROF_HOOK(_Znaj);
+	APROF_HOOK(_ZdlPv);
+	APROF_HOOK(_ZdaPv);
+
+	return AL_OK;
+}
+
+// mod is only read on a stats dump, it may still be loaded after this
+int aprof_start(so_module *mod)
+{
+	uint32_t size = ALLOC_PROF_SIZE + (APROF_MAX_SITES + 1) * (sizeof(AprofSite) + sizeof(AllocProfSite));
+	SceUID mbid;
+	void *base;
+	int ret;
+
+	mbid = sceKernelAllocMemBlock("AL::AllocProf::Tables", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(size, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, &base);
+	sceClibMemset(base, 0, size);
+
+	otab_init(&block_table, base, sizeof(AprofBlock), ALLOC_PROF_SIZE / sizeof(AprofBlock), 3);
+
+#ifdef ALLOC_PROF_TRACE
+	// one id per table entry at most, the table never fills up
+	size = ALLOC_PROF_TRACE_SIZE + block_table.count * sizeof(uint32_t);
+	mbid = sceKernelAllocMemBlock("AL::AllocProf::Trace", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(size, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, (void **)&trace);
+	trace_max = ALLOC_PROF_TRACE_SIZE / sizeof(AprofTraceOp);
+	free_ids = (uint32_t *)((uint8_t *)trace + ALLOC_PROF_TRACE_SIZE);
+#endif
+
+	sites = (AprofSite *)((uint8_t *)base + ALLOC_PROF_SIZE);
+	otab_init(&site_table, sites, sizeof(AprofSite), APROF_MAX_SITES, 1);
+	records = (AllocProfSite *)(sites + APROF_MAX_SITES + 1);
+
+	sites[APROF_MAX_SITES].lr = APRF_OTHER_SITE;
+	stats_hist_reset(&sites[APROF_MAX_SITES].size);
+	stats_hist_reset(&sites[APROF_MAX_SITES].lifetime);
+
+	for (uint32_t i = 0; i < APROF_NUM_BINS; i++)
+		bins[i].size = i < SCLS_NUM_CLASSES ? scls_size(i) : 0;
+
+	sceClibStrncpy(threads[APROF_MAX_THREADS].name, "(other)", sizeof(threads[APROF_MAX_THREADS].name));
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::AllocProf::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	sceClibMemset(&stats, 0, sizeof(AllocProfStats));
+	stats_hist_reset(&stats.size);
+	stats_hist_reset(&stats.lifetime);
+	stats_hist_reset(&stats.frameAllocs);
+	stats_hist_reset(&stats.frameBytes);
+
+	module = mod;
+	running = 1;
+
+	return stats_register_dump(aprof_dump);
+}
+
+void aprof_end_frame(void)
+{
+	if (!running)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	current.liveBytes = stats.liveBytes;
+	frames[stats.frames % APROF_FRAMES] = current;
+	stats_hist_add(&stats.frameAllocs, current.allocs);
+	stats_hist_add(&stats.frameBytes, current.bytes);
+	sceClibMemset(&current, 0, sizeof(AllocProfFrame));
+	stats.frames++;
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+const AllocProfStats *aprof_get_stats(void)
+{
+	return &stats;
+}
+
+// called with the lock held
+static uint32_t fill_records(void)
+{
+	const AprofSite *s;
+	AllocProfSite *r;
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i <= APROF_MAX_SITES; i++) {
+		s = &sites[i];
+		if (s->lr == 0 || (s->allocs == 0 && s->reallocs == 0))
+			continue;
+
+		r = &records[count++];
+		r->address = s->lr;
+		r->name = APRF_NO_NAME;
+		r->symOffset = 0;
+		r->allocs = s->allocs;
+		r->frees = s->frees;
+		r->reallocs = s->reallocs;
+		r->frameLocal = s->frameLocal;
+		r->threads = s->threads;
+		r->bytes = s->bytes;
+		r->liveCount = s->liveCount;
+		r->liveBytes = s->liveBytes;
+		r->peakLiveBytes = s->peakLiveBytes;
+		r->sizeMin = s->size.count > 0 ? s->size.min : 0;
+		r->sizeP50 = stats_hist_percentile(&s->size, 50);
+		r->sizeMax = s->size.max;
+		r->lifetimeP50 = stats_hist_percentile(&s->lifetime, 50);
+		r->lifetimeP95 = stats_hist_percentile(&s->lifetime, 95);
+	}
+
+	return count;
+}
+
+// maps return addresses to functions and gives every function name an
+// offset in the name table, in order of first use, returns its size
+static uint32_t resolve_records(uint32_t count)
+{
+	uint32_t bytes = 0, addr;
+	const so_sym *sym;
+	AllocProfSite *r;
+
+	for (uint32_t i = 0; i < count; i++) {
+		r = &records[i];
+		record_syms[i] = -1;
+		if (r->address == APRF_OTHER_SITE)
+			continue;
+
+		// the return address is past the call, look up the call itself
+		addr = (r->address & ~1) - 1;
+		if (module != NULL && addr >= module->text_base && addr < module->text_base + module->text_size) {
+			if (so_addr2sym(module, addr, &sym) == AL_OK) {
+				record_syms[i] = sym - module->symidx;
+				r->symOffset = (r->address & ~1) - (module->text_base + sym->addr);
+			}
+			r->address -= module->text_base;
+		}
+
+		if (record_syms[i] < 0)
+			continue;
+
+		for (uint32_t j = 0; j < i; j++) {
+			if (record_syms[j] == record_syms[i]) {
+				r->name = records[j].name;
+				break;
+			}
+		}
+
+		if (r->name == APRF_NO_NAME) {
+			r->name = bytes;
+			bytes += sceClibStrnlen(module->dynstr + module->symidx[record_syms[i]].name, 1024) + 1;
+		}
+	}
+
+	return bytes;
+}
+
+static void write_site_name(SceUID fd, uint32_t i)
+{
+	const AllocProfSite *r = &records[i];
+
+	if (r->address == APRF_OTHER_SITE)
+		stats_file_printf(fd, "(other)");
+	else if (record_syms[i] >= 0)
+		stats_file_printf(fd, "%s+0x%x", module->dynstr + module->symidx[record_syms[i]].name, r->symOffset);
+	else
+		stats_file_printf(fd, "0x%08x", r->address);
+}
+
+#ifdef ALLOC_PROF_TRACE
+// calls are only ever appended, the first count can be read without the lock
+static void write_trace(uint32_t count)
+{
+	char buf[4096];
+	uint32_t len = 0;
+	const AprofTraceOp *o;
+	SceUID fd;
+
+	fd = stats_file_open("alloc_trace.txt");
+	if (fd < 0)
+		return;
+
+	for (uint32_t i = 0; i < count; i++) {
+		o = &trace[i];
+		if (o->op == 'f')
+			len += sceClibSnprintf(buf + len, sizeof(buf) - len, "f %u\n", o->id);
+		else
+			len += sceClibSnprintf(buf + len, sizeof(buf) - len, "%c %u %u\n", o->op, o->id, o->size);
+
+		// a line is 24 bytes at most
+		if (len > sizeof(buf) - 32) {
+			sceIoWrite(fd, buf, len);
+			len = 0;
+		}
+	}
+
+	if (len > 0)
+		sceIoWrite(fd, buf, len);
+
+	stats_file_close(fd);
+}
+#endif
+
+void aprof_dump(void)
+{
+	AllocProfHeader hdr;
+	const char *name;
+	uint32_t count, frames_kept, first, written, len;
+#ifdef ALLOC_PROF_TRACE
+	uint32_t trace_kept;
+#endif
+	SceUID fd;
+
+	if (!running)
+		return;
+
+	// a snapshot, the game keeps allocating meanwhile
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	count = fill_records();
+
+	frames_kept = stats.frames < APROF_FRAMES ? stats.frames : APROF_FRAMES;
+	first = (stats.frames - frames_kept) % APROF_FRAMES;
+	for (uint32_t i = 0; i < frames_kept; i++)
+		frames_out[i] = frames[(first + i) % APROF_FRAMES];
+
+	hdr.magic = APRF_MAGIC;
+	hdr.version = APRF_VERSION;
+	hdr.numSites = count;
+	hdr.numBins = APROF_NUM_BINS;
+	hdr.numThreads = stats.threads;
+	// the other bucket only fills once every entry before it is taken
+	if (threads[APROF_MAX_THREADS].allocs + threads[APROF_MAX_THREADS].frees > 0)
+		hdr.numThreads = APROF_MAX_THREADS + 1;
+	hdr.numFrames = frames_kept;
+	hdr.frames = stats.frames;
+	hdr.allocs = stats.allocs;
+	hdr.frees = stats.frees;
+	hdr.reallocs = stats.reallocs;
+	hdr.untrackedFrees = stats.untrackedFrees;
+	hdr.dropped = stats.dropped;
+	hdr.liveCount = stats.liveCount;
+	hdr.liveBytes = stats.liveBytes;
+	hdr.peakLiveBytes = stats.peakLiveBytes;
+	hdr.peakFrame = stats.peakFrame;
+	hdr.textBase = module != NULL ? module->text_base : 0;
+	hdr.bytes = stats.bytes;
+
+	fd = stats_file_open("alloc_prof.csv");
+	if (fd >= 0) {
+		stats_file_printf(fd, "allocs,%u\n", stats.allocs);
+		stats_file_printf(fd, "frees,%u\n", stats.frees);
+		stats_file_printf(fd, "reallocs,%u\n", stats.reallocs);
+		stats_file_printf(fd, "bytes,%llu\n", stats.bytes);
+		stats_file_printf(fd, "untracked_frees,%u\n", stats.untrackedFrees);
+		stats_file_printf(fd, "dropped,%u\n", stats.dropped);
+		stats_file_printf(fd, "live_blocks,%u\n", stats.liveCount);
+		stats_file_printf(fd, "live_bytes,%u\n", stats.liveBytes);
+		stats_file_printf(fd, "peak_live_bytes,%u\n", stats.peakLiveBytes);
+		stats_file_printf(fd, "peak_frame,%u\n", stats.peakFrame);
+		stats_file_printf(fd, "frames,%u\n", stats.frames);
+		stats_file_printf(fd, "sites,%u\n", stats.sites);
+#ifdef ALLOC_PROF_TRACE
+		stats_file_printf(fd, "trace_calls,%u\n", trace_count);
+		stats_file_printf(fd, "trace_dropped,%u\n", trace_dropped);
+#endif
+
+		stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+		stats_file_write_hist(fd, "size", &stats.size);
+		stats_file_write_hist(fd, "lifetime_us", &stats.lifetime);
+		stats_file_write_hist(fd, "frame_allocs", &stats.frameAllocs);
+		stats_file_write_hist(fd, "frame_bytes", &stats.frameBytes);
+
+		stats_file_printf(fd, "bin_size,allocs,bytes,frame_local,live,live_bytes,peak_live_bytes\n");
+		for (uint32_t i = 0; i < APROF_NUM_BINS; i++) {
+			if (bins[i].allocs > 0)
+				stats_file_printf(fd, "%u,%u,%llu,%u,%u,%u,%u\n", bins[i].size, bins[i].allocs, bins[i].bytes,
+					bins[i].frameLocal, bins[i].liveCount, bins[i].liveBytes, bins[i].peakLiveBytes);
+		}
+
+		stats_file_printf(fd, "thread,allocs,frees,reallocs,bytes\n");
+		for (uint32_t i = 0; i <= APROF_MAX_THREADS; i++) {
+			if (i < stats.threads || (i == APROF_MAX_THREADS && threads[i].allocs + threads[i].frees > 0))
+				stats_file_printf(fd, "%s,%u,%u,%u,%llu\n", threads[i].name, threads[i].allocs, threads[i].frees, threads[i].reallocs, threads[i].bytes);
+		}
+	}
+
+#ifdef ALLOC_PROF_TRACE
+	trace_kept = trace_count;
+#endif
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+#ifdef ALLOC_PROF_TRACE
+	write_trace(trace_kept);
+#endif
+
+	hdr.nameBytes = resolve_records(count);
+
+	if (fd >= 0) {
+		stats_file_printf(fd, "site,allocs,frees,reallocs,frame_local,bytes,live_bytes,peak_live_bytes,size_p50,lifetime_p50_us\n");
+		for (uint32_t i = 0; i < count; i++) {
+			write_site_name(fd, i);
+			stats_file_printf(fd, ",%u,%u,%u,%u,%llu,%u,%u,%u,%u\n", records[i].allocs, records[i].frees, records[i].reallocs,
+				records[i].frameLocal, records[i].bytes, records[i].liveBytes, records[i].peakLiveBytes, records[i].sizeP50, records[i].lifetimeP50);
+		}
+
+		stats_file_close(fd);
+	}
+
+	fd = stats_file_open("alloc_prof.bin");
+	if (fd < 0)
+		return;
+
+	sceIoWrite(fd, &hdr, sizeof(hdr));
+
+	// names were numbered in order of first use, write them the same way
+	written = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (record_syms[i] < 0 || records[i].name != written)
+			continue;
+
+		name = module->dynstr + module->symidx[record_syms[i]].name;
+		len = sceClibStrnlen(name, 1024);
+		sceIoWrite(fd, name, len);
+		sceIoWrite(fd, "", 1);
+		written += len + 1;
+	}
+
+	sceIoWrite(fd, records, count * sizeof(AllocProfSite));
+	sceIoWrite(fd, bins, sizeof(bins));
+	sceIoWrite(fd, threads, hdr.numThreads * sizeof(AllocProfThread));
+	sceIoWrite(fd, frames_out, frames_kept * sizeof(AllocProfFrame));
+
+	stats_file_close(fd);
+}
@@ -0,0 +1,47 @@
+#ifndef __ALLOC_PROF_H__
+#define __ALLOC_PROF_H__
+
+#include <kernel.h>
+
+#include "alloc_prof_format.h"
+#include "symtable.h"
+#include "so_util.h"
+#include "stats.h"
+
+// call sites with their own counters, power of two, calls from later
+// ones are counted together
+#define APROF_MAX_SITES		2048
+
+// threads counted on their own, at most 32
+#define APROF_MAX_THREADS	16
+
+// frames kept for the per-frame table
+#define APROF_FRAMES		1024
+
+typedef struct {
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t reallocs;
+	uint32_t untrackedFrees;
+	uint32_t dropped;
+	uint32_t sites;
+	uint32_t threads;
+	uint32_t frames;
+	uint32_t liveCount;
+	uint32_t liveBytes;
+	uint32_t peakLiveBytes;
+	uint32_t peakFrame;
+	uint64_t bytes;
+	StatsHist size;
+	StatsHist lifetime;
+	StatsHist frameAllocs;
+	StatsHist frameBytes;
+} AllocProfStats;
+
+int aprof_bind(Symtable *table);
+int aprof_start(so_module *mod);
+void aprof_end_frame(void);
+const AllocProfStats *aprof_get_stats(void);
+void aprof_dump(void);
+
+#endif
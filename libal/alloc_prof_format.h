@@ -0,0 +1,92 @@
+#ifndef __ALLOC_PROF_FORMAT_H__
+#define __ALLOC_PROF_FORMAT_H__
+
+//
+// Shared between libal and tools/allocprof.c, keep it free of SDK headers.
+//
+// A profile is an AllocProfHeader, nameBytes of NUL terminated symbol
+// names, numSites AllocProfSite, numBins AllocProfBin, numThreads
+// AllocProfThread and numFrames AllocProfFrame entries, oldest frame
+// first. All values are little endian.
+//
+
+#include <stdint.h>
+
+#define APRF_MAGIC		0x46525041 // 'APRF'
+#define APRF_VERSION	1
+
+// name of a site that is not in a function the module exports
+#define APRF_NO_NAME	0xFFFFFFFF
+
+// address of the site collecting calls once the site table is full
+#define APRF_OTHER_SITE	0xFFFFFFFF
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numSites;
+	uint32_t numBins;
+	uint32_t numThreads;
+	uint32_t numFrames;
+	uint32_t nameBytes;
+	uint32_t frames;		// frames since profiling started
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t reallocs;
+	uint32_t untrackedFrees;	// blocks allocated before profiling started or not tracked
+	uint32_t dropped;		// blocks not tracked, the live table was full
+	uint32_t liveCount;
+	uint32_t liveBytes;
+	uint32_t peakLiveBytes;
+	uint32_t peakFrame;
+	uint32_t textBase;
+	uint64_t bytes;
+} AllocProfHeader;
+
+typedef struct {
+	uint32_t address;		// return address, offset in the module's text
+	uint32_t name;			// offset in the name table or APRF_NO_NAME
+	uint32_t symOffset;		// return address minus the function's
+	uint32_t allocs;
+	uint32_t frees;			// of the blocks allocated here, wherever freed
+	uint32_t reallocs;
+	uint32_t frameLocal;	// freed in the frame they were allocated in
+	uint32_t threads;		// bit per thread index
+	uint64_t bytes;
+	uint32_t liveCount;
+	uint32_t liveBytes;
+	uint32_t peakLiveBytes;
+	uint32_t sizeMin;
+	uint32_t sizeP50;
+	uint32_t sizeMax;
+	uint32_t lifetimeP50;	// microseconds, of the blocks freed
+	uint32_t lifetimeP95;
+} AllocProfSite;
+
+typedef struct {
+	uint32_t size;			// largest size of the bin, 0 for the last one
+	uint32_t allocs;
+	uint32_t frameLocal;
+	uint32_t liveCount;
+	uint64_t bytes;
+	uint32_t liveBytes;
+	uint32_t peakLiveBytes;
+} AllocProfBin;
+
+typedef struct {
+	int32_t thid;
+	char name[32];
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t reallocs;
+	uint64_t bytes;
+} AllocProfThread;
+
+typedef struct {
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t bytes;
+	uint32_t liveBytes;		// at the end of the frame
+} AllocProfFrame;
+
+#endif
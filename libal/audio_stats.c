@@ -0,0 +1,150 @@
+/* audio_stats.c -- sound thread instrumentation
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// One buffer is one call to nativeUpdateSound. The game calls back into
+// SetShortArrayRegion from inside it to submit the mixed samples, so output
+// wait is measured inside and subtracted from the total to get the mixer time.
+//
+// Stats are updated by sound_thread only and read without locking, so a
+// reader may see a buffer half accounted. This is fine for monitoring.
+//
+
+#include <kernel.h>
+#include <audioout.h>
+
+#include "audio_stats.h"
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+
+static AudioStats stats;
+
+static int audio_port = -1;
+static unsigned int sample_rate = 0;
+static unsigned int samples_per_buf = 0;
+
+static SceUInt64 mix_start = 0;
+static SceUInt64 output_start = 0;
+static uint32_t output_wait = 0;
+
+// mixer time of the last AUDIO_TRACE_SIZE buffers, replayed by tools/audiosim
+static uint32_t trace[AUDIO_TRACE_SIZE];
+static uint32_t trace_pos = 0;
+
+int aust_init(int port, unsigned int sampleRate, unsigned int samplesPerBuf)
+{
+	if (port < 0)
+		return AL_ERROR_INVALID_ARGUMENT;
+
+	audio_port = port;
+	sample_rate = sampleRate;
+	samples_per_buf = samplesPerBuf;
+
+	aust_reset();
+
+	return stats_register_dump(aust_dump);
+}
+
+void aust_reset(void)
+{
+	sceClibMemset(&stats, 0, sizeof(AudioStats));
+	stats_hist_reset(&stats.mixTime);
+	stats_hist_reset(&stats.outputWait);
+	stats_hist_reset(&stats.fillLevel);
+	trace_pos = 0;
+}
+
+const AudioStats *aust_get(void)
+{
+	return &stats;
+}
+
+void aust_mix_begin(void)
+{
+	output_wait = 0;
+	mix_start = sceKernelGetProcessTimeWide();
+}
+
+void aust_mix_end(void)
+{
+	uint32_t total = (uint32_t)(sceKernelGetProcessTimeWide() - mix_start);
+	uint32_t mix = total > output_wait ? total - output_wait : 0;
+
+	stats.lastMixTime = mix;
+	stats.lastOutputWait = output_wait;
+	stats_hist_add(&stats.mixTime, mix);
+	stats_hist_add(&stats.outputWait, output_wait);
+
+	trace[trace_pos % AUDIO_TRACE_SIZE] = mix;
+	trace_pos++;
+
+	stats.buffers++;
+}
+
+void aust_output_begin(void)
+{
+	int rest = sceAudioOutGetRestSample(audio_port);
+
+	if (rest >= 0) {
+		// the port ran dry before the next buffer was ready
+		if (rest == 0 && stats.buffers > 0)
+			stats.underruns++;
+
+		stats.lastFillLevel = rest;
+		stats_hist_add(&stats.fillLevel, rest);
+	}
+
+	output_start = sceKernelGetProcessTimeWide();
+}
+
+void aust_output_end(void)
+{
+	output_wait += (uint32_t)(sceKernelGetProcessTimeWide() - output_start);
+}
+
+void aust_dump(void)
+{
+	AudioTraceHeader hdr;
+	uint32_t count, first;
+	SceUID fd;
+
+	fd = stats_file_open("audio_stats.csv");
+	if (fd >= 0) {
+		stats_file_printf(fd, "buffers,%u\nunderruns,%u\nsample_rate,%u\nsamples_per_buf,%u\n",
+			stats.buffers, stats.underruns, sample_rate, samples_per_buf);
+		stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+		stats_file_write_hist(fd, "mix_us", &stats.mixTime);
+		stats_file_write_hist(fd, "output_wait_us", &stats.outputWait);
+		stats_file_write_hist(fd, "fill_samples", &stats.fillLevel);
+		stats_file_close(fd);
+	}
+
+	fd = stats_file_open("audio_trace.bin");
+	if (fd >= 0) {
+		count = trace_pos < AUDIO_TRACE_SIZE ? trace_pos : AUDIO_TRACE_SIZE;
+		first = (trace_pos - count) % AUDIO_TRACE_SIZE;
+
+		hdr.magic = AUST_TRACE_MAGIC;
+		hdr.version = AUST_TRACE_VERSION;
+		hdr.sampleRate = sample_rate;
+		hdr.samplesPerBuf = samples_per_buf;
+		hdr.count = count;
+		sceIoWrite(fd, &hdr, sizeof(hdr));
+
+		// oldest entry first
+		if (first + count > AUDIO_TRACE_SIZE) {
+			sceIoWrite(fd, &trace[first], (AUDIO_TRACE_SIZE - first) * sizeof(uint32_t));
+			count -= AUDIO_TRACE_SIZE - first;
+			first = 0;
+		}
+		sceIoWrite(fd, &trace[first], count * sizeof(uint32_t));
+
+		stats_file_close(fd);
+	}
+}
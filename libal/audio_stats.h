@@ -0,0 +1,41 @@
+#ifndef __AUDIO_STATS_H__
+#define __AUDIO_STATS_H__
+
+#include <kernel.h>
+
+#include "stats.h"
+
+#define AUST_TRACE_MAGIC	0x43525441 // 'ATRC'
+#define AUST_TRACE_VERSION	1
+
+typedef struct {
+	uint32_t buffers;
+	uint32_t underruns;
+	uint32_t lastMixTime;
+	uint32_t lastOutputWait;
+	uint32_t lastFillLevel;
+	StatsHist mixTime;		// us spent mixing one buffer, output wait excluded
+	StatsHist outputWait;	// us blocked in sceAudioOutOutput
+	StatsHist fillLevel;	// samples still queued in the port when a buffer is submitted
+} AudioStats;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sampleRate;
+	uint32_t samplesPerBuf;
+	uint32_t count;
+} AudioTraceHeader;
+
+int aust_init(int port, unsigned int sampleRate, unsigned int samplesPerBuf);
+void aust_reset(void);
+const AudioStats *aust_get(void);
+
+void aust_mix_begin(void);
+void aust_mix_end(void);
+void aust_output_begin(void);
+void aust_output_end(void);
+
+void aust_dump(void);
+
+#endif
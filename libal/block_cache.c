@@ -0,0 +1,245 @@
+/* block_cache.c -- LRU cache of fixed size file blocks
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Only bookkeeping, no I/O and no locking, so the same code runs in libal
+// and in tools/fcbench.c. A block is claimed in the LOADING state, filled
+// by the caller outside of its lock and released as VALID, or dropped if
+// the read failed. LOADING blocks are never evicted.
+//
+// All blocks sit on one LRU list, free ones at the tail, and blocks with
+// a file assigned are also chained into a hash table keyed by file and
+// block index.
+//
+
+#include <string.h>
+
+#include "block_cache.h"
+
+static uint32_t bucket(const BlockCache *cache, uint64_t file, uint32_t index)
+{
+	uint32_t h = (uint32_t)file ^ (uint32_t)(file >> 32) ^ (index * 0x9E3779B1);
+
+	h ^= h >> 15;
+	return h & cache->bucketMask;
+}
+
+static uint32_t bucket_count(uint32_t count)
+{
+	uint32_t buckets = 1;
+
+	while (buckets < 2 * count)
+		buckets <<= 1;
+
+	return buckets;
+}
+
+static void lru_unlink(BlockCache *cache, uint32_t i)
+{
+	BcacheBlock *b = &cache->blocks[i];
+
+	if (b->prev != BCACHE_NONE)
+		cache->blocks[b->prev].next = b->next;
+	else
+		cache->head = b->next;
+
+	if (b->next != BCACHE_NONE)
+		cache->blocks[b->next].prev = b->prev;
+	else
+		cache->tail = b->prev;
+}
+
+static void lru_push_head(BlockCache *cache, uint32_t i)
+{
+	BcacheBlock *b = &cache->blocks[i];
+
+	b->prev = BCACHE_NONE;
+	b->next = cache->head;
+	if (cache->head != BCACHE_NONE)
+		cache->blocks[cache->head].prev = i;
+	else
+		cache->tail = i;
+	cache->head = i;
+}
+
+static void lru_push_tail(BlockCache *cache, uint32_t i)
+{
+	BcacheBlock *b = &cache->blocks[i];
+
+	b->next = BCACHE_NONE;
+	b->prev = cache->tail;
+	if (cache->tail != BCACHE_NONE)
+		cache->blocks[cache->tail].next = i;
+	else
+		cache->head = i;
+	cache->tail = i;
+}
+
+static void hash_remove(BlockCache *cache, uint32_t i)
+{
+	BcacheBlock *b = &cache->blocks[i];
+	uint32_t *link = &cache->buckets[bucket(cache, b->file, b->index)];
+
+	while (*link != BCACHE_NONE) {
+		if (*link == i) {
+			*link = b->chain;
+			break;
+		}
+		link = &cache->blocks[*link].chain;
+	}
+
+	b->chain = BCACHE_NONE;
+}
+
+static void drop(BlockCache *cache, uint32_t i)
+{
+	BcacheBlock *b = &cache->blocks[i];
+
+	hash_remove(cache, i);
+	b->state = BCACHE_FREE;
+	b->flags = 0;
+	b->size = 0;
+
+	lru_unlink(cache, i);
+	lru_push_tail(cache, i);
+}
+
+uint32_t bcache_mem_size(uint32_t count, uint32_t blockSize)
+{
+	return count * blockSize + count * sizeof(BcacheBlock) + bucket_count(count) * sizeof(uint32_t);
+}
+
+// mem is bcache_mem_size() bytes, block data comes first and keeps its alignment
+void bcache_init(BlockCache *cache, void *mem, uint32_t count, uint32_t blockSize)
+{
+	uint8_t *p = (uint8_t *)mem;
+	uint32_t buckets = bucket_count(count);
+
+	cache->count = count;
+	cache->blockSize = blockSize;
+	cache->bucketMask = buckets - 1;
+	cache->blocks = (BcacheBlock *)(p + count * blockSize);
+	cache->buckets = (uint32_t *)(p + count * blockSize + count * sizeof(BcacheBlock));
+	cache->head = BCACHE_NONE;
+	cache->tail = BCACHE_NONE;
+
+	memset(cache->buckets, 0xFF, buckets * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < count; i++) {
+		BcacheBlock *b = &cache->blocks[i];
+
+		memset(b, 0, sizeof(BcacheBlock));
+		b->chain = BCACHE_NONE;
+		b->data = p + i * blockSize;
+		lru_push_tail(cache, i);
+	}
+}
+
+// VALID or LOADING block, or NULL, marks it most recently used
+BcacheBlock *bcache_find(BlockCache *cache, uint64_t file, uint32_t index)
+{
+	uint32_t i = cache->buckets[bucket(cache, file, index)];
+
+	while (i != BCACHE_NONE) {
+		BcacheBlock *b = &cache->blocks[i];
+
+		if (b->file == file && b->index == index) {
+			lru_unlink(cache, i);
+			lru_push_head(cache, i);
+			return b;
+		}
+		i = b->chain;
+	}
+
+	return NULL;
+}
+
+// least recently used block that is not loading, or NULL if all of them are
+BcacheBlock *bcache_claim(BlockCache *cache, uint64_t file, uint32_t index)
+{
+	uint32_t i = cache->tail, *link;
+	BcacheBlock *b;
+
+	while (i != BCACHE_NONE && cache->blocks[i].state == BCACHE_LOADING)
+		i = cache->blocks[i].prev;
+
+	if (i == BCACHE_NONE)
+		return NULL;
+
+	b = &cache->blocks[i];
+	if (b->state == BCACHE_VALID)
+		hash_remove(cache, i);
+
+	b->file = file;
+	b->index = index;
+	b->size = 0;
+	b->state = BCACHE_LOADING;
+	b->flags = 0;
+
+	link = &cache->buckets[bucket(cache, file, index)];
+	b->chain = *link;
+	*link = i;
+
+	lru_unlink(cache, i);
+	lru_push_head(cache, i);
+
+	return b;
+}
+
+// size 0 means the read failed
+void bcache_release(BlockCache *cache, BcacheBlock *block, uint32_t size)
+{
+	if (size == 0 || (block->flags & BCACHE_STALE)) {
+		drop(cache, block - cache->blocks);
+		return;
+	}
+
+	block->size = size;
+	block->state = BCACHE_VALID;
+}
+
+void bcache_invalidate(BlockCache *cache, uint64_t file)
+{
+	for (uint32_t i = 0; i < cache->count; i++) {
+		BcacheBlock *b = &cache->blocks[i];
+
+		if (b->state == BCACHE_FREE || b->file != file)
+			continue;
+
+		if (b->state == BCACHE_LOADING)
+			b->flags |= BCACHE_STALE;
+		else
+			drop(cache, i);
+	}
+}
+
+void bcache_stream_reset(BcacheStream *stream)
+{
+	stream->next = BCACHE_NONE;
+	stream->run = 0;
+}
+
+// number of blocks after index to read ahead, ramps up while the stream
+// keeps moving to the next block and stops as soon as it jumps
+uint32_t bcache_stream_ahead(BcacheStream *stream, uint32_t index, uint32_t maxAhead)
+{
+	if (index + 1 == stream->next)
+		return 0;
+
+	if (index == stream->next)
+		stream->run++;
+	else
+		stream->run = 0;
+
+	stream->next = index + 1;
+
+	if (maxAhead > BCACHE_MAX_AHEAD)
+		maxAhead = BCACHE_MAX_AHEAD;
+
+	return stream->run < maxAhead ? stream->run : maxAhead;
+}
@@ -0,0 +1,57 @@
+#ifndef __BLOCK_CACHE_H__
+#define __BLOCK_CACHE_H__
+
+#include <stdint.h>
+
+#define BCACHE_NONE			0xFFFFFFFF
+
+// most blocks read ahead of a sequential stream at once
+#define BCACHE_MAX_AHEAD	8
+
+enum {
+	BCACHE_FREE = 0,
+	BCACHE_LOADING,
+	BCACHE_VALID
+};
+
+// block flags
+#define BCACHE_PREFETCHED	1	// loaded by read-ahead and not used yet
+#define BCACHE_STALE		2	// file was invalidated while loading
+
+typedef struct {
+	uint64_t file;
+	uint32_t index;
+	uint32_t size;
+	uint32_t state;
+	uint32_t flags;
+	uint32_t prev;
+	uint32_t next;
+	uint32_t chain;
+	uint8_t *data;
+} BcacheBlock;
+
+typedef struct {
+	BcacheBlock *blocks;
+	uint32_t *buckets;
+	uint32_t count;
+	uint32_t bucketMask;
+	uint32_t blockSize;
+	uint32_t head;
+	uint32_t tail;
+} BlockCache;
+
+typedef struct {
+	uint32_t next;
+	uint32_t run;
+} BcacheStream;
+
+uint32_t bcache_mem_size(uint32_t count, uint32_t blockSize);
+void bcache_init(BlockCache *cache, void *mem, uint32_t count, uint32_t blockSize);
+BcacheBlock *bcache_find(BlockCache *cache, uint64_t file, uint32_t index);
+BcacheBlock *bcache_claim(BlockCache *cache, uint64_t file, uint32_t index);
+void bcache_release(BlockCache *cache, BcacheBlock *block, uint32_t size);
+void bcache_invalidate(BlockCache *cache, uint64_t file);
+void bcache_stream_reset(BcacheStream *stream);
+uint32_t bcache_stream_ahead(BcacheStream *stream, uint32_t index, uint32_t maxAhead);
+
+#endif
@@ -4,11 +4,81 @@
 #define DATA_PATH "app0:gamedata"
 #define SAVEDATA_PATH "savedata0:"
 #define SO_PATH DATA_PATH "/" "libbc2.so"
+#define ASSET_PACK_PATH DATA_PATH "/" "assets.pak"
+#define STATS_PATH SAVEDATA_PATH "/" "stats"
+#define INPUT_PATH SAVEDATA_PATH "/" "input"
+#define CAPTURE_PATH SAVEDATA_PATH "/" "capture"
+#define SETTINGS_PATH SAVEDATA_PATH "/" "settings.ini"
+#define TEX_CACHE_PATH SAVEDATA_PATH "/" "texcache"
+#define LOAD_TRACE_PATH SAVEDATA_PATH "/" "iotrace"
 
 #define AUDIO_SAMPLE_RATE 44100
 #define AUDIO_SAMPLES_PER_BUF 8192
+#define AUDIO_TRACE_SIZE 8192
 
 #define SCREEN_W 1920
 #define SCREEN_H 1088
 
+#define INPUT_RECORD_MAX_EVENTS 65536
+
+#define GL_CAPTURE_BUF_SIZE (1 * 1024 * 1024)
+#define GL_CAPTURE_MAX_SIZE (1024 * 1024 * 1024)
+
+#define GL_DEFER_BUF_SIZE (4 * 1024 * 1024)
+
+// PVR texture heaps in uncached main memory and CDRAM
+#define PVR_UNC_HEAP_SIZE (60 * 1024 * 1024)
+#define PVR_CDRAM_HEAP_SIZE (96 * 1024 * 1024)
+
+// render resolution bounds in percent of the surface and the frame time to hold
+#define DYNRES_MIN_SCALE 50
+#define DYNRES_MAX_SCALE 100
+#define DYNRES_STEP 5
+#define DYNRES_TARGET_US 33333
+
+// transcoded texture cache bounds, textures outside the size range or
+// encoding worse than the mean squared error per channel stay as they are
+#define TEX_CACHE_MAX_SIZE (128 * 1024 * 1024)
+#define TEX_CACHE_MAX_ENTRIES 4096
+#define TEX_CACHE_MIN_DIM 64
+#define TEX_CACHE_MAX_DIM 1024
+#define TEX_CACHE_MAX_MSE 48
+
+// per-frame streaming buffer and the total size of cached static vertex data
+#define VBO_CACHE_RING_SIZE (1 * 1024 * 1024)
+#define VBO_CACHE_MAX_BYTES (16 * 1024 * 1024)
+
+// stdio block cache size, block size and blocks read ahead of a sequential stream
+#define FILE_CACHE_SIZE (4 * 1024 * 1024)
+#define FILE_CACHE_BLOCK_SIZE (64 * 1024)
+#define FILE_CACHE_READ_AHEAD 4
+
+// largest pack directory loaded into memory
+#define PACK_MAX_DIRECTORY_SIZE (16 * 1024 * 1024)
+
+// quiet time that ends a load and how far the load prefetcher may run ahead of the game
+#define LOAD_TRACE_IDLE_US 1000000
+#define LOAD_PREFETCH_WINDOW (FILE_CACHE_SIZE / 2)
+
+// slab region of the game's heap, a multiple of 64KB, larger requests get
+// their own memblock
+#define POOL_ALLOC_SIZE (32 * 1024 * 1024)
+
+// live blocks tracked by the allocation profiler, 16 bytes each (20 with
+// ALLOC_PROF_TRACE), and its call trace, 12 bytes per call
+#define ALLOC_PROF_SIZE (4 * 1024 * 1024)
+#define ALLOC_PROF_TRACE_SIZE (12 * 1024 * 1024)
+
+// share of a pool's limit and free kernel memory left that print a warning
+#define MEM_BUDGET_WARN_PERCENT 90
+#define MEM_BUDGET_MIN_FREE (8 * 1024 * 1024)
+
+// buffered savedata writes of all streams
+#define WRITE_BEHIND_SIZE (1 * 1024 * 1024)
+
+// file call log, 20 bytes per call
+#define IO_LOG_SIZE (4 * 1024 * 1024)
+
+#define STATS_DUMP_COMBO (SCE_CTRL_SELECT | SCE_CTRL_L | SCE_CTRL_R)
+
 #endif
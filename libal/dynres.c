@@ -0,0 +1,425 @@
+/* dynres.c -- dynamic resolution scaling
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// The game renders into an offscreen framebuffer instead of the window. Its
+// binds of framebuffer 0 are redirected there and the viewport and scissor
+// boxes it sets while drawing to it are scaled down to the current render
+// size, so the engine keeps working in full surface coordinates. At the end
+// of the frame the rendered part is stretched over the whole window with
+// one textured quad. The offscreen target has no multisampling, the upscale
+// filter stands in for it.
+//
+// GLES1 on this GPU has no timer queries, so the controller works on the
+// frame times measured by frame_stats. A frame running over
+// DYNRES_TARGET_US lowers the scale by DYNRES_STEP percent, but only while
+// the time outside the SWAP stage, the CPU side of the frame, fits the
+// target: the rest is spent waiting for the GPU, the only part a smaller
+// render size shortens. CPU bound frames leave the scale alone. Raising it
+// again is a probe: after DRES_PROBE_FRAMES on target the scale goes up one
+// step, a probe that has to be taken back doubles the wait for the next one.
+//
+// The blit covers the whole window whatever the render size is, so touch
+// coordinates keep mapping onto the same game space and need no rescaling.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "dynres.h"
+#include "gl_util.h"
+#include "gl_defer.h"
+#include "frame_stats.h"
+#include "overlay.h"
+#include "symtable.h"
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+
+#define RING_SIZE	4
+
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+} DynresFrame;
+
+static int active = 0;
+static int surface_width, surface_height;
+
+static GLuint target_fbo = 0;
+static GLuint target_tex = 0;
+static GLuint target_depth = 0;
+
+// game state, in surface coordinates
+static GLuint game_fb = 0;
+static GLint game_viewport[4];
+static GLint game_scissor[4];
+static int viewport_known = 0;
+static int scissor_known = 0;
+
+// controller
+static uint32_t scale = DYNRES_MAX_SCALE;
+static uint32_t ema_us = DYNRES_TARGET_US;
+static uint32_t ema_swap_us = 0;
+static uint32_t settle = 0;
+static uint32_t stable = 0;
+static uint32_t probe_interval = DRES_PROBE_FRAMES;
+static int probing = 0;
+
+// sizes of the frames in flight, the blit may run on the render thread
+static DynresFrame frames[RING_SIZE];
+static uint32_t frame_index = 0;
+static GlSavedState saved;
+
+static DynresStats stats;
+
+static void (* next_glBindFramebufferOES)(GLenum target, GLuint framebuffer);
+static void (* next_glViewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+static void (* next_glScissor)(GLint x, GLint y, GLsizei width, GLsizei height);
+
+static inline GLint scale_x(GLint x)
+{
+	return x * (GLint)stats.width / surface_width;
+}
+
+static inline GLint scale_y(GLint y)
+{
+	return y * (GLint)stats.height / surface_height;
+}
+
+static void set_viewport(void)
+{
+	GLint x = scale_x(game_viewport[0]);
+	GLint y = scale_y(game_viewport[1]);
+
+	next_glViewport(x, y, scale_x(game_viewport[0] + game_viewport[2]) - x, scale_y(game_viewport[1] + game_viewport[3]) - y);
+}
+
+static void set_scissor(void)
+{
+	GLint x = scale_x(game_scissor[0]);
+	GLint y = scale_y(game_scissor[1]);
+
+	next_glScissor(x, y, scale_x(game_scissor[0] + game_scissor[2]) - x, scale_y(game_scissor[1] + game_scissor[3]) - y);
+}
+
+static void glBindFramebufferOES_dres(GLenum target, GLuint framebuffer)
+{
+	game_fb = framebuffer;
+
+	if (active && framebuffer == 0)
+		next_glBindFramebufferOES(target, target_fbo);
+	else
+		next_glBindFramebufferOES(target, framebuffer);
+}
+
+static void glViewport_dres(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	game_viewport[0] = x;
+	game_viewport[1] = y;
+	game_viewport[2] = width;
+	game_viewport[3] = height;
+	viewport_known = 1;
+
+	if (active && game_fb == 0)
+		set_viewport();
+	else
+		next_glViewport(x, y, width, height);
+}
+
+static void glScissor_dres(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	game_scissor[0] = x;
+	game_scissor[1] = y;
+	game_scissor[2] = width;
+	game_scissor[3] = height;
+	scissor_known = 1;
+
+	if (active && game_fb == 0)
+		set_scissor();
+	else
+		next_glScissor(x, y, width, height);
+}
+
+static void create_target(void *arg)
+{
+	int *result = (int *)arg;
+
+	glGenTextures(1, &target_tex);
+	glBindTexture(GL_TEXTURE_2D, target_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface_width, surface_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffersOES(1, &target_depth);
+	glBindRenderbufferOES(GL_RENDERBUFFER_OES, target_depth);
+	glRenderbufferStorageOES(GL_RENDERBUFFER_OES, GL_DEPTH_COMPONENT16_OES, surface_width, surface_height);
+	glBindRenderbufferOES(GL_RENDERBUFFER_OES, 0);
+
+	glGenFramebuffersOES(1, &target_fbo);
+	glBindFramebufferOES(GL_FRAMEBUFFER_OES, target_fbo);
+	glFramebufferTexture2DOES(GL_FRAMEBUFFER_OES, GL_COLOR_ATTACHMENT0_OES, GL_TEXTURE_2D, target_tex, 0);
+	glFramebufferRenderbufferOES(GL_FRAMEBUFFER_OES, GL_DEPTH_ATTACHMENT_OES, GL_RENDERBUFFER_OES, target_depth);
+
+	*result = glCheckFramebufferStatusOES(GL_FRAMEBUFFER_OES) == GL_FRAMEBUFFER_COMPLETE_OES;
+
+	glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+}
+
+static void blit(void *arg)
+{
+	static const GLfloat positions[8] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+	static GLfloat texcoords[RING_SIZE][8];
+	DynresFrame *frame = (DynresFrame *)arg;
+	GLfloat *uv = texcoords[frame - frames];
+	GLfloat u = (GLfloat)frame->width / surface_width;
+	GLfloat v = (GLfloat)frame->height / surface_height;
+
+	uv[0] = 0.0f;	uv[1] = 0.0f;
+	uv[2] = u;		uv[3] = 0.0f;
+	uv[4] = 0.0f;	uv[5] = v;
+	uv[6] = u;		uv[7] = v;
+
+	glu_save_state(&saved);
+
+	glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+	glViewport(0, 0, surface_width, surface_height);
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	for (int i = 1; i < saved.numTexUnits; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		glDisable(GL_TEXTURE_2D);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glClientActiveTexture(GL_TEXTURE0);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, target_tex);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_FOG);
+	glDepthMask(GL_FALSE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, positions);
+	glTexCoordPointer(2, GL_FLOAT, 0, uv);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	glu_restore_state(&saved);
+}
+
+static void set_scale(uint32_t value)
+{
+	if (value < DYNRES_MIN_SCALE)
+		value = DYNRES_MIN_SCALE;
+	if (value > DYNRES_MAX_SCALE)
+		value = DYNRES_MAX_SCALE;
+
+	scale = value;
+	settle = DRES_SETTLE_FRAMES;
+	stable = 0;
+
+	stats.scale = scale;
+	stats.width = (surface_width * scale / 100) & ~1;
+	stats.height = (surface_height * scale / 100) & ~1;
+}
+
+static void update_scale(void)
+{
+	const FrameRecord *last = frst_last();
+	uint32_t frame_us = last->total;
+	uint32_t swap_us = last->stage[FRST_STAGE_SWAP];
+
+	// loading screens and one-off hitches say nothing about the render cost
+	if (frame_us > DYNRES_TARGET_US * 4)
+		return;
+
+	ema_us = ema_us + ((int32_t)(frame_us - ema_us) >> 3);
+	ema_swap_us = ema_swap_us + ((int32_t)(swap_us - ema_swap_us) >> 3);
+
+	if (settle > 0) {
+		settle--;
+		return;
+	}
+
+	if (ema_us > DYNRES_TARGET_US * 105 / 100) {
+		// the CPU alone misses the target, a smaller render size wins nothing
+		if (ema_us > ema_swap_us + DYNRES_TARGET_US) {
+			stats.cpuBoundFrames++;
+			stable = 0;
+			return;
+		}
+
+		if (scale > DYNRES_MIN_SCALE) {
+			if (probing) {
+				stats.failedRaises++;
+				if (probe_interval < DRES_PROBE_FRAMES_MAX)
+					probe_interval *= 2;
+				probing = 0;
+			}
+
+			stats.drops++;
+			set_scale(scale - DYNRES_STEP);
+		}
+		stable = 0;
+		return;
+	}
+
+	if (ema_us <= DYNRES_TARGET_US * 102 / 100)
+		stable++;
+	else
+		stable = 0;
+
+	if (stable < probe_interval)
+		return;
+
+	if (probing) {
+		probe_interval = DRES_PROBE_FRAMES;
+		probing = 0;
+	}
+
+	if (scale < DYNRES_MAX_SCALE) {
+		stats.raises++;
+		probing = 1;
+		set_scale(scale + DYNRES_STEP);
+	}
+}
+
+#define DRES_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_dres, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int dres_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	DRES_HOOK(glBindFramebufferOES);
+	DRES_HOOK(glViewport);
+	DRES_HOOK(glScissor);
+
+	sceClibMemset(&stats, 0, sizeof(DynresStats));
+	stats_hist_reset(&stats.scaleHist);
+
+	return AL_OK;
+}
+
+// must run before the game issues any GL, with GL_DEFERRED after gldf_start
+int dres_start(int surfaceWidth, int surfaceHeight)
+{
+	int complete = 0;
+
+	surface_width = surfaceWidth;
+	surface_height = surfaceHeight;
+
+	gldf_run_sync(create_target, &complete);
+	if (!complete)
+		return AL_ERROR_DRES_INCOMPLETE_TARGET;
+
+	set_scale(DYNRES_MAX_SCALE);
+	active = 1;
+
+	return stats_register_dump(dres_dump);
+}
+
+void dres_begin_frame(void)
+{
+	uint32_t width = stats.width, height = stats.height;
+	DynresFrame *frame;
+
+	if (!active)
+		return;
+
+	update_scale();
+
+	if (game_fb == 0) {
+		next_glBindFramebufferOES(GL_FRAMEBUFFER_OES, target_fbo);
+
+		if (stats.width != width || stats.height != height) {
+			if (viewport_known)
+				set_viewport();
+			if (scissor_known)
+				set_scissor();
+		}
+	}
+
+	frame = &frames[frame_index % RING_SIZE];
+	frame->width = stats.width;
+	frame->height = stats.height;
+
+	stats_hist_add(&stats.scaleHist, scale);
+	stats.frames++;
+}
+
+void dres_end_frame(void)
+{
+	if (!active)
+		return;
+
+	gldf_run(blit, &frames[frame_index % RING_SIZE]);
+	frame_index++;
+}
+
+const DynresStats *dres_get_stats(void)
+{
+	return &stats;
+}
+
+void dres_draw_overlay(void)
+{
+	if (!active)
+		return;
+
+	ovl_printf(8, 210, 2, OVL_RGBA(255, 255, 255, 255), "RES %uX%u %u%%", stats.width, stats.height, stats.scale);
+}
+
+void dres_dump(void)
+{
+	SceUID fd;
+
+	fd = stats_file_open("dynres.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "frames,%u\n", stats.frames);
+	stats_file_printf(fd, "drops,%u\n", stats.drops);
+	stats_file_printf(fd, "raises,%u\n", stats.raises);
+	stats_file_printf(fd, "failed_raises,%u\n", stats.failedRaises);
+	stats_file_printf(fd, "cpu_bound_frames,%u\n", stats.cpuBoundFrames);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "scale_percent", &stats.scaleHist);
+
+	stats_file_close(fd);
+}
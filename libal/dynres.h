@@ -0,0 +1,37 @@
+#ifndef __DYNRES_H__
+#define __DYNRES_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+// frames a raised scale has to hold the target before the next raise, the
+// interval doubles for every raise that had to be taken back
+#define DRES_PROBE_FRAMES		120
+#define DRES_PROBE_FRAMES_MAX	1920
+
+// frames to let a new scale settle before judging it
+#define DRES_SETTLE_FRAMES		8
+
+typedef struct {
+	uint32_t frames;
+	uint32_t scale;
+	uint32_t width;
+	uint32_t height;
+	uint32_t drops;
+	uint32_t raises;
+	uint32_t failedRaises;
+	uint32_t cpuBoundFrames;	// over target with the CPU side alone, scale kept
+	StatsHist scaleHist;
+} DynresStats;
+
+int dres_bind(Symtable *table);
+int dres_start(int surfaceWidth, int surfaceHeight);
+void dres_begin_frame(void);
+void dres_end_frame(void);
+const DynresStats *dres_get_stats(void);
+void dres_draw_overlay(void);
+void dres_dump(void);
+
+#endif
@@ -0,0 +1,884 @@
+/* file_cache.c -- block cache and read-ahead for the game's stdio reads
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Streams opened read-only are served by libal instead of libc: the FILE
+// pointer handed to the game points into our own table and reads go
+// through a shared LRU cache of FILE_CACHE_BLOCK_SIZE blocks keyed by the
+// path hash, so reopening a file still hits. Every other stream, and every
+// call on one, is forwarded untouched. Opening a path for writing drops
+// its cached blocks.
+//
+// Once a stream reads on into the next block, an I/O thread loads up to
+// FILE_CACHE_READ_AHEAD blocks after it. A block that is still being read
+// ahead when the game gets there is waited for rather than read twice.
+// Reads covering whole blocks that are not cached skip the cache and land
+// in the game's buffer directly.
+//
+// With ASSET_PACK, files found in the asset pack are read from the pack's
+// descriptor at their offset in it instead of being opened one by one.
+// Compressed files are decoded a block at a time, a cache block is exactly
+// one LZ4 block, so seeking stays a matter of picking the block. Compressed
+// data is read into one of FCACHE_SCRATCH_BUFFERS scratch buffers and
+// decoded from there into the cache block, or into the game's buffer for
+// direct reads.
+//
+// With WRITE_BEHIND a file is opened once its pending commit is done.
+//
+// With LOAD_PREFETCH every read is also reported to load_trace.c, which
+// replays recorded loads into the cache through fcache_prefetch().
+//
+// fprintf is not interposed, the game never writes to a stream it opened
+// for reading. fileno of a cached stream is a placeholder descriptor that
+// only fstat understands: it is answered by stat on the stream's path,
+// through the pack when the file is in it. Any other call on it fails as
+// on a closed descriptor.
+//
+
+#include <kernel.h>
+
+#include <stdio.h>
+
+#include "file_cache.h"
+#include "block_cache.h"
+#include "load_trace.h"
+#include "pack.h"
+#include "write_behind.h"
+#include "lz4.h"
+#include "hash.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+// where a file's data comes from
+typedef struct {
+	SceUID fd;
+	int shared;					// the pack's descriptor
+	SceOff base;
+	const uint64_t *blocks;		// compressed block offsets, NULL if stored
+} FcacheSource;
+
+typedef struct {
+	int used;
+	FcacheSource src;
+	uint64_t key;
+	SceOff size;
+	SceOff pos;
+	int eof;
+	uint32_t inflight;
+	uint32_t traceId;
+	BcacheStream stream;
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE];
+} FcacheFile;
+
+typedef struct {
+	FcacheFile *file;
+	uint32_t index;
+} AheadRequest;
+
+static FcacheFile files[FCACHE_MAX_FILES];
+static AheadRequest queue[FCACHE_QUEUE_SIZE];
+static uint32_t queue_head = 0;
+static uint32_t queue_tail = 0;
+
+static BlockCache cache;
+static SceKernelLwMutexWork lock;
+static SceKernelLwCondWork work_cond;
+static SceKernelLwCondWork done_cond;
+static int running = 0;
+
+static FileCacheStats stats;
+
+// file the load prefetcher is working on, only used by its thread
+static FcacheSource prefetch_src = { -1 };
+static uint64_t prefetch_key = 0;
+static SceOff prefetch_size = 0;
+
+#ifdef ASSET_PACK
+static uint8_t *scratch;
+static uint32_t scratch_free = (1 << FCACHE_SCRATCH_BUFFERS) - 1;
+#endif
+
+static FILE *(* next_fopen)(const char *filename, const char *mode);
+static size_t (* next_fread)(void *ptr, size_t size, size_t count, FILE *stream);
+static size_t (* next_fwrite)(const void *ptr, size_t size, size_t count, FILE *stream);
+static int (* next_fseek)(FILE *stream, long offset, int whence);
+static long (* next_ftell)(FILE *stream);
+static char *(* next_fgets)(char *s, int n, FILE *stream);
+static int (* next_fflush)(FILE *stream);
+static int (* next_fileno)(FILE *stream);
+static int (* next_fclose)(FILE *stream);
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+static int (* next_fstat)(int fd, void *buf);
+static int (* game_stat)(const char *path, void *buf);
+#endif
+
+static inline FcacheFile *lookup(FILE *stream)
+{
+	FcacheFile *f = (FcacheFile *)stream;
+
+	if (f >= files && f < files + FCACHE_MAX_FILES)
+		return f;
+
+	return NULL;
+}
+
+static inline uint32_t block_size(SceOff size, uint32_t index)
+{
+	SceOff left = size - (SceOff)index * cache.blockSize;
+
+	return left < cache.blockSize ? (uint32_t)left : cache.blockSize;
+}
+
+#ifdef ASSET_PACK
+static uint8_t *claim_scratch(void)
+{
+	uint32_t slot = 0;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	while (scratch_free == 0)
+		sceKernelWaitLwCond(&done_cond, NULL);
+
+	while (!(scratch_free & (1 << slot)))
+		slot++;
+	scratch_free &= ~(1 << slot);
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return scratch + slot * cache.blockSize;
+}
+
+static void release_scratch(uint8_t *buf, uint32_t stored, uint32_t size, SceUInt64 time)
+{
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	scratch_free |= 1 << ((buf - scratch) / cache.blockSize);
+	stats.blocksDecoded++;
+	stats.bytesStored += stored;
+	stats.bytesDecoded += size;
+	stats.decodeTime += time;
+	sceKernelSignalLwCondAll(&done_cond);
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+#endif
+
+// reads size bytes of block index, decoding compressed blocks, returns
+// size or a negative value, called without the lock
+static int read_block(const FcacheSource *src, uint32_t index, uint8_t *dst, uint32_t size)
+{
+#ifdef ASSET_PACK
+	SceUInt64 start;
+	uint32_t stored;
+	uint8_t *buf;
+	int res;
+
+	if (src->blocks != NULL) {
+		stored = src->blocks[index + 1] - src->blocks[index];
+		if (stored == size)
+			return sceIoPread(src->fd, dst, size, src->blocks[index]);
+
+		buf = claim_scratch();
+		res = sceIoPread(src->fd, buf, stored, src->blocks[index]);
+		start = sceKernelGetProcessTimeWide();
+		if (res == stored)
+			res = lz4_decode(buf, stored, dst, size);
+		release_scratch(buf, stored, size, sceKernelGetProcessTimeWide() - start);
+
+		return res;
+	}
+#endif
+
+	return sceIoPread(src->fd, dst, size, src->base + (SceOff)index * cache.blockSize);
+}
+
+// called with the lock held
+static void queue_ahead(FcacheFile *f, uint32_t index)
+{
+	uint32_t ahead = bcache_stream_ahead(&f->stream, index, FILE_CACHE_READ_AHEAD);
+	uint32_t last = (f->size - 1) / cache.blockSize;
+	int queued = 0;
+
+	for (uint32_t i = index + 1; i <= index + ahead && i <= last; i++) {
+		if (bcache_find(&cache, f->key, i) != NULL)
+			continue;
+
+		if (queue_tail - queue_head == FCACHE_QUEUE_SIZE) {
+			stats.aheadDropped++;
+			break;
+		}
+
+		queue[queue_tail % FCACHE_QUEUE_SIZE].file = f;
+		queue[queue_tail % FCACHE_QUEUE_SIZE].index = i;
+		queue_tail++;
+		f->inflight++;
+		stats.aheadIssued++;
+		queued = 1;
+	}
+
+	if (queued)
+		sceKernelSignalLwCond(&work_cond);
+}
+
+static int io_thread(SceSize args, void *argp)
+{
+	AheadRequest req;
+	BcacheBlock *block;
+	uint32_t size;
+	int res;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	while (1) {
+		while (queue_head == queue_tail)
+			sceKernelWaitLwCond(&work_cond, NULL);
+
+		req = queue[queue_head % FCACHE_QUEUE_SIZE];
+		queue_head++;
+
+		// closed while queued
+		if (req.file == NULL)
+			continue;
+
+		block = NULL;
+		if (bcache_find(&cache, req.file->key, req.index) == NULL)
+			block = bcache_claim(&cache, req.file->key, req.index);
+
+		if (block != NULL) {
+			size = block_size(req.file->size, req.index);
+
+			sceKernelUnlockLwMutex(&lock, 1);
+			res = read_block(&req.file->src, req.index, block->data, size);
+			sceKernelLockLwMutex(&lock, 1, NULL);
+
+			bcache_release(&cache, block, res == size ? size : 0);
+			if (block->state == BCACHE_VALID) {
+				block->flags |= BCACHE_PREFETCHED;
+				stats.bytesAhead += size;
+				stats.bytesRead += size;
+			}
+		}
+
+		req.file->inflight--;
+		sceKernelSignalLwCondAll(&done_cond);
+	}
+
+	return 0;
+}
+
+// called with the lock held, returns the block with index read in full or
+// NULL on a read error, the lock is dropped while reading
+static BcacheBlock *get_block(FcacheFile *f, uint32_t index, uint64_t *wait)
+{
+	uint32_t size = block_size(f->size, index);
+	BcacheBlock *block;
+	SceUInt64 start;
+	int late = 0;
+	int res;
+
+	while (1) {
+		block = bcache_find(&cache, f->key, index);
+		if (block != NULL && block->state == BCACHE_VALID) {
+			if (late)
+				stats.lateHits++;
+			else if (block->flags & BCACHE_PREFETCHED)
+				stats.aheadHits++;
+			else
+				stats.hits++;
+
+			block->flags &= ~BCACHE_PREFETCHED;
+			return block;
+		}
+
+		if (block == NULL) {
+			block = bcache_claim(&cache, f->key, index);
+			if (block != NULL) {
+				stats.misses++;
+
+				sceKernelUnlockLwMutex(&lock, 1);
+				start = sceKernelGetProcessTimeWide();
+				res = read_block(&f->src, index, block->data, size);
+				*wait += sceKernelGetProcessTimeWide() - start;
+				sceKernelLockLwMutex(&lock, 1, NULL);
+
+				bcache_release(&cache, block, res == size ? size : 0);
+				sceKernelSignalLwCondAll(&done_cond);
+
+				if (res != size)
+					return NULL;
+
+				stats.bytesRead += size;
+
+				// invalidated while loading, released empty, read again
+				if (block->state == BCACHE_VALID)
+					return block;
+
+				stats.staleReloads++;
+				continue;
+			}
+		}
+
+		// being read ahead, or every block is busy loading
+		late = 1;
+		start = sceKernelGetProcessTimeWide();
+		sceKernelWaitLwCond(&done_cond, NULL);
+		*wait += sceKernelGetProcessTimeWide() - start;
+	}
+}
+
+// called with the lock held, line stops after the first newline
+static uint32_t cache_read(FcacheFile *f, uint8_t *dst, uint32_t size, int line, uint64_t *wait)
+{
+	uint32_t bs = cache.blockSize;
+	uint32_t done = 0, index, offset, run, n;
+	BcacheBlock *block;
+	SceUInt64 start;
+	int res;
+
+	if (f->pos >= f->size)
+		return 0;
+
+	if (size > f->size - f->pos)
+		size = f->size - f->pos;
+
+	while (done < size) {
+		index = f->pos / bs;
+		offset = f->pos % bs;
+
+		if (!line && offset == 0 && size - done >= bs && bcache_find(&cache, f->key, index) == NULL) {
+			run = 1;
+			while ((run + 1) * bs <= size - done && bcache_find(&cache, f->key, index + run) == NULL)
+				run++;
+
+			sceKernelUnlockLwMutex(&lock, 1);
+			start = sceKernelGetProcessTimeWide();
+			if (f->src.blocks == NULL) {
+				res = sceIoPread(f->src.fd, dst + done, run * bs, f->src.base + f->pos);
+			} else {
+				for (res = 0; res < run * bs; res += bs) {
+					if (read_block(&f->src, index + res / bs, dst + done + res, bs) != bs)
+						break;
+				}
+			}
+			*wait += sceKernelGetProcessTimeWide() - start;
+			sceKernelLockLwMutex(&lock, 1, NULL);
+
+			if (res <= 0)
+				break;
+
+			stats.bytesDirect += res;
+			stats.bytesRead += res;
+			f->pos += res;
+			done += res;
+
+			for (uint32_t i = 0; i < run - 1; i++)
+				bcache_stream_ahead(&f->stream, index + i, FILE_CACHE_READ_AHEAD);
+			queue_ahead(f, index + run - 1);
+
+			if (res != run * bs)
+				break;
+			continue;
+		}
+
+		block = get_block(f, index, wait);
+		if (block == NULL || offset >= block->size)
+			break;
+
+		n = block->size - offset;
+		if (n > size - done)
+			n = size - done;
+
+		if (line) {
+			for (uint32_t i = 0; i < n; i++) {
+				if (block->data[offset + i] == '\n') {
+					n = i + 1;
+					break;
+				}
+			}
+		}
+
+		sceClibMemcpy(dst + done, block->data + offset, n);
+		f->pos += n;
+		done += n;
+
+		queue_ahead(f, index);
+
+		if (line && dst[done - 1] == '\n')
+			break;
+	}
+
+	return done;
+}
+
+// opens path for reading, files in the asset pack share its descriptor
+static int open_source(const char *path, FcacheSource *src, SceOff *size)
+{
+#ifdef ASSET_PACK
+	const PackEntry *e = pack_lookup(path);
+
+	if (e != NULL && !(e->flags & APAK_DIR)) {
+		src->fd = pack_fd();
+		src->shared = 1;
+		src->base = (e->flags & APAK_LZ4) ? 0 : e->offset;
+		src->blocks = (e->flags & APAK_LZ4) ? pack_blocks(e) : NULL;
+		*size = e->size;
+		return 0;
+	}
+#endif
+
+#ifdef WRITE_BEHIND
+	wbuf_wait(path);
+#endif
+
+	src->fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (src->fd < 0)
+		return src->fd;
+
+	src->shared = 0;
+	src->base = 0;
+	src->blocks = NULL;
+	*size = sceIoLseek(src->fd, 0, SCE_SEEK_END);
+	if (*size < 0) {
+		sceIoClose(src->fd);
+		return (int)*size;
+	}
+
+	return 0;
+}
+
+static void close_source(FcacheSource *src)
+{
+	if (src->fd >= 0 && !src->shared)
+		sceIoClose(src->fd);
+
+	src->fd = -1;
+}
+
+static void account_read(uint32_t size, uint64_t wait)
+{
+	stats.reads++;
+	stats.bytesRequested += size;
+	stats.waitTime += wait;
+	stats_hist_add(&stats.readWait, (uint32_t)wait);
+}
+
+static FILE *fopen_fcache(const char *filename, const char *mode)
+{
+	FcacheFile *f = NULL;
+	uint64_t key;
+	SceOff size;
+
+	if (!running || filename == NULL || mode == NULL)
+		return next_fopen(filename, mode);
+
+	key = hash_data(filename, sceClibStrnlen(filename, SCE_IO_MAX_PATH_LENGTH), 0);
+
+	if (mode[0] != 'r' || sceClibStrchr(mode, '+') != NULL) {
+		sceKernelLockLwMutex(&lock, 1, NULL);
+		bcache_invalidate(&cache, key);
+		stats.invalidations++;
+		sceKernelUnlockLwMutex(&lock, 1);
+
+#ifdef ASSET_PACK
+		pack_override(filename);
+#endif
+
+		return next_fopen(filename, mode);
+	}
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	for (int i = 0; i < FCACHE_MAX_FILES; i++) {
+		if (!files[i].used) {
+			f = &files[i];
+			f->used = 1;
+			break;
+		}
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	if (f == NULL)
+		return next_fopen(filename, mode);
+
+	if (open_source(filename, &f->src, &size) < 0) {
+		f->used = 0;
+		return NULL;
+	}
+
+	sceClibStrncpy(f->path, filename, sizeof(f->path) - 1);
+	f->key = key;
+	f->size = size;
+	f->pos = 0;
+	f->eof = 0;
+	f->inflight = 0;
+	bcache_stream_reset(&f->stream);
+#ifdef LOAD_PREFETCH
+	f->traceId = ldtr_file_id(filename);
+#endif
+
+	stats.opens++;
+
+	return (FILE *)f;
+}
+
+static size_t fread_fcache(void *ptr, size_t size, size_t count, FILE *stream)
+{
+	FcacheFile *f = lookup(stream);
+	uint64_t wait = 0;
+	uint32_t total, done;
+
+	if (f == NULL)
+		return next_fread(ptr, size, count, stream);
+
+	if (size == 0 || count == 0)
+		return 0;
+
+	total = size * count;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+#ifdef LOAD_PREFETCH
+	ldtr_read(f->traceId, (uint32_t)f->pos, total);
+#endif
+	done = cache_read(f, (uint8_t *)ptr, total, 0, &wait);
+	account_read(total, wait);
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	if (done < total)
+		f->eof = 1;
+
+	return done / size;
+}
+
+static char *fgets_fcache(char *s, int n, FILE *stream)
+{
+	FcacheFile *f = lookup(stream);
+	uint64_t wait = 0;
+	uint32_t done;
+
+	if (f == NULL)
+		return next_fgets(s, n, stream);
+
+	if (n <= 0)
+		return NULL;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+#ifdef LOAD_PREFETCH
+	ldtr_read(f->traceId, (uint32_t)f->pos, n - 1);
+#endif
+	done = cache_read(f, (uint8_t *)s, n - 1, 1, &wait);
+	account_read(n - 1, wait);
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	s[done] = '\0';
+
+	if (done == 0 && n > 1) {
+		f->eof = 1;
+		return NULL;
+	}
+
+	return s;
+}
+
+static size_t fwrite_fcache(const void *ptr, size_t size, size_t count, FILE *stream)
+{
+	if (lookup(stream) != NULL)
+		return 0;
+
+	return next_fwrite(ptr, size, count, stream);
+}
+
+static int fseek_fcache(FILE *stream, long offset, int whence)
+{
+	FcacheFile *f = lookup(stream);
+	SceOff pos;
+
+	if (f == NULL)
+		return next_fseek(stream, offset, whence);
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = f->pos + offset;
+		break;
+	case SEEK_END:
+		pos = f->size + offset;
+		break;
+	default:
+		return -1;
+	}
+
+	if (pos < 0)
+		return -1;
+
+	f->pos = pos;
+	f->eof = 0;
+	stats.seeks++;
+
+	return 0;
+}
+
+static long ftell_fcache(FILE *stream)
+{
+	FcacheFile *f = lookup(stream);
+
+	if (f == NULL)
+		return next_ftell(stream);
+
+	return (long)f->pos;
+}
+
+static int fflush_fcache(FILE *stream)
+{
+	if (lookup(stream) != NULL)
+		return 0;
+
+	return next_fflush(stream);
+}
+
+static int fileno_fcache(FILE *stream)
+{
+	FcacheFile *f = lookup(stream);
+
+	if (f != NULL)
+		return FCACHE_FD_BASE + (int)(f - files);
+
+	return next_fileno(stream);
+}
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+static int fstat_fcache(int fd, void *buf)
+{
+	uint32_t slot = (uint32_t)(fd - FCACHE_FD_BASE);
+
+	if (slot < FCACHE_MAX_FILES && files[slot].used)
+		return game_stat(files[slot].path, buf);
+
+	return next_fstat(fd, buf);
+}
+#endif
+
+static int fclose_fcache(FILE *stream)
+{
+	FcacheFile *f = lookup(stream);
+
+	if (f == NULL)
+		return next_fclose(stream);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	for (uint32_t i = queue_head; i != queue_tail; i++) {
+		if (queue[i % FCACHE_QUEUE_SIZE].file == f) {
+			queue[i % FCACHE_QUEUE_SIZE].file = NULL;
+			f->inflight--;
+		}
+	}
+
+	while (f->inflight > 0)
+		sceKernelWaitLwCond(&done_cond, NULL);
+
+	close_source(&f->src);
+	f->used = 0;
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return 0;
+}
+
+#define FCACHE_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_fcache, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int fcache_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	FCACHE_HOOK(fopen);
+	FCACHE_HOOK(fread);
+	FCACHE_HOOK(fwrite);
+	FCACHE_HOOK(fseek);
+	FCACHE_HOOK(ftell);
+	FCACHE_HOOK(fgets);
+	FCACHE_HOOK(fflush);
+	FCACHE_HOOK(fileno);
+	FCACHE_HOOK(fclose);
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	FCACHE_HOOK(fstat);
+
+	// stat as the game sees it, so pack files are answered by the pack
+	ret = symt_lookup(table, "stat", (uintptr_t *)&game_stat);
+	if (ret < 0)
+		return ret;
+#endif
+
+	return AL_OK;
+}
+
+int fcache_start(void)
+{
+	uint32_t count = FILE_CACHE_SIZE / FILE_CACHE_BLOCK_SIZE;
+	SceUID mbid, thid;
+	void *base;
+	int ret;
+
+	mbid = sceKernelAllocMemBlock("AL::FileCache::Blocks", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(bcache_mem_size(count, FILE_CACHE_BLOCK_SIZE), SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, &base);
+	bcache_init(&cache, base, count, FILE_CACHE_BLOCK_SIZE);
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::FileCache::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	ret = sceKernelCreateLwCond(&work_cond, "AL::FileCache::Work", 0, &lock, NULL);
+	if (ret < 0)
+		return ret;
+
+	ret = sceKernelCreateLwCond(&done_cond, "AL::FileCache::Done", 0, &lock, NULL);
+	if (ret < 0)
+		return ret;
+
+	thid = sceKernelCreateThread("io_thread", (SceKernelThreadEntry)io_thread, 64, 16 * 1024, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	if (thid < 0)
+		return thid;
+
+	sceKernelStartThread(thid, 0, NULL);
+
+#ifdef ASSET_PACK
+	mbid = sceKernelAllocMemBlock("AL::FileCache::Scratch", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(FCACHE_SCRATCH_BUFFERS * FILE_CACHE_BLOCK_SIZE, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, (void **)&scratch);
+#endif
+
+	sceClibMemset(&stats, 0, sizeof(FileCacheStats));
+	stats_hist_reset(&stats.readWait);
+
+	running = 1;
+
+	return stats_register_dump(fcache_dump);
+}
+
+// loads the blocks covering offset..offset+length of path that are not
+// cached yet, called from the load prefetcher's thread
+void fcache_prefetch(const char *path, uint32_t offset, uint32_t length)
+{
+	uint64_t key;
+	uint32_t first, last;
+	BcacheBlock *block;
+	uint32_t size;
+	int res;
+
+	if (!running || length == 0)
+		return;
+
+	key = hash_data(path, sceClibStrnlen(path, SCE_IO_MAX_PATH_LENGTH), 0);
+
+	if (prefetch_src.fd < 0 || key != prefetch_key) {
+		fcache_prefetch_end();
+
+		if (open_source(path, &prefetch_src, &prefetch_size) < 0) {
+			prefetch_src.fd = -1;
+			return;
+		}
+
+		prefetch_key = key;
+	}
+
+	if (offset >= prefetch_size)
+		return;
+
+	if (length > prefetch_size - offset)
+		length = prefetch_size - offset;
+
+	first = offset / cache.blockSize;
+	last = (offset + length - 1) / cache.blockSize;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	for (uint32_t i = first; i <= last; i++) {
+		if (bcache_find(&cache, key, i) != NULL)
+			continue;
+
+		block = bcache_claim(&cache, key, i);
+		if (block == NULL)
+			break;
+
+		size = block_size(prefetch_size, i);
+
+		sceKernelUnlockLwMutex(&lock, 1);
+		res = read_block(&prefetch_src, i, block->data, size);
+		sceKernelLockLwMutex(&lock, 1, NULL);
+
+		bcache_release(&cache, block, res == size ? size : 0);
+		if (block->state == BCACHE_VALID) {
+			block->flags |= BCACHE_PREFETCHED;
+			stats.prefetchBlocks++;
+			stats.bytesPrefetched += size;
+			stats.bytesRead += size;
+		}
+
+		sceKernelSignalLwCondAll(&done_cond);
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+void fcache_prefetch_end(void)
+{
+	close_source(&prefetch_src);
+}
+
+const FileCacheStats *fcache_get_stats(void)
+{
+	return &stats;
+}
+
+void fcache_dump(void)
+{
+	uint32_t lookups = stats.hits + stats.aheadHits + stats.lateHits + stats.misses;
+	SceUID fd;
+
+	fd = stats_file_open("file_cache.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "block_size,%u\n", cache.blockSize);
+	stats_file_printf(fd, "blocks,%u\n", cache.count);
+	stats_file_printf(fd, "opens,%u\n", stats.opens);
+	stats_file_printf(fd, "reads,%u\n", stats.reads);
+	stats_file_printf(fd, "seeks,%u\n", stats.seeks);
+	stats_file_printf(fd, "hits,%u\n", stats.hits);
+	stats_file_printf(fd, "read_ahead_hits,%u\n", stats.aheadHits);
+	stats_file_printf(fd, "late_hits,%u\n", stats.lateHits);
+	stats_file_printf(fd, "misses,%u\n", stats.misses);
+	stats_file_printf(fd, "hit_rate,%u%%\n", lookups ? (uint32_t)((uint64_t)(lookups - stats.misses) * 100 / lookups) : 0);
+	stats_file_printf(fd, "read_ahead_issued,%u\n", stats.aheadIssued);
+	stats_file_printf(fd, "read_ahead_dropped,%u\n", stats.aheadDropped);
+	stats_file_printf(fd, "invalidations,%u\n", stats.invalidations);
+	stats_file_printf(fd, "stale_reloads,%u\n", stats.staleReloads);
+	stats_file_printf(fd, "prefetched_blocks,%u\n", stats.prefetchBlocks);
+	stats_file_printf(fd, "bytes_requested,%llu\n", stats.bytesRequested);
+	stats_file_printf(fd, "bytes_read,%llu\n", stats.bytesRead);
+	stats_file_printf(fd, "bytes_read_ahead,%llu\n", stats.bytesAhead);
+	stats_file_printf(fd, "bytes_direct,%llu\n", stats.bytesDirect);
+	stats_file_printf(fd, "bytes_prefetched,%llu\n", stats.bytesPrefetched);
+	stats_file_printf(fd, "blocks_decoded,%u\n", stats.blocksDecoded);
+	stats_file_printf(fd, "bytes_stored,%llu\n", stats.bytesStored);
+	stats_file_printf(fd, "bytes_decoded,%llu\n", stats.bytesDecoded);
+	stats_file_printf(fd, "decode_us,%llu\n", stats.decodeTime);
+	stats_file_printf(fd, "io_wait_us,%llu\n", stats.waitTime);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "read_wait_us", &stats.readWait);
+
+	stats_file_close(fd);
+}
@@ -0,0 +1,55 @@
+#ifndef __FILE_CACHE_H__
+#define __FILE_CACHE_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+// streams open for reading at the same time, more are left to libc
+#define FCACHE_MAX_FILES	64
+
+// fileno of a cached stream is FCACHE_FD_BASE plus its slot, far above any
+// descriptor the compat library hands out
+#define FCACHE_FD_BASE		0x7FF00000
+
+// pending read-ahead blocks, power of two
+#define FCACHE_QUEUE_SIZE	64
+
+// compressed blocks being read at the same time
+#define FCACHE_SCRATCH_BUFFERS	4
+
+typedef struct {
+	uint32_t opens;
+	uint32_t reads;
+	uint32_t seeks;
+	uint32_t hits;
+	uint32_t aheadHits;
+	uint32_t lateHits;
+	uint32_t misses;
+	uint32_t aheadIssued;
+	uint32_t aheadDropped;
+	uint32_t invalidations;
+	uint32_t staleReloads;
+	uint32_t prefetchBlocks;
+	uint32_t blocksDecoded;
+	uint64_t bytesRequested;
+	uint64_t bytesRead;
+	uint64_t bytesAhead;
+	uint64_t bytesDirect;
+	uint64_t bytesPrefetched;
+	uint64_t bytesStored;
+	uint64_t bytesDecoded;
+	uint64_t decodeTime;
+	uint64_t waitTime;
+	StatsHist readWait;
+} FileCacheStats;
+
+int fcache_bind(Symtable *table);
+int fcache_start(void);
+void fcache_prefetch(const char *path, uint32_t offset, uint32_t length);
+void fcache_prefetch_end(void);
+const FileCacheStats *fcache_get_stats(void);
+void fcache_dump(void);
+
+#endif
@@ -0,0 +1,278 @@
+/* frame_stats.c -- main loop frame time instrumentation
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// main_thread brackets every frame with frst_begin/frst_end and marks the
+// end of each stage with frst_mark. A large UPDATE share means the frame is
+// CPU bound in libbc2.so, a large SWAP share means it waits on the GPU.
+//
+
+#include <kernel.h>
+
+#include <stdlib.h>
+
+#include "frame_stats.h"
+#include "overlay.h"
+#include "stats.h"
+#include "al_error.h"
+
+static const char *stage_names[FRST_STAGE_COUNT] = {
+	"input_us",
+	"update_us",
+	"overlay_us",
+	"swap_us",
+};
+
+static FrameStats stats;
+
+static FrameRecord ring[FRST_RING_SIZE];
+static FrameRecord current;
+
+static FrameHitch hitches[FRST_MAX_HITCHES];
+
+static FrameThread threads[FRST_MAX_THREADS];
+static unsigned int num_threads = 0;
+static SceUInt64 last_load_sample = 0;
+
+static SceUInt64 frame_start = 0;
+static SceUInt64 stage_start = 0;
+
+static uint32_t sorted[FRST_RING_SIZE];
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void update_percentiles(void)
+{
+	uint32_t count = stats.frames < FRST_RING_SIZE ? stats.frames : FRST_RING_SIZE;
+
+	if (count == 0)
+		return;
+
+	for (uint32_t i = 0; i < count; i++)
+		sorted[i] = ring[i].total;
+
+	qsort(sorted, count, sizeof(uint32_t), compare_u32);
+
+	stats.p50 = sorted[(count - 1) * 50 / 100];
+	stats.p95 = sorted[(count - 1) * 95 / 100];
+	stats.p99 = sorted[(count - 1) * 99 / 100];
+	stats.worst = sorted[count - 1];
+}
+
+static void sample_thread_load(SceUInt64 now)
+{
+	SceKernelThreadInfo info;
+	SceUInt64 elapsed = now - last_load_sample;
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		info.size = sizeof(SceKernelThreadInfo);
+		if (sceKernelGetThreadInfo(threads[i].thid, &info) < 0)
+			continue;
+
+		if (last_load_sample != 0 && elapsed != 0) {
+			threads[i].load = (uint32_t)((info.runClocks - threads[i].lastRunClocks) * 100 / elapsed);
+			if (threads[i].load > threads[i].peakLoad)
+				threads[i].peakLoad = threads[i].load;
+		}
+
+		threads[i].lastRunClocks = info.runClocks;
+	}
+
+	last_load_sample = now;
+}
+
+int frst_init(void)
+{
+	sceClibMemset(&stats, 0, sizeof(FrameStats));
+	stats_hist_reset(&stats.total);
+	for (int i = 0; i < FRST_STAGE_COUNT; i++)
+		stats_hist_reset(&stats.stage[i]);
+
+	num_threads = 0;
+	last_load_sample = 0;
+
+	return stats_register_dump(frst_dump);
+}
+
+int frst_add_thread(SceUID thid, const char *name)
+{
+	if (num_threads >= FRST_MAX_THREADS)
+		return AL_ERROR_INVALID_ARGUMENT;
+
+	threads[num_threads].thid = thid;
+	threads[num_threads].name = name;
+	threads[num_threads].lastRunClocks = 0;
+	threads[num_threads].load = 0;
+	threads[num_threads].peakLoad = 0;
+	num_threads++;
+
+	return AL_OK;
+}
+
+void frst_begin(void)
+{
+	sceClibMemset(&current, 0, sizeof(FrameRecord));
+	frame_start = stage_start = sceKernelGetProcessTimeWide();
+}
+
+void frst_mark(int stage)
+{
+	SceUInt64 now = sceKernelGetProcessTimeWide();
+
+	current.stage[stage] += (uint32_t)(now - stage_start);
+	stage_start = now;
+}
+
+void frst_end(void)
+{
+	SceUInt64 now = sceKernelGetProcessTimeWide();
+
+	current.total = (uint32_t)(now - frame_start);
+
+	stats_hist_add(&stats.total, current.total);
+	for (int i = 0; i < FRST_STAGE_COUNT; i++)
+		stats_hist_add(&stats.stage[i], current.stage[i]);
+
+	if (stats.frames >= FRST_RING_SIZE &&
+		current.total >= FRST_HITCH_MIN_US &&
+		current.total > stats.p50 * FRST_HITCH_FACTOR) {
+		FrameHitch *hitch = &hitches[stats.hitches % FRST_MAX_HITCHES];
+		hitch->frame = stats.frames;
+		hitch->record = current;
+		stats.hitches++;
+	}
+
+	ring[stats.frames % FRST_RING_SIZE] = current;
+	stats.frames++;
+
+	if ((stats.frames % FRST_LOAD_INTERVAL) == 0) {
+		update_percentiles();
+		sample_thread_load(now);
+	}
+}
+
+const FrameStats *frst_get(void)
+{
+	return &stats;
+}
+
+const FrameRecord *frst_last(void)
+{
+	if (stats.frames == 0)
+		return &current;
+
+	return &ring[(stats.frames - 1) % FRST_RING_SIZE];
+}
+
+void frst_draw_overlay(void)
+{
+	static const uint32_t stage_colors[FRST_STAGE_COUNT] = {
+		OVL_RGBA(80, 80, 255, 200),
+		OVL_RGBA(80, 255, 80, 200),
+		OVL_RGBA(255, 255, 80, 200),
+		OVL_RGBA(255, 80, 80, 200),
+	};
+	uint32_t count = stats.frames < FRST_GRAPH_FRAMES ? stats.frames : FRST_GRAPH_FRAMES;
+	int x = 8, base = 120, y;
+
+	ovl_rect(x - 2, base - 100, FRST_GRAPH_FRAMES * 2 + 4, 102, OVL_RGBA(0, 0, 0, 128));
+
+	// one bar per frame, 3 px per ms, stacked by stage
+	for (uint32_t i = 0; i < count; i++) {
+		const FrameRecord *rec = &ring[(stats.frames - count + i) % FRST_RING_SIZE];
+		y = base;
+		for (int s = 0; s < FRST_STAGE_COUNT; s++) {
+			int h = rec->stage[s] * 3 / 1000;
+			if (y - h < base - 100)
+				h = y - (base - 100);
+			ovl_rect(x + i * 2, y - h, 2, h, stage_colors[s]);
+			y -= h;
+		}
+	}
+
+	// 16.7 and 33.3 ms
+	ovl_rect(x, base - 50, FRST_GRAPH_FRAMES * 2, 1, OVL_RGBA(255, 255, 255, 160));
+	ovl_rect(x, base - 100, FRST_GRAPH_FRAMES * 2, 1, OVL_RGBA(255, 255, 255, 160));
+
+	y = base + 6;
+	ovl_printf(x, y, 2, OVL_RGBA(255, 255, 255, 255), "P50 %u.%u P99 %u.%u MAX %u.%u MS",
+		stats.p50 / 1000, (stats.p50 / 100) % 10,
+		stats.p99 / 1000, (stats.p99 / 100) % 10,
+		stats.worst / 1000, (stats.worst / 100) % 10);
+	y += 14;
+	ovl_printf(x, y, 2, OVL_RGBA(255, 255, 255, 255), "HITCHES %u", stats.hitches);
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		y += 14;
+		ovl_printf(x, y, 2, OVL_RGBA(255, 255, 255, 255), "%s %u%%", threads[i].name, threads[i].load);
+	}
+}
+
+void frst_dump(void)
+{
+	uint32_t count, first;
+	SceUID fd;
+
+	update_percentiles();
+
+	fd = stats_file_open("frame_stats.csv");
+	if (fd >= 0) {
+		stats_file_printf(fd, "frames,%u\nhitches,%u\np50_us,%u\np95_us,%u\np99_us,%u\nworst_us,%u\n",
+			stats.frames, stats.hitches, stats.p50, stats.p95, stats.p99, stats.worst);
+
+		stats_file_printf(fd, "thread,load_pct,peak_load_pct\n");
+		for (unsigned int i = 0; i < num_threads; i++)
+			stats_file_printf(fd, "%s,%u,%u\n", threads[i].name, threads[i].load, threads[i].peakLoad);
+
+		stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+		stats_file_write_hist(fd, "frame_us", &stats.total);
+		for (int i = 0; i < FRST_STAGE_COUNT; i++)
+			stats_file_write_hist(fd, stage_names[i], &stats.stage[i]);
+
+		stats_file_printf(fd, "hitch_frame,frame_us,input_us,update_us,overlay_us,swap_us\n");
+		count = stats.hitches < FRST_MAX_HITCHES ? stats.hitches : FRST_MAX_HITCHES;
+		for (uint32_t i = 0; i < count; i++) {
+			const FrameHitch *hitch = &hitches[(stats.hitches - count + i) % FRST_MAX_HITCHES];
+			stats_file_printf(fd, "%u,%u,%u,%u,%u,%u\n",
+				hitch->frame,
+				hitch->record.total,
+				hitch->record.stage[FRST_STAGE_INPUT],
+				hitch->record.stage[FRST_STAGE_UPDATE],
+				hitch->record.stage[FRST_STAGE_OVERLAY],
+				hitch->record.stage[FRST_STAGE_SWAP]);
+		}
+
+		stats_file_close(fd);
+	}
+
+	fd = stats_file_open("frame_times.csv");
+	if (fd >= 0) {
+		count = stats.frames < FRST_RING_SIZE ? stats.frames : FRST_RING_SIZE;
+		first = stats.frames - count;
+
+		stats_file_printf(fd, "frame,frame_us,input_us,update_us,overlay_us,swap_us\n");
+		for (uint32_t i = 0; i < count; i++) {
+			const FrameRecord *rec = &ring[(first + i) % FRST_RING_SIZE];
+			stats_file_printf(fd, "%u,%u,%u,%u,%u,%u\n",
+				first + i,
+				rec->total,
+				rec->stage[FRST_STAGE_INPUT],
+				rec->stage[FRST_STAGE_UPDATE],
+				rec->stage[FRST_STAGE_OVERLAY],
+				rec->stage[FRST_STAGE_SWAP]);
+		}
+
+		stats_file_close(fd);
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef __FRAME_STATS_H__
+#define __FRAME_STATS_H__
+
+#include <kernel.h>
+
+#include "stats.h"
+
+// frames kept for percentiles and the csv export, must be a power of two
+#define FRST_RING_SIZE			1024
+#define FRST_MAX_HITCHES		64
+#define FRST_MAX_THREADS		4
+
+// thread load is sampled every this many frames
+#define FRST_LOAD_INTERVAL		60
+
+// a frame is a hitch when it takes this many times the median and at least FRST_HITCH_MIN_US
+#define FRST_HITCH_FACTOR		2
+#define FRST_HITCH_MIN_US		40000
+
+#define FRST_GRAPH_FRAMES		120
+
+enum {
+	FRST_STAGE_INPUT = 0,	// inp_flush
+	FRST_STAGE_UPDATE,		// Android_Karisma_AppUpdate, game CPU time
+	FRST_STAGE_OVERLAY,		// debug overlays
+	FRST_STAGE_SWAP,		// eglSwapBuffers, GPU and vsync wait
+
+	FRST_STAGE_COUNT
+};
+
+typedef struct {
+	uint32_t total;
+	uint32_t stage[FRST_STAGE_COUNT];
+} FrameRecord;
+
+typedef struct {
+	uint32_t frame;
+	FrameRecord record;
+} FrameHitch;
+
+typedef struct {
+	SceUID thid;
+	const char *name;
+	SceUInt64 lastRunClocks;
+	uint32_t load;	// percent of one core over the last interval
+	uint32_t peakLoad;
+} FrameThread;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t hitches;
+	uint32_t p50;
+	uint32_t p95;
+	uint32_t p99;
+	uint32_t worst;
+	StatsHist total;
+	StatsHist stage[FRST_STAGE_COUNT];
+} FrameStats;
+
+int frst_init(void);
+int frst_add_thread(SceUID thid, const char *name);
+
+void frst_begin(void);
+void frst_mark(int stage);
+void frst_end(void);
+
+const FrameStats *frst_get(void);
+const FrameRecord *frst_last(void);
+
+void frst_draw_overlay(void);
+void frst_dump(void);
+
+#endif
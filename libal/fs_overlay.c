@@ -9,7 +9,9 @@
 #include <kernel.h>
 #include <kernel/fios2.h>
 
+#include "fs_overlay.h"
 #include "config.h"
+#include "so_util.h"
 
 int fsov_create()
 {
@@ -27,4 +29,71 @@ int fsov_create()
 	ov.dst_len = sceClibStrnlen(ov.dst, sizeof(ov.dst));
 
 	return sceFiosKernelOverlayAddForProcess02(pid, &ov, &ovId);
-}
\ No newline at end of file
+}
+
+// path relative to DATA_PATH without empty, "." and ".." components,
+// returns its length or -1 for paths outside of DATA_PATH
+int fsov_normalize(const char *path, char *out)
+{
+	uint32_t prefix = sizeof(DATA_PATH) - 1;
+	const char *p, *end;
+	int len = 0, seg;
+
+	if (sceClibStrncmp(path, DATA_PATH, prefix) != 0 || (path[prefix] != '/' && path[prefix] != '\0'))
+		return -1;
+
+	p = path + prefix;
+	while (*p) {
+		while (*p == '/')
+			p++;
+
+		end = p;
+		while (*end && *end != '/')
+			end++;
+
+		seg = end - p;
+		if (seg == 0)
+			break;
+
+		if (seg == 2 && p[0] == '.' && p[1] == '.') {
+			while (len > 0 && out[len - 1] != '/')
+				len--;
+			if (len > 0)
+				len--;
+		} else if (seg != 1 || p[0] != '.') {
+			if (len + 1 + seg >= SCE_IO_MAX_PATH_BUFFER_SIZE)
+				return -1;
+			if (len > 0)
+				out[len++] = '/';
+			sceClibMemcpy(out + len, p, seg);
+			len += seg;
+		}
+
+		p = end;
+	}
+
+	out[len] = '\0';
+
+	return len;
+}
+
+// bytes do_stat writes for path, learnt by calling it twice with buffers
+// filled differently: bytes the call leaves alone keep their fill. buf is
+// FSOV_STAT_MAX bytes and gets the result, returns 0 if the call fails
+uint32_t fsov_probe_stat(int (* do_stat)(const char *path, void *buf), const char *path, uint8_t *buf)
+{
+	static uint8_t other[FSOV_STAT_MAX];
+	uint32_t written = 0;
+
+	sceClibMemset(buf, 0x00, FSOV_STAT_MAX);
+	sceClibMemset(other, 0xFF, sizeof(other));
+	if (do_stat(path, buf) < 0 || do_stat(path, other) < 0)
+		return 0;
+
+	for (uint32_t i = 0; i < FSOV_STAT_MAX; i++) {
+		if (buf[i] == other[i])
+			written = i + 1;
+	}
+
+	return ALIGN_MEM(written, 4);
+}
@@ -1,6 +1,13 @@
 #ifndef __FS_OVERLAY_H__
 #define __FS_OVERLAY_H__
 
+#include <kernel.h>
+
+// upper bound of the compat library's stat structure
+#define FSOV_STAT_MAX	256
+
 int fsov_create();
+int fsov_normalize(const char *path, char *out);
+uint32_t fsov_probe_stat(int (* do_stat)(const char *path, void *buf), const char *path, uint8_t *buf);
 
 #endif
@@ -0,0 +1,1008 @@
+/* gl_capture.c -- GL/EGL command stream capture
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Bound on top of every layer that changes the stream, so it is what
+// libbc2.so issued before any filtering; only GL_COUNTERS, which passes
+// every call on unchanged, wraps it. Recording starts with glcap_start,
+// once the context exists, and goes to CAPTURE_PATH/gl.bin in the format
+// described in gl_capture_format.h. Client arrays are copied at draw time,
+// only the vertices the draw references, and texture uploads are stored in
+// full, so a capture taken from boot replays without the device. GL issued
+// by the loader itself (overlay, swap) is not recorded.
+//
+// eglGetProcAddress hands out the capturing entry point for any call
+// recorded here. Other procs are passed through and only their lookup is
+// recorded, glreplay points them out as missing from the capture.
+//
+// The buffer is written out whenever it fills up and on every stats dump,
+// capturing stops at the first frame boundary past GL_CAPTURE_MAX_SIZE.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "gl_capture.h"
+#include "gl_util.h"
+#include "symtable.h"
+#include "stats.h"
+#include "so_util.h"
+#include "config.h"
+#include "al_error.h"
+
+#define MAX_PROCS		80
+
+typedef struct {
+	uint32_t enabled;
+	uint32_t size;
+	uint32_t type;
+	uint32_t stride;
+	uint32_t buffer;
+	const GLvoid *pointer;
+} ArrayState;
+
+typedef struct {
+	const char *symbol;
+	uintptr_t func;
+} ProcEntry;
+
+static SceUID buf_mbid = SCE_UID_INVALID_UID;
+static uint8_t *buf = NULL;
+static uint32_t buf_pos = 0;
+static SceUID capture_fd = SCE_UID_INVALID_UID;
+static int capturing = 0;
+static volatile int flush_requested = 0;
+
+static ArrayState arrays[GLCAP_ARRAY_COUNT];
+static uint32_t client_active_texture = 0;
+static uint32_t array_buffer = 0;
+static uint32_t element_buffer = 0;
+
+static ProcEntry procs[MAX_PROCS];
+static uint32_t num_procs = 0;
+
+static GlCaptureStats stats;
+
+static void (* next_glAlphaFunc)(GLenum func, int ref);
+static void (* next_glClearDepthf)(int depth);
+static void (* next_glDepthRangef)(int n, int f);
+static void (* next_glFogf)(GLenum pname, int param);
+static void (* next_glTexEnvf)(GLenum target, GLenum pname, int param);
+static void (* next_glActiveTexture)(GLenum texture);
+static void (* next_glBindBuffer)(GLenum target, GLuint buffer);
+static void (* next_glBindFramebufferOES)(GLenum target, GLuint framebuffer);
+static void (* next_glBindTexture)(GLenum target, GLuint texture);
+static void (* next_glBlendFunc)(GLenum sfactor, GLenum dfactor);
+static void (* next_glClear)(GLbitfield mask);
+static void (* next_glClearColor)(int red, int green, int blue, int alpha);
+static void (* next_glClearStencil)(GLint s);
+static void (* next_glClientActiveTexture)(GLenum texture);
+static void (* next_glColorMask)(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+static void (* next_glColorPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glCompressedTexImage2D)(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+static void (* next_glCullFace)(GLenum mode);
+static void (* next_glDeleteBuffers)(GLsizei n, const GLuint *buffers);
+static void (* next_glDeleteTextures)(GLsizei n, const GLuint *textures);
+static void (* next_glDepthFunc)(GLenum func);
+static void (* next_glDepthMask)(GLboolean flag);
+static void (* next_glDisable)(GLenum cap);
+static void (* next_glDisableClientState)(GLenum array);
+static void (* next_glDrawArrays)(GLenum mode, GLint first, GLsizei count);
+static void (* next_glDrawElements)(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+static void (* next_glEnable)(GLenum cap);
+static void (* next_glEnableClientState)(GLenum array);
+static void (* next_glFogfv)(GLenum pname, const GLfloat *params);
+static void (* next_glFrontFace)(GLenum mode);
+static void (* next_glGenTextures)(GLsizei n, GLuint *textures);
+static GLenum (* next_glGetError)(void);
+static void (* next_glGetIntegerv)(GLenum pname, GLint *params);
+static const GLubyte *(* next_glGetString)(GLenum name);
+static void (* next_glLoadIdentity)(void);
+static void (* next_glLoadMatrixf)(const GLfloat *m);
+static void (* next_glMatrixMode)(GLenum mode);
+static void (* next_glNormalPointer)(GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glReadPixels)(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels);
+static void (* next_glScissor)(GLint x, GLint y, GLsizei width, GLsizei height);
+static void (* next_glStencilFunc)(GLenum func, GLint ref, GLuint mask);
+static void (* next_glStencilOp)(GLenum fail, GLenum zfail, GLenum zpass);
+static void (* next_glTexCoordPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glTexEnvfv)(GLenum target, GLenum pname, const GLfloat *params);
+static void (* next_glTexImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+static void (* next_glTexParameteri)(GLenum target, GLenum pname, GLint param);
+static void (* next_glVertexPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glViewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+
+static EGLBoolean (* next_eglInitialize)(EGLDisplay dpy, EGLint *major, EGLint *minor);
+static EGLBoolean (* next_eglSwapBuffers)(EGLDisplay dpy, EGLSurface surface);
+static EGLDisplay (* next_eglGetDisplay)(EGLNativeDisplayType display_id);
+static EGLBoolean (* next_eglChooseConfig)(EGLDisplay dpy, const EGLint *attrib_list, EGLConfig *configs, EGLint config_size, EGLint *num_config);
+static EGLSurface (* next_eglCreateWindowSurface)(EGLDisplay dpy, EGLConfig config, EGLNativeWindowType win, const EGLint *attrib_list);
+static EGLContext (* next_eglCreateContext)(EGLDisplay dpy, EGLConfig config, EGLContext share_context, const EGLint *attrib_list);
+static EGLBoolean (* next_eglMakeCurrent)(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx);
+static EGLBoolean (* next_eglQuerySurface)(EGLDisplay dpy, EGLSurface surface, EGLint attribute, EGLint *value);
+static EGLint (* next_eglGetError)(void);
+static EGLBoolean (* next_eglDestroyContext)(EGLDisplay dpy, EGLContext ctx);
+static EGLBoolean (* next_eglDestroySurface)(EGLDisplay dpy, EGLSurface surface);
+static EGLBoolean (* next_eglTerminate)(EGLDisplay dpy);
+static __eglMustCastToProperFunctionPointerType (* next_eglGetProcAddress)(const char *procname);
+
+static void flush(void)
+{
+	if (buf_pos == 0)
+		return;
+
+	sceIoWrite(capture_fd, buf, buf_pos);
+	stats.bytes += buf_pos;
+	buf_pos = 0;
+}
+
+static void put(const void *data, uint32_t size)
+{
+	if (buf_pos + size > GL_CAPTURE_BUF_SIZE) {
+		flush();
+		if (size > GL_CAPTURE_BUF_SIZE) {
+			sceIoWrite(capture_fd, data, size);
+			stats.bytes += size;
+			return;
+		}
+	}
+
+	sceClibMemcpy(buf + buf_pos, data, size);
+	buf_pos += size;
+}
+
+static inline void put_u32(uint32_t value)
+{
+	put(&value, sizeof(value));
+}
+
+static inline void put_blob(const void *data, uint32_t size)
+{
+	if (data == NULL)
+		size = 0;
+
+	put_u32(size);
+	if (size != 0)
+		put(data, size);
+}
+
+// returns 0 if the call is not being captured
+static inline int put_op(int op)
+{
+	uint8_t code = op;
+
+	if (!capturing)
+		return 0;
+
+	put(&code, sizeof(code));
+	stats.calls[op]++;
+	return 1;
+}
+
+static void set_array(int index, GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (index < 0 || index >= GLCAP_ARRAY_COUNT)
+		return;
+
+	arrays[index].size = size;
+	arrays[index].type = type;
+	arrays[index].stride = stride;
+	arrays[index].buffer = array_buffer;
+	arrays[index].pointer = pointer;
+}
+
+// arrays sourced from a buffer object are recorded with an empty blob
+static void put_vertices(uint32_t first, uint32_t count)
+{
+	uint32_t mask = 0;
+
+	for (int i = 0; i < GLCAP_ARRAY_COUNT; i++) {
+		if (arrays[i].enabled)
+			mask |= (1 << i);
+	}
+
+	put_u32(mask);
+	put_u32(first);
+	put_u32(count);
+
+	for (int i = 0; i < GLCAP_ARRAY_COUNT; i++) {
+		ArrayState *a = &arrays[i];
+		const uint8_t *src;
+		uint32_t elem, stride;
+
+		if (!a->enabled)
+			continue;
+
+		put_u32(a->size);
+		put_u32(a->type);
+
+		if (a->buffer != 0 || a->pointer == NULL) {
+			put_u32(0);
+			continue;
+		}
+
+		elem = a->size * glu_type_size(a->type);
+		stride = a->stride ? a->stride : elem;
+		src = (const uint8_t *)a->pointer + first * stride;
+
+		put_u32(elem * count);
+		if (stride == elem) {
+			put(src, elem * count);
+		} else {
+			for (uint32_t v = 0; v < count; v++)
+				put(src + v * stride, elem);
+		}
+	}
+}
+
+static void index_range(GLsizei count, GLenum type, const GLvoid *indices, uint32_t *first, uint32_t *num)
+{
+	uint32_t lo = 0xFFFFFFFF, hi = 0, idx;
+
+	for (GLsizei i = 0; i < count; i++) {
+		if (type == GL_UNSIGNED_BYTE)
+			idx = ((const uint8_t *)indices)[i];
+		else if (type == GL_UNSIGNED_SHORT)
+			idx = ((const uint16_t *)indices)[i];
+		else
+			idx = ((const uint32_t *)indices)[i];
+
+		if (idx < lo)
+			lo = idx;
+		if (idx > hi)
+			hi = idx;
+	}
+
+	if (count <= 0) {
+		*first = 0;
+		*num = 0;
+	} else {
+		*first = lo;
+		*num = hi - lo + 1;
+	}
+}
+
+static void glAlphaFunc_glcap(GLenum func, int ref)
+{
+	if (put_op(GLCAP_OP_glAlphaFunc)) {
+		put_u32(func);
+		put_u32(ref);
+	}
+	next_glAlphaFunc(func, ref);
+}
+
+static void glClearDepthf_glcap(int depth)
+{
+	if (put_op(GLCAP_OP_glClearDepthf))
+		put_u32(depth);
+	next_glClearDepthf(depth);
+}
+
+static void glDepthRangef_glcap(int n, int f)
+{
+	if (put_op(GLCAP_OP_glDepthRangef)) {
+		put_u32(n);
+		put_u32(f);
+	}
+	next_glDepthRangef(n, f);
+}
+
+static void glFogf_glcap(GLenum pname, int param)
+{
+	if (put_op(GLCAP_OP_glFogf)) {
+		put_u32(pname);
+		put_u32(param);
+	}
+	next_glFogf(pname, param);
+}
+
+static void glTexEnvf_glcap(GLenum target, GLenum pname, int param)
+{
+	if (put_op(GLCAP_OP_glTexEnvf)) {
+		put_u32(target);
+		put_u32(pname);
+		put_u32(param);
+	}
+	next_glTexEnvf(target, pname, param);
+}
+
+static void glActiveTexture_glcap(GLenum texture)
+{
+	if (put_op(GLCAP_OP_glActiveTexture))
+		put_u32(texture);
+	next_glActiveTexture(texture);
+}
+
+static void glBindBuffer_glcap(GLenum target, GLuint buffer)
+{
+	if (target == GL_ARRAY_BUFFER)
+		array_buffer = buffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		element_buffer = buffer;
+
+	if (put_op(GLCAP_OP_glBindBuffer)) {
+		put_u32(target);
+		put_u32(buffer);
+	}
+	next_glBindBuffer(target, buffer);
+}
+
+static void glBindFramebufferOES_glcap(GLenum target, GLuint framebuffer)
+{
+	if (put_op(GLCAP_OP_glBindFramebufferOES)) {
+		put_u32(target);
+		put_u32(framebuffer);
+	}
+	next_glBindFramebufferOES(target, framebuffer);
+}
+
+static void glBindTexture_glcap(GLenum target, GLuint texture)
+{
+	if (put_op(GLCAP_OP_glBindTexture)) {
+		put_u32(target);
+		put_u32(texture);
+	}
+	next_glBindTexture(target, texture);
+}
+
+static void glBlendFunc_glcap(GLenum sfactor, GLenum dfactor)
+{
+	if (put_op(GLCAP_OP_glBlendFunc)) {
+		put_u32(sfactor);
+		put_u32(dfactor);
+	}
+	next_glBlendFunc(sfactor, dfactor);
+}
+
+static void glClear_glcap(GLbitfield mask)
+{
+	if (put_op(GLCAP_OP_glClear))
+		put_u32(mask);
+	next_glClear(mask);
+}
+
+static void glClearColor_glcap(int red, int green, int blue, int alpha)
+{
+	if (put_op(GLCAP_OP_glClearColor)) {
+		put_u32(red);
+		put_u32(green);
+		put_u32(blue);
+		put_u32(alpha);
+	}
+	next_glClearColor(red, green, blue, alpha);
+}
+
+static void glClearStencil_glcap(GLint s)
+{
+	if (put_op(GLCAP_OP_glClearStencil))
+		put_u32(s);
+	next_glClearStencil(s);
+}
+
+static void glClientActiveTexture_glcap(GLenum texture)
+{
+	client_active_texture = texture - GL_TEXTURE0;
+
+	if (put_op(GLCAP_OP_glClientActiveTexture))
+		put_u32(texture);
+	next_glClientActiveTexture(texture);
+}
+
+static void glColorMask_glcap(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	if (put_op(GLCAP_OP_glColorMask)) {
+		put_u32(red);
+		put_u32(green);
+		put_u32(blue);
+		put_u32(alpha);
+	}
+	next_glColorMask(red, green, blue, alpha);
+}
+
+static void glColorPointer_glcap(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(GLCAP_ARRAY_COLOR, size, type, stride, pointer);
+
+	if (put_op(GLCAP_OP_glColorPointer)) {
+		put_u32(size);
+		put_u32(type);
+		put_u32(stride);
+		put_u32((uint32_t)pointer);
+	}
+	next_glColorPointer(size, type, stride, pointer);
+}
+
+static void glCompressedTexImage2D_glcap(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	if (put_op(GLCAP_OP_glCompressedTexImage2D)) {
+		put_u32(target);
+		put_u32(level);
+		put_u32(internalformat);
+		put_u32(width);
+		put_u32(height);
+		put_u32(border);
+		put_u32(imageSize);
+		put_blob(data, imageSize);
+	}
+	next_glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+static void glCullFace_glcap(GLenum mode)
+{
+	if (put_op(GLCAP_OP_glCullFace))
+		put_u32(mode);
+	next_glCullFace(mode);
+}
+
+static void glDeleteBuffers_glcap(GLsizei n, const GLuint *buffers)
+{
+	if (put_op(GLCAP_OP_glDeleteBuffers)) {
+		put_u32(n);
+		put_blob(buffers, n * sizeof(GLuint));
+	}
+	next_glDeleteBuffers(n, buffers);
+}
+
+static void glDeleteTextures_glcap(GLsizei n, const GLuint *textures)
+{
+	if (put_op(GLCAP_OP_glDeleteTextures)) {
+		put_u32(n);
+		put_blob(textures, n * sizeof(GLuint));
+	}
+	next_glDeleteTextures(n, textures);
+}
+
+static void glDepthFunc_glcap(GLenum func)
+{
+	if (put_op(GLCAP_OP_glDepthFunc))
+		put_u32(func);
+	next_glDepthFunc(func);
+}
+
+static void glDepthMask_glcap(GLboolean flag)
+{
+	if (put_op(GLCAP_OP_glDepthMask))
+		put_u32(flag);
+	next_glDepthMask(flag);
+}
+
+static void glDisable_glcap(GLenum cap)
+{
+	if (put_op(GLCAP_OP_glDisable))
+		put_u32(cap);
+	next_glDisable(cap);
+}
+
+static void glDisableClientState_glcap(GLenum array)
+{
+	int index = glu_array_index(array, client_active_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = 0;
+
+	if (put_op(GLCAP_OP_glDisableClientState))
+		put_u32(array);
+	next_glDisableClientState(array);
+}
+
+static void glDrawArrays_glcap(GLenum mode, GLint first, GLsizei count)
+{
+	if (put_op(GLCAP_OP_glDrawArrays)) {
+		put_u32(mode);
+		put_u32(first);
+		put_u32(count);
+		put_vertices(first, count > 0 ? count : 0);
+	}
+	next_glDrawArrays(mode, first, count);
+}
+
+static void glDrawElements_glcap(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+	uint32_t first, num;
+
+	if (put_op(GLCAP_OP_glDrawElements)) {
+		put_u32(mode);
+		put_u32(count);
+		put_u32(type);
+		put_u32((uint32_t)indices);
+
+		if (element_buffer != 0 || indices == NULL) {
+			put_u32(0);
+			put_vertices(0, 0);
+		} else {
+			put_blob(indices, count * glu_type_size(type));
+			index_range(count, type, indices, &first, &num);
+			put_vertices(first, num);
+		}
+	}
+	next_glDrawElements(mode, count, type, indices);
+}
+
+static void glEnable_glcap(GLenum cap)
+{
+	if (put_op(GLCAP_OP_glEnable))
+		put_u32(cap);
+	next_glEnable(cap);
+}
+
+static void glEnableClientState_glcap(GLenum array)
+{
+	int index = glu_array_index(array, client_active_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = 1;
+
+	if (put_op(GLCAP_OP_glEnableClientState))
+		put_u32(array);
+	next_glEnableClientState(array);
+}
+
+static void glFogfv_glcap(GLenum pname, const GLfloat *params)
+{
+	if (put_op(GLCAP_OP_glFogfv)) {
+		put_u32(pname);
+		put_blob(params, (pname == GL_FOG_COLOR ? 4 : 1) * sizeof(GLfloat));
+	}
+	next_glFogfv(pname, params);
+}
+
+static void glFrontFace_glcap(GLenum mode)
+{
+	if (put_op(GLCAP_OP_glFrontFace))
+		put_u32(mode);
+	next_glFrontFace(mode);
+}
+
+static void glGenTextures_glcap(GLsizei n, GLuint *textures)
+{
+	next_glGenTextures(n, textures);
+
+	if (put_op(GLCAP_OP_glGenTextures)) {
+		put_u32(n);
+		put_blob(textures, n * sizeof(GLuint));
+	}
+}
+
+static GLenum glGetError_glcap(void)
+{
+	put_op(GLCAP_OP_glGetError);
+	return next_glGetError();
+}
+
+static void glGetIntegerv_glcap(GLenum pname, GLint *params)
+{
+	if (put_op(GLCAP_OP_glGetIntegerv))
+		put_u32(pname);
+	next_glGetIntegerv(pname, params);
+}
+
+static const GLubyte *glGetString_glcap(GLenum name)
+{
+	if (put_op(GLCAP_OP_glGetString))
+		put_u32(name);
+	return next_glGetString(name);
+}
+
+static void glLoadIdentity_glcap(void)
+{
+	put_op(GLCAP_OP_glLoadIdentity);
+	next_glLoadIdentity();
+}
+
+static void glLoadMatrixf_glcap(const GLfloat *m)
+{
+	if (put_op(GLCAP_OP_glLoadMatrixf))
+		put_blob(m, 16 * sizeof(GLfloat));
+	next_glLoadMatrixf(m);
+}
+
+static void glMatrixMode_glcap(GLenum mode)
+{
+	if (put_op(GLCAP_OP_glMatrixMode))
+		put_u32(mode);
+	next_glMatrixMode(mode);
+}
+
+static void glNormalPointer_glcap(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(GLCAP_ARRAY_NORMAL, 3, type, stride, pointer);
+
+	if (put_op(GLCAP_OP_glNormalPointer)) {
+		put_u32(type);
+		put_u32(stride);
+		put_u32((uint32_t)pointer);
+	}
+	next_glNormalPointer(type, stride, pointer);
+}
+
+static void glReadPixels_glcap(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels)
+{
+	if (put_op(GLCAP_OP_glReadPixels)) {
+		put_u32(x);
+		put_u32(y);
+		put_u32(width);
+		put_u32(height);
+		put_u32(format);
+		put_u32(type);
+	}
+	next_glReadPixels(x, y, width, height, format, type, pixels);
+}
+
+static void glScissor_glcap(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (put_op(GLCAP_OP_glScissor)) {
+		put_u32(x);
+		put_u32(y);
+		put_u32(width);
+		put_u32(height);
+	}
+	next_glScissor(x, y, width, height);
+}
+
+static void glStencilFunc_glcap(GLenum func, GLint ref, GLuint mask)
+{
+	if (put_op(GLCAP_OP_glStencilFunc)) {
+		put_u32(func);
+		put_u32(ref);
+		put_u32(mask);
+	}
+	next_glStencilFunc(func, ref, mask);
+}
+
+static void glStencilOp_glcap(GLenum fail, GLenum zfail, GLenum zpass)
+{
+	if (put_op(GLCAP_OP_glStencilOp)) {
+		put_u32(fail);
+		put_u32(zfail);
+		put_u32(zpass);
+	}
+	next_glStencilOp(fail, zfail, zpass);
+}
+
+static void glTexCoordPointer_glcap(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (client_active_texture < GLU_MAX_TEX_UNITS)
+		set_array(GLCAP_ARRAY_TEX_COORD + client_active_texture, size, type, stride, pointer);
+
+	if (put_op(GLCAP_OP_glTexCoordPointer)) {
+		put_u32(size);
+		put_u32(type);
+		put_u32(stride);
+		put_u32((uint32_t)pointer);
+	}
+	next_glTexCoordPointer(size, type, stride, pointer);
+}
+
+static void glTexEnvfv_glcap(GLenum target, GLenum pname, const GLfloat *params)
+{
+	if (put_op(GLCAP_OP_glTexEnvfv)) {
+		put_u32(target);
+		put_u32(pname);
+		put_blob(params, (pname == GL_TEXTURE_ENV_COLOR ? 4 : 1) * sizeof(GLfloat));
+	}
+	next_glTexEnvfv(target, pname, params);
+}
+
+static void glTexImage2D_glcap(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels)
+{
+	if (put_op(GLCAP_OP_glTexImage2D)) {
+		put_u32(target);
+		put_u32(level);
+		put_u32(internalformat);
+		put_u32(width);
+		put_u32(height);
+		put_u32(border);
+		put_u32(format);
+		put_u32(type);
+		put_blob(pixels, glu_image_size(width, height, format, type));
+	}
+	next_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+static void glTexParameteri_glcap(GLenum target, GLenum pname, GLint param)
+{
+	if (put_op(GLCAP_OP_glTexParameteri)) {
+		put_u32(target);
+		put_u32(pname);
+		put_u32(param);
+	}
+	next_glTexParameteri(target, pname, param);
+}
+
+static void glVertexPointer_glcap(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(GLCAP_ARRAY_VERTEX, size, type, stride, pointer);
+
+	if (put_op(GLCAP_OP_glVertexPointer)) {
+		put_u32(size);
+		put_u32(type);
+		put_u32(stride);
+		put_u32((uint32_t)pointer);
+	}
+	next_glVertexPointer(size, type, stride, pointer);
+}
+
+static void glViewport_glcap(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (put_op(GLCAP_OP_glViewport)) {
+		put_u32(x);
+		put_u32(y);
+		put_u32(width);
+		put_u32(height);
+	}
+	next_glViewport(x, y, width, height);
+}
+
+static EGLBoolean eglInitialize_glcap(EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+	if (put_op(GLCAP_OP_eglInitialize))
+		put_u32((uint32_t)dpy);
+	return next_eglInitialize(dpy, major, minor);
+}
+
+static EGLBoolean eglSwapBuffers_glcap(EGLDisplay dpy, EGLSurface surface)
+{
+	if (put_op(GLCAP_OP_eglSwapBuffers)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)surface);
+	}
+	return next_eglSwapBuffers(dpy, surface);
+}
+
+static EGLDisplay eglGetDisplay_glcap(EGLNativeDisplayType display_id)
+{
+	if (put_op(GLCAP_OP_eglGetDisplay))
+		put_u32((uint32_t)display_id);
+	return next_eglGetDisplay(display_id);
+}
+
+static EGLBoolean eglChooseConfig_glcap(EGLDisplay dpy, const EGLint *attrib_list, EGLConfig *configs, EGLint config_size, EGLint *num_config)
+{
+	if (put_op(GLCAP_OP_eglChooseConfig)) {
+		put_u32((uint32_t)dpy);
+		put_u32(config_size);
+	}
+	return next_eglChooseConfig(dpy, attrib_list, configs, config_size, num_config);
+}
+
+static EGLSurface eglCreateWindowSurface_glcap(EGLDisplay dpy, EGLConfig config, EGLNativeWindowType win, const EGLint *attrib_list)
+{
+	if (put_op(GLCAP_OP_eglCreateWindowSurface)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)config);
+		put_u32((uint32_t)win);
+	}
+	return next_eglCreateWindowSurface(dpy, config, win, attrib_list);
+}
+
+static EGLContext eglCreateContext_glcap(EGLDisplay dpy, EGLConfig config, EGLContext share_context, const EGLint *attrib_list)
+{
+	if (put_op(GLCAP_OP_eglCreateContext)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)config);
+		put_u32((uint32_t)share_context);
+	}
+	return next_eglCreateContext(dpy, config, share_context, attrib_list);
+}
+
+static EGLBoolean eglMakeCurrent_glcap(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx)
+{
+	if (put_op(GLCAP_OP_eglMakeCurrent)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)draw);
+		put_u32((uint32_t)read);
+		put_u32((uint32_t)ctx);
+	}
+	return next_eglMakeCurrent(dpy, draw, read, ctx);
+}
+
+static EGLBoolean eglQuerySurface_glcap(EGLDisplay dpy, EGLSurface surface, EGLint attribute, EGLint *value)
+{
+	if (put_op(GLCAP_OP_eglQuerySurface)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)surface);
+		put_u32(attribute);
+	}
+	return next_eglQuerySurface(dpy, surface, attribute, value);
+}
+
+static EGLint eglGetError_glcap(void)
+{
+	put_op(GLCAP_OP_eglGetError);
+	return next_eglGetError();
+}
+
+static EGLBoolean eglDestroyContext_glcap(EGLDisplay dpy, EGLContext ctx)
+{
+	if (put_op(GLCAP_OP_eglDestroyContext)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)ctx);
+	}
+	return next_eglDestroyContext(dpy, ctx);
+}
+
+static EGLBoolean eglDestroySurface_glcap(EGLDisplay dpy, EGLSurface surface)
+{
+	if (put_op(GLCAP_OP_eglDestroySurface)) {
+		put_u32((uint32_t)dpy);
+		put_u32((uint32_t)surface);
+	}
+	return next_eglDestroySurface(dpy, surface);
+}
+
+static EGLBoolean eglTerminate_glcap(EGLDisplay dpy)
+{
+	if (put_op(GLCAP_OP_eglTerminate))
+		put_u32((uint32_t)dpy);
+	return next_eglTerminate(dpy);
+}
+
+static __eglMustCastToProperFunctionPointerType eglGetProcAddress_glcap(const char *procname)
+{
+	if (put_op(GLCAP_OP_eglGetProcAddress))
+		put_blob(procname, procname ? sceClibStrnlen(procname, 256) : 0);
+
+	if (procname != NULL) {
+		for (uint32_t i = 0; i < num_procs; i++) {
+			if (sceClibStrcmp(procs[i].symbol, procname) == 0)
+				return (__eglMustCastToProperFunctionPointerType)procs[i].func;
+		}
+	}
+
+	stats.rawProcs++;
+	return next_eglGetProcAddress(procname);
+}
+
+#define GLCAP_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_glcap, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret; \
+	if (num_procs < MAX_PROCS) { \
+		procs[num_procs].symbol = #name; \
+		procs[num_procs++].func = (uintptr_t)&name##_glcap; \
+	}
+
+int glcap_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	GLCAP_HOOK(glAlphaFunc);
+	GLCAP_HOOK(glClearDepthf);
+	GLCAP_HOOK(glDepthRangef);
+	GLCAP_HOOK(glFogf);
+	GLCAP_HOOK(glTexEnvf);
+	GLCAP_HOOK(glActiveTexture);
+	GLCAP_HOOK(glBindBuffer);
+	GLCAP_HOOK(glBindFramebufferOES);
+	GLCAP_HOOK(glBindTexture);
+	GLCAP_HOOK(glBlendFunc);
+	GLCAP_HOOK(glClear);
+	GLCAP_HOOK(glClearColor);
+	GLCAP_HOOK(glClearStencil);
+	GLCAP_HOOK(glClientActiveTexture);
+	GLCAP_HOOK(glColorMask);
+	GLCAP_HOOK(glColorPointer);
+	GLCAP_HOOK(glCompressedTexImage2D);
+	GLCAP_HOOK(glCullFace);
+	GLCAP_HOOK(glDeleteBuffers);
+	GLCAP_HOOK(glDeleteTextures);
+	GLCAP_HOOK(glDepthFunc);
+	GLCAP_HOOK(glDepthMask);
+	GLCAP_HOOK(glDisable);
+	GLCAP_HOOK(glDisableClientState);
+	GLCAP_HOOK(glDrawArrays);
+	GLCAP_HOOK(glDrawElements);
+	GLCAP_HOOK(glEnable);
+	GLCAP_HOOK(glEnableClientState);
+	GLCAP_HOOK(glFogfv);
+	GLCAP_HOOK(glFrontFace);
+	GLCAP_HOOK(glGenTextures);
+	GLCAP_HOOK(glGetError);
+	GLCAP_HOOK(glGetIntegerv);
+	GLCAP_HOOK(glGetString);
+	GLCAP_HOOK(glLoadIdentity);
+	GLCAP_HOOK(glLoadMatrixf);
+	GLCAP_HOOK(glMatrixMode);
+	GLCAP_HOOK(glNormalPointer);
+	GLCAP_HOOK(glReadPixels);
+	GLCAP_HOOK(glScissor);
+	GLCAP_HOOK(glStencilFunc);
+	GLCAP_HOOK(glStencilOp);
+	GLCAP_HOOK(glTexCoordPointer);
+	GLCAP_HOOK(glTexEnvfv);
+	GLCAP_HOOK(glTexImage2D);
+	GLCAP_HOOK(glTexParameteri);
+	GLCAP_HOOK(glVertexPointer);
+	GLCAP_HOOK(glViewport);
+
+	GLCAP_HOOK(eglInitialize);
+	GLCAP_HOOK(eglSwapBuffers);
+	GLCAP_HOOK(eglGetDisplay);
+	GLCAP_HOOK(eglChooseConfig);
+	GLCAP_HOOK(eglCreateWindowSurface);
+	GLCAP_HOOK(eglCreateContext);
+	GLCAP_HOOK(eglMakeCurrent);
+	GLCAP_HOOK(eglQuerySurface);
+	GLCAP_HOOK(eglGetError);
+	GLCAP_HOOK(eglDestroyContext);
+	GLCAP_HOOK(eglDestroySurface);
+	GLCAP_HOOK(eglTerminate);
+	GLCAP_HOOK(eglGetProcAddress);
+
+	sceClibMemset(&stats, 0, sizeof(GlCaptureStats));
+	sceClibMemset(arrays, 0, sizeof(arrays));
+
+	return AL_OK;
+}
+
+int glcap_start(uint32_t width, uint32_t height)
+{
+	GlCaptureHeader hdr;
+
+	buf_mbid = sceKernelAllocMemBlock("AL::GlCapture::Buffer", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(GL_CAPTURE_BUF_SIZE, SCE_KERNEL_4KiB), NULL);
+	if (buf_mbid < 0)
+		return buf_mbid;
+
+	sceKernelGetMemBlockBase(buf_mbid, (void **)&buf);
+
+	sceIoMkdir(CAPTURE_PATH, 0777);
+
+	capture_fd = sceIoOpen(CAPTURE_PATH "/" "gl.bin", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (capture_fd < 0)
+		return capture_fd;
+
+	hdr.magic = GLCAP_MAGIC;
+	hdr.version = GLCAP_VERSION;
+	hdr.width = width;
+	hdr.height = height;
+
+	buf_pos = 0;
+	put(&hdr, sizeof(hdr));
+	capturing = 1;
+
+	return stats_register_dump(glcap_dump);
+}
+
+void glcap_end_frame(void)
+{
+	if (!put_op(GLCAP_OP_FRAME))
+		return;
+
+	stats.frames++;
+
+	if (flush_requested) {
+		flush();
+		flush_requested = 0;
+	}
+
+	if (stats.bytes + buf_pos >= GL_CAPTURE_MAX_SIZE) {
+		flush();
+		sceIoClose(capture_fd);
+		capture_fd = SCE_UID_INVALID_UID;
+		capturing = 0;
+	}
+}
+
+const GlCaptureStats *glcap_get_stats(void)
+{
+	return &stats;
+}
+
+// called from the input thread, the main thread writes the buffer out at
+// the end of the frame so the file always ends on a whole record
+void glcap_dump(void)
+{
+	flush_requested = 1;
+}
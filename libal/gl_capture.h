@@ -0,0 +1,22 @@
+#ifndef __GL_CAPTURE_H__
+#define __GL_CAPTURE_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "gl_capture_format.h"
+
+typedef struct {
+	uint32_t frames;
+	uint64_t bytes;
+	uint32_t rawProcs;
+	uint32_t calls[GLCAP_OP_COUNT];
+} GlCaptureStats;
+
+int glcap_bind(Symtable *table);
+int glcap_start(uint32_t width, uint32_t height);
+void glcap_end_frame(void);
+const GlCaptureStats *glcap_get_stats(void);
+void glcap_dump(void);
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef __GL_CAPTURE_FORMAT_H__
+#define __GL_CAPTURE_FORMAT_H__
+
+//
+// Shared between libal and tools/glreplay.c, keep it free of SDK headers.
+//
+// A capture is a GlCaptureHeader followed by records. A record is a one byte
+// opcode, the number of 32-bit arguments listed below (floats as bit
+// patterns, pointers as raw values) and, for some opcodes, blobs. A blob is
+// a 32-bit byte count followed by the bytes. All values are little endian.
+//
+// Blobs per opcode:
+//   glCompressedTexImage2D, glTexImage2D	pixel data
+//   glDeleteTextures, glDeleteBuffers		names
+//   glGenTextures							names returned by the driver
+//   glFogfv, glTexEnvfv, glLoadMatrixf		parameters
+//   eglGetProcAddress						procedure name, calls through procs
+//   										without an opcode are not recorded
+//   glDrawElements							indices, then a vertex block
+//   glDrawArrays							vertex block
+//
+// A vertex block is an array mask, first vertex and vertex count, then for
+// every set bit of the mask (lowest first) size, type and a blob with the
+// tightly packed elements of the vertices used by the draw.
+//
+
+#include <stdint.h>
+
+#define GLCAP_MAGIC		0x50434C47 // 'GLCP'
+#define GLCAP_VERSION	1
+
+// the same order as GLU_ARRAY_* in gl_util.h
+enum {
+	GLCAP_ARRAY_VERTEX = 0,
+	GLCAP_ARRAY_COLOR,
+	GLCAP_ARRAY_NORMAL,
+	GLCAP_ARRAY_TEX_COORD,	// one per texture unit, must stay last
+
+	GLCAP_ARRAY_COUNT = GLCAP_ARRAY_TEX_COORD + 4
+};
+
+#define GLCAP_OPS(X) \
+	X(FRAME,					0) \
+	X(glAlphaFunc,				2) \
+	X(glClearDepthf,			1) \
+	X(glDepthRangef,			2) \
+	X(glFogf,					2) \
+	X(glTexEnvf,				3) \
+	X(glActiveTexture,			1) \
+	X(glBindBuffer,				2) \
+	X(glBindFramebufferOES,		2) \
+	X(glBindTexture,			2) \
+	X(glBlendFunc,				2) \
+	X(glClear,					1) \
+	X(glClearColor,				4) \
+	X(glClearStencil,			1) \
+	X(glClientActiveTexture,	1) \
+	X(glColorMask,				4) \
+	X(glColorPointer,			4) \
+	X(glCompressedTexImage2D,	7) \
+	X(glCullFace,				1) \
+	X(glDeleteBuffers,			1) \
+	X(glDeleteTextures,			1) \
+	X(glDepthFunc,				1) \
+	X(glDepthMask,				1) \
+	X(glDisable,				1) \
+	X(glDisableClientState,		1) \
+	X(glDrawArrays,				3) \
+	X(glDrawElements,			4) \
+	X(glEnable,					1) \
+	X(glEnableClientState,		1) \
+	X(glFogfv,					1) \
+	X(glFrontFace,				1) \
+	X(glGenTextures,			1) \
+	X(glGetError,				0) \
+	X(glGetIntegerv,			1) \
+	X(glGetString,				1) \
+	X(glLoadIdentity,			0) \
+	X(glLoadMatrixf,			0) \
+	X(glMatrixMode,				1) \
+	X(glNormalPointer,			3) \
+	X(glReadPixels,				6) \
+	X(glScissor,				4) \
+	X(glStencilFunc,			3) \
+	X(glStencilOp,				3) \
+	X(glTexCoordPointer,		4) \
+	X(glTexEnvfv,				2) \
+	X(glTexImage2D,				8) \
+	X(glTexParameteri,			3) \
+	X(glVertexPointer,			4) \
+	X(glViewport,				4) \
+	X(eglInitialize,			1) \
+	X(eglSwapBuffers,			2) \
+	X(eglGetDisplay,			1) \
+	X(eglChooseConfig,			2) \
+	X(eglCreateWindowSurface,	3) \
+	X(eglCreateContext,			3) \
+	X(eglMakeCurrent,			4) \
+	X(eglQuerySurface,			3) \
+	X(eglGetError,				0) \
+	X(eglDestroyContext,		2) \
+	X(eglDestroySurface,		2) \
+	X(eglTerminate,				1) \
+	X(eglGetProcAddress,		0)
+
+#define GLCAP_OP_ENUM(name, args) GLCAP_OP_##name,
+
+enum {
+	GLCAP_OPS(GLCAP_OP_ENUM)
+
+	GLCAP_OP_COUNT
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+} GlCaptureHeader;
+
+#endif
@@ -0,0 +1,391 @@
+/* gl_counters.c -- per-frame draw call and state change counters
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Bound outermost, so it counts what libbc2.so asks for before any of the
+// other GL layers filter, cache or defer it. Client array bytes are the
+// vertex data the driver has to copy for each draw, the vertex range a
+// glDrawElements reads plus its indices. Upload bytes are the texture data
+// as the game passes it in.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "gl_counters.h"
+#include "gl_util.h"
+#include "overlay.h"
+#include "symtable.h"
+#include "stats.h"
+#include "al_error.h"
+
+typedef struct {
+	GLboolean enabled;
+	GLuint buffer;
+	uint32_t elemSize;
+} ArrayState;
+
+static const char *counter_names[GLCT_COUNT] = {
+	"draws",
+	"triangles",
+	"texture_binds",
+	"blend_changes",
+	"depth_changes",
+	"matrix_loads",
+	"array_bytes",
+	"upload_bytes",
+};
+
+static GlCounterStats stats;
+static GlFrameCounters current;
+static GlFrameCounters ring[GLCT_RING_SIZE];
+
+static ArrayState arrays[GLU_ARRAY_COUNT];
+static uint32_t client_active_texture = 0;
+static GLuint array_buffer = 0;
+static GLuint element_buffer = 0;
+
+static void (* next_glBindBuffer)(GLenum target, GLuint buffer);
+static void (* next_glClientActiveTexture)(GLenum texture);
+static void (* next_glEnableClientState)(GLenum array);
+static void (* next_glDisableClientState)(GLenum array);
+static void (* next_glVertexPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glColorPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glNormalPointer)(GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glTexCoordPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glDrawArrays)(GLenum mode, GLint first, GLsizei count);
+static void (* next_glDrawElements)(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+static void (* next_glBindTexture)(GLenum target, GLuint texture);
+static void (* next_glEnable)(GLenum cap);
+static void (* next_glDisable)(GLenum cap);
+static void (* next_glBlendFunc)(GLenum sfactor, GLenum dfactor);
+static void (* next_glDepthFunc)(GLenum func);
+static void (* next_glDepthMask)(GLboolean flag);
+static void (* next_glLoadMatrixf)(const GLfloat *m);
+static void (* next_glTexImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+static void (* next_glCompressedTexImage2D)(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+
+static void set_array(int index, GLint size, GLenum type)
+{
+	if (index < 0)
+		return;
+
+	arrays[index].buffer = array_buffer;
+	arrays[index].elemSize = size * glu_type_size(type);
+}
+
+static uint32_t triangles(GLenum mode, GLsizei count)
+{
+	switch (mode) {
+	case GL_TRIANGLES:
+		return count / 3;
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN:
+		return count > 2 ? count - 2 : 0;
+	default:
+		return 0;
+	}
+}
+
+static void count_draw(GLenum mode, GLsizei count, uint32_t vertices)
+{
+	current.value[GLCT_DRAWS]++;
+	current.value[GLCT_TRIANGLES] += triangles(mode, count);
+
+	for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+		if (arrays[i].enabled && arrays[i].buffer == 0)
+			current.value[GLCT_ARRAY_BYTES] += arrays[i].elemSize * vertices;
+	}
+}
+
+static void glBindBuffer_glct(GLenum target, GLuint buffer)
+{
+	if (target == GL_ARRAY_BUFFER)
+		array_buffer = buffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		element_buffer = buffer;
+
+	next_glBindBuffer(target, buffer);
+}
+
+static void glClientActiveTexture_glct(GLenum texture)
+{
+	client_active_texture = texture - GL_TEXTURE0;
+	next_glClientActiveTexture(texture);
+}
+
+static void glEnableClientState_glct(GLenum array)
+{
+	int index = glu_array_index(array, client_active_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = GL_TRUE;
+
+	next_glEnableClientState(array);
+}
+
+static void glDisableClientState_glct(GLenum array)
+{
+	int index = glu_array_index(array, client_active_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = GL_FALSE;
+
+	next_glDisableClientState(array);
+}
+
+static void glVertexPointer_glct(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(GLU_ARRAY_VERTEX, size, type);
+	next_glVertexPointer(size, type, stride, pointer);
+}
+
+static void glColorPointer_glct(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(GLU_ARRAY_COLOR, size, type);
+	next_glColorPointer(size, type, stride, pointer);
+}
+
+static void glNormalPointer_glct(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(GLU_ARRAY_NORMAL, 3, type);
+	next_glNormalPointer(type, stride, pointer);
+}
+
+static void glTexCoordPointer_glct(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(glu_array_index(GL_TEXTURE_COORD_ARRAY, client_active_texture), size, type);
+	next_glTexCoordPointer(size, type, stride, pointer);
+}
+
+static void glDrawArrays_glct(GLenum mode, GLint first, GLsizei count)
+{
+	count_draw(mode, count, count);
+	next_glDrawArrays(mode, first, count);
+}
+
+static void glDrawElements_glct(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+	uint32_t lo = 0xFFFFFFFF, hi = 0, idx;
+
+	if (element_buffer == 0 && count > 0) {
+		for (GLsizei i = 0; i < count; i++) {
+			if (type == GL_UNSIGNED_BYTE)
+				idx = ((const uint8_t *)indices)[i];
+			else if (type == GL_UNSIGNED_SHORT)
+				idx = ((const uint16_t *)indices)[i];
+			else
+				idx = ((const uint32_t *)indices)[i];
+
+			if (idx < lo)
+				lo = idx;
+			if (idx > hi)
+				hi = idx;
+		}
+
+		count_draw(mode, count, hi - lo + 1);
+		current.value[GLCT_ARRAY_BYTES] += count * glu_type_size(type);
+	} else {
+		count_draw(mode, count, 0);
+	}
+
+	next_glDrawElements(mode, count, type, indices);
+}
+
+static void glBindTexture_glct(GLenum target, GLuint texture)
+{
+	current.value[GLCT_TEXTURE_BINDS]++;
+	next_glBindTexture(target, texture);
+}
+
+static void glEnable_glct(GLenum cap)
+{
+	if (cap == GL_BLEND)
+		current.value[GLCT_BLEND_CHANGES]++;
+	else if (cap == GL_DEPTH_TEST)
+		current.value[GLCT_DEPTH_CHANGES]++;
+
+	next_glEnable(cap);
+}
+
+static void glDisable_glct(GLenum cap)
+{
+	if (cap == GL_BLEND)
+		current.value[GLCT_BLEND_CHANGES]++;
+	else if (cap == GL_DEPTH_TEST)
+		current.value[GLCT_DEPTH_CHANGES]++;
+
+	next_glDisable(cap);
+}
+
+static void glBlendFunc_glct(GLenum sfactor, GLenum dfactor)
+{
+	current.value[GLCT_BLEND_CHANGES]++;
+	next_glBlendFunc(sfactor, dfactor);
+}
+
+static void glDepthFunc_glct(GLenum func)
+{
+	current.value[GLCT_DEPTH_CHANGES]++;
+	next_glDepthFunc(func);
+}
+
+static void glDepthMask_glct(GLboolean flag)
+{
+	current.value[GLCT_DEPTH_CHANGES]++;
+	next_glDepthMask(flag);
+}
+
+static void glLoadMatrixf_glct(const GLfloat *m)
+{
+	current.value[GLCT_MATRIX_LOADS]++;
+	next_glLoadMatrixf(m);
+}
+
+static void glTexImage2D_glct(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels)
+{
+	if (pixels != NULL)
+		current.value[GLCT_UPLOAD_BYTES] += width * height * glu_pixel_size(format, type);
+
+	next_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+static void glCompressedTexImage2D_glct(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	current.value[GLCT_UPLOAD_BYTES] += imageSize;
+	next_glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+#define GLCT_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_glct, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int glct_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	GLCT_HOOK(glBindBuffer);
+	GLCT_HOOK(glClientActiveTexture);
+	GLCT_HOOK(glEnableClientState);
+	GLCT_HOOK(glDisableClientState);
+	GLCT_HOOK(glVertexPointer);
+	GLCT_HOOK(glColorPointer);
+	GLCT_HOOK(glNormalPointer);
+	GLCT_HOOK(glTexCoordPointer);
+	GLCT_HOOK(glDrawArrays);
+	GLCT_HOOK(glDrawElements);
+	GLCT_HOOK(glBindTexture);
+	GLCT_HOOK(glEnable);
+	GLCT_HOOK(glDisable);
+	GLCT_HOOK(glBlendFunc);
+	GLCT_HOOK(glDepthFunc);
+	GLCT_HOOK(glDepthMask);
+	GLCT_HOOK(glLoadMatrixf);
+	GLCT_HOOK(glTexImage2D);
+	GLCT_HOOK(glCompressedTexImage2D);
+
+	sceClibMemset(&stats, 0, sizeof(GlCounterStats));
+	sceClibMemset(&current, 0, sizeof(GlFrameCounters));
+	for (int i = 0; i < GLCT_COUNT; i++)
+		stats_hist_reset(&stats.perFrame[i]);
+
+	return stats_register_dump(glct_dump);
+}
+
+void glct_end_frame(void)
+{
+	for (int i = 0; i < GLCT_COUNT; i++) {
+		stats.total[i] += current.value[i];
+		stats_hist_add(&stats.perFrame[i], current.value[i]);
+	}
+
+	ring[stats.frames % GLCT_RING_SIZE] = current;
+	stats.frames++;
+
+	sceClibMemset(&current, 0, sizeof(GlFrameCounters));
+}
+
+const GlCounterStats *glct_get_stats(void)
+{
+	return &stats;
+}
+
+const GlFrameCounters *glct_last(void)
+{
+	if (stats.frames == 0)
+		return &current;
+
+	return &ring[(stats.frames - 1) % GLCT_RING_SIZE];
+}
+
+void glct_draw_overlay(void)
+{
+	const GlFrameCounters *last = glct_last();
+	uint32_t color = OVL_RGBA(255, 255, 255, 255);
+	int x = 8, y = 230;
+
+	ovl_printf(x, y, 2, color, "DRAWS %u TRIS %u TEX %u MTX %u",
+		last->value[GLCT_DRAWS],
+		last->value[GLCT_TRIANGLES],
+		last->value[GLCT_TEXTURE_BINDS],
+		last->value[GLCT_MATRIX_LOADS]);
+	y += 14;
+	ovl_printf(x, y, 2, color, "BLEND %u DEPTH %u ARRAYS %uKB UPLOAD %uKB",
+		last->value[GLCT_BLEND_CHANGES],
+		last->value[GLCT_DEPTH_CHANGES],
+		last->value[GLCT_ARRAY_BYTES] / 1024,
+		last->value[GLCT_UPLOAD_BYTES] / 1024);
+}
+
+void glct_dump(void)
+{
+	uint32_t count, first;
+	SceUID fd;
+
+	fd = stats_file_open("gl_counters.csv");
+	if (fd >= 0) {
+		stats_file_printf(fd, "frames,%u\n", stats.frames);
+
+		stats_file_printf(fd, "counter,total\n");
+		for (int i = 0; i < GLCT_COUNT; i++)
+			stats_file_printf(fd, "%s,%llu\n", counter_names[i], stats.total[i]);
+
+		stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+		for (int i = 0; i < GLCT_COUNT; i++)
+			stats_file_write_hist(fd, counter_names[i], &stats.perFrame[i]);
+
+		stats_file_close(fd);
+	}
+
+	fd = stats_file_open("gl_frames.csv");
+	if (fd >= 0) {
+		count = stats.frames < GLCT_RING_SIZE ? stats.frames : GLCT_RING_SIZE;
+		first = stats.frames - count;
+
+		stats_file_printf(fd, "frame");
+		for (int i = 0; i < GLCT_COUNT; i++)
+			stats_file_printf(fd, ",%s", counter_names[i]);
+		stats_file_printf(fd, "\n");
+
+		for (uint32_t f = 0; f < count; f++) {
+			const GlFrameCounters *rec = &ring[(first + f) % GLCT_RING_SIZE];
+			stats_file_printf(fd, "%u", first + f);
+			for (int i = 0; i < GLCT_COUNT; i++)
+				stats_file_printf(fd, ",%u", rec->value[i]);
+			stats_file_printf(fd, "\n");
+		}
+
+		stats_file_close(fd);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef __GL_COUNTERS_H__
+#define __GL_COUNTERS_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+// frames kept for the csv export
+#define GLCT_RING_SIZE		1024
+
+enum {
+	GLCT_DRAWS = 0,
+	GLCT_TRIANGLES,
+	GLCT_TEXTURE_BINDS,
+	GLCT_BLEND_CHANGES,
+	GLCT_DEPTH_CHANGES,
+	GLCT_MATRIX_LOADS,
+	GLCT_ARRAY_BYTES,
+	GLCT_UPLOAD_BYTES,
+
+	GLCT_COUNT
+};
+
+typedef struct {
+	uint32_t value[GLCT_COUNT];
+} GlFrameCounters;
+
+typedef struct {
+	uint32_t frames;
+	uint64_t total[GLCT_COUNT];
+	StatsHist perFrame[GLCT_COUNT];
+} GlCounterStats;
+
+int glct_bind(Symtable *table);
+void glct_end_frame(void);
+const GlCounterStats *glct_get_stats(void);
+const GlFrameCounters *glct_last(void);
+void glct_draw_overlay(void);
+void glct_dump(void);
+
+#endif
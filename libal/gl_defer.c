@@ -0,0 +1,1227 @@
+/* gl_defer.c -- deferred GL command buffer and render thread
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Replaces every GL entry point in the symtable with one that records the
+// call into a command buffer. Once gldf_start has run the EGL context
+// belongs to render_thread, which executes the buffers in submission order
+// while main_thread records the next one, so game logic for frame N+1
+// overlaps driver work and the swap for frame N. There are two buffers,
+// main_thread only waits when it wants a buffer the render thread has not
+// finished yet.
+//
+// Commands without pointer operands store the next function and its
+// arguments as words, which is how all of them are passed. Data the
+// driver reads from client memory (array contents, indices, texture
+// uploads, parameter vectors) is copied into the buffer, draws only copy
+// the vertices they reference and are rebased to start at zero.
+//
+// Calls returning data (glGetError, glGetIntegerv, glGetString,
+// glReadPixels, glGenTextures) and anything too large to copy take the
+// synchronous path: the call is executed on the render thread and
+// main_thread waits until everything recorded so far has completed, so
+// the result reflects all earlier calls and client pointers stay valid.
+// Loader code issuing GL must do so through gldf_run or gldf_run_sync.
+//
+// The game's EGL calls are left alone and must not touch the context.
+// eglGetProcAddress hands out the recording entry point for anything this
+// layer hooks. Other procs are looked up on the render thread once all
+// recorded calls are done, and run on the caller's thread when called, so
+// only those that do not need the context work.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+#include <EGL/egl.h>
+
+#include "gl_defer.h"
+#include "gl_util.h"
+#include "symtable.h"
+#include "stats.h"
+#include "so_util.h"
+#include "config.h"
+#include "al_error.h"
+
+#define BUF_WORDS		(GL_DEFER_BUF_SIZE / 4)
+#define INLINE_MAX		(GL_DEFER_BUF_SIZE / 4)
+
+
+#define MAX_PROCS		64
+
+typedef struct {
+	const char *symbol;
+	uintptr_t func;
+} ProcEntry;
+
+enum {
+	CMD_CALL0 = 0,
+	CMD_CALL1,
+	CMD_CALL2,
+	CMD_CALL3,
+	CMD_CALL4,
+	CMD_CALL_PTR0,
+	CMD_CALL_PTR1,
+	CMD_CALL_PTR2,
+	CMD_TEX_IMAGE,
+	CMD_COMPRESSED_TEX_IMAGE,
+	CMD_ARRAY,
+	CMD_DRAW_ARRAYS,
+	CMD_DRAW_ELEMENTS,
+	CMD_CALLBACK,
+	CMD_SWAP
+};
+
+// arguments of the commands carrying a pointer, which is either inline
+// data following the arguments or a raw client pointer
+#define CALL_PTR_ARGS		5	// fn, a0, a1, inline, pointer
+#define TEX_IMAGE_ARGS		10	// target, level, internalformat, width, height, border, format, type, inline, pointer
+#define COMPRESSED_ARGS		9	// target, level, internalformat, width, height, border, size, inline, pointer
+#define ARRAY_ARGS			6	// array, size, type, stride, inline, pointer
+#define DRAW_ELEMENTS_ARGS	5	// mode, count, type, inline, pointer
+
+typedef struct {
+	uint32_t enabled;
+	uint32_t size;
+	uint32_t type;
+	uint32_t stride;
+	uint32_t buffer;
+	const GLvoid *pointer;
+} ArrayState;
+
+typedef void (* Call0)(void);
+typedef void (* Call1)(uint32_t);
+typedef void (* Call2)(uint32_t, uint32_t);
+typedef void (* Call3)(uint32_t, uint32_t, uint32_t);
+typedef void (* Call4)(uint32_t, uint32_t, uint32_t, uint32_t);
+typedef void (* CallPtr0)(const void *);
+typedef void (* CallPtr1)(uint32_t, const void *);
+typedef void (* CallPtr2)(uint32_t, uint32_t, const void *);
+
+static SceUID buf_mbid = SCE_UID_INVALID_UID;
+static uint32_t *buffers[2];
+static uint32_t buffer_words[2];
+static uint32_t cur = 0;
+static uint32_t pos = 0;
+static SceUID ready_sema = SCE_UID_INVALID_UID;
+static SceUID free_sema = SCE_UID_INVALID_UID;
+static int running = 0;
+
+static EGLDisplay egl_dpy;
+static EGLSurface egl_surface;
+static EGLContext egl_context;
+
+static ArrayState arrays[GLU_ARRAY_COUNT];
+static uint32_t client_active_texture = 0;
+static uint32_t array_buffer = 0;
+static uint32_t element_buffer = 0;
+
+static ProcEntry procs[MAX_PROCS];
+static uint32_t num_procs = 0;
+
+static GlDeferStats stats;
+static SceUInt64 frame_wait = 0;
+static SceUInt64 frame_render = 0;
+
+static void (* next_glAlphaFunc)(GLenum func, int ref);
+static void (* next_glClearDepthf)(int depth);
+static void (* next_glDepthRangef)(int n, int f);
+static void (* next_glFogf)(GLenum pname, int param);
+static void (* next_glTexEnvf)(GLenum target, GLenum pname, int param);
+static void (* next_glActiveTexture)(GLenum texture);
+static void (* next_glBindBuffer)(GLenum target, GLuint buffer);
+static void (* next_glBindFramebufferOES)(GLenum target, GLuint framebuffer);
+static void (* next_glBindTexture)(GLenum target, GLuint texture);
+static void (* next_glBlendFunc)(GLenum sfactor, GLenum dfactor);
+static void (* next_glClear)(GLbitfield mask);
+static void (* next_glClearColor)(int red, int green, int blue, int alpha);
+static void (* next_glClearStencil)(GLint s);
+static void (* next_glClientActiveTexture)(GLenum texture);
+static void (* next_glColorMask)(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+static void (* next_glColorPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glCompressedTexImage2D)(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+static void (* next_glCullFace)(GLenum mode);
+static void (* next_glDeleteBuffers)(GLsizei n, const GLuint *buffers);
+static void (* next_glDeleteTextures)(GLsizei n, const GLuint *textures);
+static void (* next_glDepthFunc)(GLenum func);
+static void (* next_glDepthMask)(GLboolean flag);
+static void (* next_glDisable)(GLenum cap);
+static void (* next_glDisableClientState)(GLenum array);
+static void (* next_glDrawArrays)(GLenum mode, GLint first, GLsizei count);
+static void (* next_glDrawElements)(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+static void (* next_glEnable)(GLenum cap);
+static void (* next_glEnableClientState)(GLenum array);
+static void (* next_glFogfv)(GLenum pname, const GLfloat *params);
+static void (* next_glFrontFace)(GLenum mode);
+static void (* next_glGenTextures)(GLsizei n, GLuint *textures);
+static GLenum (* next_glGetError)(void);
+static void (* next_glGetIntegerv)(GLenum pname, GLint *params);
+static const GLubyte *(* next_glGetString)(GLenum name);
+static void (* next_glLoadIdentity)(void);
+static void (* next_glLoadMatrixf)(const GLfloat *m);
+static void (* next_glMatrixMode)(GLenum mode);
+static void (* next_glNormalPointer)(GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glReadPixels)(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels);
+static void (* next_glScissor)(GLint x, GLint y, GLsizei width, GLsizei height);
+static void (* next_glStencilFunc)(GLenum func, GLint ref, GLuint mask);
+static void (* next_glStencilOp)(GLenum fail, GLenum zfail, GLenum zpass);
+static void (* next_glTexCoordPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glTexEnvfv)(GLenum target, GLenum pname, const GLfloat *params);
+static void (* next_glTexImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+static void (* next_glTexParameteri)(GLenum target, GLenum pname, GLint param);
+static void (* next_glVertexPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glViewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+static __eglMustCastToProperFunctionPointerType (* next_eglGetProcAddress)(const char *procname);
+
+/* Render thread */
+
+static inline const void *cmd_pointer(const uint32_t *args, uint32_t nargs)
+{
+	return args[nargs - 2] ? (const void *)&args[nargs] : (const void *)args[nargs - 1];
+}
+
+static void exec_array(const uint32_t *a)
+{
+	const void *p = cmd_pointer(a, ARRAY_ARGS);
+
+	switch (a[0]) {
+	case GLU_ARRAY_VERTEX:
+		next_glVertexPointer(a[1], a[2], a[3], p);
+		break;
+	case GLU_ARRAY_COLOR:
+		next_glColorPointer(a[1], a[2], a[3], p);
+		break;
+	case GLU_ARRAY_NORMAL:
+		next_glNormalPointer(a[2], a[3], p);
+		break;
+	default:
+		next_glTexCoordPointer(a[1], a[2], a[3], p);
+		break;
+	}
+}
+
+static void execute(const uint32_t *words, uint32_t count)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	uint32_t i = 0;
+
+	while (i < count) {
+		const uint32_t *a = &words[i + 1];
+		uint32_t op = words[i] & 0xFF;
+
+		i += words[i] >> 8;
+
+		switch (op) {
+		case CMD_CALL0:
+			((Call0)a[0])();
+			break;
+		case CMD_CALL1:
+			((Call1)a[0])(a[1]);
+			break;
+		case CMD_CALL2:
+			((Call2)a[0])(a[1], a[2]);
+			break;
+		case CMD_CALL3:
+			((Call3)a[0])(a[1], a[2], a[3]);
+			break;
+		case CMD_CALL4:
+			((Call4)a[0])(a[1], a[2], a[3], a[4]);
+			break;
+		case CMD_CALL_PTR0:
+			((CallPtr0)a[0])(cmd_pointer(a, CALL_PTR_ARGS));
+			break;
+		case CMD_CALL_PTR1:
+			((CallPtr1)a[0])(a[1], cmd_pointer(a, CALL_PTR_ARGS));
+			break;
+		case CMD_CALL_PTR2:
+			((CallPtr2)a[0])(a[1], a[2], cmd_pointer(a, CALL_PTR_ARGS));
+			break;
+		case CMD_TEX_IMAGE:
+			next_glTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], cmd_pointer(a, TEX_IMAGE_ARGS));
+			break;
+		case CMD_COMPRESSED_TEX_IMAGE:
+			next_glCompressedTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], cmd_pointer(a, COMPRESSED_ARGS));
+			break;
+		case CMD_ARRAY:
+			exec_array(a);
+			break;
+		case CMD_DRAW_ARRAYS:
+			next_glDrawArrays(a[0], a[1], a[2]);
+			break;
+		case CMD_DRAW_ELEMENTS:
+			next_glDrawElements(a[0], a[1], a[2], cmd_pointer(a, DRAW_ELEMENTS_ARGS));
+			break;
+		case CMD_CALLBACK:
+			((void (*)(void *))a[0])((void *)a[1]);
+			break;
+		case CMD_SWAP:
+			frame_render += sceKernelGetProcessTimeWide() - start;
+			stats_hist_add(&stats.renderTime, (uint32_t)frame_render);
+			frame_render = 0;
+			eglSwapBuffers(egl_dpy, egl_surface);
+			start = sceKernelGetProcessTimeWide();
+			break;
+		default:
+			break;
+		}
+	}
+
+	frame_render += sceKernelGetProcessTimeWide() - start;
+}
+
+static int render_thread(SceSize args, void *argp)
+{
+	uint32_t index = 0;
+
+	eglMakeCurrent(egl_dpy, egl_surface, egl_surface, egl_context);
+
+	while (1) {
+		sceKernelWaitSema(ready_sema, 1, NULL);
+		execute(buffers[index], buffer_words[index]);
+		index ^= 1;
+		sceKernelSignalSema(free_sema, 1);
+	}
+
+	return 0;
+}
+
+/* Recording */
+
+// hands the current buffer to the render thread and waits for the other one
+static void submit(void)
+{
+	SceUInt64 start;
+
+	buffer_words[cur] = pos;
+	sceKernelSignalSema(ready_sema, 1);
+	cur ^= 1;
+	pos = 0;
+
+	start = sceKernelGetProcessTimeWide();
+	sceKernelWaitSema(free_sema, 1, NULL);
+	frame_wait += sceKernelGetProcessTimeWide() - start;
+}
+
+// returns once the render thread has executed everything recorded so far
+static void finish(void)
+{
+	SceUInt64 start;
+
+	if (pos != 0)
+		submit();
+
+	start = sceKernelGetProcessTimeWide();
+	sceKernelWaitSema(free_sema, 1, NULL);
+	sceKernelSignalSema(free_sema, 1);
+	frame_wait += sceKernelGetProcessTimeWide() - start;
+
+	stats.syncs++;
+	stats.frameSyncs++;
+}
+
+// makes sure the next words are recorded into the same buffer
+static void reserve(uint32_t words)
+{
+	if (pos + words > BUF_WORDS) {
+		stats.overflows++;
+		submit();
+	}
+}
+
+static uint32_t *emit(uint32_t op, uint32_t nargs, uint32_t bytes)
+{
+	uint32_t words = 1 + nargs + (bytes + 3) / 4;
+	uint32_t *cmd;
+
+	reserve(words);
+
+	cmd = &buffers[cur][pos];
+	cmd[0] = op | (words << 8);
+	pos += words;
+	stats.frameBytes += words * 4;
+
+	return cmd + 1;
+}
+
+// emits a command with a pointer operand, data that does not fit is passed
+// as is and the caller has to finish() before returning to the game
+static uint32_t *emit_pointer(uint32_t op, uint32_t nargs, const void *data, uint32_t bytes)
+{
+	int copy = (data != NULL && bytes <= INLINE_MAX);
+	uint32_t *args = emit(op, nargs, copy ? bytes : 0);
+
+	args[nargs - 2] = copy;
+	args[nargs - 1] = (uint32_t)data;
+	if (copy)
+		sceClibMemcpy(&args[nargs], data, bytes);
+
+	return args;
+}
+
+static void call0(void *fn)
+{
+	uint32_t *args;
+
+	if (!running) {
+		((Call0)fn)();
+		return;
+	}
+
+	args = emit(CMD_CALL0, 1, 0);
+	args[0] = (uint32_t)fn;
+}
+
+static void call1(void *fn, uint32_t a0)
+{
+	uint32_t *args;
+
+	if (!running) {
+		((Call1)fn)(a0);
+		return;
+	}
+
+	args = emit(CMD_CALL1, 2, 0);
+	args[0] = (uint32_t)fn;
+	args[1] = a0;
+}
+
+static void call2(void *fn, uint32_t a0, uint32_t a1)
+{
+	uint32_t *args;
+
+	if (!running) {
+		((Call2)fn)(a0, a1);
+		return;
+	}
+
+	args = emit(CMD_CALL2, 3, 0);
+	args[0] = (uint32_t)fn;
+	args[1] = a0;
+	args[2] = a1;
+}
+
+static void call3(void *fn, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+	uint32_t *args;
+
+	if (!running) {
+		((Call3)fn)(a0, a1, a2);
+		return;
+	}
+
+	args = emit(CMD_CALL3, 4, 0);
+	args[0] = (uint32_t)fn;
+	args[1] = a0;
+	args[2] = a1;
+	args[3] = a2;
+}
+
+static void call4(void *fn, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+	uint32_t *args;
+
+	if (!running) {
+		((Call4)fn)(a0, a1, a2, a3);
+		return;
+	}
+
+	args = emit(CMD_CALL4, 5, 0);
+	args[0] = (uint32_t)fn;
+	args[1] = a0;
+	args[2] = a1;
+	args[3] = a2;
+	args[4] = a3;
+}
+
+// fn(a0..., data) with nargs leading word arguments and bytes of data
+static void call_ptr(uint32_t nargs, void *fn, uint32_t a0, uint32_t a1, const void *data, uint32_t bytes)
+{
+	uint32_t *args;
+
+	if (!running) {
+		if (nargs == 0)
+			((CallPtr0)fn)(data);
+		else if (nargs == 1)
+			((CallPtr1)fn)(a0, data);
+		else
+			((CallPtr2)fn)(a0, a1, data);
+		return;
+	}
+
+	args = emit_pointer(CMD_CALL_PTR0 + nargs, CALL_PTR_ARGS, data, bytes);
+	args[0] = (uint32_t)fn;
+	args[1] = a0;
+	args[2] = a1;
+
+	if (data != NULL && !args[CALL_PTR_ARGS - 2])
+		finish();
+}
+
+static void set_array(int index, GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (index < 0 || index >= GLU_ARRAY_COUNT)
+		return;
+
+	arrays[index].size = size;
+	arrays[index].type = type;
+	arrays[index].stride = stride;
+	arrays[index].buffer = array_buffer;
+	arrays[index].pointer = pointer;
+}
+
+static inline uint32_t array_elem_size(const ArrayState *a)
+{
+	return a->size * glu_type_size(a->type);
+}
+
+// returns the words needed to copy count vertices of every enabled array,
+// or 0 if one of them lives in a buffer object
+static uint32_t packed_words(uint32_t count)
+{
+	uint32_t words = 0;
+
+	for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+		if (!arrays[i].enabled)
+			continue;
+		if (arrays[i].buffer != 0)
+			return 0;
+
+		// array command and the client texture switches around it
+		words += 1 + ARRAY_ARGS + 6;
+		if (arrays[i].pointer != NULL)
+			words += (array_elem_size(&arrays[i]) * count + 3) / 4;
+	}
+
+	return words ? words : 1;
+}
+
+// packed arrays hold vertices [first, first + count) starting at zero,
+// otherwise the pointers are passed as is
+static void emit_arrays(uint32_t first, uint32_t count, int packed)
+{
+	for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+		ArrayState *a = &arrays[i];
+		uint32_t unit = i - GLU_ARRAY_TEX_COORD;
+		uint32_t *args;
+
+		if (!a->enabled)
+			continue;
+
+		if (i >= GLU_ARRAY_TEX_COORD && unit != client_active_texture)
+			call1((void *)next_glClientActiveTexture, GL_TEXTURE0 + unit);
+
+		if (packed && a->pointer != NULL) {
+			uint32_t elem = array_elem_size(a);
+			uint32_t stride = a->stride ? a->stride : elem;
+			const uint8_t *src = (const uint8_t *)a->pointer + first * stride;
+			uint8_t *dst;
+
+			args = emit(CMD_ARRAY, ARRAY_ARGS, elem * count);
+			args[3] = 0;
+			args[4] = 1;
+			args[5] = 0;
+
+			dst = (uint8_t *)&args[ARRAY_ARGS];
+			if (stride == elem) {
+				sceClibMemcpy(dst, src, elem * count);
+			} else {
+				for (uint32_t v = 0; v < count; v++)
+					sceClibMemcpy(dst + v * elem, src + v * stride, elem);
+			}
+		} else {
+			args = emit(CMD_ARRAY, ARRAY_ARGS, 0);
+			args[3] = a->stride;
+			args[4] = 0;
+			args[5] = (uint32_t)a->pointer;
+		}
+
+		args[0] = i;
+		args[1] = a->size;
+		args[2] = a->type;
+
+		if (i >= GLU_ARRAY_TEX_COORD && unit != client_active_texture)
+			call1((void *)next_glClientActiveTexture, GL_TEXTURE0 + client_active_texture);
+	}
+}
+
+static void index_range(GLsizei count, GLenum type, const GLvoid *indices, uint32_t *first, uint32_t *num)
+{
+	uint32_t lo = 0xFFFFFFFF, hi = 0, idx;
+
+	for (GLsizei i = 0; i < count; i++) {
+		if (type == GL_UNSIGNED_BYTE)
+			idx = ((const uint8_t *)indices)[i];
+		else if (type == GL_UNSIGNED_SHORT)
+			idx = ((const uint16_t *)indices)[i];
+		else
+			idx = ((const uint32_t *)indices)[i];
+
+		if (idx < lo)
+			lo = idx;
+		if (idx > hi)
+			hi = idx;
+	}
+
+	*first = lo;
+	*num = hi - lo + 1;
+}
+
+static void rebase_indices(void *dst, const GLvoid *indices, GLsizei count, GLenum type, uint32_t first)
+{
+	for (GLsizei i = 0; i < count; i++) {
+		if (type == GL_UNSIGNED_BYTE)
+			((uint8_t *)dst)[i] = ((const uint8_t *)indices)[i] - first;
+		else if (type == GL_UNSIGNED_SHORT)
+			((uint16_t *)dst)[i] = ((const uint16_t *)indices)[i] - first;
+		else
+			((uint32_t *)dst)[i] = ((const uint32_t *)indices)[i] - first;
+	}
+}
+
+/* Hooks */
+
+static void glAlphaFunc_gldf(GLenum func, int ref)
+{
+	call2((void *)next_glAlphaFunc, func, ref);
+}
+
+static void glClearDepthf_gldf(int depth)
+{
+	call1((void *)next_glClearDepthf, depth);
+}
+
+static void glDepthRangef_gldf(int n, int f)
+{
+	call2((void *)next_glDepthRangef, n, f);
+}
+
+static void glFogf_gldf(GLenum pname, int param)
+{
+	call2((void *)next_glFogf, pname, param);
+}
+
+static void glTexEnvf_gldf(GLenum target, GLenum pname, int param)
+{
+	call3((void *)next_glTexEnvf, target, pname, param);
+}
+
+static void glActiveTexture_gldf(GLenum texture)
+{
+	call1((void *)next_glActiveTexture, texture);
+}
+
+static void glBindBuffer_gldf(GLenum target, GLuint buffer)
+{
+	if (target == GL_ARRAY_BUFFER)
+		array_buffer = buffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		element_buffer = buffer;
+
+	call2((void *)next_glBindBuffer, target, buffer);
+}
+
+static void glBindFramebufferOES_gldf(GLenum target, GLuint framebuffer)
+{
+	call2((void *)next_glBindFramebufferOES, target, framebuffer);
+}
+
+static void glBindTexture_gldf(GLenum target, GLuint texture)
+{
+	call2((void *)next_glBindTexture, target, texture);
+}
+
+static void glBlendFunc_gldf(GLenum sfactor, GLenum dfactor)
+{
+	call2((void *)next_glBlendFunc, sfactor, dfactor);
+}
+
+static void glClear_gldf(GLbitfield mask)
+{
+	call1((void *)next_glClear, mask);
+}
+
+static void glClearColor_gldf(int red, int green, int blue, int alpha)
+{
+	call4((void *)next_glClearColor, red, green, blue, alpha);
+}
+
+static void glClearStencil_gldf(GLint s)
+{
+	call1((void *)next_glClearStencil, s);
+}
+
+static void glClientActiveTexture_gldf(GLenum texture)
+{
+	client_active_texture = texture - GL_TEXTURE0;
+	call1((void *)next_glClientActiveTexture, texture);
+}
+
+static void glColorMask_gldf(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	call4((void *)next_glColorMask, red, green, blue, alpha);
+}
+
+// array pointers are only recorded, every draw sets the ones it uses
+static void glColorPointer_gldf(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (!running)
+		next_glColorPointer(size, type, stride, pointer);
+	set_array(GLU_ARRAY_COLOR, size, type, stride, pointer);
+}
+
+static void glCompressedTexImage2D_gldf(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	uint32_t *args;
+
+	if (!running) {
+		next_glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+		return;
+	}
+
+	args = emit_pointer(CMD_COMPRESSED_TEX_IMAGE, COMPRESSED_ARGS, data, imageSize);
+	args[0] = target;
+	args[1] = level;
+	args[2] = internalformat;
+	args[3] = width;
+	args[4] = height;
+	args[5] = border;
+	args[6] = imageSize;
+
+	if (data != NULL && !args[COMPRESSED_ARGS - 2])
+		finish();
+}
+
+static void glCullFace_gldf(GLenum mode)
+{
+	call1((void *)next_glCullFace, mode);
+}
+
+static void glDeleteBuffers_gldf(GLsizei n, const GLuint *buffers)
+{
+	call_ptr(1, (void *)next_glDeleteBuffers, n, 0, buffers, n * sizeof(GLuint));
+}
+
+static void glDeleteTextures_gldf(GLsizei n, const GLuint *textures)
+{
+	call_ptr(1, (void *)next_glDeleteTextures, n, 0, textures, n * sizeof(GLuint));
+}
+
+static void glDepthFunc_gldf(GLenum func)
+{
+	call1((void *)next_glDepthFunc, func);
+}
+
+static void glDepthMask_gldf(GLboolean flag)
+{
+	call1((void *)next_glDepthMask, flag);
+}
+
+static void glDisable_gldf(GLenum cap)
+{
+	call1((void *)next_glDisable, cap);
+}
+
+static void glDisableClientState_gldf(GLenum array)
+{
+	int index = glu_array_index(array, client_active_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = 0;
+
+	call1((void *)next_glDisableClientState, array);
+}
+
+static void glDrawArrays_gldf(GLenum mode, GLint first, GLsizei count)
+{
+	uint32_t words, *args;
+
+	if (!running) {
+		next_glDrawArrays(mode, first, count);
+		return;
+	}
+
+	words = count > 0 ? packed_words(count) : 0;
+
+	if (words != 0 && words <= INLINE_MAX / 4) {
+		reserve(words + 1 + 3);
+		emit_arrays(first, count, 1);
+		first = 0;
+	} else {
+		emit_arrays(0, 0, 0);
+	}
+
+	args = emit(CMD_DRAW_ARRAYS, 3, 0);
+	args[0] = mode;
+	args[1] = first;
+	args[2] = count;
+
+	if (words == 0 || words > INLINE_MAX / 4)
+		finish();
+}
+
+static void glDrawElements_gldf(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+	uint32_t words = 0, index_bytes, first = 0, num = 0, *args;
+
+	if (!running) {
+		next_glDrawElements(mode, count, type, indices);
+		return;
+	}
+
+	index_bytes = count > 0 ? count * glu_type_size(type) : 0;
+
+	if (element_buffer == 0 && indices != NULL && count > 0) {
+		index_range(count, type, indices, &first, &num);
+		words = packed_words(num);
+		if (words != 0)
+			words += 1 + DRAW_ELEMENTS_ARGS + (index_bytes + 3) / 4;
+	}
+
+	if (words == 0 || words > INLINE_MAX / 4) {
+		emit_arrays(0, 0, 0);
+
+		args = emit(CMD_DRAW_ELEMENTS, DRAW_ELEMENTS_ARGS, 0);
+		args[0] = mode;
+		args[1] = count;
+		args[2] = type;
+		args[3] = 0;
+		args[4] = (uint32_t)indices;
+
+		finish();
+		return;
+	}
+
+	reserve(words);
+	emit_arrays(first, num, 1);
+
+	args = emit(CMD_DRAW_ELEMENTS, DRAW_ELEMENTS_ARGS, index_bytes);
+	args[0] = mode;
+	args[1] = count;
+	args[2] = type;
+	args[3] = 1;
+	args[4] = 0;
+	rebase_indices(&args[DRAW_ELEMENTS_ARGS], indices, count, type, first);
+}
+
+void glEnable_gldf(GLenum cap)
+{
+	call1((void *)next_glEnable, cap);
+}
+
+static void glEnableClientState_gldf(GLenum array)
+{
+	int index = glu_array_index(array, client_active_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = 1;
+
+	call1((void *)next_glEnableClientState, array);
+}
+
+static void glFogfv_gldf(GLenum pname, const GLfloat *params)
+{
+	call_ptr(1, (void *)next_glFogfv, pname, 0, params, (pname == GL_FOG_COLOR ? 4 : 1) * sizeof(GLfloat));
+}
+
+static void glFrontFace_gldf(GLenum mode)
+{
+	call1((void *)next_glFrontFace, mode);
+}
+
+typedef struct {
+	GLsizei n;
+	GLuint *textures;
+} GenTexturesArgs;
+
+static void gen_textures(void *arg)
+{
+	GenTexturesArgs *a = (GenTexturesArgs *)arg;
+	next_glGenTextures(a->n, a->textures);
+}
+
+static void glGenTextures_gldf(GLsizei n, GLuint *textures)
+{
+	GenTexturesArgs a = { n, textures };
+	gldf_run_sync(gen_textures, &a);
+}
+
+static void get_error(void *arg)
+{
+	*(GLenum *)arg = next_glGetError();
+}
+
+static GLenum glGetError_gldf(void)
+{
+	GLenum error;
+	gldf_run_sync(get_error, &error);
+	return error;
+}
+
+typedef struct {
+	GLenum pname;
+	GLint *params;
+} GetIntegervArgs;
+
+static void get_integerv(void *arg)
+{
+	GetIntegervArgs *a = (GetIntegervArgs *)arg;
+	next_glGetIntegerv(a->pname, a->params);
+}
+
+static void glGetIntegerv_gldf(GLenum pname, GLint *params)
+{
+	GetIntegervArgs a = { pname, params };
+	gldf_run_sync(get_integerv, &a);
+}
+
+typedef struct {
+	GLenum name;
+	const GLubyte *result;
+} GetStringArgs;
+
+static void get_string(void *arg)
+{
+	GetStringArgs *a = (GetStringArgs *)arg;
+	a->result = next_glGetString(a->name);
+}
+
+static const GLubyte *glGetString_gldf(GLenum name)
+{
+	GetStringArgs a = { name, NULL };
+	gldf_run_sync(get_string, &a);
+	return a.result;
+}
+
+static void glLoadIdentity_gldf(void)
+{
+	call0((void *)next_glLoadIdentity);
+}
+
+static void glLoadMatrixf_gldf(const GLfloat *m)
+{
+	call_ptr(0, (void *)next_glLoadMatrixf, 0, 0, m, 16 * sizeof(GLfloat));
+}
+
+static void glMatrixMode_gldf(GLenum mode)
+{
+	call1((void *)next_glMatrixMode, mode);
+}
+
+static void glNormalPointer_gldf(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (!running)
+		next_glNormalPointer(type, stride, pointer);
+	set_array(GLU_ARRAY_NORMAL, 3, type, stride, pointer);
+}
+
+typedef struct {
+	GLint x, y;
+	GLsizei width, height;
+	GLenum format, type;
+	GLvoid *pixels;
+} ReadPixelsArgs;
+
+static void read_pixels(void *arg)
+{
+	ReadPixelsArgs *a = (ReadPixelsArgs *)arg;
+	next_glReadPixels(a->x, a->y, a->width, a->height, a->format, a->type, a->pixels);
+}
+
+static void glReadPixels_gldf(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels)
+{
+	ReadPixelsArgs a = { x, y, width, height, format, type, pixels };
+	gldf_run_sync(read_pixels, &a);
+}
+
+static void glScissor_gldf(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	call4((void *)next_glScissor, x, y, width, height);
+}
+
+static void glStencilFunc_gldf(GLenum func, GLint ref, GLuint mask)
+{
+	call3((void *)next_glStencilFunc, func, ref, mask);
+}
+
+static void glStencilOp_gldf(GLenum fail, GLenum zfail, GLenum zpass)
+{
+	call3((void *)next_glStencilOp, fail, zfail, zpass);
+}
+
+static void glTexCoordPointer_gldf(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (!running)
+		next_glTexCoordPointer(size, type, stride, pointer);
+	if (client_active_texture < GLU_MAX_TEX_UNITS)
+		set_array(GLU_ARRAY_TEX_COORD + client_active_texture, size, type, stride, pointer);
+}
+
+static void glTexEnvfv_gldf(GLenum target, GLenum pname, const GLfloat *params)
+{
+	call_ptr(2, (void *)next_glTexEnvfv, target, pname, params, (pname == GL_TEXTURE_ENV_COLOR ? 4 : 1) * sizeof(GLfloat));
+}
+
+static void glTexImage2D_gldf(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels)
+{
+	uint32_t *args;
+
+	if (!running) {
+		next_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+		return;
+	}
+
+	args = emit_pointer(CMD_TEX_IMAGE, TEX_IMAGE_ARGS, pixels, glu_image_size(width, height, format, type));
+	args[0] = target;
+	args[1] = level;
+	args[2] = internalformat;
+	args[3] = width;
+	args[4] = height;
+	args[5] = border;
+	args[6] = format;
+	args[7] = type;
+
+	if (pixels != NULL && !args[TEX_IMAGE_ARGS - 2])
+		finish();
+}
+
+static void glTexParameteri_gldf(GLenum target, GLenum pname, GLint param)
+{
+	call3((void *)next_glTexParameteri, target, pname, param);
+}
+
+static void glVertexPointer_gldf(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (!running)
+		next_glVertexPointer(size, type, stride, pointer);
+	set_array(GLU_ARRAY_VERTEX, size, type, stride, pointer);
+}
+
+static void glViewport_gldf(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	call4((void *)next_glViewport, x, y, width, height);
+}
+
+typedef struct {
+	const char *procname;
+	__eglMustCastToProperFunctionPointerType result;
+} GetProcAddressArgs;
+
+static void get_proc_address(void *arg)
+{
+	GetProcAddressArgs *a = (GetProcAddressArgs *)arg;
+	a->result = next_eglGetProcAddress(a->procname);
+}
+
+static __eglMustCastToProperFunctionPointerType eglGetProcAddress_gldf(const char *procname)
+{
+	GetProcAddressArgs a = { procname, NULL };
+
+	if (procname == NULL)
+		return next_eglGetProcAddress(procname);
+
+	for (uint32_t i = 0; i < num_procs; i++) {
+		if (sceClibStrcmp(procs[i].symbol, procname) == 0)
+			return (__eglMustCastToProperFunctionPointerType)procs[i].func;
+	}
+
+	stats.rawProcs++;
+	gldf_run_sync(get_proc_address, &a);
+	return a.result;
+}
+
+#define GLDF_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_gldf, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret; \
+	if (num_procs < MAX_PROCS) { \
+		procs[num_procs].symbol = #name; \
+		procs[num_procs++].func = (uintptr_t)&name##_gldf; \
+	}
+
+int gldf_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	GLDF_HOOK(glAlphaFunc);
+	GLDF_HOOK(glClearDepthf);
+	GLDF_HOOK(glDepthRangef);
+	GLDF_HOOK(glFogf);
+	GLDF_HOOK(glTexEnvf);
+	GLDF_HOOK(glActiveTexture);
+	GLDF_HOOK(glBindBuffer);
+	GLDF_HOOK(glBindFramebufferOES);
+	GLDF_HOOK(glBindTexture);
+	GLDF_HOOK(glBlendFunc);
+	GLDF_HOOK(glClear);
+	GLDF_HOOK(glClearColor);
+	GLDF_HOOK(glClearStencil);
+	GLDF_HOOK(glClientActiveTexture);
+	GLDF_HOOK(glColorMask);
+	GLDF_HOOK(glColorPointer);
+	GLDF_HOOK(glCompressedTexImage2D);
+	GLDF_HOOK(glCullFace);
+	GLDF_HOOK(glDeleteBuffers);
+	GLDF_HOOK(glDeleteTextures);
+	GLDF_HOOK(glDepthFunc);
+	GLDF_HOOK(glDepthMask);
+	GLDF_HOOK(glDisable);
+	GLDF_HOOK(glDisableClientState);
+	GLDF_HOOK(glDrawArrays);
+	GLDF_HOOK(glDrawElements);
+	GLDF_HOOK(glEnable);
+	GLDF_HOOK(glEnableClientState);
+	GLDF_HOOK(glFogfv);
+	GLDF_HOOK(glFrontFace);
+	GLDF_HOOK(glGenTextures);
+	GLDF_HOOK(glGetError);
+	GLDF_HOOK(glGetIntegerv);
+	GLDF_HOOK(glGetString);
+	GLDF_HOOK(glLoadIdentity);
+	GLDF_HOOK(glLoadMatrixf);
+	GLDF_HOOK(glMatrixMode);
+	GLDF_HOOK(glNormalPointer);
+	GLDF_HOOK(glReadPixels);
+	GLDF_HOOK(glScissor);
+	GLDF_HOOK(glStencilFunc);
+	GLDF_HOOK(glStencilOp);
+	GLDF_HOOK(glTexCoordPointer);
+	GLDF_HOOK(glTexEnvfv);
+	GLDF_HOOK(glTexImage2D);
+	GLDF_HOOK(glTexParameteri);
+	GLDF_HOOK(glVertexPointer);
+	GLDF_HOOK(glViewport);
+
+	ret = symt_hook(table, "eglGetProcAddress", (uintptr_t)&eglGetProcAddress_gldf, (uintptr_t *)&next_eglGetProcAddress);
+	if (ret < 0)
+		return ret;
+
+	sceClibMemset(&stats, 0, sizeof(GlDeferStats));
+	stats_hist_reset(&stats.bytesPerFrame);
+	stats_hist_reset(&stats.syncsPerFrame);
+	stats_hist_reset(&stats.submitWait);
+	stats_hist_reset(&stats.renderTime);
+	sceClibMemset(arrays, 0, sizeof(arrays));
+
+	return AL_OK;
+}
+
+// the calling thread gives up the context, on failure it keeps it and GL
+// is issued directly
+int gldf_start(EGLDisplay dpy, EGLSurface surface, EGLContext context)
+{
+	SceUID thid;
+	void *base;
+
+	egl_dpy = dpy;
+	egl_surface = surface;
+	egl_context = context;
+
+	buf_mbid = sceKernelAllocMemBlock("AL::GlDefer::Buffer", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(2 * GL_DEFER_BUF_SIZE, SCE_KERNEL_4KiB), NULL);
+	if (buf_mbid < 0)
+		return buf_mbid;
+
+	sceKernelGetMemBlockBase(buf_mbid, &base);
+	buffers[0] = (uint32_t *)base;
+	buffers[1] = (uint32_t *)base + BUF_WORDS;
+
+	ready_sema = sceKernelCreateSema("AL::GlDefer::Ready", 0, 0, 2, NULL);
+	if (ready_sema < 0)
+		return ready_sema;
+
+	free_sema = sceKernelCreateSema("AL::GlDefer::Free", 0, 1, 2, NULL);
+	if (free_sema < 0)
+		return free_sema;
+
+	thid = sceKernelCreateThread("render_thread", (SceKernelThreadEntry)render_thread, 64, 128 * 1024, 0, SCE_KERNEL_CPU_MASK_USER_1, NULL);
+	if (thid < 0)
+		return thid;
+
+	eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	sceKernelStartThread(thid, 0, NULL);
+
+	cur = 0;
+	pos = 0;
+	running = 1;
+
+	stats_register_dump(gldf_dump);
+
+	return thid;
+}
+
+void gldf_run(void (*fn)(void *arg), void *arg)
+{
+	uint32_t *args;
+
+	if (!running) {
+		fn(arg);
+		return;
+	}
+
+	args = emit(CMD_CALLBACK, 2, 0);
+	args[0] = (uint32_t)fn;
+	args[1] = (uint32_t)arg;
+}
+
+void gldf_run_sync(void (*fn)(void *arg), void *arg)
+{
+	gldf_run(fn, arg);
+
+	if (running)
+		finish();
+}
+
+void gldf_end_frame(void)
+{
+	if (!running) {
+		eglSwapBuffers(egl_dpy, egl_surface);
+		return;
+	}
+
+	emit(CMD_SWAP, 0, 0);
+
+	stats_hist_add(&stats.bytesPerFrame, stats.frameBytes);
+	stats_hist_add(&stats.syncsPerFrame, stats.frameSyncs);
+	stats.frameBytes = 0;
+	stats.frameSyncs = 0;
+	stats.frames++;
+
+	submit();
+
+	stats_hist_add(&stats.submitWait, (uint32_t)frame_wait);
+	frame_wait = 0;
+}
+
+const GlDeferStats *gldf_get_stats(void)
+{
+	return &stats;
+}
+
+void gldf_dump(void)
+{
+	SceUID fd;
+
+	fd = stats_file_open("gl_defer.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "frames,%u\n", stats.frames);
+	stats_file_printf(fd, "syncs,%u\n", stats.syncs);
+	stats_file_printf(fd, "overflows,%u\n", stats.overflows);
+	stats_file_printf(fd, "raw_procs,%u\n", stats.rawProcs);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "bytes_per_frame", &stats.bytesPerFrame);
+	stats_file_write_hist(fd, "syncs_per_frame", &stats.syncsPerFrame);
+	stats_file_write_hist(fd, "submit_wait_us", &stats.submitWait);
+	stats_file_write_hist(fd, "render_us", &stats.renderTime);
+
+	stats_file_close(fd);
+}
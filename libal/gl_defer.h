@@ -0,0 +1,35 @@
+#ifndef __GL_DEFER_H__
+#define __GL_DEFER_H__
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <EGL/egl.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+typedef struct {
+	uint32_t frames;
+	uint32_t syncs;
+	uint32_t overflows;
+	uint32_t rawProcs;
+	uint32_t frameSyncs;
+	uint32_t frameBytes;
+	StatsHist bytesPerFrame;
+	StatsHist syncsPerFrame;
+	StatsHist submitWait;
+	StatsHist renderTime;
+} GlDeferStats;
+
+int gldf_bind(Symtable *table);
+int gldf_start(EGLDisplay dpy, EGLSurface surface, EGLContext context);
+void gldf_run(void (*fn)(void *arg), void *arg);
+void gldf_run_sync(void (*fn)(void *arg), void *arg);
+void gldf_end_frame(void);
+const GlDeferStats *gldf_get_stats(void);
+void gldf_dump(void);
+
+void glEnable_gldf(GLenum cap);
+
+#endif
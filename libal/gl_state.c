@@ -0,0 +1,631 @@
+/* gl_state.c -- redundant GL state filtering
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Sits between libbc2.so and the driver for the state setting GLES1 entry
+// points. Every piece of state starts out unknown and is learned from the
+// calls that go through, a call that would set a value already in place is
+// dropped. Anything issuing GL behind this layer's back without restoring
+// what it changed must call glst_invalidate afterwards.
+//
+// Float parameters arrive as int bit patterns, as the game is softfp, and are
+// compared as such.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "gl_state.h"
+#include "gl_util.h"
+#include "symtable.h"
+#include "stats.h"
+#include "al_error.h"
+
+#define UNKNOWN		0xFFFFFFFF
+
+enum {
+	CAP_ALPHA_TEST = 0,
+	CAP_BLEND,
+	CAP_COLOR_LOGIC_OP,
+	CAP_COLOR_MATERIAL,
+	CAP_CULL_FACE,
+	CAP_DEPTH_TEST,
+	CAP_DITHER,
+	CAP_FOG,
+	CAP_LIGHTING,
+	CAP_MULTISAMPLE,
+	CAP_NORMALIZE,
+	CAP_POLYGON_OFFSET_FILL,
+	CAP_RESCALE_NORMAL,
+	CAP_SAMPLE_ALPHA_TO_COVERAGE,
+	CAP_SCISSOR_TEST,
+	CAP_STENCIL_TEST,
+	CAP_TEXTURE_2D,		// per texture unit, must stay last
+
+	CAP_COUNT = CAP_TEXTURE_2D + GLU_MAX_TEX_UNITS
+};
+
+enum {
+	CLIENT_VERTEX_ARRAY = 0,
+	CLIENT_COLOR_ARRAY,
+	CLIENT_NORMAL_ARRAY,
+	CLIENT_TEXTURE_COORD_ARRAY,	// per texture unit, must stay last
+
+	CLIENT_COUNT = CLIENT_TEXTURE_COORD_ARRAY + GLU_MAX_TEX_UNITS
+};
+
+typedef struct {
+	GLint size;
+	uint32_t type;
+	GLsizei stride;
+	uint32_t buffer;
+	const GLvoid *pointer;
+} ArrayState;
+
+typedef struct {
+	uint32_t caps[CAP_COUNT];
+	uint32_t client[CLIENT_COUNT];
+	uint32_t activeTexture;
+	uint32_t clientActiveTexture;
+	uint32_t texture[GLU_MAX_TEX_UNITS];
+	uint32_t texEnvMode[GLU_MAX_TEX_UNITS];
+	uint32_t arrayBuffer;
+	uint32_t elementBuffer;
+	uint32_t framebuffer;
+	uint32_t blendSrc, blendDst;
+	uint32_t depthFunc;
+	uint32_t depthMask;
+	uint32_t alphaFunc, alphaRef;
+	uint32_t cullFace;
+	uint32_t frontFace;
+	uint32_t colorMask;
+	uint32_t stencilFunc, stencilRef, stencilMask;
+	uint32_t stencilFail, stencilZFail, stencilZPass;
+	uint32_t scissor[4];
+	uint32_t viewport[4];
+	uint32_t matrixMode;
+	ArrayState arrays[GLU_ARRAY_COUNT];
+} ShadowState;
+
+static ShadowState shadow;
+static GlStateStats stats;
+
+static void (* next_glEnable)(GLenum cap);
+static void (* next_glDisable)(GLenum cap);
+static void (* next_glEnableClientState)(GLenum array);
+static void (* next_glDisableClientState)(GLenum array);
+static void (* next_glActiveTexture)(GLenum texture);
+static void (* next_glClientActiveTexture)(GLenum texture);
+static void (* next_glBindTexture)(GLenum target, GLuint texture);
+static void (* next_glDeleteTextures)(GLsizei n, const GLuint *textures);
+static void (* next_glBindBuffer)(GLenum target, GLuint buffer);
+static void (* next_glDeleteBuffers)(GLsizei n, const GLuint *buffers);
+static void (* next_glBindFramebufferOES)(GLenum target, GLuint framebuffer);
+static void (* next_glBlendFunc)(GLenum sfactor, GLenum dfactor);
+static void (* next_glDepthFunc)(GLenum func);
+static void (* next_glDepthMask)(GLboolean flag);
+static void (* next_glAlphaFunc)(GLenum func, int ref);
+static void (* next_glCullFace)(GLenum mode);
+static void (* next_glFrontFace)(GLenum mode);
+static void (* next_glColorMask)(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+static void (* next_glStencilFunc)(GLenum func, GLint ref, GLuint mask);
+static void (* next_glStencilOp)(GLenum fail, GLenum zfail, GLenum zpass);
+static void (* next_glScissor)(GLint x, GLint y, GLsizei width, GLsizei height);
+static void (* next_glViewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+static void (* next_glMatrixMode)(GLenum mode);
+static void (* next_glTexEnvf)(GLenum target, GLenum pname, int param);
+static void (* next_glTexEnvfv)(GLenum target, GLenum pname, const GLfloat *params);
+static void (* next_glVertexPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glColorPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glNormalPointer)(GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glTexCoordPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+
+static inline int forward(int call)
+{
+	stats.forwarded[call]++;
+	stats.frameForwarded++;
+	return 1;
+}
+
+static inline int filter(int call)
+{
+	stats.filtered[call]++;
+	stats.frameFiltered++;
+	return 0;
+}
+
+// returns 1 if the call changes *slot and has to be forwarded
+static inline int update(int call, uint32_t *slot, uint32_t value)
+{
+	if (*slot == value)
+		return filter(call);
+
+	*slot = value;
+	return forward(call);
+}
+
+static int cap_index(GLenum cap)
+{
+	switch (cap) {
+	case GL_ALPHA_TEST:					return CAP_ALPHA_TEST;
+	case GL_BLEND:						return CAP_BLEND;
+	case GL_COLOR_LOGIC_OP:				return CAP_COLOR_LOGIC_OP;
+	case GL_COLOR_MATERIAL:				return CAP_COLOR_MATERIAL;
+	case GL_CULL_FACE:					return CAP_CULL_FACE;
+	case GL_DEPTH_TEST:					return CAP_DEPTH_TEST;
+	case GL_DITHER:						return CAP_DITHER;
+	case GL_FOG:						return CAP_FOG;
+	case GL_LIGHTING:					return CAP_LIGHTING;
+	case GL_MULTISAMPLE:				return CAP_MULTISAMPLE;
+	case GL_NORMALIZE:					return CAP_NORMALIZE;
+	case GL_POLYGON_OFFSET_FILL:		return CAP_POLYGON_OFFSET_FILL;
+	case GL_RESCALE_NORMAL:				return CAP_RESCALE_NORMAL;
+	case GL_SAMPLE_ALPHA_TO_COVERAGE:	return CAP_SAMPLE_ALPHA_TO_COVERAGE;
+	case GL_SCISSOR_TEST:				return CAP_SCISSOR_TEST;
+	case GL_STENCIL_TEST:				return CAP_STENCIL_TEST;
+	case GL_TEXTURE_2D:
+		if (shadow.activeTexture < GLU_MAX_TEX_UNITS)
+			return CAP_TEXTURE_2D + shadow.activeTexture;
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+static int client_index(GLenum array)
+{
+	switch (array) {
+	case GL_VERTEX_ARRAY:			return CLIENT_VERTEX_ARRAY;
+	case GL_COLOR_ARRAY:			return CLIENT_COLOR_ARRAY;
+	case GL_NORMAL_ARRAY:			return CLIENT_NORMAL_ARRAY;
+	case GL_TEXTURE_COORD_ARRAY:
+		if (shadow.clientActiveTexture < GLU_MAX_TEX_UNITS)
+			return CLIENT_TEXTURE_COORD_ARRAY + shadow.clientActiveTexture;
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+static int array_changed(int call, ArrayState *array, GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (array->size == size &&
+		array->type == type &&
+		array->stride == stride &&
+		array->pointer == pointer &&
+		array->buffer == shadow.arrayBuffer &&
+		shadow.arrayBuffer != UNKNOWN)
+		return filter(call);
+
+	array->size = size;
+	array->type = type;
+	array->stride = stride;
+	array->pointer = pointer;
+	array->buffer = shadow.arrayBuffer;
+
+	return forward(call);
+}
+
+void glEnable_glst(GLenum cap)
+{
+	int idx = cap_index(cap);
+
+	if (idx < 0) {
+		forward(GLST_CALL_ENABLE);
+		next_glEnable(cap);
+	} else if (update(GLST_CALL_ENABLE, &shadow.caps[idx], GL_TRUE)) {
+		next_glEnable(cap);
+	}
+}
+
+void glDisable_glst(GLenum cap)
+{
+	int idx = cap_index(cap);
+
+	if (idx < 0) {
+		forward(GLST_CALL_DISABLE);
+		next_glDisable(cap);
+	} else if (update(GLST_CALL_DISABLE, &shadow.caps[idx], GL_FALSE)) {
+		next_glDisable(cap);
+	}
+}
+
+static void glEnableClientState_glst(GLenum array)
+{
+	int idx = client_index(array);
+
+	if (idx < 0) {
+		forward(GLST_CALL_ENABLE_CLIENT_STATE);
+		next_glEnableClientState(array);
+	} else if (update(GLST_CALL_ENABLE_CLIENT_STATE, &shadow.client[idx], GL_TRUE)) {
+		next_glEnableClientState(array);
+	}
+}
+
+static void glDisableClientState_glst(GLenum array)
+{
+	int idx = client_index(array);
+
+	if (idx < 0) {
+		forward(GLST_CALL_DISABLE_CLIENT_STATE);
+		next_glDisableClientState(array);
+	} else if (update(GLST_CALL_DISABLE_CLIENT_STATE, &shadow.client[idx], GL_FALSE)) {
+		next_glDisableClientState(array);
+	}
+}
+
+static void glActiveTexture_glst(GLenum texture)
+{
+	if (update(GLST_CALL_ACTIVE_TEXTURE, &shadow.activeTexture, texture - GL_TEXTURE0))
+		next_glActiveTexture(texture);
+}
+
+static void glClientActiveTexture_glst(GLenum texture)
+{
+	if (update(GLST_CALL_CLIENT_ACTIVE_TEXTURE, &shadow.clientActiveTexture, texture - GL_TEXTURE0))
+		next_glClientActiveTexture(texture);
+}
+
+static void glBindTexture_glst(GLenum target, GLuint texture)
+{
+	if (target != GL_TEXTURE_2D || shadow.activeTexture >= GLU_MAX_TEX_UNITS) {
+		forward(GLST_CALL_BIND_TEXTURE);
+		next_glBindTexture(target, texture);
+	} else if (update(GLST_CALL_BIND_TEXTURE, &shadow.texture[shadow.activeTexture], texture)) {
+		next_glBindTexture(target, texture);
+	}
+}
+
+static void glDeleteTextures_glst(GLsizei n, const GLuint *textures)
+{
+	// deleting a bound texture reverts the binding to 0
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < GLU_MAX_TEX_UNITS; j++) {
+			if (shadow.texture[j] == textures[i])
+				shadow.texture[j] = 0;
+		}
+	}
+
+	next_glDeleteTextures(n, textures);
+}
+
+static void glBindBuffer_glst(GLenum target, GLuint buffer)
+{
+	uint32_t *slot;
+
+	if (target == GL_ARRAY_BUFFER)
+		slot = &shadow.arrayBuffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		slot = &shadow.elementBuffer;
+	else
+		slot = NULL;
+
+	if (slot == NULL) {
+		forward(GLST_CALL_BIND_BUFFER);
+		next_glBindBuffer(target, buffer);
+	} else if (update(GLST_CALL_BIND_BUFFER, slot, buffer)) {
+		next_glBindBuffer(target, buffer);
+	}
+}
+
+static void glDeleteBuffers_glst(GLsizei n, const GLuint *buffers)
+{
+	for (int i = 0; i < n; i++) {
+		if (buffers[i] == 0)
+			continue;
+		if (shadow.arrayBuffer == buffers[i])
+			shadow.arrayBuffer = 0;
+		if (shadow.elementBuffer == buffers[i])
+			shadow.elementBuffer = 0;
+		// arrays sourced from the buffer must be respecified anyway
+		for (int j = 0; j < GLU_ARRAY_COUNT; j++) {
+			if (shadow.arrays[j].buffer == buffers[i])
+				shadow.arrays[j].buffer = UNKNOWN;
+		}
+	}
+
+	next_glDeleteBuffers(n, buffers);
+}
+
+static void glBindFramebufferOES_glst(GLenum target, GLuint framebuffer)
+{
+	if (update(GLST_CALL_BIND_FRAMEBUFFER, &shadow.framebuffer, framebuffer))
+		next_glBindFramebufferOES(target, framebuffer);
+}
+
+static void glBlendFunc_glst(GLenum sfactor, GLenum dfactor)
+{
+	if (shadow.blendSrc == sfactor && shadow.blendDst == dfactor) {
+		filter(GLST_CALL_BLEND_FUNC);
+		return;
+	}
+
+	shadow.blendSrc = sfactor;
+	shadow.blendDst = dfactor;
+	forward(GLST_CALL_BLEND_FUNC);
+	next_glBlendFunc(sfactor, dfactor);
+}
+
+static void glDepthFunc_glst(GLenum func)
+{
+	if (update(GLST_CALL_DEPTH_FUNC, &shadow.depthFunc, func))
+		next_glDepthFunc(func);
+}
+
+static void glDepthMask_glst(GLboolean flag)
+{
+	if (update(GLST_CALL_DEPTH_MASK, &shadow.depthMask, flag ? GL_TRUE : GL_FALSE))
+		next_glDepthMask(flag);
+}
+
+static void glAlphaFunc_glst(GLenum func, int ref)
+{
+	if (shadow.alphaFunc == func && shadow.alphaRef == (uint32_t)ref) {
+		filter(GLST_CALL_ALPHA_FUNC);
+		return;
+	}
+
+	shadow.alphaFunc = func;
+	shadow.alphaRef = ref;
+	forward(GLST_CALL_ALPHA_FUNC);
+	next_glAlphaFunc(func, ref);
+}
+
+static void glCullFace_glst(GLenum mode)
+{
+	if (update(GLST_CALL_CULL_FACE, &shadow.cullFace, mode))
+		next_glCullFace(mode);
+}
+
+static void glFrontFace_glst(GLenum mode)
+{
+	if (update(GLST_CALL_FRONT_FACE, &shadow.frontFace, mode))
+		next_glFrontFace(mode);
+}
+
+static void glColorMask_glst(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	uint32_t mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+
+	if (update(GLST_CALL_COLOR_MASK, &shadow.colorMask, mask))
+		next_glColorMask(red, green, blue, alpha);
+}
+
+static void glStencilFunc_glst(GLenum func, GLint ref, GLuint mask)
+{
+	if (shadow.stencilFunc == func && shadow.stencilRef == (uint32_t)ref && shadow.stencilMask == mask) {
+		filter(GLST_CALL_STENCIL_FUNC);
+		return;
+	}
+
+	shadow.stencilFunc = func;
+	shadow.stencilRef = ref;
+	shadow.stencilMask = mask;
+	forward(GLST_CALL_STENCIL_FUNC);
+	next_glStencilFunc(func, ref, mask);
+}
+
+static void glStencilOp_glst(GLenum fail, GLenum zfail, GLenum zpass)
+{
+	if (shadow.stencilFail == fail && shadow.stencilZFail == zfail && shadow.stencilZPass == zpass) {
+		filter(GLST_CALL_STENCIL_OP);
+		return;
+	}
+
+	shadow.stencilFail = fail;
+	shadow.stencilZFail = zfail;
+	shadow.stencilZPass = zpass;
+	forward(GLST_CALL_STENCIL_OP);
+	next_glStencilOp(fail, zfail, zpass);
+}
+
+static int rect_changed(int call, uint32_t *rect, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (rect[0] == (uint32_t)x && rect[1] == (uint32_t)y && rect[2] == (uint32_t)width && rect[3] == (uint32_t)height)
+		return filter(call);
+
+	rect[0] = x;
+	rect[1] = y;
+	rect[2] = width;
+	rect[3] = height;
+
+	return forward(call);
+}
+
+static void glScissor_glst(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (rect_changed(GLST_CALL_SCISSOR, shadow.scissor, x, y, width, height))
+		next_glScissor(x, y, width, height);
+}
+
+static void glViewport_glst(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (rect_changed(GLST_CALL_VIEWPORT, shadow.viewport, x, y, width, height))
+		next_glViewport(x, y, width, height);
+}
+
+static void glMatrixMode_glst(GLenum mode)
+{
+	if (update(GLST_CALL_MATRIX_MODE, &shadow.matrixMode, mode))
+		next_glMatrixMode(mode);
+}
+
+static void glTexEnvf_glst(GLenum target, GLenum pname, int param)
+{
+	float value;
+
+	// softfp, the float arrives as its bits
+	sceClibMemcpy(&value, &param, sizeof(value));
+
+	// only the env mode is shadowed, it is by far the most repeated one
+	if (target != GL_TEXTURE_ENV || pname != GL_TEXTURE_ENV_MODE || shadow.activeTexture >= GLU_MAX_TEX_UNITS) {
+		forward(GLST_CALL_TEX_ENV);
+		next_glTexEnvf(target, pname, param);
+	} else if (update(GLST_CALL_TEX_ENV, &shadow.texEnvMode[shadow.activeTexture], (uint32_t)value)) {
+		next_glTexEnvf(target, pname, param);
+	}
+}
+
+// the mode can be set through either entry point, both keep the shadow
+static void glTexEnvfv_glst(GLenum target, GLenum pname, const GLfloat *params)
+{
+	if (target != GL_TEXTURE_ENV || pname != GL_TEXTURE_ENV_MODE || shadow.activeTexture >= GLU_MAX_TEX_UNITS) {
+		forward(GLST_CALL_TEX_ENV);
+		next_glTexEnvfv(target, pname, params);
+	} else if (update(GLST_CALL_TEX_ENV, &shadow.texEnvMode[shadow.activeTexture], (uint32_t)params[0])) {
+		next_glTexEnvfv(target, pname, params);
+	}
+}
+
+static void glVertexPointer_glst(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (array_changed(GLST_CALL_VERTEX_POINTER, &shadow.arrays[GLU_ARRAY_VERTEX], size, type, stride, pointer))
+		next_glVertexPointer(size, type, stride, pointer);
+}
+
+static void glColorPointer_glst(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (array_changed(GLST_CALL_COLOR_POINTER, &shadow.arrays[GLU_ARRAY_COLOR], size, type, stride, pointer))
+		next_glColorPointer(size, type, stride, pointer);
+}
+
+static void glNormalPointer_glst(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (array_changed(GLST_CALL_NORMAL_POINTER, &shadow.arrays[GLU_ARRAY_NORMAL], 3, type, stride, pointer))
+		next_glNormalPointer(type, stride, pointer);
+}
+
+static void glTexCoordPointer_glst(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	if (shadow.clientActiveTexture >= GLU_MAX_TEX_UNITS) {
+		forward(GLST_CALL_TEX_COORD_POINTER);
+		next_glTexCoordPointer(size, type, stride, pointer);
+	} else if (array_changed(GLST_CALL_TEX_COORD_POINTER, &shadow.arrays[GLU_ARRAY_TEX_COORD + shadow.clientActiveTexture], size, type, stride, pointer)) {
+		next_glTexCoordPointer(size, type, stride, pointer);
+	}
+}
+
+#define GLST_HOOK(name, hook) \
+	ret = symt_hook(table, #name, (uintptr_t)&hook, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int glst_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	GLST_HOOK(glEnable, glEnable_glst);
+	GLST_HOOK(glDisable, glDisable_glst);
+	GLST_HOOK(glEnableClientState, glEnableClientState_glst);
+	GLST_HOOK(glDisableClientState, glDisableClientState_glst);
+	GLST_HOOK(glActiveTexture, glActiveTexture_glst);
+	GLST_HOOK(glClientActiveTexture, glClientActiveTexture_glst);
+	GLST_HOOK(glBindTexture, glBindTexture_glst);
+	GLST_HOOK(glDeleteTextures, glDeleteTextures_glst);
+	GLST_HOOK(glBindBuffer, glBindBuffer_glst);
+	GLST_HOOK(glDeleteBuffers, glDeleteBuffers_glst);
+	GLST_HOOK(glBindFramebufferOES, glBindFramebufferOES_glst);
+	GLST_HOOK(glBlendFunc, glBlendFunc_glst);
+	GLST_HOOK(glDepthFunc, glDepthFunc_glst);
+	GLST_HOOK(glDepthMask, glDepthMask_glst);
+	GLST_HOOK(glAlphaFunc, glAlphaFunc_glst);
+	GLST_HOOK(glCullFace, glCullFace_glst);
+	GLST_HOOK(glFrontFace, glFrontFace_glst);
+	GLST_HOOK(glColorMask, glColorMask_glst);
+	GLST_HOOK(glStencilFunc, glStencilFunc_glst);
+	GLST_HOOK(glStencilOp, glStencilOp_glst);
+	GLST_HOOK(glScissor, glScissor_glst);
+	GLST_HOOK(glViewport, glViewport_glst);
+	GLST_HOOK(glMatrixMode, glMatrixMode_glst);
+	GLST_HOOK(glTexEnvf, glTexEnvf_glst);
+	GLST_HOOK(glTexEnvfv, glTexEnvfv_glst);
+	GLST_HOOK(glVertexPointer, glVertexPointer_glst);
+	GLST_HOOK(glColorPointer, glColorPointer_glst);
+	GLST_HOOK(glNormalPointer, glNormalPointer_glst);
+	GLST_HOOK(glTexCoordPointer, glTexCoordPointer_glst);
+
+	sceClibMemset(&stats, 0, sizeof(GlStateStats));
+	stats_hist_reset(&stats.forwardedPerFrame);
+	stats_hist_reset(&stats.filteredPerFrame);
+
+	glst_invalidate();
+
+	return stats_register_dump(glst_dump);
+}
+
+void glst_invalidate(void)
+{
+	sceClibMemset(&shadow, 0xFF, sizeof(ShadowState));
+}
+
+void glst_end_frame(void)
+{
+	stats_hist_add(&stats.forwardedPerFrame, stats.frameForwarded);
+	stats_hist_add(&stats.filteredPerFrame, stats.frameFiltered);
+	stats.frameForwarded = 0;
+	stats.frameFiltered = 0;
+	stats.frames++;
+}
+
+const GlStateStats *glst_get_stats(void)
+{
+	return &stats;
+}
+
+void glst_dump(void)
+{
+	static const char *call_names[GLST_CALL_COUNT] = {
+		"glEnable",
+		"glDisable",
+		"glEnableClientState",
+		"glDisableClientState",
+		"glActiveTexture",
+		"glClientActiveTexture",
+		"glBindTexture",
+		"glBindBuffer",
+		"glBindFramebufferOES",
+		"glBlendFunc",
+		"glDepthFunc",
+		"glDepthMask",
+		"glAlphaFunc",
+		"glCullFace",
+		"glFrontFace",
+		"glColorMask",
+		"glStencilFunc",
+		"glStencilOp",
+		"glScissor",
+		"glViewport",
+		"glMatrixMode",
+		"glTexEnvf",
+		"glVertexPointer",
+		"glColorPointer",
+		"glNormalPointer",
+		"glTexCoordPointer",
+	};
+	SceUID fd;
+
+	fd = stats_file_open("gl_state.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "frames,%u\n", stats.frames);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "forwarded_per_frame", &stats.forwardedPerFrame);
+	stats_file_write_hist(fd, "filtered_per_frame", &stats.filteredPerFrame);
+
+	stats_file_printf(fd, "call,forwarded,filtered\n");
+	for (int i = 0; i < GLST_CALL_COUNT; i++)
+		stats_file_printf(fd, "%s,%u,%u\n", call_names[i], stats.forwarded[i], stats.filtered[i]);
+
+	stats_file_close(fd);
+}
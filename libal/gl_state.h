@@ -0,0 +1,62 @@
+#ifndef __GL_STATE_H__
+#define __GL_STATE_H__
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+enum {
+	GLST_CALL_ENABLE = 0,
+	GLST_CALL_DISABLE,
+	GLST_CALL_ENABLE_CLIENT_STATE,
+	GLST_CALL_DISABLE_CLIENT_STATE,
+	GLST_CALL_ACTIVE_TEXTURE,
+	GLST_CALL_CLIENT_ACTIVE_TEXTURE,
+	GLST_CALL_BIND_TEXTURE,
+	GLST_CALL_BIND_BUFFER,
+	GLST_CALL_BIND_FRAMEBUFFER,
+	GLST_CALL_BLEND_FUNC,
+	GLST_CALL_DEPTH_FUNC,
+	GLST_CALL_DEPTH_MASK,
+	GLST_CALL_ALPHA_FUNC,
+	GLST_CALL_CULL_FACE,
+	GLST_CALL_FRONT_FACE,
+	GLST_CALL_COLOR_MASK,
+	GLST_CALL_STENCIL_FUNC,
+	GLST_CALL_STENCIL_OP,
+	GLST_CALL_SCISSOR,
+	GLST_CALL_VIEWPORT,
+	GLST_CALL_MATRIX_MODE,
+	GLST_CALL_TEX_ENV,
+	GLST_CALL_VERTEX_POINTER,
+	GLST_CALL_COLOR_POINTER,
+	GLST_CALL_NORMAL_POINTER,
+	GLST_CALL_TEX_COORD_POINTER,
+
+	GLST_CALL_COUNT
+};
+
+typedef struct {
+	uint32_t frames;
+	uint32_t frameForwarded;
+	uint32_t frameFiltered;
+	uint32_t forwarded[GLST_CALL_COUNT];
+	uint32_t filtered[GLST_CALL_COUNT];
+	StatsHist forwardedPerFrame;
+	StatsHist filteredPerFrame;
+} GlStateStats;
+
+int glst_bind(Symtable *table);
+void glst_invalidate(void);
+void glst_end_frame(void);
+const GlStateStats *glst_get_stats(void);
+void glst_dump(void);
+
+void glEnable_glst(GLenum cap);
+void glDisable_glst(GLenum cap);
+
+#endif
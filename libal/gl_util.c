@@ -0,0 +1,213 @@
+/* gl_util.c -- helpers for GL issued by the loader itself
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Loader-side drawing (overlay, upscale blit) runs in the middle of the
+// game's GL stream. glu_save_state captures everything such code is allowed
+// to touch and pushes both matrix stacks, glu_restore_state puts it all back
+// so neither the engine nor the GL layers shadowing its state notice.
+//
+// The size and array helpers are shared by the GL layers that look at the
+// game's client arrays and texture uploads.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "gl_util.h"
+#include "so_util.h"
+
+uint32_t glu_type_size(GLenum type)
+{
+	switch (type) {
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+uint32_t glu_pixel_size(GLenum format, GLenum type)
+{
+	if (type != GL_UNSIGNED_BYTE)
+		return 2;
+
+	switch (format) {
+	case GL_ALPHA:
+	case GL_LUMINANCE:
+		return 1;
+	case GL_LUMINANCE_ALPHA:
+		return 2;
+	case GL_RGB:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+// client storage read by glTexImage2D, rows are 4 byte aligned as the game
+// has no way to change GL_UNPACK_ALIGNMENT
+uint32_t glu_image_size(GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+	uint32_t row;
+
+	if (width <= 0 || height <= 0)
+		return 0;
+
+	row = width * glu_pixel_size(format, type);
+	return ALIGN_MEM(row, 4) * (height - 1) + row;
+}
+
+// GLU_ARRAY_* of array, texture coordinates are those of clientTexture,
+// -1 for anything else
+int glu_array_index(GLenum array, uint32_t clientTexture)
+{
+	switch (array) {
+	case GL_VERTEX_ARRAY:			return GLU_ARRAY_VERTEX;
+	case GL_COLOR_ARRAY:			return GLU_ARRAY_COLOR;
+	case GL_NORMAL_ARRAY:			return GLU_ARRAY_NORMAL;
+	case GL_TEXTURE_COORD_ARRAY:
+		if (clientTexture < GLU_MAX_TEX_UNITS)
+			return GLU_ARRAY_TEX_COORD + clientTexture;
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+void glu_set_cap(GLenum cap, GLboolean enable)
+{
+	if (enable)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+void glu_set_client_cap(GLenum cap, GLboolean enable)
+{
+	if (enable)
+		glEnableClientState(cap);
+	else
+		glDisableClientState(cap);
+}
+
+void glu_save_state(GlSavedState *s)
+{
+	glGetIntegerv(GL_VIEWPORT, s->viewport);
+	glGetIntegerv(GL_MATRIX_MODE, &s->matrixMode);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_OES, &s->framebuffer);
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &s->arrayBuffer);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &s->activeTexture);
+	glGetIntegerv(GL_CLIENT_ACTIVE_TEXTURE, &s->clientActiveTexture);
+	glGetIntegerv(GL_MAX_TEXTURE_UNITS, &s->numTexUnits);
+	glGetIntegerv(GL_BLEND_SRC, &s->blendSrc);
+	glGetIntegerv(GL_BLEND_DST, &s->blendDst);
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &s->depthMask);
+	glGetBooleanv(GL_COLOR_WRITEMASK, s->colorMask);
+
+	if (s->numTexUnits > GLU_MAX_TEX_UNITS)
+		s->numTexUnits = GLU_MAX_TEX_UNITS;
+
+	for (int i = 0; i < s->numTexUnits; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		s->texture2D[i] = glIsEnabled(GL_TEXTURE_2D);
+		s->texCoordArray[i] = glIsEnabled(GL_TEXTURE_COORD_ARRAY);
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &s->textureBinding[i]);
+		glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &s->texEnvMode[i]);
+		glGetIntegerv(GL_TEXTURE_COORD_ARRAY_BUFFER_BINDING, &s->texCoordBuffer[i]);
+		glGetIntegerv(GL_TEXTURE_COORD_ARRAY_SIZE, &s->texCoordSize[i]);
+		glGetIntegerv(GL_TEXTURE_COORD_ARRAY_TYPE, &s->texCoordType[i]);
+		glGetIntegerv(GL_TEXTURE_COORD_ARRAY_STRIDE, &s->texCoordStride[i]);
+		glGetPointerv(GL_TEXTURE_COORD_ARRAY_POINTER, &s->texCoordPointer[i]);
+	}
+
+	s->blend = glIsEnabled(GL_BLEND);
+	s->depthTest = glIsEnabled(GL_DEPTH_TEST);
+	s->cullFace = glIsEnabled(GL_CULL_FACE);
+	s->alphaTest = glIsEnabled(GL_ALPHA_TEST);
+	s->scissorTest = glIsEnabled(GL_SCISSOR_TEST);
+	s->stencilTest = glIsEnabled(GL_STENCIL_TEST);
+	s->lighting = glIsEnabled(GL_LIGHTING);
+	s->fog = glIsEnabled(GL_FOG);
+
+	s->vertexArray = glIsEnabled(GL_VERTEX_ARRAY);
+	s->colorArray = glIsEnabled(GL_COLOR_ARRAY);
+	s->normalArray = glIsEnabled(GL_NORMAL_ARRAY);
+
+	glGetIntegerv(GL_VERTEX_ARRAY_BUFFER_BINDING, &s->vertexBuffer);
+	glGetIntegerv(GL_VERTEX_ARRAY_SIZE, &s->vertexSize);
+	glGetIntegerv(GL_VERTEX_ARRAY_TYPE, &s->vertexType);
+	glGetIntegerv(GL_VERTEX_ARRAY_STRIDE, &s->vertexStride);
+	glGetPointerv(GL_VERTEX_ARRAY_POINTER, &s->vertexPointer);
+
+	glGetIntegerv(GL_COLOR_ARRAY_BUFFER_BINDING, &s->colorBuffer);
+	glGetIntegerv(GL_COLOR_ARRAY_SIZE, &s->colorSize);
+	glGetIntegerv(GL_COLOR_ARRAY_TYPE, &s->colorType);
+	glGetIntegerv(GL_COLOR_ARRAY_STRIDE, &s->colorStride);
+	glGetPointerv(GL_COLOR_ARRAY_POINTER, &s->colorPointer);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+}
+
+void glu_restore_state(const GlSavedState *s)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, s->vertexBuffer);
+	glVertexPointer(s->vertexSize, s->vertexType, s->vertexStride, s->vertexPointer);
+	glBindBuffer(GL_ARRAY_BUFFER, s->colorBuffer);
+	glColorPointer(s->colorSize, s->colorType, s->colorStride, s->colorPointer);
+
+	glu_set_client_cap(GL_VERTEX_ARRAY, s->vertexArray);
+	glu_set_client_cap(GL_COLOR_ARRAY, s->colorArray);
+	glu_set_client_cap(GL_NORMAL_ARRAY, s->normalArray);
+
+	for (int i = 0; i < s->numTexUnits; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		glu_set_cap(GL_TEXTURE_2D, s->texture2D[i]);
+		glu_set_client_cap(GL_TEXTURE_COORD_ARRAY, s->texCoordArray[i]);
+		glBindTexture(GL_TEXTURE_2D, s->textureBinding[i]);
+		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, s->texEnvMode[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, s->texCoordBuffer[i]);
+		glTexCoordPointer(s->texCoordSize[i], s->texCoordType[i], s->texCoordStride[i], s->texCoordPointer[i]);
+	}
+	glActiveTexture(s->activeTexture);
+	glClientActiveTexture(s->clientActiveTexture);
+	glBindBuffer(GL_ARRAY_BUFFER, s->arrayBuffer);
+
+	glu_set_cap(GL_BLEND, s->blend);
+	glu_set_cap(GL_DEPTH_TEST, s->depthTest);
+	glu_set_cap(GL_CULL_FACE, s->cullFace);
+	glu_set_cap(GL_ALPHA_TEST, s->alphaTest);
+	glu_set_cap(GL_SCISSOR_TEST, s->scissorTest);
+	glu_set_cap(GL_STENCIL_TEST, s->stencilTest);
+	glu_set_cap(GL_LIGHTING, s->lighting);
+	glu_set_cap(GL_FOG, s->fog);
+
+	glBlendFunc(s->blendSrc, s->blendDst);
+	glDepthMask(s->depthMask);
+	glColorMask(s->colorMask[0], s->colorMask[1], s->colorMask[2], s->colorMask[3]);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glMatrixMode(s->matrixMode);
+
+	glViewport(s->viewport[0], s->viewport[1], s->viewport[2], s->viewport[3]);
+	glBindFramebufferOES(GL_FRAMEBUFFER_OES, s->framebuffer);
+}
@@ -0,0 +1,68 @@
+#ifndef __GL_UTIL_H__
+#define __GL_UTIL_H__
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#define GLU_MAX_TEX_UNITS	4
+
+// client arrays as the GL layers index them, the same order as GLCAP_ARRAY_*
+enum {
+	GLU_ARRAY_VERTEX = 0,
+	GLU_ARRAY_COLOR,
+	GLU_ARRAY_NORMAL,
+	GLU_ARRAY_TEX_COORD,	// per texture unit, must stay last
+	GLU_ARRAY_COUNT = GLU_ARRAY_TEX_COORD + GLU_MAX_TEX_UNITS
+};
+
+typedef struct {
+	GLint viewport[4];
+	GLint matrixMode;
+	GLint framebuffer;
+	GLint arrayBuffer;
+	GLint activeTexture;
+	GLint clientActiveTexture;
+	GLint numTexUnits;
+	GLint blendSrc;
+	GLint blendDst;
+	GLboolean depthMask;
+	GLboolean colorMask[4];
+
+	GLboolean texture2D[GLU_MAX_TEX_UNITS];
+	GLint textureBinding[GLU_MAX_TEX_UNITS];
+	GLint texEnvMode[GLU_MAX_TEX_UNITS];
+	GLboolean blend;
+	GLboolean depthTest;
+	GLboolean cullFace;
+	GLboolean alphaTest;
+	GLboolean scissorTest;
+	GLboolean stencilTest;
+	GLboolean lighting;
+	GLboolean fog;
+
+	GLboolean vertexArray;
+	GLboolean colorArray;
+	GLboolean normalArray;
+	GLboolean texCoordArray[GLU_MAX_TEX_UNITS];
+
+	GLint vertexBuffer, vertexSize, vertexType, vertexStride;
+	GLvoid *vertexPointer;
+	GLint colorBuffer, colorSize, colorType, colorStride;
+	GLvoid *colorPointer;
+	GLint texCoordBuffer[GLU_MAX_TEX_UNITS], texCoordSize[GLU_MAX_TEX_UNITS], texCoordType[GLU_MAX_TEX_UNITS], texCoordStride[GLU_MAX_TEX_UNITS];
+	GLvoid *texCoordPointer[GLU_MAX_TEX_UNITS];
+} GlSavedState;
+
+void glu_save_state(GlSavedState *s);
+void glu_restore_state(const GlSavedState *s);
+void glu_set_cap(GLenum cap, GLboolean enable);
+void glu_set_client_cap(GLenum cap, GLboolean enable);
+
+uint32_t glu_type_size(GLenum type);
+uint32_t glu_pixel_size(GLenum format, GLenum type);
+uint32_t glu_image_size(GLsizei width, GLsizei height, GLenum format, GLenum type);
+int glu_array_index(GLenum array, uint32_t clientTexture);
+
+#endif
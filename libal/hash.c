@@ -0,0 +1,48 @@
+/* hash.c -- content hashing for the caching layers
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <kernel.h>
+
+#include "hash.h"
+
+static inline uint32_t rotl(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t fmix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+}
+
+// two independent murmur3 style lanes, fast enough to run over every upload
+uint64_t hash_data(const void *data, uint32_t size, uint32_t seed)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t h1 = seed, h2 = ~seed, k1, k2, i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		__builtin_memcpy(&k1, p + i, 4);
+		__builtin_memcpy(&k2, p + i + 4, 4);
+		h1 = rotl(h1 ^ rotl(k1 * 0xCC9E2D51, 15) * 0x1B873593, 13) * 5 + 0xE6546B64;
+		h2 = rotl(h2 ^ rotl(k2 * 0x1B873593, 16) * 0xCC9E2D51, 15) * 5 + 0x85EBCA6B;
+	}
+
+	for (; i < size; i++)
+		h1 = (h1 ^ p[i]) * 0x01000193;
+
+	h1 = fmix(h1 ^ size);
+	h2 = fmix(h2 ^ size);
+
+	return ((uint64_t)(h2 + h1) << 32) | (h1 + h2 * 3);
+}
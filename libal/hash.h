@@ -0,0 +1,8 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <kernel.h>
+
+uint64_t hash_data(const void *data, uint32_t size, uint32_t seed);
+
+#endif
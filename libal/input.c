@@ -0,0 +1,338 @@
+/* input.c -- ctrl/touch to Android input event translation
+ *
+ * Copyright (C) 2021 Andy Nguyen, GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Every button, stick axis and touch slot keeps the last value that was
+// reported to the engine and a new event is only generated when it changes.
+// A stick that returns to the deadzone reports a single stop event.
+//
+// Events are produced on the sampler thread and handed to main_thread
+// through a single producer/single consumer ring, so the engine only ever
+// sees input on its own thread, right before AppUpdate.
+//
+
+#include <kernel.h>
+#include <ctrl.h>
+#include <touch.h>
+
+#include "input.h"
+#include "input_replay.h"
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+
+enum {
+	ACTION_DOWN = 1,
+	ACTION_UP   = 2,
+	ACTION_MOVE = 3,
+};
+
+enum {
+	KEY_ACTION_DOWN = 0,
+	KEY_ACTION_UP   = 1,
+};
+
+enum {
+	AKEYCODE_DPAD_UP = 19,
+	AKEYCODE_DPAD_DOWN = 20,
+	AKEYCODE_DPAD_LEFT = 21,
+	AKEYCODE_DPAD_RIGHT = 22,
+	AKEYCODE_A = 29,
+	AKEYCODE_B = 30,
+	AKEYCODE_BUTTON_X = 99,
+	AKEYCODE_BUTTON_Y = 100,
+	AKEYCODE_BUTTON_L1 = 102,
+	AKEYCODE_BUTTON_R1 = 103,
+	AKEYCODE_BUTTON_START = 108,
+	AKEYCODE_BUTTON_SELECT = 109,
+};
+
+typedef struct {
+	uint32_t sce_button;
+	uint32_t android_button;
+} ButtonMapping;
+
+static ButtonMapping mapping[] = {
+	{ SCE_CTRL_UP,        AKEYCODE_DPAD_UP },
+	{ SCE_CTRL_DOWN,      AKEYCODE_DPAD_DOWN },
+	{ SCE_CTRL_LEFT,      AKEYCODE_DPAD_LEFT },
+	{ SCE_CTRL_RIGHT,     AKEYCODE_DPAD_RIGHT },
+	{ SCE_CTRL_CROSS,     AKEYCODE_A },
+	{ SCE_CTRL_CIRCLE,    AKEYCODE_B },
+	{ SCE_CTRL_SQUARE,    AKEYCODE_BUTTON_X },
+	{ SCE_CTRL_TRIANGLE,  AKEYCODE_BUTTON_Y },
+	{ SCE_CTRL_L,        AKEYCODE_BUTTON_L1 },
+	{ SCE_CTRL_R,        AKEYCODE_BUTTON_R1 },
+	{ SCE_CTRL_START,     AKEYCODE_BUTTON_START },
+	{ SCE_CTRL_SELECT,    AKEYCODE_BUTTON_SELECT },
+};
+
+static InputHandlers handlers;
+static InputStats stats;
+
+static InputEvent queue[INPUT_QUEUE_SIZE];
+static volatile uint32_t queue_head = 0;	// written by main_thread only
+static volatile uint32_t queue_tail = 0;	// written by the sampler only
+
+static uint32_t frame_index = 0;
+
+// raw stick value -> axis value as float bits, 0 inside the deadzone
+static int32_t stick_lut[256];
+
+static uint32_t old_buttons = 0;
+static uint32_t current_buttons = 0;
+static uint32_t pressed_buttons = 0;
+
+static int32_t last_touch_x[INPUT_MAX_TOUCH];
+static int32_t last_touch_y[INPUT_MAX_TOUCH];
+
+// last reported raw values with the deadzone applied, 128 is centre
+static uint8_t last_stick_x[INPUT_NUM_STICKS];
+static uint8_t last_stick_y[INPUT_NUM_STICKS];
+
+static void emit(uint8_t type, uint8_t action, uint8_t id, int32_t x, int32_t y, uint32_t timestamp)
+{
+	uint32_t tail = queue_tail;
+	InputEvent *ev;
+
+	if (tail - queue_head >= INPUT_QUEUE_SIZE) {
+		stats.dropped++;
+		return;
+	}
+
+	ev = &queue[tail & (INPUT_QUEUE_SIZE - 1)];
+	ev->type = type;
+	ev->action = action;
+	ev->id = id;
+	ev->reserved = 0;
+	ev->x = x;
+	ev->y = y;
+	ev->timestamp = timestamp;
+
+	// publish the entry before the new tail
+	__sync_synchronize();
+	queue_tail = tail + 1;
+}
+
+static uint8_t stick_deadzone(uint8_t raw)
+{
+	int v = (int)raw - 128;
+
+	if (v > -INPUT_STICK_DEADZONE && v < INPUT_STICK_DEADZONE)
+		return 128;
+
+	return raw;
+}
+
+static void process_stick(int id, uint8_t raw_x, uint8_t raw_y, uint32_t timestamp)
+{
+	uint8_t x = stick_deadzone(raw_x);
+	uint8_t y = stick_deadzone(raw_y);
+
+	if (x == last_stick_x[id] && y == last_stick_y[id])
+		return;
+
+	last_stick_x[id] = x;
+	last_stick_y[id] = y;
+
+	// centred sticks map to 0.0f so this doubles as the stop event
+	emit(INPUT_EVENT_JOYSTICK, ACTION_MOVE, id, stick_lut[x], stick_lut[y], timestamp);
+}
+
+int inp_init(const InputHandlers *h)
+{
+	if (h == NULL || h->onTouch == NULL || h->onJoystick == NULL || h->onKey == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	handlers = *h;
+
+	sceClibMemset(&stats, 0, sizeof(InputStats));
+	stats_hist_reset(&stats.latency);
+
+	queue_head = queue_tail = 0;
+	frame_index = 0;
+
+#ifdef INPUT_RECORD_REPLAY
+	irp_init();
+#endif
+
+	for (int i = 0; i < 256; i++) {
+		float f = (float)(i - 128) / 128.0f;
+		if (stick_deadzone(i) == 128)
+			f = 0.0f;
+		stick_lut[i] = *(int32_t *)&f;
+	}
+
+	for (int i = 0; i < INPUT_MAX_TOUCH; i++) {
+		last_touch_x[i] = -1;
+		last_touch_y[i] = -1;
+	}
+
+	for (int i = 0; i < INPUT_NUM_STICKS; i++) {
+		last_stick_x[i] = 128;
+		last_stick_y[i] = 128;
+	}
+
+	old_buttons = current_buttons = pressed_buttons = 0;
+
+	return stats_register_dump(inp_dump);
+}
+
+void inp_process_touch(const SceTouchData *touch)
+{
+	uint32_t timestamp = (uint32_t)touch->timeStamp;
+
+	for (int i = 0; i < INPUT_MAX_TOUCH; i++) {
+		if (i < touch->reportNum) {
+			int32_t x = (int32_t)touch->report[i].x * SCREEN_W / 1920;
+			int32_t y = (int32_t)touch->report[i].y * SCREEN_H / 1088;
+
+			// the game has always been sent MOVE for a new touch and DOWN
+			// while it is held, only frames where nothing moved are dropped
+			if (last_touch_x[i] == -1 && last_touch_y[i] == -1)
+				emit(INPUT_EVENT_TOUCH, ACTION_MOVE, i, x, y, timestamp);
+			else if (x != last_touch_x[i] || y != last_touch_y[i])
+				emit(INPUT_EVENT_TOUCH, ACTION_DOWN, i, x, y, timestamp);
+
+			last_touch_x[i] = x;
+			last_touch_y[i] = y;
+		} else {
+			if (last_touch_x[i] != -1 || last_touch_y[i] != -1)
+				emit(INPUT_EVENT_TOUCH, ACTION_UP, i, last_touch_x[i], last_touch_y[i], timestamp);
+
+			last_touch_x[i] = -1;
+			last_touch_y[i] = -1;
+		}
+	}
+}
+
+void inp_process_pad(const SceCtrlData *pad)
+{
+	uint32_t timestamp = (uint32_t)pad->timeStamp;
+	uint32_t released_buttons;
+
+	stats.samples++;
+
+	old_buttons = current_buttons;
+	current_buttons = pad->buttons;
+	pressed_buttons = current_buttons & ~old_buttons;
+	released_buttons = ~current_buttons & old_buttons;
+
+	if (pressed_buttons | released_buttons) {
+		for (int i = 0; i < sizeof(mapping) / sizeof(ButtonMapping); i++) {
+			if (pressed_buttons & mapping[i].sce_button)
+				emit(INPUT_EVENT_KEY, KEY_ACTION_DOWN, 0, mapping[i].android_button, 0, timestamp);
+			if (released_buttons & mapping[i].sce_button)
+				emit(INPUT_EVENT_KEY, KEY_ACTION_UP, 0, mapping[i].android_button, 0, timestamp);
+		}
+	}
+
+	process_stick(0, pad->lx, pad->ly, timestamp);
+	process_stick(1, pad->rx, pad->ry, timestamp);
+}
+
+void inp_dispatch(const InputEvent *ev)
+{
+	if (ev->type >= INPUT_EVENT_TYPE_COUNT)
+		return;
+
+	stats.events[ev->type]++;
+
+	switch (ev->type) {
+	case INPUT_EVENT_TOUCH:
+		handlers.onTouch(ev->action, ev->x, ev->y, ev->id);
+		break;
+	case INPUT_EVENT_KEY:
+		handlers.onKey(ev->action, ev->x);
+		break;
+	case INPUT_EVENT_JOYSTICK:
+		handlers.onJoystick(ev->action, ev->x, ev->y, ev->id);
+		break;
+	default:
+		break;
+	}
+}
+
+int inp_flush(void)
+{
+	uint32_t head = queue_head;
+	uint32_t tail = queue_tail;
+	uint32_t frame = frame_index++;
+	uint32_t now;
+	int count = 0;
+
+#ifdef INPUT_RECORD_REPLAY
+	if (irp_is_replaying()) {
+		// live input is dropped for the whole replay
+		queue_head = tail;
+		return irp_frame(frame, inp_dispatch);
+	}
+
+	irp_frame(frame, inp_dispatch);
+#endif
+
+	if (head == tail)
+		return 0;
+
+	// read the entries only after seeing the tail that published them
+	__sync_synchronize();
+
+	now = (uint32_t)sceKernelGetSystemTimeWide();
+
+	while (head != tail) {
+		InputEvent *ev = &queue[head & (INPUT_QUEUE_SIZE - 1)];
+
+		stats_hist_add(&stats.latency, now - ev->timestamp);
+		inp_dispatch(ev);
+
+#ifdef INPUT_RECORD_REPLAY
+		irp_record(frame, ev);
+#endif
+
+		head++;
+		count++;
+	}
+
+	__sync_synchronize();
+	queue_head = head;
+
+	return count;
+}
+
+uint32_t inp_get_buttons(void)
+{
+	return current_buttons;
+}
+
+uint32_t inp_get_pressed(void)
+{
+	return pressed_buttons;
+}
+
+const InputStats *inp_get_stats(void)
+{
+	return &stats;
+}
+
+void inp_dump(void)
+{
+	SceUID fd = stats_file_open("input_stats.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "samples,%u\ndropped,%u\ntouch_events,%u\nkey_events,%u\njoystick_events,%u\n",
+		stats.samples,
+		stats.dropped,
+		stats.events[INPUT_EVENT_TOUCH],
+		stats.events[INPUT_EVENT_KEY],
+		stats.events[INPUT_EVENT_JOYSTICK]);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "latency_us", &stats.latency);
+
+	stats_file_close(fd);
+}
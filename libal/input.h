@@ -0,0 +1,70 @@
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include <kernel.h>
+#include <ctrl.h>
+#include <touch.h>
+
+#include "stats.h"
+
+#define INPUT_MAX_TOUCH		2
+#define INPUT_NUM_STICKS	2
+
+// deadzone in raw stick units around the 128 centre
+#define INPUT_STICK_DEADZONE	32
+
+// samples fetched per buffered read in the sampler thread
+#define INPUT_CTRL_BUFS		16
+#define INPUT_TOUCH_BUFS	8
+
+// events waiting for main_thread, must be a power of two
+#define INPUT_QUEUE_SIZE	256
+
+enum {
+	INPUT_EVENT_TOUCH = 0,
+	INPUT_EVENT_KEY = 1,
+	INPUT_EVENT_JOYSTICK = 2,
+
+	INPUT_EVENT_TYPE_COUNT
+};
+
+// Post-mapping event as handed to the engine. For touch x/y are screen
+// coordinates, for keys x holds the Android keycode and for joysticks x/y
+// hold the axis values as float bit patterns. timestamp is the low 32 bits
+// of the sample time, in system time microseconds.
+typedef struct {
+	uint8_t type;
+	uint8_t action;
+	uint8_t id;
+	uint8_t reserved;
+	int32_t x;
+	int32_t y;
+	uint32_t timestamp;
+} InputEvent;
+
+typedef struct {
+	int (* onTouch)(int type, int x, int y, int id);
+	int (* onJoystick)(int type, int x, int y, int id);
+	int (* onKey)(int type, int keycode);
+} InputHandlers;
+
+typedef struct {
+	uint32_t samples;
+	uint32_t dropped;
+	uint32_t events[INPUT_EVENT_TYPE_COUNT];
+	StatsHist latency;	// us from sample to delivery on main_thread
+} InputStats;
+
+int inp_init(const InputHandlers *handlers);
+void inp_process_pad(const SceCtrlData *pad);
+void inp_process_touch(const SceTouchData *touch);
+void inp_dispatch(const InputEvent *ev);
+int inp_flush(void);
+
+uint32_t inp_get_buttons(void);
+uint32_t inp_get_pressed(void);
+const InputStats *inp_get_stats(void);
+
+void inp_dump(void);
+
+#endif
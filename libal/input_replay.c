@@ -0,0 +1,159 @@
+/* input_replay.c -- deterministic input record/replay
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Frame 0 is the first AppUpdate after boot. If INPUT_PATH/replay.bin
+// exists the live input is discarded and the recorded events are delivered
+// on the same frames instead; once the recording is exhausted all stats are
+// dumped and live input takes over again. Otherwise the events delivered to
+// the engine are recorded and written to INPUT_PATH/record.bin together with
+// the other stats.
+//
+
+#include <kernel.h>
+
+#include "input_replay.h"
+#include "input.h"
+#include "stats.h"
+#include "so_util.h"
+#include "config.h"
+#include "al_error.h"
+
+static SceUID record_mbid = SCE_UID_INVALID_UID;
+static InputRecordEntry *entries = NULL;
+static uint32_t max_entries = 0;
+static uint32_t num_entries = 0;
+static uint32_t num_frames = 0;
+
+static int replaying = 0;
+static uint32_t replay_pos = 0;
+
+static int load_replay(void)
+{
+	InputRecordHeader hdr;
+	SceUID fd;
+	int res;
+
+	fd = sceIoOpen(INPUT_PATH "/" "replay.bin", SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	res = sceIoRead(fd, &hdr, sizeof(hdr));
+	if (res != sizeof(hdr) || hdr.magic != IRP_MAGIC || hdr.version != IRP_VERSION || hdr.count > max_entries) {
+		sceIoClose(fd);
+		return AL_ERROR_IRP_INVALID_RECORD;
+	}
+
+	res = sceIoRead(fd, entries, hdr.count * sizeof(InputRecordEntry));
+	sceIoClose(fd);
+
+	if (res != hdr.count * sizeof(InputRecordEntry))
+		return AL_ERROR_IRP_INVALID_RECORD;
+
+	num_entries = hdr.count;
+	num_frames = hdr.frames;
+
+	return AL_OK;
+}
+
+int irp_init(void)
+{
+	unsigned int size = ALIGN_MEM(INPUT_RECORD_MAX_EVENTS * sizeof(InputRecordEntry), SCE_KERNEL_4KiB);
+
+	record_mbid = sceKernelAllocMemBlock("AL::Input::Record", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, size, NULL);
+	if (record_mbid < 0)
+		return record_mbid;
+
+	sceKernelGetMemBlockBase(record_mbid, (void **)&entries);
+	max_entries = size / sizeof(InputRecordEntry);
+
+	num_entries = 0;
+	replay_pos = 0;
+	replaying = (load_replay() == AL_OK);
+
+	if (replaying)
+		return AL_OK;
+
+	return stats_register_dump(irp_dump);
+}
+
+int irp_is_replaying(void)
+{
+	return replaying;
+}
+
+void irp_record(uint32_t frame, const InputEvent *ev)
+{
+	InputRecordEntry *entry;
+
+	if (replaying || num_entries >= max_entries)
+		return;
+
+	entry = &entries[num_entries++];
+	entry->frame = frame;
+	entry->type = ev->type;
+	entry->action = ev->action;
+	entry->id = ev->id;
+	entry->reserved = 0;
+	entry->x = ev->x;
+	entry->y = ev->y;
+}
+
+int irp_frame(uint32_t frame, void (*dispatch)(const InputEvent *ev))
+{
+	InputEvent ev;
+	int count = 0;
+
+	if (!replaying) {
+		num_frames = frame + 1;
+		return 0;
+	}
+
+	while (replay_pos < num_entries && entries[replay_pos].frame <= frame) {
+		InputRecordEntry *entry = &entries[replay_pos++];
+
+		ev.type = entry->type;
+		ev.action = entry->action;
+		ev.id = entry->id;
+		ev.reserved = 0;
+		ev.x = entry->x;
+		ev.y = entry->y;
+		ev.timestamp = (uint32_t)sceKernelGetSystemTimeWide();
+
+		dispatch(&ev);
+		count++;
+	}
+
+	if (replay_pos >= num_entries && frame + 1 >= num_frames) {
+		replaying = 0;
+		stats_dump_all();
+	}
+
+	return count;
+}
+
+void irp_dump(void)
+{
+	InputRecordHeader hdr;
+	SceUID fd;
+
+	sceIoMkdir(INPUT_PATH, 0777);
+
+	fd = sceIoOpen(INPUT_PATH "/" "record.bin", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (fd < 0)
+		return;
+
+	hdr.magic = IRP_MAGIC;
+	hdr.version = IRP_VERSION;
+	hdr.count = num_entries;
+	hdr.frames = num_frames;
+
+	sceIoWrite(fd, &hdr, sizeof(hdr));
+	sceIoWrite(fd, entries, num_entries * sizeof(InputRecordEntry));
+	sceIoClose(fd);
+}
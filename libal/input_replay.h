@@ -0,0 +1,35 @@
+#ifndef __INPUT_REPLAY_H__
+#define __INPUT_REPLAY_H__
+
+#include <kernel.h>
+
+#include "input.h"
+
+#define IRP_MAGIC	0x43455249 // 'IREC'
+#define IRP_VERSION	1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t frames;
+} InputRecordHeader;
+
+typedef struct {
+	uint32_t frame;
+	uint8_t type;
+	uint8_t action;
+	uint8_t id;
+	uint8_t reserved;
+	int32_t x;
+	int32_t y;
+} InputRecordEntry;
+
+int irp_init(void);
+int irp_is_replaying(void);
+void irp_record(uint32_t frame, const InputEvent *ev);
+int irp_frame(uint32_t frame, void (*dispatch)(const InputEvent *ev));
+
+void irp_dump(void);
+
+#endif
@@ -0,0 +1,547 @@
+/* io_log.c -- log and time the game's file calls
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Every stdio and compat library file call the game makes is timed and
+// appended to a ring of IO_LOG_SIZE bytes with its path, size and result,
+// and added to a latency histogram for the operation and one for the path.
+// The hooks are bound last, so latencies are what the game sees, caches
+// included.
+//
+// Streams and directory handles are mapped back to the path they were
+// opened with, so reads and listings are attributed to files too. The
+// first IOLOG_MAX_FILES paths get an index, calls on later ones are logged
+// without.
+//
+// On a stats dump, io_log.csv gets the histograms and io_log.bin the ring,
+// oldest record first, for tools/iolog.c.
+//
+
+#include <kernel.h>
+
+#include <stdio.h>
+
+#include "io_log.h"
+#include "hash.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+typedef struct {
+	uint64_t key;
+	uint32_t path;
+	IoLogCounter counter;
+} IoLogFile;
+
+typedef struct {
+	void *handle;
+	uint16_t file;
+	uint8_t flags;
+} IoLogHandle;
+
+static const char *op_names[IOLG_NUM_OPS] = {
+	"fopen", "fread", "fwrite", "fseek", "ftell", "fgets", "fflush", "fclose",
+	"stat", "lstat", "opendir", "readdir", "closedir", "mkdir", "rmdir", "unlink"
+};
+
+static IoLogRecord *ring;
+static uint32_t ring_size = 0;
+static uint32_t ring_pos = 0;
+
+static IoLogFile *files;
+static char *paths;
+static uint32_t paths_used = 0;
+
+static IoLogHandle streams[IOLOG_MAX_STREAMS];
+static IoLogHandle dirs[IOLOG_MAX_DIRS];
+
+static SceKernelLwMutexWork lock;
+static SceUInt64 start_time = 0;
+static int running = 0;
+
+static IoLogStats stats;
+
+static FILE *(* next_fopen)(const char *filename, const char *mode);
+static size_t (* next_fread)(void *ptr, size_t size, size_t count, FILE *stream);
+static size_t (* next_fwrite)(const void *ptr, size_t size, size_t count, FILE *stream);
+static int (* next_fseek)(FILE *stream, long offset, int whence);
+static long (* next_ftell)(FILE *stream);
+static char *(* next_fgets)(char *str, int num, FILE *stream);
+static int (* next_fflush)(FILE *stream);
+static int (* next_fclose)(FILE *stream);
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+static int (* next_stat)(const char *path, void *buf);
+static int (* next_lstat)(const char *path, void *buf);
+static void *(* next_opendir)(const char *path);
+static int (* next_readdir_r)(void *dirp, void *entry, void **result);
+static void *(* next_readdir)(void *dirp);
+static int (* next_closedir)(void *dirp);
+static int (* next_mkdir)(const char *path, int mode);
+static int (* next_rmdir)(const char *path);
+static int (* next_unlink)(const char *path);
+#endif
+
+// called with the lock held, returns IOLG_NO_FILE once the table is full
+static uint16_t file_index(const char *path)
+{
+	uint32_t len = sceClibStrnlen(path, SCE_IO_MAX_PATH_LENGTH);
+	uint64_t key = hash_data(path, len, 0);
+
+	for (uint32_t i = 0; i < stats.files; i++) {
+		if (files[i].key == key)
+			return i;
+	}
+
+	if (stats.files == IOLOG_MAX_FILES || paths_used + len + 1 > IOLOG_PATH_BYTES) {
+		stats.untracked++;
+		return IOLG_NO_FILE;
+	}
+
+	files[stats.files].key = key;
+	files[stats.files].path = paths_used;
+	stats_hist_reset(&files[stats.files].counter.latency);
+	sceClibMemcpy(paths + paths_used, path, len);
+	paths[paths_used + len] = '\0';
+	paths_used += len + 1;
+
+	return stats.files++;
+}
+
+// called with the lock held
+static IoLogHandle *find_handle(IoLogHandle *table, int count, void *handle)
+{
+	for (int i = 0; i < count; i++) {
+		if (table[i].handle == handle)
+			return &table[i];
+	}
+
+	return NULL;
+}
+
+static inline void add_counter(IoLogCounter *c, uint32_t bytes, uint32_t latency)
+{
+	c->calls++;
+	c->bytes += bytes;
+	c->time += latency;
+	stats_hist_add(&c->latency, latency);
+}
+
+// called with the lock held
+static void record(int op, uint16_t file, uint8_t flags, int32_t result, uint32_t size, SceUInt64 start)
+{
+	SceUInt64 now = sceKernelGetProcessTimeWide();
+	uint32_t latency = (uint32_t)(now - start);
+	IoLogRecord *r = &ring[ring_pos % ring_size];
+
+	r->time = (uint32_t)(start - start_time);
+	r->latency = latency;
+	r->op = op;
+	r->flags = flags;
+	r->file = file;
+	r->result = result;
+	r->size = size;
+	ring_pos++;
+
+	// bytes requested, the size of an fseek is its offset
+	if (op == IOLG_FSEEK)
+		size = 0;
+
+	add_counter(&stats.ops[op], size, latency);
+	if (file != IOLG_NO_FILE)
+		add_counter(&files[file].counter, size, latency);
+
+	stats.records = ring_pos;
+}
+
+static void log_path(int op, const char *path, int32_t result, SceUInt64 start)
+{
+	if (!running || path == NULL)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	record(op, file_index(path), 0, result, 0, start);
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+static void log_stream(int op, FILE *stream, int32_t result, uint32_t size, SceUInt64 start)
+{
+	IoLogHandle *h;
+
+	if (!running)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	h = find_handle(streams, IOLOG_MAX_STREAMS, stream);
+	record(op, h ? h->file : IOLG_NO_FILE, h ? h->flags : 0, result, size, start);
+	if (op == IOLG_FCLOSE && h != NULL)
+		h->handle = NULL;
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+static FILE *fopen_iolog(const char *filename, const char *mode)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	FILE *f = next_fopen(filename, mode);
+	uint8_t flags;
+	uint16_t file;
+	IoLogHandle *h;
+
+	if (!running || filename == NULL)
+		return f;
+
+	flags = (mode != NULL && (mode[0] != 'r' || sceClibStrchr(mode, '+') != NULL)) ? IOLG_WRITE : 0;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	file = file_index(filename);
+	record(IOLG_FOPEN, file, flags, f != NULL ? 0 : -1, 0, start);
+
+	if (f != NULL) {
+		h = find_handle(streams, IOLOG_MAX_STREAMS, NULL);
+		if (h != NULL) {
+			h->handle = f;
+			h->file = file;
+			h->flags = flags;
+		}
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return f;
+}
+
+static size_t fread_iolog(void *ptr, size_t size, size_t count, FILE *stream)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	size_t ret = next_fread(ptr, size, count, stream);
+
+	log_stream(IOLG_FREAD, stream, ret, size * count, start);
+
+	return ret;
+}
+
+static size_t fwrite_iolog(const void *ptr, size_t size, size_t count, FILE *stream)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	size_t ret = next_fwrite(ptr, size, count, stream);
+
+	log_stream(IOLG_FWRITE, stream, ret, size * count, start);
+
+	return ret;
+}
+
+static int fseek_iolog(FILE *stream, long offset, int whence)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_fseek(stream, offset, whence);
+
+	log_stream(IOLG_FSEEK, stream, ret, offset, start);
+
+	return ret;
+}
+
+static long ftell_iolog(FILE *stream)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	long ret = next_ftell(stream);
+
+	log_stream(IOLG_FTELL, stream, ret, 0, start);
+
+	return ret;
+}
+
+static char *fgets_iolog(char *str, int num, FILE *stream)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	char *ret = next_fgets(str, num, stream);
+
+	log_stream(IOLG_FGETS, stream, ret != NULL ? 0 : -1, num, start);
+
+	return ret;
+}
+
+static int fflush_iolog(FILE *stream)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_fflush(stream);
+
+	log_stream(IOLG_FFLUSH, stream, ret, 0, start);
+
+	return ret;
+}
+
+static int fclose_iolog(FILE *stream)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_fclose(stream);
+
+	log_stream(IOLG_FCLOSE, stream, ret, 0, start);
+
+	return ret;
+}
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+
+static int stat_iolog(const char *path, void *buf)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_stat(path, buf);
+
+	log_path(IOLG_STAT, path, ret, start);
+
+	return ret;
+}
+
+static int lstat_iolog(const char *path, void *buf)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_lstat(path, buf);
+
+	log_path(IOLG_LSTAT, path, ret, start);
+
+	return ret;
+}
+
+static void *opendir_iolog(const char *path)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	void *dir = next_opendir(path);
+	IoLogHandle *h;
+	uint16_t file;
+
+	if (!running || path == NULL)
+		return dir;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	file = file_index(path);
+	record(IOLG_OPENDIR, file, 0, dir != NULL ? 0 : -1, 0, start);
+
+	if (dir != NULL) {
+		h = find_handle(dirs, IOLOG_MAX_DIRS, NULL);
+		if (h != NULL) {
+			h->handle = dir;
+			h->file = file;
+			h->flags = 0;
+		}
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return dir;
+}
+
+static void log_dir(int op, void *dirp, int32_t result, SceUInt64 start)
+{
+	IoLogHandle *h;
+
+	if (!running)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	h = find_handle(dirs, IOLOG_MAX_DIRS, dirp);
+	record(op, h ? h->file : IOLG_NO_FILE, 0, result, 0, start);
+	if (op == IOLG_CLOSEDIR && h != NULL)
+		h->handle = NULL;
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+static int readdir_r_iolog(void *dirp, void *entry, void **result)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_readdir_r(dirp, entry, result);
+
+	log_dir(IOLG_READDIR, dirp, ret == 0 && *result == NULL ? 1 : ret, start);
+
+	return ret;
+}
+
+static void *readdir_iolog(void *dirp)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	void *ret = next_readdir(dirp);
+
+	log_dir(IOLG_READDIR, dirp, ret != NULL ? 0 : 1, start);
+
+	return ret;
+}
+
+static int closedir_iolog(void *dirp)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_closedir(dirp);
+
+	log_dir(IOLG_CLOSEDIR, dirp, ret, start);
+
+	return ret;
+}
+
+static int mkdir_iolog(const char *path, int mode)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_mkdir(path, mode);
+
+	log_path(IOLG_MKDIR, path, ret, start);
+
+	return ret;
+}
+
+static int rmdir_iolog(const char *path)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_rmdir(path);
+
+	log_path(IOLG_RMDIR, path, ret, start);
+
+	return ret;
+}
+
+static int unlink_iolog(const char *path)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	int ret = next_unlink(path);
+
+	log_path(IOLG_UNLINK, path, ret, start);
+
+	return ret;
+}
+
+#endif
+
+#define IOLOG_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_iolog, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int iolog_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	IOLOG_HOOK(fopen);
+	IOLOG_HOOK(fread);
+	IOLOG_HOOK(fwrite);
+	IOLOG_HOOK(fseek);
+	IOLOG_HOOK(ftell);
+	IOLOG_HOOK(fgets);
+	IOLOG_HOOK(fflush);
+	IOLOG_HOOK(fclose);
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	IOLOG_HOOK(stat);
+	IOLOG_HOOK(lstat);
+	IOLOG_HOOK(opendir);
+	IOLOG_HOOK(readdir_r);
+	IOLOG_HOOK(readdir);
+	IOLOG_HOOK(closedir);
+	IOLOG_HOOK(mkdir);
+	IOLOG_HOOK(rmdir);
+	IOLOG_HOOK(unlink);
+#endif
+
+	return AL_OK;
+}
+
+int iolog_start(void)
+{
+	uint32_t size = IO_LOG_SIZE + IOLOG_MAX_FILES * sizeof(IoLogFile) + IOLOG_PATH_BYTES;
+	SceUID mbid;
+	void *base;
+	int ret;
+
+	mbid = sceKernelAllocMemBlock("AL::IoLog::Ring", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(size, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, &base);
+	ring = (IoLogRecord *)base;
+	ring_size = IO_LOG_SIZE / sizeof(IoLogRecord);
+	files = (IoLogFile *)((uint8_t *)base + IO_LOG_SIZE);
+	paths = (char *)(files + IOLOG_MAX_FILES);
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::IoLog::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	sceClibMemset(&stats, 0, sizeof(IoLogStats));
+	for (int i = 0; i < IOLG_NUM_OPS; i++)
+		stats_hist_reset(&stats.ops[i].latency);
+
+	start_time = sceKernelGetProcessTimeWide();
+	running = 1;
+
+	return stats_register_dump(iolog_dump);
+}
+
+const IoLogStats *iolog_get_stats(void)
+{
+	return &stats;
+}
+
+void iolog_dump(void)
+{
+	IoLogHeader hdr;
+	uint32_t first, count, bytes, numFiles;
+	SceUID fd;
+
+	fd = stats_file_open("io_log.csv");
+	if (fd >= 0) {
+		stats_file_printf(fd, "records,%u\n", stats.records);
+		stats_file_printf(fd, "files,%u\n", stats.files);
+		stats_file_printf(fd, "untracked_calls,%u\n", stats.untracked);
+
+		stats_file_printf(fd, "op,calls,bytes,total_us\n");
+		for (int i = 0; i < IOLG_NUM_OPS; i++) {
+			if (stats.ops[i].calls > 0)
+				stats_file_printf(fd, "%s,%u,%llu,%llu\n", op_names[i], stats.ops[i].calls, stats.ops[i].bytes, stats.ops[i].time);
+		}
+
+		stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+		for (int i = 0; i < IOLG_NUM_OPS; i++) {
+			if (stats.ops[i].calls > 0)
+				stats_file_write_hist(fd, op_names[i], &stats.ops[i].latency);
+		}
+
+		stats_file_printf(fd, "file,calls,bytes,total_us\n");
+		for (uint32_t i = 0; i < stats.files; i++)
+			stats_file_printf(fd, "%s,%u,%llu,%llu\n", paths + files[i].path, files[i].counter.calls, files[i].counter.bytes, files[i].counter.time);
+
+		stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+		for (uint32_t i = 0; i < stats.files; i++)
+			stats_file_write_hist(fd, paths + files[i].path, &files[i].counter.latency);
+
+		stats_file_close(fd);
+	}
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	count = ring_pos < ring_size ? ring_pos : ring_size;
+	first = (ring_pos - count) % ring_size;
+	hdr.dropped = ring_pos - count;
+	numFiles = stats.files;
+	bytes = numFiles > 0 ? files[numFiles - 1].path + sceClibStrnlen(paths + files[numFiles - 1].path, SCE_IO_MAX_PATH_LENGTH) + 1 : 0;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	fd = stats_file_open("io_log.bin");
+	if (fd < 0)
+		return;
+
+	hdr.magic = IOLG_MAGIC;
+	hdr.version = IOLG_VERSION;
+	hdr.numFiles = numFiles;
+	hdr.numRecords = count;
+	hdr.pathBytes = bytes;
+	sceIoWrite(fd, &hdr, sizeof(hdr));
+	sceIoWrite(fd, paths, bytes);
+
+	// oldest record first, the game keeps logging meanwhile
+	if (first + count > ring_size) {
+		sceIoWrite(fd, &ring[first], (ring_size - first) * sizeof(IoLogRecord));
+		count -= ring_size - first;
+		first = 0;
+	}
+	sceIoWrite(fd, &ring[first], count * sizeof(IoLogRecord));
+
+	stats_file_close(fd);
+}
@@ -0,0 +1,37 @@
+#ifndef __IO_LOG_H__
+#define __IO_LOG_H__
+
+#include <kernel.h>
+
+#include "io_log_format.h"
+#include "symtable.h"
+#include "stats.h"
+
+// paths with their own histogram, later ones are counted as IOLG_NO_FILE
+#define IOLOG_MAX_FILES		256
+#define IOLOG_PATH_BYTES	(64 * 1024)
+
+// open streams and directories whose path is tracked
+#define IOLOG_MAX_STREAMS	64
+#define IOLOG_MAX_DIRS		16
+
+typedef struct {
+	uint32_t calls;
+	uint64_t bytes;
+	uint64_t time;
+	StatsHist latency;
+} IoLogCounter;
+
+typedef struct {
+	uint32_t records;
+	uint32_t files;
+	uint32_t untracked;
+	IoLogCounter ops[IOLG_NUM_OPS];
+} IoLogStats;
+
+int iolog_bind(Symtable *table);
+int iolog_start(void);
+const IoLogStats *iolog_get_stats(void);
+void iolog_dump(void);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __IO_LOG_FORMAT_H__
+#define __IO_LOG_FORMAT_H__
+
+//
+// Shared between libal and tools/iolog.c, keep it free of SDK headers.
+//
+// A log is an IoLogHeader, pathBytes of NUL terminated paths in file index
+// order and numRecords IoLogRecord entries, oldest first. All values are
+// little endian.
+//
+
+#include <stdint.h>
+
+#define IOLG_MAGIC		0x474C4F49 // 'IOLG'
+#define IOLG_VERSION	1
+
+// file index of calls whose path is not known
+#define IOLG_NO_FILE	0xFFFF
+
+enum {
+	IOLG_FOPEN = 0,
+	IOLG_FREAD,
+	IOLG_FWRITE,
+	IOLG_FSEEK,
+	IOLG_FTELL,
+	IOLG_FGETS,
+	IOLG_FFLUSH,
+	IOLG_FCLOSE,
+	IOLG_STAT,
+	IOLG_LSTAT,
+	IOLG_OPENDIR,
+	IOLG_READDIR,
+	IOLG_CLOSEDIR,
+	IOLG_MKDIR,
+	IOLG_RMDIR,
+	IOLG_UNLINK,
+	IOLG_NUM_OPS
+};
+
+// record flags
+#define IOLG_WRITE		1	// stream opened for writing
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numFiles;
+	uint32_t numRecords;
+	uint32_t pathBytes;
+	uint32_t dropped;		// records overwritten before the dump
+} IoLogHeader;
+
+typedef struct {
+	uint32_t time;			// microseconds since logging started
+	uint32_t latency;		// microseconds
+	uint8_t op;
+	uint8_t flags;
+	uint16_t file;
+	int32_t result;
+	uint32_t size;			// bytes requested, fseek offset
+} IoLogRecord;
+
+#endif
@@ -0,0 +1,431 @@
+/* load_trace.c -- record level load reads and prefetch them on later loads
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// The game has no load callback we could hook, so a load is taken to be a
+// burst of reads: it starts with the first read after LOAD_TRACE_IDLE_US
+// without any and ends once another LOAD_TRACE_IDLE_US pass quietly. The
+// first LDTR_KEY_READS reads (path, offset, length) identify the load, a
+// level is entered through the same files every time.
+//
+// Every read of a load is recorded through file_cache.c and saved to
+// LOAD_TRACE_PATH/<key>.bin once the load ends. When a load starts with a
+// key that has a trace, the trace thread replays the rest of it into the
+// block cache, staying at most LOAD_PREFETCH_WINDOW bytes ahead of what the
+// game has read so far so it does not evict blocks before they are used.
+//
+
+#include <kernel.h>
+
+#include "load_trace.h"
+#include "file_cache.h"
+#include "hash.h"
+#include "stats.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+typedef struct {
+	uint64_t path;
+	uint32_t offset;
+	uint32_t length;
+} LoadKeyRead;
+
+static LoadTraceRead *records;
+static LoadTraceRead *replay;
+static char *paths;
+static char *replay_paths;
+static char *save_paths;
+
+static uint64_t path_keys[LDTR_MAX_FILES];
+static uint32_t path_offsets[LDTR_MAX_FILES];
+static uint32_t replay_offsets[LDTR_MAX_FILES];
+static uint32_t save_map[LDTR_MAX_FILES];
+static uint32_t num_paths = 0;
+static uint32_t paths_used = 0;
+
+static SceKernelLwMutexWork lock;
+static SceUID wake_sema;
+static int running = 0;
+
+static int loading = 0;
+static SceUInt64 load_start = 0;
+static SceUInt64 last_read = 0;
+static uint32_t num_records = 0;
+static uint64_t load_key = 0;
+static volatile uint64_t load_bytes = 0;
+static volatile uint32_t generation = 0;
+static int save_pending = 0;
+static int replay_pending = 0;
+static LoadSummary *current = NULL;
+
+static LoadTraceStats stats;
+
+static uint64_t trace_key(void)
+{
+	LoadKeyRead key[LDTR_KEY_READS];
+
+	for (int i = 0; i < LDTR_KEY_READS; i++) {
+		key[i].path = path_keys[records[i].file];
+		key[i].offset = records[i].offset;
+		key[i].length = records[i].length;
+	}
+
+	return hash_data(key, sizeof(key), 0);
+}
+
+static void save_trace(void)
+{
+	LoadTraceHeader hdr;
+	uint32_t count, files = 0, bytes = 0, len;
+	char name[64];
+	SceUID fd;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	count = num_paths;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	for (uint32_t i = 0; i < count; i++)
+		save_map[i] = LDTR_NO_FILE;
+
+	// keep only the files this load read, numbered in first use order
+	for (uint32_t i = 0; i < num_records; i++) {
+		LoadTraceRead *r = &records[i];
+
+		if (save_map[r->file] == LDTR_NO_FILE) {
+			len = sceClibStrnlen(paths + path_offsets[r->file], LDTR_PATH_BYTES) + 1;
+			sceClibMemcpy(save_paths + bytes, paths + path_offsets[r->file], len);
+			bytes += len;
+			save_map[r->file] = files++;
+		}
+		r->file = save_map[r->file];
+	}
+
+	hdr.magic = LDTR_MAGIC;
+	hdr.version = LDTR_VERSION;
+	hdr.key = load_key;
+	hdr.numFiles = files;
+	hdr.numReads = num_records;
+	hdr.pathBytes = bytes;
+	hdr.duration = records[num_records - 1].time;
+
+	sceIoMkdir(LOAD_TRACE_PATH, 0777);
+
+	sceClibSnprintf(name, sizeof(name), LOAD_TRACE_PATH "/" "%016llX.bin", load_key);
+	fd = sceIoOpen(name, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (fd < 0)
+		return;
+
+	sceIoWrite(fd, &hdr, sizeof(hdr));
+	sceIoWrite(fd, save_paths, bytes);
+	sceIoWrite(fd, records, num_records * sizeof(LoadTraceRead));
+	sceIoClose(fd);
+
+	stats.tracesSaved++;
+}
+
+// returns the number of reads in the trace, 0 if there is none for key
+static uint32_t load_replay(uint64_t key)
+{
+	LoadTraceHeader hdr;
+	uint32_t files = 0;
+	char name[64];
+	SceUID fd;
+	int res;
+
+	sceClibSnprintf(name, sizeof(name), LOAD_TRACE_PATH "/" "%016llX.bin", key);
+	fd = sceIoOpen(name, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+
+	res = sceIoRead(fd, &hdr, sizeof(hdr));
+	if (res != sizeof(hdr) || hdr.magic != LDTR_MAGIC || hdr.version != LDTR_VERSION || hdr.key != key ||
+		hdr.numFiles > LDTR_MAX_FILES || hdr.numReads > LDTR_MAX_READS || hdr.pathBytes > LDTR_PATH_BYTES) {
+		sceIoClose(fd);
+		return 0;
+	}
+
+	res = sceIoRead(fd, replay_paths, hdr.pathBytes);
+	if (res != hdr.pathBytes) {
+		sceIoClose(fd);
+		return 0;
+	}
+
+	res = sceIoRead(fd, replay, hdr.numReads * sizeof(LoadTraceRead));
+	sceIoClose(fd);
+	if (res != hdr.numReads * sizeof(LoadTraceRead))
+		return 0;
+
+	for (uint32_t i = 0; i < hdr.pathBytes && files < hdr.numFiles; i++) {
+		replay_offsets[files++] = i;
+		while (i < hdr.pathBytes && replay_paths[i] != '\0')
+			i++;
+	}
+
+	if (files != hdr.numFiles || hdr.pathBytes == 0 || replay_paths[hdr.pathBytes - 1] != '\0')
+		return 0;
+
+	for (uint32_t i = 0; i < hdr.numReads; i++) {
+		if (replay[i].file >= files)
+			return 0;
+	}
+
+	return hdr.numReads;
+}
+
+static void prefetch(uint32_t count, uint32_t gen, LoadSummary *summary)
+{
+	uint64_t ahead = 0;
+	uint32_t i;
+
+	for (i = 0; i < LDTR_KEY_READS && i < count; i++)
+		ahead += replay[i].length;
+
+	for (; i < count && generation == gen; i++) {
+		const LoadTraceRead *r = &replay[i];
+
+		while (generation == gen && ahead > load_bytes + LOAD_PREFETCH_WINDOW)
+			sceKernelDelayThread(1000);
+
+		if (generation != gen)
+			break;
+
+		fcache_prefetch(replay_paths + replay_offsets[r->file], r->offset, r->length);
+		ahead += r->length;
+		summary->prefetchedReads++;
+		summary->prefetchedBytes += r->length;
+	}
+
+	fcache_prefetch_end();
+}
+
+static int trace_thread(SceSize args, void *argp)
+{
+	LoadSummary *summary;
+	uint32_t count, gen;
+	uint64_t key;
+	int pending;
+
+	while (1) {
+		sceKernelWaitSema(wake_sema, 1, NULL);
+
+		if (save_pending) {
+			save_trace();
+
+			sceKernelLockLwMutex(&lock, 1, NULL);
+			save_pending = 0;
+			sceKernelUnlockLwMutex(&lock, 1);
+		}
+
+		sceKernelLockLwMutex(&lock, 1, NULL);
+		pending = replay_pending;
+		replay_pending = 0;
+		key = load_key;
+		gen = generation;
+		summary = current;
+		sceKernelUnlockLwMutex(&lock, 1);
+
+		if (!pending)
+			continue;
+
+		count = load_replay(key);
+		if (count > 0) {
+			stats.tracesReplayed++;
+			prefetch(count, gen, summary);
+		}
+	}
+
+	return 0;
+}
+
+int ldtr_start(void)
+{
+	SceUID mbid, thid;
+	uint8_t *base;
+	int ret;
+
+	mbid = sceKernelAllocMemBlock("AL::LoadTrace::Buffers", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(2 * LDTR_MAX_READS * sizeof(LoadTraceRead) + 3 * LDTR_PATH_BYTES, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, (void **)&base);
+	records = (LoadTraceRead *)base;
+	replay = records + LDTR_MAX_READS;
+	paths = (char *)(replay + LDTR_MAX_READS);
+	replay_paths = paths + LDTR_PATH_BYTES;
+	save_paths = replay_paths + LDTR_PATH_BYTES;
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::LoadTrace::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	wake_sema = sceKernelCreateSema("AL::LoadTrace::Wake", 0, 0, 2, NULL);
+	if (wake_sema < 0)
+		return wake_sema;
+
+	thid = sceKernelCreateThread("trace_thread", (SceKernelThreadEntry)trace_thread, 96, 16 * 1024, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	if (thid < 0)
+		return thid;
+
+	sceKernelStartThread(thid, 0, NULL);
+
+	sceClibMemset(&stats, 0, sizeof(LoadTraceStats));
+	running = 1;
+
+	return stats_register_dump(ldtr_dump);
+}
+
+uint32_t ldtr_file_id(const char *path)
+{
+	uint32_t len, id = LDTR_NO_FILE;
+	uint64_t key;
+
+	if (!running)
+		return LDTR_NO_FILE;
+
+	len = sceClibStrnlen(path, SCE_IO_MAX_PATH_LENGTH);
+	key = hash_data(path, len, 0);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	for (uint32_t i = 0; i < num_paths; i++) {
+		if (path_keys[i] == key) {
+			id = i;
+			break;
+		}
+	}
+
+	if (id == LDTR_NO_FILE && num_paths < LDTR_MAX_FILES && paths_used + len + 1 <= LDTR_PATH_BYTES) {
+		sceClibMemcpy(paths + paths_used, path, len);
+		paths[paths_used + len] = '\0';
+		path_offsets[num_paths] = paths_used;
+		path_keys[num_paths] = key;
+		paths_used += len + 1;
+		id = num_paths++;
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return id;
+}
+
+void ldtr_read(uint32_t file, uint32_t offset, uint32_t length)
+{
+	SceUInt64 now = sceKernelGetProcessTimeWide();
+	LoadTraceRead *r;
+
+	if (!running || file == LDTR_NO_FILE)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	if (!loading) {
+		// still busy writing the last trace, or not a new burst
+		if (save_pending || (last_read != 0 && now - last_read < LOAD_TRACE_IDLE_US)) {
+			last_read = now;
+			sceKernelUnlockLwMutex(&lock, 1);
+			return;
+		}
+
+		loading = 1;
+		load_start = now;
+		num_records = 0;
+		load_bytes = 0;
+		load_key = 0;
+		generation++;
+
+		current = &stats.history[stats.loads % LDTR_HISTORY];
+		sceClibMemset(current, 0, sizeof(LoadSummary));
+		stats.loads++;
+	}
+
+	if (num_records < LDTR_MAX_READS) {
+		r = &records[num_records++];
+		r->file = file;
+		r->offset = offset;
+		r->length = length;
+		r->time = (uint32_t)(now - load_start);
+	} else if (num_records == LDTR_MAX_READS) {
+		stats.truncated++;
+		num_records++;
+	}
+
+	load_bytes += length;
+	last_read = now;
+
+	if (num_records == LDTR_KEY_READS) {
+		load_key = trace_key();
+		replay_pending = 1;
+		sceKernelSignalSema(wake_sema, 1);
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+void ldtr_end_frame(void)
+{
+	SceUInt64 now = sceKernelGetProcessTimeWide();
+
+	if (!running)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	if (loading && now - last_read > LOAD_TRACE_IDLE_US) {
+		loading = 0;
+		generation++;
+
+		if (num_records > LDTR_MAX_READS)
+			num_records = LDTR_MAX_READS;
+
+		current->key = load_key;
+		current->reads = num_records;
+		current->bytes = load_bytes;
+		current->duration = (uint32_t)(last_read - load_start);
+
+		if (num_records >= LDTR_MIN_READS) {
+			save_pending = 1;
+			sceKernelSignalSema(wake_sema, 1);
+		} else {
+			stats.skipped++;
+		}
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+const LoadTraceStats *ldtr_get_stats(void)
+{
+	return &stats;
+}
+
+void ldtr_dump(void)
+{
+	uint32_t count = stats.loads < LDTR_HISTORY ? stats.loads : LDTR_HISTORY;
+	SceUID fd;
+
+	fd = stats_file_open("load_trace.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "loads,%u\n", stats.loads);
+	stats_file_printf(fd, "traces_saved,%u\n", stats.tracesSaved);
+	stats_file_printf(fd, "traces_replayed,%u\n", stats.tracesReplayed);
+	stats_file_printf(fd, "truncated,%u\n", stats.truncated);
+	stats_file_printf(fd, "too_short,%u\n", stats.skipped);
+
+	stats_file_printf(fd, "load,key,reads,bytes,duration_ms,prefetched_reads,prefetched_bytes\n");
+	for (uint32_t i = stats.loads - count; i < stats.loads; i++) {
+		const LoadSummary *s = &stats.history[i % LDTR_HISTORY];
+
+		stats_file_printf(fd, "%u,%016llX,%u,%llu,%u,%u,%llu\n", i, s->key, s->reads, s->bytes,
+			s->duration / 1000, s->prefetchedReads, s->prefetchedBytes);
+	}
+
+	stats_file_close(fd);
+}
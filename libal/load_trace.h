@@ -0,0 +1,49 @@
+#ifndef __LOAD_TRACE_H__
+#define __LOAD_TRACE_H__
+
+#include <kernel.h>
+
+#include "load_trace_format.h"
+
+// reads and distinct files kept per load, longer loads are cut off
+#define LDTR_MAX_READS		32768
+#define LDTR_MAX_FILES		1024
+#define LDTR_PATH_BYTES		(64 * 1024)
+
+// reads that identify a load, the trace is looked up once they are in
+#define LDTR_KEY_READS		4
+
+// shorter loads are not worth a trace
+#define LDTR_MIN_READS		64
+
+// loads listed in load_trace.csv
+#define LDTR_HISTORY		32
+
+#define LDTR_NO_FILE		0xFFFFFFFF
+
+typedef struct {
+	uint64_t key;
+	uint32_t reads;
+	uint32_t duration;
+	uint64_t bytes;
+	uint32_t prefetchedReads;
+	uint64_t prefetchedBytes;
+} LoadSummary;
+
+typedef struct {
+	uint32_t loads;
+	uint32_t tracesSaved;
+	uint32_t tracesReplayed;
+	uint32_t truncated;
+	uint32_t skipped;
+	LoadSummary history[LDTR_HISTORY];
+} LoadTraceStats;
+
+int ldtr_start(void);
+uint32_t ldtr_file_id(const char *path);
+void ldtr_read(uint32_t file, uint32_t offset, uint32_t length);
+void ldtr_end_frame(void);
+const LoadTraceStats *ldtr_get_stats(void);
+void ldtr_dump(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __LOAD_TRACE_FORMAT_H__
+#define __LOAD_TRACE_FORMAT_H__
+
+//
+// Shared between libal and tools/iotrace.c, tools/fcbench.c, keep it free
+// of SDK headers.
+//
+// A trace is a LoadTraceHeader, pathBytes of NUL terminated paths in file
+// index order and numReads LoadTraceRead entries in the order the game
+// issued them. All values are little endian.
+//
+
+#include <stdint.h>
+
+#define LDTR_MAGIC		0x5254444C // 'LDTR'
+#define LDTR_VERSION	1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t numFiles;
+	uint32_t numReads;
+	uint32_t pathBytes;
+	uint32_t duration;		// microseconds from the first to the last read
+} LoadTraceHeader;
+
+typedef struct {
+	uint32_t file;
+	uint32_t offset;
+	uint32_t length;
+	uint32_t time;			// microseconds since the first read
+} LoadTraceRead;
+
+#endif
@@ -0,0 +1,123 @@
+/* lz4.c -- LZ4 block decoder
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Decodes raw LZ4 blocks (no frame header) as written by tools/mkpack.c,
+// free of SDK headers so the tool can check its own output with it.
+//
+// Literals and matches are copied 16 bytes at a time, one NEON load and
+// store each, as long as the overshoot stays inside both buffers. Close
+// to the ends, and for matches overlapping their own output, bytes are
+// copied one by one. Every length and offset is bounds checked, a
+// malformed block fails instead of writing outside dst.
+//
+
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "lz4.h"
+
+#define MIN_MATCH	4
+
+static inline void copy16(uint8_t *dst, const uint8_t *src)
+{
+#ifdef __ARM_NEON
+	vst1q_u8(dst, vld1q_u8(src));
+#else
+	memcpy(dst, src, 16);
+#endif
+}
+
+// copies len rounded up to 16 bytes, dst and src must be 16 bytes apart
+static inline void wild_copy(uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+	uint8_t *end = dst + len;
+
+	do {
+		copy16(dst, src);
+		dst += 16;
+		src += 16;
+	} while (dst < end);
+}
+
+static inline int read_length(const uint8_t **ip, const uint8_t *iend, uint32_t *len)
+{
+	uint32_t b;
+
+	do {
+		if (*ip >= iend)
+			return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255 && *len < 0x40000000);
+
+	return b == 255 ? -1 : 0;
+}
+
+// returns the decoded size, or -1 for a malformed block
+int lz4_decode(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstSize)
+{
+	const uint8_t *ip = src, *iend = src + srcSize;
+	uint8_t *op = dst, *oend = dst + dstSize;
+	const uint8_t *match;
+	uint32_t token, len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15 && read_length(&ip, iend, &len) < 0)
+			return -1;
+
+		if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op))
+			return -1;
+
+		if ((uint32_t)(iend - ip) >= len + 16 && (uint32_t)(oend - op) >= len + 16)
+			wild_copy(op, ip, len);
+		else
+			memcpy(op, ip, len);
+
+		op += len;
+		ip += len;
+
+		// the last sequence has no match
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (uint32_t)(op - dst))
+			return -1;
+
+		len = token & 15;
+		if (len == 15 && read_length(&ip, iend, &len) < 0)
+			return -1;
+		len += MIN_MATCH;
+
+		if (len > (uint32_t)(oend - op))
+			return -1;
+
+		match = op - offset;
+		if (offset >= 16 && (uint32_t)(oend - op) >= len + 16) {
+			wild_copy(op, match, len);
+			op += len;
+		} else {
+			for (uint32_t i = 0; i < len; i++)
+				*op++ = *match++;
+		}
+	}
+
+	return op - dst;
+}
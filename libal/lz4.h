@@ -0,0 +1,8 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+#include <stdint.h>
+
+int lz4_decode(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstSize);
+
+#endif
@@ -42,6 +42,29 @@
 #include "fs_overlay.h"
 #include "dialog.h"
 #include "al_error.h"
+#include "stats.h"
+#include "audio_stats.h"
+#include "input.h"
+#include "frame_stats.h"
+#include "overlay.h"
+#include "gl_state.h"
+#include "gl_capture.h"
+#include "gl_counters.h"
+#include "gl_defer.h"
+#include "dynres.h"
+#include "tex_cache.h"
+#include "vbo_cache.h"
+#include "settings.h"
+#include "pacer.h"
+#include "file_cache.h"
+#include "load_trace.h"
+#include "pack.h"
+#include "meta_cache.h"
+#include "io_log.h"
+#include "write_behind.h"
+#include "pool_alloc.h"
+#include "alloc_prof.h"
+#include "mem_budget.h"
 
 static uintptr_t *functable = NULL;
 
@@ -55,125 +78,36 @@ int ret1(void) {
 	return 1;
 }
 
-enum {
-	ACTION_DOWN = 1,
-	ACTION_UP   = 2,
-	ACTION_MOVE = 3,
-};
-
-enum {
-	AKEYCODE_DPAD_UP = 19,
-	AKEYCODE_DPAD_DOWN = 20,
-	AKEYCODE_DPAD_LEFT = 21,
-	AKEYCODE_DPAD_RIGHT = 22,
-	AKEYCODE_A = 29,
-	AKEYCODE_B = 30,
-	AKEYCODE_BUTTON_X = 99,
-	AKEYCODE_BUTTON_Y = 100,
-	AKEYCODE_BUTTON_L1 = 102,
-	AKEYCODE_BUTTON_R1 = 103,
-	AKEYCODE_BUTTON_START = 108,
-	AKEYCODE_BUTTON_SELECT = 109,
-};
-
-typedef struct {
-	uint32_t sce_button;
-	uint32_t android_button;
-} ButtonMapping;
-
-static ButtonMapping mapping[] = {
-	{ SCE_CTRL_UP,        AKEYCODE_DPAD_UP },
-	{ SCE_CTRL_DOWN,      AKEYCODE_DPAD_DOWN },
-	{ SCE_CTRL_LEFT,      AKEYCODE_DPAD_LEFT },
-	{ SCE_CTRL_RIGHT,     AKEYCODE_DPAD_RIGHT },
-	{ SCE_CTRL_CROSS,     AKEYCODE_A },
-	{ SCE_CTRL_CIRCLE,    AKEYCODE_B },
-	{ SCE_CTRL_SQUARE,    AKEYCODE_BUTTON_X },
-	{ SCE_CTRL_TRIANGLE,  AKEYCODE_BUTTON_Y },
-	{ SCE_CTRL_L,        AKEYCODE_BUTTON_L1 },
-	{ SCE_CTRL_R,        AKEYCODE_BUTTON_R1 },
-	{ SCE_CTRL_START,     AKEYCODE_BUTTON_START },
-	{ SCE_CTRL_SELECT,    AKEYCODE_BUTTON_SELECT },
-};
-
 int ctrl_thread(SceSize args, void *argp)
 {
-	int (* Android_Karisma_AppOnTouchEvent)(int type, int x, int y, int id);
-	int (* Android_Karisma_AppOnJoystickEvent)(int type, int x, int y, int id);
-	int (* Android_Karisma_AppOnKeyEvent)(int type, int keycode);
-
-	so_symbol(&bc2_mod, "Android_Karisma_AppOnTouchEvent", (uintptr_t *)&Android_Karisma_AppOnTouchEvent);
-	so_symbol(&bc2_mod, "Android_Karisma_AppOnJoystickEvent", (uintptr_t *)&Android_Karisma_AppOnJoystickEvent);
-	so_symbol(&bc2_mod, "Android_Karisma_AppOnKeyEvent", (uintptr_t *)&Android_Karisma_AppOnKeyEvent);
-
-	int lastX[2] = { -1, -1 };
-	int lastY[2] = { -1, -1 };
-
-	float lx = 0.0f, ly = 0.0f, rx = 0.0f, ry = 0.0f;
-	uint32_t old_buttons = 0, current_buttons = 0, pressed_buttons = 0, released_buttons = 0;
-	int ia1, ia2;
+	SceCtrlData pads[INPUT_CTRL_BUFS];
+	SceTouchData touches[INPUT_TOUCH_BUFS];
+	SceUInt64 last_touch = 0;
+	int num_pads, num_touches, p, t;
 
 	while (1) {
-		SceTouchData touch;
-		sceTouchPeek(SCE_TOUCH_PORT_FRONT, &touch, 1);
-
-		for (int i = 0; i < 2; i++) {
-			if (i < touch.reportNum) {
-				int x = (int)((float)touch.report[i].x * (float)SCREEN_W / 1920.0f);
-				int y = (int)((float)touch.report[i].y * (float)SCREEN_H / 1088.0f);
-
-				if (lastX[i] != -1 || lastY[i] != -1)
-					Android_Karisma_AppOnTouchEvent(ACTION_DOWN, x, y, i);
-				else
-					Android_Karisma_AppOnTouchEvent(ACTION_MOVE, x, y, i);
-				lastX[i] = x;
-				lastY[i] = y;
+		// blocks until the next ctrl sample, one per vblank, and returns all
+		// buffered since the last call
+		num_pads = sceCtrlReadBufferPositive(0, pads, INPUT_CTRL_BUFS);
+		num_touches = sceTouchPeek(SCE_TOUCH_PORT_FRONT, touches, INPUT_TOUCH_BUFS);
+
+		// both oldest first, merged so events are queued in timestamp order
+		p = t = 0;
+		while (p < num_pads || t < num_touches) {
+			if (t < num_touches && touches[t].timeStamp <= last_touch) {
+				t++;
+			} else if (t < num_touches && (p == num_pads || touches[t].timeStamp < pads[p].timeStamp)) {
+				inp_process_touch(&touches[t]);
+				last_touch = touches[t].timeStamp;
+				t++;
 			} else {
-				if (lastX[i] != -1 || lastY[i] != -1)
-					Android_Karisma_AppOnTouchEvent(ACTION_UP, lastX[i], lastY[i], i);
-				lastX[i] = -1;
-				lastY[i] = -1;
-			}
-		}
-
-		SceCtrlData pad;
-		sceCtrlPeekBufferPositive(0, &pad, 1);
+				inp_process_pad(&pads[p]);
+				p++;
 
-		old_buttons = current_buttons;
-		current_buttons = pad.buttons;
-		pressed_buttons = current_buttons & ~old_buttons;
-		released_buttons = ~current_buttons & old_buttons;
-
-		for (int i = 0; i < sizeof(mapping) / sizeof(ButtonMapping); i++) {
-		if (pressed_buttons & mapping[i].sce_button)
-			Android_Karisma_AppOnKeyEvent(0, mapping[i].android_button);
-		if (released_buttons & mapping[i].sce_button)
-			Android_Karisma_AppOnKeyEvent(1, mapping[i].android_button);
+				if ((inp_get_buttons() & STATS_DUMP_COMBO) == STATS_DUMP_COMBO && (inp_get_pressed() & STATS_DUMP_COMBO))
+					stats_dump_all();
+			}
 		}
-
-		lx = ((float)pad.lx - 128.0f) / 128.0f;
-		ly = ((float)pad.ly - 128.0f) / 128.0f;
-		rx = ((float)pad.rx - 128.0f) / 128.0f;
-		ry = ((float)pad.ry - 128.0f) / 128.0f;
-
-		if (fabsf(lx) < 0.25f)
-			lx = 0.0f;
-		if (fabsf(ly) < 0.25f)
-			ly = 0.0f;
-		if (fabsf(rx) < 0.25f)
-			rx = 0.0f;
-		if (fabsf(ry) < 0.25f)
-			ry = 0.0f;
-
-		// TODO: send stop event only once
-		ia1 = *(int *)&lx;
-		ia2 = *(int *)&ly;
-		Android_Karisma_AppOnJoystickEvent(3, ia1, ia2, 0);
-		ia1 = *(int *)&rx;
-		ia2 = *(int *)&ry;
-		Android_Karisma_AppOnJoystickEvent(3, ia1, ia2, 1);
-
-		sceDisplayWaitVblankStart();
 	}
 
 	return 0;
@@ -184,7 +118,9 @@ static int disable_sound = 0;
 
 void SetShortArrayRegion(void *env, int array, size_t start, size_t len, const uint8_t *buf)
 {
+	aust_output_begin();
 	sceAudioOutOutput(audio_port, buf);
+	aust_output_end();
 }
 
 int sound_thread(SceSize args, void *argp)
@@ -194,6 +130,7 @@ int sound_thread(SceSize args, void *argp)
 	so_symbol(&bc2_mod, "Java_com_dle_bc2_KarismaBridge_nativeUpdateSound", (uintptr_t *)&Java_com_dle_bc2_KarismaBridge_nativeUpdateSound);
 
 	audio_port = sceAudioOutOpenPort(SCE_AUDIO_OUT_PORT_TYPE_BGM, AUDIO_SAMPLES_PER_BUF / 2, AUDIO_SAMPLE_RATE, SCE_AUDIO_OUT_PARAM_FORMAT_S16_STEREO);
+	aust_init(audio_port, AUDIO_SAMPLE_RATE, AUDIO_SAMPLES_PER_BUF);
 
 	static char fake_env[0x1000];
 	memset(fake_env, 'A', sizeof(fake_env));
@@ -203,8 +140,11 @@ int sound_thread(SceSize args, void *argp)
 	while (1) {
 		if (disable_sound)
 			sceKernelDelayThread(1000);
-		else
+		else {
+			aust_mix_begin();
 			Java_com_dle_bc2_KarismaBridge_nativeUpdateSound(fake_env, 0, 0, AUDIO_SAMPLES_PER_BUF);
+			aust_mix_end();
+		}
 	}
 
 	return 0;
@@ -212,10 +152,13 @@ int sound_thread(SceSize args, void *argp)
 
 static EGLDisplay dpy;
 static EGLSurface surface;
+static EGLContext context;
+static EGLint surface_width, surface_height;
+
+static Settings settings;
 
 int eglInit(EGLNativeDisplayType eglDisplay, EGLNativeWindowType eglWindow)
 {
-	EGLContext context;
 	EGLConfig configs[2];
 	EGLBoolean eRetStatus;
 	EGLint major, minor;
@@ -227,7 +170,7 @@ int eglInit(EGLNativeDisplayType eglDisplay, EGLNativeWindowType eglWindow)
 							EGL_BLUE_SIZE,      8,
 							EGL_ALPHA_SIZE,		8,
 							EGL_DEPTH_SIZE,		16,
-							EGL_SAMPLES,		4,
+							EGL_SAMPLES,		settings.msaa,
 							EGL_NONE };
 
 	dpy = eglGetDisplay(eglDisplay);
@@ -262,8 +205,8 @@ int eglInit(EGLNativeDisplayType eglDisplay, EGLNativeWindowType eglWindow)
 	else {
 		win.windowSize = PSP2_WINDOW_960X544;
 	}
-	win.numFlipBuffers = 2;
-	win.flipChainThrdAffinity = SCE_KERNEL_CPU_MASK_USER_1;
+	win.numFlipBuffers = settings.flipBuffers;
+	win.flipChainThrdAffinity = SCE_KERNEL_CPU_MASK_USER_0 << settings.flipAffinity;
 
 	surface = eglCreateWindowSurface(dpy, configs[0], &win, NULL);
 
@@ -286,9 +229,44 @@ int eglInit(EGLNativeDisplayType eglDisplay, EGLNativeWindowType eglWindow)
 		printf("Error: eglMakeCurrent\n");
 	}
 
+	eglSwapInterval(dpy, pace_swap_interval());
+
+	eglQuerySurface(dpy, surface, EGL_WIDTH, &surface_width);
+	eglQuerySurface(dpy, surface, EGL_HEIGHT, &surface_height);
+
 	return 0;
 }
 
+#ifdef VBO_CACHE
+static void end_vbo_frame(void *arg)
+{
+	vboc_end_frame();
+}
+#endif
+
+#ifdef GL_DEFERRED
+static void frame_delivered(void *arg)
+{
+	pace_frame_delivered();
+}
+#endif
+
+static void draw_overlay(void *arg)
+{
+	ovl_begin(surface_width, surface_height);
+	frst_draw_overlay();
+#ifdef DYNAMIC_RESOLUTION
+	dres_draw_overlay();
+#endif
+#ifdef GL_COUNTERS
+	glct_draw_overlay();
+#endif
+#ifdef MEM_BUDGET
+	mbud_draw_overlay();
+#endif
+	ovl_end();
+}
+
 int main_thread(SceSize args, void *argp)
 {
 
@@ -296,13 +274,36 @@ int main_thread(SceSize args, void *argp)
 
 	PVRSRVInitializeAppHint(&hint);
 
-	hint.ui32UNCTexHeapSize = 60 * 1024 * 1024;
-	hint.ui32CDRAMTexHeapSize = 96 * 1024 * 1024;
+	hint.ui32UNCTexHeapSize = PVR_UNC_HEAP_SIZE;
+	hint.ui32CDRAMTexHeapSize = PVR_CDRAM_HEAP_SIZE;
 
 	PVRSRVCreateVirtualAppHint(&hint);
 
+	sett_load(&settings);
+	pace_init(&settings);
+
 	eglInit(EGL_DEFAULT_DISPLAY, 0);
 
+#ifdef GL_CAPTURE
+	glcap_start(surface_width, surface_height);
+#endif
+
+#ifdef GL_DEFERRED
+	SceUID render_thid = gldf_start(dpy, surface, context);
+#endif
+
+#ifdef DYNAMIC_RESOLUTION
+	dres_start(surface_width, surface_height);
+#endif
+
+#ifdef TEX_CACHE
+	texc_start();
+#endif
+
+#ifdef VBO_CACHE
+	vboc_start();
+#endif
+
 	int(*Android_Karisma_AppInit)(void);
 	int(*Android_Karisma_InitGfxContext)(void);
 	int(*Android_Karisma_AppUpdate)(void);
@@ -311,6 +312,14 @@ int main_thread(SceSize args, void *argp)
 	so_symbol(&bc2_mod, "Android_Karisma_InitGfxContext", (uintptr_t *)&Android_Karisma_InitGfxContext);
 	so_symbol(&bc2_mod, "Android_Karisma_AppUpdate", (uintptr_t *)&Android_Karisma_AppUpdate);
 
+	InputHandlers handlers;
+
+	so_symbol(&bc2_mod, "Android_Karisma_AppOnTouchEvent", (uintptr_t *)&handlers.onTouch);
+	so_symbol(&bc2_mod, "Android_Karisma_AppOnJoystickEvent", (uintptr_t *)&handlers.onJoystick);
+	so_symbol(&bc2_mod, "Android_Karisma_AppOnKeyEvent", (uintptr_t *)&handlers.onKey);
+
+	inp_init(&handlers);
+
 	Android_Karisma_InitGfxContext();
 	Android_Karisma_AppInit();
 
@@ -320,10 +329,84 @@ int main_thread(SceSize args, void *argp)
 	SceUID sound_thid = sceKernelCreateThread("sound_thread", (SceKernelThreadEntry)sound_thread, 64, 128 * 1024, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
 	sceKernelStartThread(sound_thid, 0, NULL);
 
+	frst_init();
+	frst_add_thread(sceKernelGetThreadId(), "MAIN");
+	frst_add_thread(ctrl_thid, "INPUT");
+	frst_add_thread(sound_thid, "AUDIO");
+#ifdef GL_DEFERRED
+	if (render_thid >= 0)
+		frst_add_thread(render_thid, "RENDER");
+#endif
+
 	while (1) {
-		glEnable(GL_MULTISAMPLE);
+		frst_begin();
+
+#ifdef DYNAMIC_RESOLUTION
+		dres_begin_frame();
+#endif
+
+		if (settings.msaa) {
+#if defined(GL_STATE_FILTER)
+			glEnable_glst(GL_MULTISAMPLE);
+#elif defined(GL_DEFERRED)
+			glEnable_gldf(GL_MULTISAMPLE);
+#else
+			glEnable(GL_MULTISAMPLE);
+#endif
+		}
+		inp_flush();
+		frst_mark(FRST_STAGE_INPUT);
+
 		Android_Karisma_AppUpdate();
+		frst_mark(FRST_STAGE_UPDATE);
+
+#ifdef GL_STATE_FILTER
+		glst_end_frame();
+#endif
+#ifdef GL_CAPTURE
+		glcap_end_frame();
+#endif
+#ifdef DYNAMIC_RESOLUTION
+		dres_end_frame();
+#endif
+#ifdef TEX_CACHE
+		texc_end_frame();
+#endif
+#ifdef VBO_CACHE
+		gldf_run(end_vbo_frame, NULL);
+#endif
+#ifdef GL_COUNTERS
+		glct_end_frame();
+#endif
+#ifdef LOAD_PREFETCH
+		ldtr_end_frame();
+#endif
+#ifdef ALLOC_PROF
+		aprof_end_frame();
+#endif
+#ifdef MEM_BUDGET
+		mbud_end_frame();
+#endif
+
+#ifdef FRAME_STATS_OVERLAY
+#ifdef GL_DEFERRED
+		gldf_run(draw_overlay, NULL);
+#else
+		draw_overlay(NULL);
+#endif
+		frst_mark(FRST_STAGE_OVERLAY);
+#endif
+
+#ifdef GL_DEFERRED
+		gldf_end_frame();
+		gldf_run(frame_delivered, NULL);
+#else
 		eglSwapBuffers(dpy, surface);
+		pace_frame_delivered();
+#endif
+		frst_mark(FRST_STAGE_SWAP);
+
+		frst_end();
 	}
 
 	return 0;
@@ -456,7 +539,7 @@ int module_start(SceSize args, const void * argp)
 	if (ret < 0)
 		goto show_error_and_die;
 
-	ret = symt_create(&table, 4 * 1024, functable);
+	ret = symt_create(&table, 8 * 1024, functable);
 	if (ret < 0)
 		goto show_error_and_die;
 
@@ -464,17 +547,171 @@ int module_start(SceSize args, const void * argp)
 	symt_override(&table, "printf", (uintptr_t)&ret0);
 	symt_append(&table, "fcntl", (uintptr_t)&ret0);
 
+#ifdef POOL_ALLOC
+	ret = palloc_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef ALLOC_PROF
+	ret = aprof_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef WRITE_BEHIND
+	ret = wbuf_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef META_CACHE
+	ret = mcache_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef ASSET_PACK
+	ret = pack_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef FILE_CACHE
+	ret = fcache_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef IO_LOG
+	ret = iolog_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef MEM_BUDGET
+	ret = mbud_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef VBO_CACHE
+	ret = vboc_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef GL_DEFERRED
+	ret = gldf_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef DYNAMIC_RESOLUTION
+	ret = dres_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef TEX_CACHE
+	ret = texc_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef GL_STATE_FILTER
+	ret = glst_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef GL_CAPTURE
+	ret = glcap_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef GL_COUNTERS
+	ret = glct_bind(&table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
 	ret = fsov_create();
 	if (ret < 0)
 		goto show_error_and_die;
 
+#ifdef IO_LOG
+	ret = iolog_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef POOL_ALLOC
+	ret = palloc_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef ALLOC_PROF
+	ret = aprof_start(&bc2_mod);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef WRITE_BEHIND
+	ret = wbuf_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef META_CACHE
+	ret = mcache_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef ASSET_PACK
+	ret = pack_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef FILE_CACHE
+	ret = fcache_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+#ifdef LOAD_PREFETCH
+	ret = ldtr_start();
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
 	ret = so_load(&bc2_mod, SO_PATH);
 	if (ret < 0)
 		goto show_error_and_die;
 
 	so_relocate(&bc2_mod);
+
+#ifdef ALLOC_PROF
+	// names the call sites in the profile
+	ret = so_build_symidx(&bc2_mod);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
 	so_resolve(&bc2_mod, table.funTable, table.count, 1);
 
+#ifdef MEM_BUDGET
+	ret = mbud_start(&bc2_mod, &table);
+	if (ret < 0)
+		goto show_error_and_die;
+#endif
+
+	// every import is bound now and the hooks keep their own next pointers
+	symt_destroy(&table);
+
 	patch_game();
 
 	so_flush_caches(&bc2_mod);
@@ -0,0 +1,423 @@
+/* mem_budget.c -- memory use of every pool against its budget
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Every MBUD_SAMPLE_INTERVAL frames the use of each pool is sampled next to
+// the free memory the kernel reports for main memory, CDRAM and the
+// physically contiguous partition. Pools are read where they are kept:
+// so_module and the Symtable for the loader's own blocks, libc's heap
+// statistics, POOL_ALLOC, ALLOC_PROF and VBO_CACHE when they are built in.
+//
+// The PVR texture heaps cannot be asked how full they are, so texture
+// uploads are tracked per texture name and level instead. The hooks are
+// bound before the other GL layers, so they see what reaches the driver,
+// TEX_CACHE's transcoded uploads included, and run on whichever thread
+// owns the context.
+//
+// A pool past MEM_BUDGET_WARN_PERCENT of its limit, or free memory below
+// MEM_BUDGET_MIN_FREE, is printed once each time it happens and shown in
+// the overlay. mem_budget.csv gets current, peak and limit of every pool
+// and the last MBUD_RING_SIZE samples.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "mem_budget.h"
+#include "gl_util.h"
+#include "open_table.h"
+#include "overlay.h"
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+#ifdef POOL_ALLOC
+#include "pool_alloc.h"
+#endif
+#ifdef ALLOC_PROF
+#include "alloc_prof.h"
+#endif
+#ifdef VBO_CACHE
+#include "vbo_cache.h"
+#endif
+
+typedef struct {
+	GLuint name;
+	uint32_t bytes;
+	uint32_t level[MBUD_MAX_LEVELS];
+} MbudTexture;
+
+// SCE libc heap statistics
+typedef struct {
+	size_t max_system_size;
+	size_t current_system_size;
+	size_t max_inuse_size;
+	size_t current_inuse_size;
+	size_t reserved[4];
+} malloc_managed_size;
+
+int malloc_stats_fast(malloc_managed_size *mmsize);
+
+static const char *pool_names[MBUD_NUM_POOLS] = {
+	"module", "symtable", "libc_heap", "libc_mapped", "pool_slabs", "pool_large", "game_heap", "gpu_textures", "gpu_buffers"
+};
+
+static const char *free_names[MBUD_NUM_FREE] = {
+	"free_main", "free_cdram", "free_phycont"
+};
+
+static MbudTexture textures[MBUD_MAX_TEXTURES];
+static OpenTable texture_table;
+static GLuint bound[GLU_MAX_TEX_UNITS];
+static uint32_t active_unit = 0;
+static uint32_t texture_bytes = 0;
+
+static MemBudgetSample ring[MBUD_RING_SIZE];
+
+static so_module *module;
+static uint32_t symtable_bytes = 0;
+static uint32_t symtable_size = 0;
+
+static SceKernelLwMutexWork lock;
+static int running = 0;
+
+static MemBudgetStats stats;
+
+static void (* next_glActiveTexture)(GLenum texture);
+static void (* next_glBindTexture)(GLenum target, GLuint texture);
+static void (* next_glDeleteTextures)(GLsizei n, const GLuint *textures);
+static void (* next_glTexImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+static void (* next_glCompressedTexImage2D)(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+
+static MbudTexture *find_texture(GLuint name, int create)
+{
+	MbudTexture *t = otab_find(&texture_table, name);
+
+	if (t != NULL || !create)
+		return t;
+
+	t = otab_insert(&texture_table, name);
+	if (t != NULL)
+		stats.textures++;
+
+	return t;
+}
+
+static void set_level(GLenum target, GLint level, uint32_t bytes)
+{
+	GLuint name = bound[active_unit];
+	MbudTexture *t;
+
+	if (target != GL_TEXTURE_2D || name == 0 || level < 0 || level >= MBUD_MAX_LEVELS)
+		return;
+
+	t = find_texture(name, 1);
+	if (t == NULL) {
+		stats.untracked++;
+		return;
+	}
+
+	texture_bytes += bytes - t->level[level];
+	t->bytes += bytes - t->level[level];
+	t->level[level] = bytes;
+}
+
+static void glActiveTexture_mbud(GLenum texture)
+{
+	if (texture - GL_TEXTURE0 < GLU_MAX_TEX_UNITS)
+		active_unit = texture - GL_TEXTURE0;
+
+	next_glActiveTexture(texture);
+}
+
+static void glBindTexture_mbud(GLenum target, GLuint texture)
+{
+	if (target == GL_TEXTURE_2D)
+		bound[active_unit] = texture;
+
+	next_glBindTexture(target, texture);
+}
+
+static void glDeleteTextures_mbud(GLsizei n, const GLuint *names)
+{
+	MbudTexture *t;
+
+	for (GLsizei i = 0; i < n; i++) {
+		if (names[i] == 0)
+			continue;
+
+		t = find_texture(names[i], 0);
+		if (t != NULL) {
+			texture_bytes -= t->bytes;
+			otab_remove(&texture_table, t);
+			stats.textures--;
+		}
+
+		for (int j = 0; j < GLU_MAX_TEX_UNITS; j++) {
+			if (bound[j] == names[i])
+				bound[j] = 0;
+		}
+	}
+
+	next_glDeleteTextures(n, names);
+}
+
+static void glTexImage2D_mbud(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels)
+{
+	set_level(target, level, width * height * glu_pixel_size(format, type));
+	next_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+static void glCompressedTexImage2D_mbud(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	set_level(target, level, imageSize);
+	next_glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+#define MBUD_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_mbud, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int mbud_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	otab_init(&texture_table, textures, sizeof(MbudTexture), MBUD_MAX_TEXTURES, 0);
+
+	MBUD_HOOK(glActiveTexture);
+	MBUD_HOOK(glBindTexture);
+	MBUD_HOOK(glDeleteTextures);
+	MBUD_HOOK(glTexImage2D);
+	MBUD_HOOK(glCompressedTexImage2D);
+
+	return AL_OK;
+}
+
+static void set_pool(int pool, uint32_t used)
+{
+	MemBudgetPool *p = &stats.pool[pool];
+	int over;
+
+	p->used = used;
+	if (used > p->peak)
+		p->peak = used;
+
+	if (p->limit == 0)
+		return;
+
+	over = (uint64_t)used * 100 >= (uint64_t)p->limit * MEM_BUDGET_WARN_PERCENT;
+	if (over && !p->over) {
+		p->warnings++;
+		sceClibPrintf("AL: %s at %u of %u KB\n", pool_names[pool], used / 1024, p->limit / 1024);
+	}
+	p->over = over;
+}
+
+static void set_free(int kind, uint32_t free)
+{
+	MemBudgetFree *f = &stats.kernel[kind];
+	int low;
+
+	f->free = free;
+	if (stats.samples == 0 || free < f->minFree)
+		f->minFree = free;
+
+	low = free < MEM_BUDGET_MIN_FREE;
+	if (low && !f->low) {
+		f->warnings++;
+		sceClibPrintf("AL: %s down to %u KB\n", free_names[kind], free / 1024);
+	}
+	f->low = low;
+}
+
+// called with the lock held
+static void sample(void)
+{
+	SceKernelFreeMemorySizeInfo info;
+	malloc_managed_size mmsize;
+	MemBudgetSample *s;
+
+	if (module != NULL)
+		set_pool(MBUD_MODULE, module->text_size + module->data_size + module->num_symidx * sizeof(so_sym));
+
+	set_pool(MBUD_SYMTABLE, symtable_bytes);
+
+	if (malloc_stats_fast(&mmsize) == 0) {
+		set_pool(MBUD_LIBC_HEAP, mmsize.current_inuse_size);
+		set_pool(MBUD_LIBC_MAPPED, mmsize.current_system_size);
+	}
+
+#ifdef POOL_ALLOC
+	set_pool(MBUD_POOL_SLABS, palloc_get_heap()->liveSpans * SCLS_SPAN_SIZE);
+	set_pool(MBUD_POOL_LARGE, palloc_get_stats()->largeBytes);
+#endif
+
+#ifdef ALLOC_PROF
+	set_pool(MBUD_GAME_HEAP, aprof_get_stats()->liveBytes);
+#endif
+
+	set_pool(MBUD_GPU_TEXTURES, texture_bytes);
+
+#ifdef VBO_CACHE
+	set_pool(MBUD_GPU_BUFFERS, vboc_get_stats()->staticBytes + VBOC_RING_BUFFERS * VBO_CACHE_RING_SIZE);
+#endif
+
+	info.size = sizeof(SceKernelFreeMemorySizeInfo);
+	if (sceKernelGetFreeMemorySize(&info) == 0) {
+		set_free(MBUD_FREE_USER, info.sizeMain);
+		set_free(MBUD_FREE_CDRAM, info.sizeCdram);
+		set_free(MBUD_FREE_PHYCONT, info.sizePhycont);
+	}
+
+	s = &ring[stats.samples % MBUD_RING_SIZE];
+	s->frame = stats.frames;
+	for (int i = 0; i < MBUD_NUM_POOLS; i++)
+		s->used[i] = stats.pool[i].used;
+	for (int i = 0; i < MBUD_NUM_FREE; i++)
+		s->free[i] = stats.kernel[i].free;
+
+	stats.samples++;
+}
+
+// mod and table are read once the module is loaded and resolved
+int mbud_start(so_module *mod, const Symtable *table)
+{
+	int ret;
+
+	if (mod == NULL || table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::MemBudget::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	module = mod;
+
+	symtable_size = table->size;
+	symtable_bytes = table->count * sizeof(DynLibFunction) + table->stringSize;
+
+	stats.pool[MBUD_SYMTABLE].limit = symtable_size;
+	stats.pool[MBUD_POOL_SLABS].limit = POOL_ALLOC_SIZE;
+	stats.pool[MBUD_GPU_TEXTURES].limit = PVR_UNC_HEAP_SIZE + PVR_CDRAM_HEAP_SIZE;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	sample();
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	// the table is destroyed once imports are resolved, only its peak stays
+	symtable_bytes = 0;
+
+	running = 1;
+
+	return stats_register_dump(mbud_dump);
+}
+
+void mbud_end_frame(void)
+{
+	if (!running)
+		return;
+
+	stats.frames++;
+	if (stats.frames % MBUD_SAMPLE_INTERVAL != 0)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	sample();
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+const MemBudgetStats *mbud_get_stats(void)
+{
+	return &stats;
+}
+
+void mbud_draw_overlay(void)
+{
+	uint32_t white = OVL_RGBA(255, 255, 255, 255), red = OVL_RGBA(255, 80, 80, 255);
+	uint32_t color = white;
+
+	for (int i = 0; i < MBUD_NUM_POOLS; i++) {
+		if (stats.pool[i].over)
+			color = red;
+	}
+	for (int i = 0; i < MBUD_NUM_FREE; i++) {
+		if (stats.kernel[i].low)
+			color = red;
+	}
+
+	ovl_printf(8, 258, 2, color, "HEAP %uKB GPU %uKB FREE %uKB CDRAM %uKB",
+		stats.pool[MBUD_LIBC_HEAP].used / 1024 + stats.pool[MBUD_POOL_SLABS].used / 1024 + stats.pool[MBUD_POOL_LARGE].used / 1024,
+		(stats.pool[MBUD_GPU_TEXTURES].used + stats.pool[MBUD_GPU_BUFFERS].used) / 1024,
+		stats.kernel[MBUD_FREE_USER].free / 1024,
+		stats.kernel[MBUD_FREE_CDRAM].free / 1024);
+}
+
+void mbud_dump(void)
+{
+	uint32_t count, first;
+	const MemBudgetSample *s;
+	SceUID fd;
+
+	if (!running)
+		return;
+
+	fd = stats_file_open("mem_budget.csv");
+	if (fd < 0)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	sample();
+
+	stats_file_printf(fd, "frames,%u\n", stats.frames);
+	stats_file_printf(fd, "samples,%u\n", stats.samples);
+	stats_file_printf(fd, "textures,%u\n", stats.textures);
+	stats_file_printf(fd, "untracked_uploads,%u\n", stats.untracked);
+	stats_file_printf(fd, "symtable_block,%u\n", symtable_size);
+
+	stats_file_printf(fd, "pool,used,peak,limit,peak_percent,warnings\n");
+	for (int i = 0; i < MBUD_NUM_POOLS; i++) {
+		const MemBudgetPool *p = &stats.pool[i];
+
+		stats_file_printf(fd, "%s,%u,%u,%u,%u,%u\n", pool_names[i], p->used, p->peak, p->limit,
+			p->limit ? (uint32_t)((uint64_t)p->peak * 100 / p->limit) : 0, p->warnings);
+	}
+
+	stats_file_printf(fd, "kernel,free,min_free,warnings\n");
+	for (int i = 0; i < MBUD_NUM_FREE; i++)
+		stats_file_printf(fd, "%s,%u,%u,%u\n", free_names[i], stats.kernel[i].free, stats.kernel[i].minFree, stats.kernel[i].warnings);
+
+	stats_file_printf(fd, "frame");
+	for (int i = 0; i < MBUD_NUM_POOLS; i++)
+		stats_file_printf(fd, ",%s", pool_names[i]);
+	for (int i = 0; i < MBUD_NUM_FREE; i++)
+		stats_file_printf(fd, ",%s", free_names[i]);
+	stats_file_printf(fd, "\n");
+
+	count = stats.samples < MBUD_RING_SIZE ? stats.samples : MBUD_RING_SIZE;
+	first = stats.samples - count;
+	for (uint32_t i = 0; i < count; i++) {
+		s = &ring[(first + i) % MBUD_RING_SIZE];
+
+		stats_file_printf(fd, "%u", s->frame);
+		for (int j = 0; j < MBUD_NUM_POOLS; j++)
+			stats_file_printf(fd, ",%u", s->used[j]);
+		for (int j = 0; j < MBUD_NUM_FREE; j++)
+			stats_file_printf(fd, ",%u", s->free[j]);
+		stats_file_printf(fd, "\n");
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	stats_file_close(fd);
+}
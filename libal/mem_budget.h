@@ -0,0 +1,76 @@
+#ifndef __MEM_BUDGET_H__
+#define __MEM_BUDGET_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "so_util.h"
+
+// frames between samples and samples kept for the csv export
+#define MBUD_SAMPLE_INTERVAL	60
+#define MBUD_RING_SIZE			512
+
+// textures whose size is tracked
+#define MBUD_MAX_TEXTURES		4096
+#define MBUD_MAX_LEVELS			13
+
+enum {
+	MBUD_MODULE = 0,	// .so segments in the RX and RW memblocks and its symbol index
+	MBUD_SYMTABLE,		// symtable entries and names, until imports are resolved
+	MBUD_LIBC_HEAP,		// in use, libc's heap has no limit of its own
+	MBUD_LIBC_MAPPED,	// what libc took from the kernel for its heap
+	MBUD_POOL_SLABS,	// POOL_ALLOC spans in use
+	MBUD_POOL_LARGE,	// POOL_ALLOC large block memblocks
+	MBUD_GAME_HEAP,		// live blocks of the game as ALLOC_PROF counts them
+	MBUD_GPU_TEXTURES,	// texture data as uploaded, out of both PVR texture heaps
+	MBUD_GPU_BUFFERS,	// VBO_CACHE's buffer objects, the game makes none
+
+	MBUD_NUM_POOLS
+};
+
+enum {
+	MBUD_FREE_USER = 0,
+	MBUD_FREE_CDRAM,
+	MBUD_FREE_PHYCONT,
+
+	MBUD_NUM_FREE
+};
+
+typedef struct {
+	uint32_t used;
+	uint32_t peak;
+	uint32_t limit;		// 0 if there is none
+	uint32_t warnings;	// times it went past MEM_BUDGET_WARN_PERCENT of the limit
+	uint8_t over;
+} MemBudgetPool;
+
+typedef struct {
+	uint32_t free;
+	uint32_t minFree;
+	uint32_t warnings;	// times it fell below MEM_BUDGET_MIN_FREE
+	uint8_t low;
+} MemBudgetFree;
+
+typedef struct {
+	uint32_t frame;
+	uint32_t used[MBUD_NUM_POOLS];
+	uint32_t free[MBUD_NUM_FREE];
+} MemBudgetSample;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t samples;
+	uint32_t textures;
+	uint32_t untracked;	// texture uploads beyond the table
+	MemBudgetPool pool[MBUD_NUM_POOLS];
+	MemBudgetFree kernel[MBUD_NUM_FREE];
+} MemBudgetStats;
+
+int mbud_bind(Symtable *table);
+int mbud_start(so_module *mod, const Symtable *table);
+void mbud_end_frame(void);
+const MemBudgetStats *mbud_get_stats(void);
+void mbud_draw_overlay(void);
+void mbud_dump(void);
+
+#endif
@@ -0,0 +1,710 @@
+/* meta_cache.c -- cache stat results and directory listings of game data
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// stat, lstat, opendir and readdir on paths under DATA_PATH are answered
+// from memory after the first call, failed stats included, so existence
+// checks and directory scans cost no syscall and no trip through the
+// savedata0: overlay. Paths outside of DATA_PATH are forwarded untouched.
+// The compat library's lstat is its stat, both share one cache.
+//
+// Results are kept as the compat library returned them: stat buffers are
+// stat_size bytes, learnt at boot by filling two buffers differently, and
+// directory entries are stored up to their last non-zero byte. A listing
+// is read in full on its first opendir.
+//
+// The read-only side never changes, the writable one only through calls
+// the game makes, so fopen for writing, fclose of such a stream, mkdir,
+// rmdir and unlink drop the entries of the path and its parent. While a
+// stream is open for writing its path is not cached. libal's own files
+// under SAVEDATA_PATH are not tracked, the game does not look at them.
+//
+// The stat table is flushed when 3/4 full, the listing pool when full and
+// no cached listing is being read.
+//
+
+#include <kernel.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+#include "meta_cache.h"
+#include "fs_overlay.h"
+#include "stats.h"
+#include "hash.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+// streams open for writing that are tracked at the same time
+#define MCACHE_MAX_WRITERS	16
+
+#define MCACHE_OPENING		((FILE *)-1)
+
+enum {
+	MCACHE_EMPTY = 0,
+	MCACHE_VALID,
+	MCACHE_DEAD
+};
+
+typedef struct {
+	uint64_t key;
+	uint32_t state;
+	int32_t result;
+	int32_t err;
+} StatEntry;
+
+typedef struct {
+	uint64_t key;
+	uint32_t state;
+	uint32_t offset;
+	uint32_t count;
+} DirEntry;
+
+typedef struct {
+	int used;
+	uint32_t offset;
+	uint32_t left;
+	uint8_t entry[MCACHE_DIRENT_MAX];
+} McacheHandle;
+
+typedef struct {
+	FILE *stream;
+	uint64_t key;
+	uint64_t parent;
+} Writer;
+
+static StatEntry *stat_entries;
+static uint8_t *stat_bufs;
+static uint32_t stat_used = 0;
+static uint32_t stat_size = 0;
+
+static DirEntry dir_entries[MCACHE_DIRS];
+static uint32_t dir_used = 0;
+static uint8_t *pool;
+static uint32_t pool_used = 0;
+
+static McacheHandle handles[MCACHE_MAX_HANDLES];
+static uint32_t handles_reading = 0;
+
+static Writer writers[MCACHE_MAX_WRITERS];
+
+// bumped on every invalidation, results read across one are not cached
+static uint32_t generation = 0;
+
+static SceKernelLwMutexWork lock;
+static SceKernelLwMutexWork fill_lock;
+static int running = 0;
+
+static MetaCacheStats stats;
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+static int (* next_stat)(const char *path, void *buf);
+static int (* next_lstat)(const char *path, void *buf);
+static void *(* next_opendir)(const char *path);
+static int (* next_readdir_r)(void *dirp, void *entry, void **result);
+static void *(* next_readdir)(void *dirp);
+static int (* next_closedir)(void *dirp);
+static int (* next_mkdir)(const char *path, int mode);
+static int (* next_rmdir)(const char *path);
+static int (* next_unlink)(const char *path);
+#endif
+static FILE *(* next_fopen)(const char *filename, const char *mode);
+static int (* next_fclose)(FILE *stream);
+
+static inline uint64_t make_key(const char *norm, uint32_t len)
+{
+	uint64_t key = hash_data(norm, len, 0);
+
+	return key ? key : 1;
+}
+
+// key of path and of its parent directory, 0 for paths outside DATA_PATH
+// and for the parent of DATA_PATH itself
+static uint64_t path_keys(const char *path, uint64_t *parent)
+{
+	char norm[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	int len, p;
+
+	len = path ? fsov_normalize(path, norm) : -1;
+	if (len < 0)
+		return 0;
+
+	if (parent != NULL) {
+		p = len;
+		while (p > 0 && norm[p - 1] != '/')
+			p--;
+		*parent = len > 0 ? make_key(norm, p > 0 ? p - 1 : 0) : 0;
+	}
+
+	return make_key(norm, len);
+}
+
+// called with the lock held, insert also returns the free slot for key
+static StatEntry *find_stat(uint64_t key, int insert)
+{
+	uint32_t i = (uint32_t)key & (MCACHE_STAT_ENTRIES - 1);
+
+	for (uint32_t n = 0; n < MCACHE_STAT_ENTRIES; n++) {
+		StatEntry *e = &stat_entries[i];
+
+		if (e->state == MCACHE_EMPTY)
+			return insert ? e : NULL;
+		if (e->key == key)
+			return e;
+
+		i = (i + 1) & (MCACHE_STAT_ENTRIES - 1);
+	}
+
+	return NULL;
+}
+
+static DirEntry *find_dir(uint64_t key, int insert)
+{
+	uint32_t i = (uint32_t)key & (MCACHE_DIRS - 1);
+
+	for (uint32_t n = 0; n < MCACHE_DIRS; n++) {
+		DirEntry *e = &dir_entries[i];
+
+		if (e->state == MCACHE_EMPTY)
+			return insert ? e : NULL;
+		if (e->key == key)
+			return e;
+
+		i = (i + 1) & (MCACHE_DIRS - 1);
+	}
+
+	return NULL;
+}
+
+// called with the lock held
+static void drop(uint64_t key)
+{
+	StatEntry *s;
+	DirEntry *d;
+
+	if (key == 0)
+		return;
+
+	s = find_stat(key, 0);
+	if (s != NULL)
+		s->state = MCACHE_DEAD;
+
+	d = find_dir(key, 0);
+	if (d != NULL)
+		d->state = MCACHE_DEAD;
+}
+
+static void invalidate(uint64_t key, uint64_t parent)
+{
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	drop(key);
+	drop(parent);
+	generation++;
+	stats.invalidations++;
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+// called with the lock held
+static int is_written(uint64_t key)
+{
+	for (int i = 0; i < MCACHE_MAX_WRITERS; i++) {
+		if (writers[i].stream != NULL && writers[i].key == key)
+			return 1;
+	}
+
+	return 0;
+}
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+
+static int cached_stat(const char *path, void *buf, int (* next)(const char *path, void *buf))
+{
+	uint32_t gen;
+	uint64_t key;
+	StatEntry *e;
+	int ret, err;
+
+	if (!running || stat_size == 0 || (key = path_keys(path, NULL)) == 0)
+		return next(path, buf);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	e = find_stat(key, 0);
+	if (e != NULL && e->state == MCACHE_VALID) {
+		ret = e->result;
+		if (ret == 0) {
+			sceClibMemcpy(buf, stat_bufs + (e - stat_entries) * stat_size, stat_size);
+			stats.statHits++;
+		} else {
+			errno = e->err;
+			stats.negativeHits++;
+		}
+
+		sceKernelUnlockLwMutex(&lock, 1);
+		return ret;
+	}
+
+	stats.statMisses++;
+	gen = generation;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	ret = next(path, buf);
+	err = errno;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	if (gen == generation && !is_written(key)) {
+		if (stat_used >= MCACHE_STAT_ENTRIES / 4 * 3) {
+			sceClibMemset(stat_entries, 0, MCACHE_STAT_ENTRIES * sizeof(StatEntry));
+			stat_used = 0;
+			stats.flushes++;
+		}
+
+		e = find_stat(key, 1);
+		if (e->state == MCACHE_EMPTY)
+			stat_used++;
+
+		e->key = key;
+		e->state = MCACHE_VALID;
+		e->result = ret;
+		e->err = err;
+		if (ret == 0)
+			sceClibMemcpy(stat_bufs + (e - stat_entries) * stat_size, buf, stat_size);
+
+		stats.statEntries = stat_used;
+	}
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	errno = err;
+
+	return ret;
+}
+
+static int stat_mcache(const char *path, void *buf)
+{
+	return cached_stat(path, buf, next_stat);
+}
+
+static int lstat_mcache(const char *path, void *buf)
+{
+	return cached_stat(path, buf, next_lstat);
+}
+
+static inline McacheHandle *lookup_handle(void *dirp)
+{
+	McacheHandle *h = (McacheHandle *)dirp;
+
+	if (h >= handles && h < handles + MCACHE_MAX_HANDLES)
+		return h;
+
+	return NULL;
+}
+
+// reads the whole listing into the pool, called with fill_lock held,
+// returns the number of entries or -1 if it does not fit or failed
+static int fill(void *dir, uint32_t *offset)
+{
+	uint8_t entry[MCACHE_DIRENT_MAX];
+	uint32_t start = pool_used, len, count = 0;
+	void *res;
+
+	while (1) {
+		sceClibMemset(entry, 0, sizeof(entry));
+		if (next_readdir_r(dir, entry, &res) != 0) {
+			pool_used = start;
+			return -1;
+		}
+
+		if (res == NULL)
+			break;
+
+		len = MCACHE_DIRENT_MAX;
+		while (len > 0 && entry[len - 1] == 0)
+			len--;
+
+		if (pool_used + ALIGN_MEM(2 + len, 4) > MCACHE_DIRENT_POOL) {
+			pool_used = start;
+			return -1;
+		}
+
+		*(uint16_t *)(pool + pool_used) = len;
+		sceClibMemcpy(pool + pool_used + 2, entry, len);
+		pool_used += ALIGN_MEM(2 + len, 4);
+		count++;
+	}
+
+	*offset = start;
+
+	return count;
+}
+
+static void *opendir_mcache(const char *path)
+{
+	McacheHandle *h = NULL;
+	uint32_t gen, offset;
+	uint64_t key;
+	DirEntry *d;
+	void *dir;
+	int count;
+
+	if (!running || (key = path_keys(path, NULL)) == 0)
+		return next_opendir(path);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	for (int i = 0; i < MCACHE_MAX_HANDLES; i++) {
+		if (!handles[i].used) {
+			h = &handles[i];
+			h->used = 1;
+			break;
+		}
+	}
+
+	if (h == NULL) {
+		sceKernelUnlockLwMutex(&lock, 1);
+		return next_opendir(path);
+	}
+
+	d = find_dir(key, 0);
+	if (d != NULL && d->state == MCACHE_VALID) {
+		h->offset = d->offset;
+		h->left = d->count;
+		handles_reading++;
+		stats.dirHits++;
+
+		sceKernelUnlockLwMutex(&lock, 1);
+		return h;
+	}
+
+	stats.dirMisses++;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	sceKernelLockLwMutex(&fill_lock, 1, NULL);
+
+	// listings being read keep their entries in place
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	if (handles_reading == 0 && (pool_used > MCACHE_DIRENT_POOL / 4 * 3 || dir_used >= MCACHE_DIRS / 4 * 3)) {
+		sceClibMemset(dir_entries, 0, sizeof(dir_entries));
+		dir_used = 0;
+		pool_used = 0;
+		stats.flushes++;
+	}
+	gen = generation;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	dir = next_opendir(path);
+	if (dir == NULL) {
+		sceKernelUnlockLwMutex(&fill_lock, 1);
+		h->used = 0;
+		return NULL;
+	}
+
+	count = fill(dir, &offset);
+	if (count < 0) {
+		sceKernelUnlockLwMutex(&fill_lock, 1);
+		next_closedir(dir);
+		h->used = 0;
+		stats.dirUncached++;
+		return next_opendir(path);
+	}
+
+	next_closedir(dir);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	// stale entries are still served to this stream, they are as current
+	// as a direct read would have been
+	if (gen == generation && dir_used < MCACHE_DIRS) {
+		d = find_dir(key, 1);
+		if (d->state == MCACHE_EMPTY)
+			dir_used++;
+
+		d->key = key;
+		d->state = MCACHE_VALID;
+		d->offset = offset;
+		d->count = count;
+	}
+
+	h->offset = offset;
+	h->left = count;
+	handles_reading++;
+	stats.dirBytes = pool_used;
+
+	sceKernelUnlockLwMutex(&lock, 1);
+	sceKernelUnlockLwMutex(&fill_lock, 1);
+
+	return h;
+}
+
+static int readdir_r_mcache(void *dirp, void *entry, void **result)
+{
+	McacheHandle *h = lookup_handle(dirp);
+	uint32_t len;
+
+	if (h == NULL)
+		return next_readdir_r(dirp, entry, result);
+
+	if (h->left == 0) {
+		*result = NULL;
+		return 0;
+	}
+
+	// up to the last non-zero byte, then the name's terminator
+	len = *(uint16_t *)(pool + h->offset);
+	sceClibMemcpy(entry, pool + h->offset + 2, len);
+	if (len < MCACHE_DIRENT_MAX)
+		((uint8_t *)entry)[len] = '\0';
+
+	h->offset += ALIGN_MEM(2 + len, 4);
+	h->left--;
+
+	*result = entry;
+
+	return 0;
+}
+
+static void *readdir_mcache(void *dirp)
+{
+	McacheHandle *h = lookup_handle(dirp);
+	void *result;
+
+	if (h == NULL)
+		return next_readdir(dirp);
+
+	readdir_r_mcache(dirp, h->entry, &result);
+
+	return result;
+}
+
+static int closedir_mcache(void *dirp)
+{
+	McacheHandle *h = lookup_handle(dirp);
+
+	if (h == NULL)
+		return next_closedir(dirp);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	handles_reading--;
+	h->used = 0;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return 0;
+}
+
+static int mkdir_mcache(const char *path, int mode)
+{
+	uint64_t key, parent;
+	int ret;
+
+	ret = next_mkdir(path, mode);
+
+	key = path_keys(path, &parent);
+	if (running && key != 0)
+		invalidate(key, parent);
+
+	return ret;
+}
+
+static int rmdir_mcache(const char *path)
+{
+	uint64_t key, parent;
+	int ret;
+
+	ret = next_rmdir(path);
+
+	key = path_keys(path, &parent);
+	if (running && key != 0)
+		invalidate(key, parent);
+
+	return ret;
+}
+
+static int unlink_mcache(const char *path)
+{
+	uint64_t key, parent;
+	int ret;
+
+	ret = next_unlink(path);
+
+	key = path_keys(path, &parent);
+	if (running && key != 0)
+		invalidate(key, parent);
+
+	return ret;
+}
+
+#endif
+
+static FILE *fopen_mcache(const char *filename, const char *mode)
+{
+	uint64_t key, parent;
+	int slot = -1;
+	FILE *f;
+
+	if (!running || mode == NULL || (mode[0] == 'r' && sceClibStrchr(mode, '+') == NULL))
+		return next_fopen(filename, mode);
+
+	key = path_keys(filename, &parent);
+	if (key == 0)
+		return next_fopen(filename, mode);
+
+	// claimed before the call, so a stat in between is not cached either
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	for (int i = 0; i < MCACHE_MAX_WRITERS; i++) {
+		if (writers[i].stream == NULL) {
+			writers[i].stream = MCACHE_OPENING;
+			writers[i].key = key;
+			writers[i].parent = parent;
+			slot = i;
+			break;
+		}
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	f = next_fopen(filename, mode);
+
+	if (slot >= 0)
+		writers[slot].stream = f;
+
+	invalidate(key, parent);
+
+	return f;
+}
+
+static int fclose_mcache(FILE *stream)
+{
+	uint64_t key = 0, parent = 0;
+	int ret;
+
+	ret = next_fclose(stream);
+
+	if (!running || stream == NULL)
+		return ret;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	for (int i = 0; i < MCACHE_MAX_WRITERS; i++) {
+		if (writers[i].stream == stream) {
+			key = writers[i].key;
+			parent = writers[i].parent;
+			writers[i].stream = NULL;
+			break;
+		}
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	if (key != 0)
+		invalidate(key, parent);
+
+	return ret;
+}
+
+#define MCACHE_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_mcache, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int mcache_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	MCACHE_HOOK(stat);
+	MCACHE_HOOK(lstat);
+	MCACHE_HOOK(opendir);
+	MCACHE_HOOK(readdir_r);
+	MCACHE_HOOK(readdir);
+	MCACHE_HOOK(closedir);
+	MCACHE_HOOK(mkdir);
+	MCACHE_HOOK(rmdir);
+	MCACHE_HOOK(unlink);
+#endif
+	MCACHE_HOOK(fopen);
+	MCACHE_HOOK(fclose);
+
+	return AL_OK;
+}
+
+int mcache_start(void)
+{
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	static uint8_t probe[FSOV_STAT_MAX];
+#endif
+	SceUID mbid;
+	void *base;
+	int ret;
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	stat_size = fsov_probe_stat(next_stat, DATA_PATH, probe);
+#endif
+
+	mbid = sceKernelAllocMemBlock("AL::MetaCache::Stat", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(MCACHE_STAT_ENTRIES * (sizeof(StatEntry) + stat_size), SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, &base);
+	stat_entries = (StatEntry *)base;
+	stat_bufs = (uint8_t *)(stat_entries + MCACHE_STAT_ENTRIES);
+	sceClibMemset(stat_entries, 0, MCACHE_STAT_ENTRIES * sizeof(StatEntry));
+
+	mbid = sceKernelAllocMemBlock("AL::MetaCache::Dirents", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(MCACHE_DIRENT_POOL, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, &base);
+	pool = (uint8_t *)base;
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::MetaCache::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	ret = sceKernelCreateLwMutex(&fill_lock, "AL::MetaCache::Fill", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	sceClibMemset(&stats, 0, sizeof(MetaCacheStats));
+	stats.statSize = stat_size;
+
+	running = 1;
+
+	return stats_register_dump(mcache_dump);
+}
+
+const MetaCacheStats *mcache_get_stats(void)
+{
+	return &stats;
+}
+
+void mcache_dump(void)
+{
+	uint32_t lookups = stats.statHits + stats.negativeHits + stats.statMisses;
+	SceUID fd;
+
+	fd = stats_file_open("meta_cache.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "stat_size,%u\n", stats.statSize);
+	stats_file_printf(fd, "stat_hits,%u\n", stats.statHits);
+	stats_file_printf(fd, "stat_negative_hits,%u\n", stats.negativeHits);
+	stats_file_printf(fd, "stat_misses,%u\n", stats.statMisses);
+	stats_file_printf(fd, "stat_hit_rate,%u%%\n", lookups ? (uint32_t)((uint64_t)(lookups - stats.statMisses) * 100 / lookups) : 0);
+	stats_file_printf(fd, "stat_entries,%u\n", stats.statEntries);
+	stats_file_printf(fd, "dir_hits,%u\n", stats.dirHits);
+	stats_file_printf(fd, "dir_misses,%u\n", stats.dirMisses);
+	stats_file_printf(fd, "dir_uncached,%u\n", stats.dirUncached);
+	stats_file_printf(fd, "dir_bytes,%u\n", stats.dirBytes);
+	stats_file_printf(fd, "invalidations,%u\n", stats.invalidations);
+	stats_file_printf(fd, "flushes,%u\n", stats.flushes);
+
+	stats_file_close(fd);
+}
@@ -0,0 +1,42 @@
+#ifndef __META_CACHE_H__
+#define __META_CACHE_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+
+// cached stat results, power of two, flushed when 3/4 full
+#define MCACHE_STAT_ENTRIES		2048
+
+// cached directory listings, power of two
+#define MCACHE_DIRS				256
+
+// bytes for the entries of all cached listings
+#define MCACHE_DIRENT_POOL		(512 * 1024)
+
+// directory streams served from the cache at the same time
+#define MCACHE_MAX_HANDLES		16
+
+// upper bound of the compat library's dirent structure
+#define MCACHE_DIRENT_MAX		0x100
+
+typedef struct {
+	uint32_t statHits;
+	uint32_t statMisses;
+	uint32_t negativeHits;
+	uint32_t dirHits;
+	uint32_t dirMisses;
+	uint32_t dirUncached;
+	uint32_t invalidations;
+	uint32_t flushes;
+	uint32_t statEntries;
+	uint32_t dirBytes;
+	uint32_t statSize;
+} MetaCacheStats;
+
+int mcache_bind(Symtable *table);
+int mcache_start(void);
+const MetaCacheStats *mcache_get_stats(void);
+void mcache_dump(void);
+
+#endif
@@ -0,0 +1,117 @@
+/* open_table.c -- open addressing hash table with linear probing
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// The lookup table behind the address and name keyed tables of the
+// profiling and allocation layers. No locking, callers hold their own.
+//
+// Keys are spread with a multiplicative hash and mapped to a slot by their
+// high bits, so any entry count works. The table is kept at most 3/4 full
+// so probe sequences stay short, and removal moves later entries of the
+// probe sequence into the hole so lookups never need tombstones.
+//
+
+#include <string.h>
+
+#include "open_table.h"
+
+static inline uint8_t *entry_at(const OpenTable *table, uint32_t slot)
+{
+	return table->entries + slot * table->entrySize;
+}
+
+static inline uint32_t key_at(const OpenTable *table, uint32_t slot)
+{
+	return *(const uint32_t *)entry_at(table, slot);
+}
+
+static inline uint32_t home_slot(const OpenTable *table, uint32_t key)
+{
+	uint32_t h = (key >> table->keyShift) * 0x9E3779B1;
+
+	return (uint32_t)(((uint64_t)h * table->count) >> 32);
+}
+
+void otab_init(OpenTable *table, void *entries, uint32_t entrySize, uint32_t count, uint32_t keyShift)
+{
+	table->entries = (uint8_t *)entries;
+	table->entrySize = entrySize;
+	table->count = count;
+	table->keyShift = keyShift;
+	otab_clear(table);
+}
+
+void otab_clear(OpenTable *table)
+{
+	memset(table->entries, 0, table->count * table->entrySize);
+	table->used = 0;
+}
+
+// entry with key, or NULL
+void *otab_find(const OpenTable *table, uint32_t key)
+{
+	uint32_t slot = home_slot(table, key), k;
+
+	for (uint32_t i = 0; i < table->count; i++) {
+		k = key_at(table, slot);
+		if (k == key)
+			return entry_at(table, slot);
+		if (k == 0)
+			break;
+		if (++slot == table->count)
+			slot = 0;
+	}
+
+	return NULL;
+}
+
+// zeroed entry with key set, or NULL if the table is full, key must not be
+// in it yet
+void *otab_insert(OpenTable *table, uint32_t key)
+{
+	uint32_t slot = home_slot(table, key);
+	uint8_t *e;
+
+	if (key == 0 || table->used >= table->count / 4 * 3)
+		return NULL;
+
+	while (key_at(table, slot) != 0) {
+		if (++slot == table->count)
+			slot = 0;
+	}
+
+	e = entry_at(table, slot);
+	memset(e, 0, table->entrySize);
+	*(uint32_t *)e = key;
+	table->used++;
+
+	return e;
+}
+
+void otab_remove(OpenTable *table, void *entry)
+{
+	uint32_t hole = ((uint8_t *)entry - table->entries) / table->entrySize;
+	uint32_t i = hole, home;
+
+	while (1) {
+		if (++i == table->count)
+			i = 0;
+		if (key_at(table, i) == 0)
+			break;
+
+		home = home_slot(table, key_at(table, i));
+		if (hole <= i ? (hole < home && home <= i) : (hole < home || home <= i))
+			continue;
+
+		memcpy(entry_at(table, hole), entry_at(table, i), table->entrySize);
+		hole = i;
+	}
+
+	*(uint32_t *)entry_at(table, hole) = 0;
+	table->used--;
+}
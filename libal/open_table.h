@@ -0,0 +1,21 @@
+#ifndef __OPEN_TABLE_H__
+#define __OPEN_TABLE_H__
+
+#include <stdint.h>
+
+// entries start with a 32-bit key, a pointer on the device, 0 is a free slot
+typedef struct {
+	uint8_t *entries;
+	uint32_t entrySize;
+	uint32_t count;
+	uint32_t keyShift;	// low key bits that are always the same, e.g. alignment
+	uint32_t used;
+} OpenTable;
+
+void otab_init(OpenTable *table, void *entries, uint32_t entrySize, uint32_t count, uint32_t keyShift);
+void otab_clear(OpenTable *table);
+void *otab_find(const OpenTable *table, uint32_t key);
+void *otab_insert(OpenTable *table, uint32_t key);
+void otab_remove(OpenTable *table, void *entry);
+
+#endif
@@ -0,0 +1,182 @@
+/* overlay.c -- minimal GLES1 debug overlay
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Everything between ovl_begin and ovl_end is batched as coloured quads and
+// drawn with a single glDrawArrays on top of the default framebuffer. The GL
+// state touched for that is saved and restored, so the engine never notices.
+//
+
+#include <kernel.h>
+
+#include <stdarg.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "overlay.h"
+#include "gl_util.h"
+
+// 3x5 glyphs, row major from the top left, bit 14 first
+static const uint16_t font_digits[10] = {
+	0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9,
+	0x79CF, 0x79EF, 0x7249, 0x7BEF, 0x7BCF,
+};
+
+static const uint16_t font_letters[26] = {
+	0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B,
+	0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D,
+	0x2B6A, 0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F,
+	0x5B6A, 0x5BFD, 0x5AAD, 0x5A92, 0x72A7,
+};
+
+static GlSavedState saved;
+
+static GLshort positions[OVL_MAX_QUADS * 6 * 2];
+static uint32_t colors[OVL_MAX_QUADS * 6];
+static unsigned int num_quads = 0;
+
+static int surface_width = OVL_WIDTH;
+static int surface_height = OVL_HEIGHT;
+
+static uint16_t glyph(char c)
+{
+	if (c >= '0' && c <= '9')
+		return font_digits[c - '0'];
+	if (c >= 'A' && c <= 'Z')
+		return font_letters[c - 'A'];
+	if (c >= 'a' && c <= 'z')
+		return font_letters[c - 'a'];
+
+	switch (c) {
+	case '.':
+		return 0x0002;
+	case ':':
+		return 0x0410;
+	case '%':
+		return 0x52A5;
+	case '/':
+		return 0x12A4;
+	case '-':
+		return 0x01C0;
+	default:
+		return 0;
+	}
+}
+
+void ovl_begin(int surfaceWidth, int surfaceHeight)
+{
+	surface_width = surfaceWidth;
+	surface_height = surfaceHeight;
+	num_quads = 0;
+}
+
+void ovl_rect(int x, int y, int w, int h, uint32_t color)
+{
+	GLshort *p;
+	uint32_t *c;
+
+	if (num_quads >= OVL_MAX_QUADS || w <= 0 || h <= 0)
+		return;
+
+	p = &positions[num_quads * 6 * 2];
+	c = &colors[num_quads * 6];
+
+	p[0] = x;		p[1] = y;
+	p[2] = x + w;	p[3] = y;
+	p[4] = x;		p[5] = y + h;
+	p[6] = x + w;	p[7] = y;
+	p[8] = x + w;	p[9] = y + h;
+	p[10] = x;		p[11] = y + h;
+
+	for (int i = 0; i < 6; i++)
+		c[i] = color;
+
+	num_quads++;
+}
+
+int ovl_text(int x, int y, int scale, uint32_t color, const char *str)
+{
+	int start = x;
+
+	while (*str) {
+		uint16_t bits = glyph(*str++);
+
+		for (int row = 0; row < 5; row++) {
+			for (int col = 0; col < 3; col++) {
+				if (bits & (1 << (14 - (row * 3 + col))))
+					ovl_rect(x + col * scale, y + row * scale, scale, scale, color);
+			}
+		}
+
+		x += 4 * scale;
+	}
+
+	return x - start;
+}
+
+int ovl_printf(int x, int y, int scale, uint32_t color, const char *fmt, ...)
+{
+	va_list list;
+	char string[128];
+
+	va_start(list, fmt);
+	sceClibVsnprintf(string, sizeof(string), fmt, list);
+	va_end(list);
+
+	return ovl_text(x, y, scale, color, string);
+}
+
+void ovl_end(void)
+{
+	if (num_quads == 0)
+		return;
+
+	glu_save_state(&saved);
+
+	glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+	glViewport(0, 0, surface_width, surface_height);
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrthof(0.0f, (GLfloat)OVL_WIDTH, (GLfloat)OVL_HEIGHT, 0.0f, -1.0f, 1.0f);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	for (int i = 0; i < saved.numTexUnits; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		glDisable(GL_TEXTURE_2D);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_FOG);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(2, GL_SHORT, 0, positions);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors);
+
+	glDrawArrays(GL_TRIANGLES, 0, num_quads * 6);
+
+	glu_restore_state(&saved);
+
+	num_quads = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef __OVERLAY_H__
+#define __OVERLAY_H__
+
+#include <kernel.h>
+
+// virtual resolution of the overlay, scaled to whatever the surface is
+#define OVL_WIDTH		960
+#define OVL_HEIGHT		544
+
+#define OVL_MAX_QUADS	2048
+
+#define OVL_RGBA(r, g, b, a)	((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+
+void ovl_begin(int surfaceWidth, int surfaceHeight);
+void ovl_rect(int x, int y, int w, int h, uint32_t color);
+int ovl_text(int x, int y, int scale, uint32_t color, const char *str);
+int ovl_printf(int x, int y, int scale, uint32_t color, const char *fmt, ...);
+void ovl_end(void);
+
+#endif
@@ -0,0 +1,114 @@
+/* pacer.c -- swap interval selection and frame delivery statistics
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// A game that needs a little over 16.7 ms per frame flips between 30 and 60
+// fps with swap interval 1, which looks worse than a steady 30. With
+// pacer_fps set the swap interval is picked so the display flips on every
+// 60 / pacer_fps vblank, the flip chain then holds finished frames back
+// until their slot comes up.
+//
+// pace_frame_delivered runs on the thread calling eglSwapBuffers right after
+// it returns. The vblank counter difference between two calls is the time
+// the previous frame stayed on screen, a frame that stayed longer than the
+// swap interval was late.
+//
+
+#include <kernel.h>
+#include <display.h>
+
+#include "pacer.h"
+#include "settings.h"
+#include "stats.h"
+#include "al_error.h"
+
+static Settings current;
+static int swap_interval = 1;
+
+static PacerStats stats;
+static int last_vcount = -1;
+static uint32_t last_vblanks = 0;
+static SceUInt64 last_time = 0;
+
+int pace_init(const Settings *settings)
+{
+	if (settings == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	current = *settings;
+	swap_interval = settings->pacerFps ? 60 / settings->pacerFps : settings->swapInterval;
+
+	sceClibMemset(&stats, 0, sizeof(PacerStats));
+	stats_hist_reset(&stats.intervalUs);
+	last_vcount = -1;
+
+	return stats_register_dump(pace_dump);
+}
+
+int pace_swap_interval(void)
+{
+	return swap_interval;
+}
+
+void pace_frame_delivered(void)
+{
+	int vcount = sceDisplayGetVcount();
+	SceUInt64 now = sceKernelGetProcessTimeWide();
+	uint32_t vblanks;
+
+	if (last_vcount >= 0) {
+		vblanks = (uint32_t)(vcount - last_vcount);
+
+		stats.vblanks[vblanks < PACE_VBLANK_BUCKETS ? vblanks : PACE_VBLANK_BUCKETS - 1]++;
+		stats_hist_add(&stats.intervalUs, (uint32_t)(now - last_time));
+
+		if (swap_interval > 0 && vblanks > swap_interval)
+			stats.late++;
+		if (stats.frames > 0 && vblanks != last_vblanks)
+			stats.changes++;
+
+		last_vblanks = vblanks;
+		stats.frames++;
+	}
+
+	last_vcount = vcount;
+	last_time = now;
+}
+
+const PacerStats *pace_get_stats(void)
+{
+	return &stats;
+}
+
+void pace_dump(void)
+{
+	SceUID fd;
+
+	fd = stats_file_open("frame_pacing.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "model,%s\n", sett_model_name());
+	stats_file_printf(fd, "flip_buffers,%d\n", current.flipBuffers);
+	stats_file_printf(fd, "msaa,%d\n", current.msaa);
+	stats_file_printf(fd, "swap_interval,%d\n", swap_interval);
+	stats_file_printf(fd, "pacer_fps,%d\n", current.pacerFps);
+	stats_file_printf(fd, "flip_affinity,%d\n", current.flipAffinity);
+	stats_file_printf(fd, "frames,%u\n", stats.frames);
+	stats_file_printf(fd, "late,%u\n", stats.late);
+	stats_file_printf(fd, "interval_changes,%u\n", stats.changes);
+
+	stats_file_printf(fd, "vblanks,frames\n");
+	for (int i = 0; i < PACE_VBLANK_BUCKETS; i++)
+		stats_file_printf(fd, "%d%s,%u\n", i, i == PACE_VBLANK_BUCKETS - 1 ? "+" : "", stats.vblanks[i]);
+
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "interval_us", &stats.intervalUs);
+
+	stats_file_close(fd);
+}
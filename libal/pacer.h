@@ -0,0 +1,26 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <kernel.h>
+
+#include "settings.h"
+#include "stats.h"
+
+// delivered frames are counted per vblanks they stayed on screen, the last bucket takes the rest
+#define PACE_VBLANK_BUCKETS	5
+
+typedef struct {
+	uint32_t frames;
+	uint32_t late;
+	uint32_t changes;
+	uint32_t vblanks[PACE_VBLANK_BUCKETS];
+	StatsHist intervalUs;
+} PacerStats;
+
+int pace_init(const Settings *settings);
+int pace_swap_interval(void);
+void pace_frame_delivered(void);
+const PacerStats *pace_get_stats(void);
+void pace_dump(void);
+
+#endif
@@ -0,0 +1,621 @@
+/* pack.c -- serve game data from a single indexed pack file
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// ASSET_PACK_PATH is built from the extracted game data by tools/mkpack.c.
+// Its directory is read into memory at boot, after which a path under
+// DATA_PATH is resolved with a hash and a binary search instead of a trip
+// through the filesystem and the savedata0: overlay. file_cache.c serves
+// stdio streams from offsets in the one pack handle, this file answers
+// stat, lstat and directory listings.
+//
+// The compat library's stat and dirent layouts are not documented, so they
+// are learnt at boot: stat of the pack file itself gives the structure
+// size and where st_size sits, stat of DATA_PATH the template for
+// directories. The first entries of a real DATA_PATH listing give the name
+// offset and templates for file and directory entries. Anything that
+// cannot be learnt is left to the compat library. Timestamps are the
+// pack's.
+//
+// Everything that also exists on savedata0: (found at boot, or opened for
+// writing since) goes to the filesystem, together with every directory
+// above it, so the overlay still merges the game's own files in.
+//
+
+#include <kernel.h>
+
+#include "pack.h"
+#include "fs_overlay.h"
+#include "stats.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+typedef struct {
+	int used;
+	const PackEntry *dir;
+	uint32_t next;
+	uint8_t entry[PACK_DIRENT_MAX];
+} PackDir;
+
+static PackHeader header;
+static PackEntry *entries;
+static uint64_t *blocks;
+static uint32_t *children;
+static char *names;
+static SceUID pack = -1;
+static int running = 0;
+
+static PackDir dirs[PACK_MAX_DIRS];
+static SceKernelLwMutexWork lock;
+
+static uint8_t stat_file[FSOV_STAT_MAX];
+static uint8_t stat_dir[FSOV_STAT_MAX];
+static uint32_t stat_size = 0;
+static int size_offset = -1;
+static int size_width = 0;
+
+static uint8_t dirent_file[PACK_DIRENT_MAX];
+static uint8_t dirent_dir[PACK_DIRENT_MAX];
+static int name_offset = -1;
+
+static PackStats stats;
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+static int (* next_stat)(const char *path, void *buf);
+static int (* next_lstat)(const char *path, void *buf);
+static void *(* next_opendir)(const char *path);
+static int (* next_readdir_r)(void *dirp, void *entry, void **result);
+static void *(* next_readdir)(void *dirp);
+static int (* next_closedir)(void *dirp);
+#endif
+
+static PackEntry *find(const char *norm, uint32_t len)
+{
+	uint64_t hash = apak_hash(norm, len);
+	uint32_t lo = 0, hi = header.numEntries, mid;
+	const char *name;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == header.numEntries || entries[lo].hash != hash)
+		return NULL;
+
+	name = names + entries[lo].name;
+	if (sceClibStrncmp(name, norm, len) != 0 || name[len] != '\0')
+		return NULL;
+
+	return &entries[lo];
+}
+
+// the entry at norm and every directory above it
+static void mark(const char *norm, uint32_t len)
+{
+	PackEntry *e;
+
+	for (int i = len; i >= 0; i--) {
+		if (i != len && i != 0 && norm[i] != '/')
+			continue;
+
+		e = find(norm, i);
+		if (e != NULL && !(e->flags & APAK_OVERRIDDEN)) {
+			e->flags |= APAK_OVERRIDDEN;
+			stats.overridden++;
+		}
+	}
+}
+
+// rel is the directory relative to SAVEDATA_PATH, only directories that
+// are also in the pack can hide pack files so no others are entered
+static void scan_savedata(char *rel, uint32_t len, int depth)
+{
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	uint32_t n, sub;
+	SceIoDirent ent;
+	SceUID dfd;
+
+	sceClibSnprintf(path, sizeof(path), SAVEDATA_PATH "/" "%s", rel);
+	dfd = sceIoDopen(path);
+	if (dfd < 0)
+		return;
+
+	while (sceIoDread(dfd, &ent) > 0) {
+		n = sceClibStrnlen(ent.d_name, sizeof(ent.d_name));
+		sub = len + (len > 0) + n;
+		if (sub + sizeof(SAVEDATA_PATH) + 1 >= SCE_IO_MAX_PATH_BUFFER_SIZE)
+			continue;
+
+		if (len > 0)
+			rel[len] = '/';
+		sceClibMemcpy(rel + len + (len > 0), ent.d_name, n + 1);
+
+		mark(rel, sub);
+
+		if (SCE_STM_ISDIR(ent.d_stat.st_mode) && depth < 8 && find(rel, sub) != NULL)
+			scan_savedata(rel, sub, depth + 1);
+
+		rel[len] = '\0';
+	}
+
+	sceIoDclose(dfd);
+}
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+
+static void learn_stat(SceOff size)
+{
+	static uint8_t a[FSOV_STAT_MAX];
+	uint32_t written = fsov_probe_stat(next_stat, ASSET_PACK_PATH, a);
+	uint64_t v64;
+	uint32_t v32;
+
+	if (written == 0)
+		return;
+
+	for (uint32_t off = 0; off + 8 <= written && size_offset < 0; off += 4) {
+		sceClibMemcpy(&v64, a + off, 8);
+		if (v64 == (uint64_t)size) {
+			size_offset = off;
+			size_width = 8;
+		}
+	}
+
+	for (uint32_t off = 0; off + 4 <= written && size_offset < 0; off += 4) {
+		sceClibMemcpy(&v32, a + off, 4);
+		if (v32 == (uint64_t)size) {
+			size_offset = off;
+			size_width = 4;
+		}
+	}
+
+	if (size_offset < 0)
+		return;
+
+	sceClibMemset(stat_dir, 0, sizeof(stat_dir));
+	if (next_stat(DATA_PATH, stat_dir) < 0)
+		return;
+
+	sceClibMemcpy(stat_file, a, written);
+	stat_size = written;
+}
+
+static int is_name(const uint8_t *entry, int off)
+{
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	SceIoStat st;
+	int len = 0;
+
+	while (off + len < PACK_DIRENT_MAX && entry[off + len] >= 0x20 && entry[off + len] < 0x7F)
+		len++;
+
+	if (len == 0 || off + len == PACK_DIRENT_MAX || entry[off + len] != '\0')
+		return 0;
+
+	if (entry[off] == '.' && (len == 1 || (len == 2 && entry[off + 1] == '.')))
+		return 0;
+
+	sceClibSnprintf(path, sizeof(path), DATA_PATH "/" "%s", (const char *)entry + off);
+
+	return sceIoGetstat(path, &st) >= 0;
+}
+
+static void learn_dirent(void)
+{
+	uint8_t entry[PACK_DIRENT_MAX];
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	int have_file = 0, have_dir = 0, off = -1;
+	SceIoStat st;
+	void *dir, *res;
+
+	dir = next_opendir(DATA_PATH);
+	if (dir == NULL)
+		return;
+
+	while (!have_file || !have_dir) {
+		sceClibMemset(entry, 0, sizeof(entry));
+		if (next_readdir_r(dir, entry, &res) != 0 || res == NULL)
+			break;
+
+		for (int i = 0; i < PACK_DIRENT_MAX && off < 0; i++) {
+			if (is_name(entry, i))
+				off = i;
+		}
+
+		if (off < 0 || !is_name(entry, off))
+			continue;
+
+		sceClibSnprintf(path, sizeof(path), DATA_PATH "/" "%s", (const char *)entry + off);
+		if (sceIoGetstat(path, &st) < 0)
+			continue;
+
+		if (SCE_STM_ISDIR(st.st_mode) && !have_dir) {
+			sceClibMemcpy(dirent_dir, entry, off);
+			have_dir = 1;
+		} else if (!SCE_STM_ISDIR(st.st_mode) && !have_file) {
+			sceClibMemcpy(dirent_file, entry, off);
+			have_file = 1;
+		}
+	}
+
+	next_closedir(dir);
+
+	if (have_file && have_dir)
+		name_offset = off;
+}
+
+static void fill_stat(const PackEntry *e, void *buf)
+{
+	if (e->flags & APAK_DIR) {
+		sceClibMemcpy(buf, stat_dir, stat_size);
+	} else {
+		sceClibMemcpy(buf, stat_file, stat_size);
+		sceClibMemcpy((uint8_t *)buf + size_offset, &e->size, size_width);
+	}
+
+	stats.statHits++;
+}
+
+static int stat_pack(const char *path, void *buf)
+{
+	const PackEntry *e;
+
+	if (stat_size == 0 || (e = pack_lookup(path)) == NULL)
+		return next_stat(path, buf);
+
+	fill_stat(e, buf);
+
+	return 0;
+}
+
+static int lstat_pack(const char *path, void *buf)
+{
+	const PackEntry *e;
+
+	if (stat_size == 0 || (e = pack_lookup(path)) == NULL)
+		return next_lstat(path, buf);
+
+	fill_stat(e, buf);
+
+	return 0;
+}
+
+static inline PackDir *lookup_dir(void *dirp)
+{
+	PackDir *d = (PackDir *)dirp;
+
+	if (d >= dirs && d < dirs + PACK_MAX_DIRS)
+		return d;
+
+	return NULL;
+}
+
+static void *opendir_pack(const char *path)
+{
+	const PackEntry *e;
+	PackDir *d = NULL;
+
+	if (name_offset < 0 || (e = pack_lookup(path)) == NULL || !(e->flags & APAK_DIR))
+		return next_opendir(path);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	for (int i = 0; i < PACK_MAX_DIRS; i++) {
+		if (!dirs[i].used) {
+			d = &dirs[i];
+			d->used = 1;
+			break;
+		}
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	if (d == NULL)
+		return next_opendir(path);
+
+	d->dir = e;
+	d->next = 0;
+	stats.dirOpens++;
+
+	return d;
+}
+
+static int readdir_r_pack(void *dirp, void *entry, void **result)
+{
+	PackDir *d = lookup_dir(dirp);
+	const PackEntry *child;
+	const char *name, *base;
+	uint32_t len;
+
+	if (d == NULL)
+		return next_readdir_r(dirp, entry, result);
+
+	if (d->next >= d->dir->size) {
+		*result = NULL;
+		return 0;
+	}
+
+	child = &entries[children[d->dir->offset + d->next++]];
+	name = names + child->name;
+	base = sceClibStrrchr(name, '/');
+	base = base ? base + 1 : name;
+	len = sceClibStrnlen(base, PACK_DIRENT_MAX - name_offset - 1);
+
+	sceClibMemcpy(entry, (child->flags & APAK_DIR) ? dirent_dir : dirent_file, name_offset);
+	sceClibMemcpy((uint8_t *)entry + name_offset, base, len);
+	((uint8_t *)entry)[name_offset + len] = '\0';
+
+	*result = entry;
+
+	return 0;
+}
+
+static void *readdir_pack(void *dirp)
+{
+	PackDir *d = lookup_dir(dirp);
+	void *result;
+
+	if (d == NULL)
+		return next_readdir(dirp);
+
+	readdir_r_pack(dirp, d->entry, &result);
+
+	return result;
+}
+
+static int closedir_pack(void *dirp)
+{
+	PackDir *d = lookup_dir(dirp);
+
+	if (d == NULL)
+		return next_closedir(dirp);
+
+	d->used = 0;
+
+	return 0;
+}
+
+#endif
+
+#define PACK_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_pack, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int pack_bind(Symtable *table)
+{
+	int ret = AL_OK;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	PACK_HOOK(stat);
+	PACK_HOOK(lstat);
+	PACK_HOOK(opendir);
+	PACK_HOOK(readdir_r);
+	PACK_HOOK(readdir);
+	PACK_HOOK(closedir);
+#endif
+
+	return ret;
+}
+
+// a missing pack is not an error, everything is then read from the filesystem
+// called once the directory is read, the pack may be truncated or corrupt
+static int check_directory(SceOff packSize)
+{
+	uint64_t end, last;
+
+	if (names[header.nameBytes - 1] != '\0')
+		return AL_ERROR_PACK_INVALID_DIRECTORY;
+
+	for (uint32_t i = 0; i < header.numBlocks; i++) {
+		if (blocks[i] < header.dataOffset || blocks[i] > (uint64_t)packSize || (i > 0 && blocks[i] < blocks[i - 1]))
+			return AL_ERROR_PACK_INVALID_DIRECTORY;
+	}
+
+	for (uint32_t i = 0; i < header.numEntries; i++) {
+		const PackEntry *e = &entries[i];
+
+		if (e->name >= header.nameBytes)
+			return AL_ERROR_PACK_INVALID_DIRECTORY;
+
+		if (e->flags & APAK_DIR) {
+			if (e->offset > header.numChildren || e->size > header.numChildren - e->offset)
+				return AL_ERROR_PACK_INVALID_DIRECTORY;
+			end = e->offset + e->size;
+			for (uint32_t c = e->offset; c < end; c++) {
+				if (children[c] >= header.numEntries)
+					return AL_ERROR_PACK_INVALID_DIRECTORY;
+			}
+		} else if (e->flags & APAK_LZ4) {
+			last = e->offset + (e->size + header.blockSize - 1) / header.blockSize;
+			if (e->offset >= header.numBlocks || last >= header.numBlocks)
+				return AL_ERROR_PACK_INVALID_DIRECTORY;
+			for (uint64_t b = e->offset; b < last; b++) {
+				if (blocks[b + 1] - blocks[b] > header.blockSize)
+					return AL_ERROR_PACK_INVALID_DIRECTORY;
+			}
+			stats.compressed++;
+		} else if (e->offset < header.dataOffset || e->offset > (uint64_t)packSize || e->size > (uint64_t)packSize - e->offset) {
+			return AL_ERROR_PACK_INVALID_DIRECTORY;
+		}
+	}
+
+	return AL_OK;
+}
+
+int pack_start(void)
+{
+	char rel[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	uint64_t size;
+	SceOff packSize;
+	SceUID mbid;
+	void *base;
+	int ret;
+
+	sceClibMemset(&stats, 0, sizeof(PackStats));
+
+	pack = sceIoOpen(ASSET_PACK_PATH, SCE_O_RDONLY, 0);
+	if (pack < 0)
+		return AL_OK;
+
+	ret = sceIoRead(pack, &header, sizeof(PackHeader));
+	if (ret != sizeof(PackHeader) || header.magic != APAK_MAGIC || header.version != APAK_VERSION) {
+		ret = AL_ERROR_PACK_INVALID_HEADER;
+		goto close_pack;
+	}
+
+	size = sizeof(PackHeader) + (uint64_t)header.numEntries * sizeof(PackEntry) + (uint64_t)header.numBlocks * sizeof(uint64_t) +
+		(uint64_t)header.numChildren * sizeof(uint32_t) + header.nameBytes;
+	if (header.dataOffset < size || header.dataOffset > PACK_MAX_DIRECTORY_SIZE || header.nameBytes == 0) {
+		ret = AL_ERROR_PACK_INVALID_DIRECTORY;
+		goto close_pack;
+	}
+
+	// compressed blocks are decoded straight into file cache blocks
+	if (header.numBlocks != 0 && header.blockSize != FILE_CACHE_BLOCK_SIZE) {
+		ret = AL_ERROR_PACK_BLOCK_SIZE;
+		goto close_pack;
+	}
+
+	mbid = sceKernelAllocMemBlock("AL::Pack::Directory", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(size, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0) {
+		ret = mbid;
+		goto close_pack;
+	}
+
+	sceKernelGetMemBlockBase(mbid, &base);
+
+	ret = sceIoPread(pack, base, size - sizeof(PackHeader), sizeof(PackHeader));
+	if (ret != size - sizeof(PackHeader)) {
+		ret = AL_ERROR_PACK_INVALID_DIRECTORY;
+		goto free_directory;
+	}
+
+	entries = (PackEntry *)base;
+	blocks = (uint64_t *)(entries + header.numEntries);
+	children = (uint32_t *)(blocks + header.numBlocks);
+	names = (char *)(children + header.numChildren);
+
+	packSize = sceIoLseek(pack, 0, SCE_SEEK_END);
+
+	ret = check_directory(packSize);
+	if (ret < 0)
+		goto free_directory;
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::Pack::Lock", 0, 0, NULL);
+	if (ret < 0)
+		goto free_directory;
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	learn_stat(packSize);
+	learn_dirent();
+#endif
+
+	rel[0] = '\0';
+	scan_savedata(rel, 0, 0);
+
+	stats.entries = header.numEntries;
+	stats.directorySize = size;
+	stats.statSize = stat_size;
+	stats.sizeOffset = size_offset;
+	stats.nameOffset = name_offset;
+
+	running = 1;
+
+	return stats_register_dump(pack_dump);
+
+free_directory:
+	sceKernelFreeMemBlock(mbid);
+close_pack:
+	sceIoClose(pack);
+	pack = -1;
+
+	return ret;
+}
+
+const PackEntry *pack_lookup(const char *path)
+{
+	char norm[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	const PackEntry *e;
+	int len;
+
+	if (!running || path == NULL)
+		return NULL;
+
+	stats.lookups++;
+
+	len = fsov_normalize(path, norm);
+	if (len < 0)
+		return NULL;
+
+	e = find(norm, len);
+	if (e == NULL || (e->flags & APAK_OVERRIDDEN))
+		return NULL;
+
+	stats.hits++;
+
+	return e;
+}
+
+SceUID pack_fd(void)
+{
+	return pack;
+}
+
+// offsets of a compressed file's blocks in the pack, one past its last block
+const uint64_t *pack_blocks(const PackEntry *e)
+{
+	return &blocks[e->offset];
+}
+
+void pack_override(const char *path)
+{
+	char norm[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	int len;
+
+	if (!running || path == NULL)
+		return;
+
+	len = fsov_normalize(path, norm);
+	if (len >= 0)
+		mark(norm, len);
+}
+
+const PackStats *pack_get_stats(void)
+{
+	return &stats;
+}
+
+void pack_dump(void)
+{
+	SceUID fd;
+
+	fd = stats_file_open("pack.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "entries,%u\n", stats.entries);
+	stats_file_printf(fd, "compressed,%u\n", stats.compressed);
+	stats_file_printf(fd, "directory_bytes,%u\n", stats.directorySize);
+	stats_file_printf(fd, "lookups,%u\n", stats.lookups);
+	stats_file_printf(fd, "hits,%u\n", stats.hits);
+	stats_file_printf(fd, "overridden,%u\n", stats.overridden);
+	stats_file_printf(fd, "stat_hits,%u\n", stats.statHits);
+	stats_file_printf(fd, "dir_opens,%u\n", stats.dirOpens);
+	stats_file_printf(fd, "stat_size,%u\n", stats.statSize);
+	stats_file_printf(fd, "stat_size_offset,%d\n", stats.sizeOffset);
+	stats_file_printf(fd, "dirent_name_offset,%d\n", stats.nameOffset);
+
+	stats_file_close(fd);
+}
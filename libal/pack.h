@@ -0,0 +1,41 @@
+#ifndef __PACK_H__
+#define __PACK_H__
+
+#include <kernel.h>
+
+#include "pack_format.h"
+#include "symtable.h"
+
+// directory streams open on the pack at the same time, more are left to libc
+#define PACK_MAX_DIRS		16
+
+// upper bound of the compat library's dirent structure
+#define PACK_DIRENT_MAX		0x100
+
+// runtime only entry flag, the file or directory also exists on savedata0:
+#define APAK_OVERRIDDEN		0x80000000
+
+typedef struct {
+	uint32_t entries;
+	uint32_t compressed;
+	uint32_t directorySize;
+	uint32_t lookups;
+	uint32_t hits;
+	uint32_t overridden;
+	uint32_t statHits;
+	uint32_t dirOpens;
+	uint32_t statSize;
+	int32_t sizeOffset;
+	int32_t nameOffset;
+} PackStats;
+
+int pack_bind(Symtable *table);
+int pack_start(void);
+const PackEntry *pack_lookup(const char *path);
+SceUID pack_fd(void);
+const uint64_t *pack_blocks(const PackEntry *e);
+void pack_override(const char *path);
+const PackStats *pack_get_stats(void);
+void pack_dump(void);
+
+#endif
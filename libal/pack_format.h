@@ -0,0 +1,67 @@
+#ifndef __PACK_FORMAT_H__
+#define __PACK_FORMAT_H__
+
+//
+// Shared between libal and tools/mkpack.c, keep it free of SDK headers.
+//
+// A pack is a PackHeader, numEntries PackEntry sorted by hash, numBlocks
+// block offsets, numChildren entry indices and nameBytes of NUL terminated
+// paths, followed by the file data. Paths are relative to the packed directory, '/' separated, without
+// leading or trailing slashes, the root directory has the empty path.
+//
+// A directory's children are the entries children[offset] to
+// children[offset + size - 1], sorted by name.
+//
+// Files flagged APAK_LZ4 are split into blockSize blocks, each compressed
+// on its own as a raw LZ4 block. Their offset is the index of their first
+// block in the block table, which holds one offset past the last block so
+// a block's stored size is the distance to the next. Blocks stored at full
+// size are not compressed. All values are little endian.
+//
+
+#include <stdint.h>
+
+#define APAK_MAGIC		0x4B415041 // 'APAK'
+#define APAK_VERSION	2
+
+// file data alignment
+#define APAK_ALIGN		16
+
+// entry flags
+#define APAK_DIR		1
+#define APAK_LZ4		2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numEntries;
+	uint32_t numChildren;
+	uint32_t nameBytes;
+	uint32_t blockSize;		// compressed file block size
+	uint32_t numBlocks;
+	uint32_t reserved;
+	uint64_t dataOffset;	// end of the directory, start of the file data
+} PackHeader;
+
+typedef struct {
+	uint64_t hash;
+	uint32_t name;			// offset in the name table
+	uint32_t flags;
+	uint64_t offset;		// file data, first block or first child for directories
+	uint64_t size;			// uncompressed file size, or child count for directories
+} PackEntry;
+
+// 64-bit FNV-1a
+static inline uint64_t apak_hash(const char *path, uint32_t len)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+
+	for (uint32_t i = 0; i < len; i++) {
+		h ^= (uint8_t)path[i];
+		h *= 0x100000001B3ULL;
+	}
+
+	return h;
+}
+
+#endif
@@ -0,0 +1,479 @@
+/* pool_alloc.c -- size class allocator for the game's heap
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// malloc, free, realloc and operator new/delete of the game are served by
+// libal instead of the SCE libc heap. Requests up to SCLS_MAX_SIZE come
+// from size class slabs (size_class.c) in one POOL_ALLOC_SIZE memblock,
+// larger ones get a memblock each, 4KB aligned, found again through a
+// table keyed by address.
+//
+// Every thread has a cache of free objects per class, so most calls take
+// no lock: an empty cache is refilled with half its depth in one locked
+// call, a full one gives half back. A cache holds PALLOC_CACHE_DEPTH
+// objects at most, and no more than PALLOC_CACHE_BYTES of a class. The
+// caches of threads that exited keep their objects.
+//
+// When the region or the large object table is full, or a memblock cannot
+// be had, the request goes to the libc function the hook replaced; pointers
+// that are not libal's are handed to libc's free, realloc or operator
+// delete the same way, so memory allocated before the pool started or by
+// libc itself is still freed right.
+//
+
+#include <kernel.h>
+
+#include "pool_alloc.h"
+#include "open_table.h"
+#include "stats.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+typedef struct {
+	SceUID thid;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t hits;
+	uint8_t count[SCLS_NUM_CLASSES];
+	void *objs[SCLS_NUM_CLASSES][PALLOC_CACHE_DEPTH];
+} PallocCache;
+
+typedef struct {
+	void *ptr;
+	SceUID mbid;
+	uint32_t size;
+} PallocLarge;
+
+static SizeClassHeap heap;
+static PallocCache caches[PALLOC_MAX_THREADS];
+static PallocLarge large[PALLOC_MAX_LARGE];
+static OpenTable large_table;
+static uint8_t cache_limit[SCLS_NUM_CLASSES];
+
+static SceKernelLwMutexWork lock;
+static int running = 0;
+
+static PoolAllocStats stats;
+
+static void *(* next_malloc)(size_t size);
+static void (* next_free)(void *ptr);
+static void *(* next_realloc)(void *ptr, size_t size);
+static void *(* next__Znwj)(size_t size);
+static void *(* next__Znaj)(size_t size);
+static void (* next__ZdlPv)(void *ptr);
+static void (* next__ZdaPv)(void *ptr);
+
+// the calling thread's cache, claimed on its first call, NULL once all
+// are taken
+static PallocCache *thread_cache(void)
+{
+	SceUID thid = sceKernelGetThreadId();
+	uint32_t slot = ((uint32_t)thid * 0x9E3779B1) >> 16;
+	PallocCache *c;
+
+	for (uint32_t i = 0; i < PALLOC_MAX_THREADS; i++) {
+		c = &caches[(slot + i) % PALLOC_MAX_THREADS];
+		if (c->thid == thid)
+			return c;
+		if (c->thid != 0)
+			continue;
+
+		// only the owner ever writes its slot, others just skip it
+		sceKernelLockLwMutex(&lock, 1, NULL);
+		if (c->thid == 0) {
+			c->thid = thid;
+			stats.threads++;
+		}
+		sceKernelUnlockLwMutex(&lock, 1);
+
+		if (c->thid == thid)
+			return c;
+	}
+
+	return NULL;
+}
+
+static void *alloc_small(uint32_t cls)
+{
+	PallocCache *c = thread_cache();
+	void *ptr = NULL;
+	uint32_t n;
+
+	if (c != NULL) {
+		c->allocs++;
+		if (c->count[cls] > 0) {
+			c->hits++;
+			return c->objs[cls][--c->count[cls]];
+		}
+	}
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	if (c != NULL) {
+		n = scls_alloc(&heap, cls, c->objs[cls], (cache_limit[cls] + 1) / 2);
+		if (n > 0)
+			ptr = c->objs[cls][--n];
+		c->count[cls] = n;
+		stats.refills++;
+	} else {
+		scls_alloc(&heap, cls, &ptr, 1);
+		stats.allocs++;
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return ptr;
+}
+
+static void free_small(void *ptr)
+{
+	PallocCache *c = thread_cache();
+	uint32_t cls = scls_class_of(&heap, ptr);
+
+	if (c != NULL) {
+		c->frees++;
+		if (c->count[cls] < cache_limit[cls]) {
+			c->objs[cls][c->count[cls]++] = ptr;
+			return;
+		}
+	}
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	if (c != NULL) {
+		while (c->count[cls] > cache_limit[cls] / 2)
+			scls_free(&heap, c->objs[cls][--c->count[cls]]);
+		stats.flushes++;
+	} else {
+		stats.frees++;
+	}
+	scls_free(&heap, ptr);
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+static void *alloc_large(size_t size)
+{
+	PallocLarge *l;
+	uint32_t total;
+	SceUID mbid;
+	void *ptr;
+
+	if (size > 0x7FFFF000)
+		return NULL;
+
+	total = ALIGN_MEM(size, SCE_KERNEL_4KiB);
+
+	mbid = sceKernelAllocMemBlock("AL::PoolAlloc::Large", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, total, NULL);
+	if (mbid < 0)
+		return NULL;
+
+	sceKernelGetMemBlockBase(mbid, &ptr);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	l = otab_insert(&large_table, (uintptr_t)ptr);
+	if (l == NULL) {
+		sceKernelUnlockLwMutex(&lock, 1);
+		sceKernelFreeMemBlock(mbid);
+		return NULL;
+	}
+
+	l->mbid = mbid;
+	l->size = total;
+
+	stats.largeAllocs++;
+	stats.largeLive++;
+	stats.largeBytes += total;
+	if (stats.largeBytes > stats.peakLargeBytes)
+		stats.peakLargeBytes = stats.largeBytes;
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return ptr;
+}
+
+// returns 0 if ptr is not a large object
+static int free_large(void *ptr)
+{
+	PallocLarge *l;
+	SceUID mbid;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	l = otab_find(&large_table, (uintptr_t)ptr);
+	if (l == NULL) {
+		sceKernelUnlockLwMutex(&lock, 1);
+		return 0;
+	}
+
+	mbid = l->mbid;
+	stats.largeFrees++;
+	stats.largeLive--;
+	stats.largeBytes -= l->size;
+	otab_remove(&large_table, l);
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	sceKernelFreeMemBlock(mbid);
+
+	return 1;
+}
+
+// bytes usable at ptr, 0 if ptr is not libal's
+static uint32_t usable_size(const void *ptr)
+{
+	PallocLarge *l;
+	uint32_t size = 0;
+
+	if (scls_owns(&heap, ptr))
+		return scls_size(scls_class_of(&heap, ptr));
+
+	if (((uintptr_t)ptr & (SCE_KERNEL_4KiB - 1)) != 0)
+		return 0;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	l = otab_find(&large_table, (uintptr_t)ptr);
+	if (l != NULL)
+		size = l->size;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return size;
+}
+
+// fallback is the libc function the hook replaced, so operator new falls
+// back to libc's operator new and not to malloc
+static void *alloc_palloc(size_t size, void *(* fallback)(size_t size))
+{
+	uint32_t cls;
+	void *ptr;
+
+	if (!running)
+		return fallback(size);
+
+	cls = scls_class(size);
+	ptr = cls != SCLS_NONE ? alloc_small(cls) : alloc_large(size);
+
+	if (ptr == NULL) {
+		stats.fallbacks++;
+		ptr = fallback(size);
+	}
+
+	return ptr;
+}
+
+// foreign gets the pointers that are not libal's, same as fallback above
+static void release_palloc(void *ptr, void (* foreign)(void *ptr))
+{
+	if (ptr == NULL)
+		return;
+
+	if (scls_owns(&heap, ptr)) {
+		free_small(ptr);
+		return;
+	}
+
+	// large objects are page aligned, only such pointers are looked up
+	if (running && ((uintptr_t)ptr & (SCE_KERNEL_4KiB - 1)) == 0 && free_large(ptr))
+		return;
+
+	if (running)
+		stats.foreignFrees++;
+
+	foreign(ptr);
+}
+
+static void *malloc_palloc(size_t size)
+{
+	return alloc_palloc(size, next_malloc);
+}
+
+static void free_palloc(void *ptr)
+{
+	release_palloc(ptr, next_free);
+}
+
+static void *realloc_palloc(void *ptr, size_t size)
+{
+	uint32_t old;
+	void *ret;
+
+	if (!running)
+		return next_realloc(ptr, size);
+
+	if (ptr == NULL)
+		return malloc_palloc(size);
+
+	if (size == 0) {
+		free_palloc(ptr);
+		return NULL;
+	}
+
+	old = usable_size(ptr);
+	if (old == 0)
+		return next_realloc(ptr, size);
+
+	stats.reallocs++;
+
+	// stays put unless it would waste more than half
+	if (size <= old && size > old / 2)
+		return ptr;
+
+	ret = malloc_palloc(size);
+	if (ret == NULL)
+		return NULL;
+
+	sceClibMemcpy(ret, ptr, size < old ? size : old);
+	free_palloc(ptr);
+	stats.reallocMoves++;
+
+	return ret;
+}
+
+static void *_Znwj_palloc(size_t size)
+{
+	return alloc_palloc(size, next__Znwj);
+}
+
+static void *_Znaj_palloc(size_t size)
+{
+	return alloc_palloc(size, next__Znaj);
+}
+
+static void _ZdlPv_palloc(void *ptr)
+{
+	release_palloc(ptr, next__ZdlPv);
+}
+
+static void _ZdaPv_palloc(void *ptr)
+{
+	release_palloc(ptr, next__ZdaPv);
+}
+
+#define PALLOC_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_palloc, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int palloc_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	PALLOC_HOOK(malloc);
+	PALLOC_HOOK(free);
+	PALLOC_HOOK(realloc);
+	PALLOC_HOOK(_Znwj);
+	PALLOC_HOOK(_Znaj);
+	PALLOC_HOOK(_ZdlPv);
+	PALLOC_HOOK(_ZdaPv);
+
+	return AL_OK;
+}
+
+int palloc_start(void)
+{
+	uint32_t meta = ALIGN_MEM(scls_meta_size(POOL_ALLOC_SIZE), SCE_KERNEL_4KiB);
+	uint32_t limit;
+	SceUID mbid;
+	uint8_t *base;
+	int ret;
+
+	// one span more, so the region can be aligned to the span size
+	mbid = sceKernelAllocMemBlock("AL::PoolAlloc::Slabs", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, meta + POOL_ALLOC_SIZE + SCLS_SPAN_SIZE, NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, (void **)&base);
+	scls_init(&heap, base, (void *)ALIGN_MEM((uintptr_t)base + meta, SCLS_SPAN_SIZE), POOL_ALLOC_SIZE);
+
+	for (uint32_t i = 0; i < SCLS_NUM_CLASSES; i++) {
+		limit = PALLOC_CACHE_BYTES / scls_size(i);
+		cache_limit[i] = limit > PALLOC_CACHE_DEPTH ? PALLOC_CACHE_DEPTH : limit > 0 ? limit : 1;
+	}
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::PoolAlloc::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	otab_init(&large_table, large, sizeof(PallocLarge), PALLOC_MAX_LARGE, 12);
+	sceClibMemset(&stats, 0, sizeof(PoolAllocStats));
+
+	running = 1;
+
+	return stats_register_dump(palloc_dump);
+}
+
+const SizeClassHeap *palloc_get_heap(void)
+{
+	return &heap;
+}
+
+// counters of the thread caches are only summed up here
+const PoolAllocStats *palloc_get_stats(void)
+{
+	static PoolAllocStats total;
+
+	total = stats;
+	for (int i = 0; i < PALLOC_MAX_THREADS; i++) {
+		total.allocs += caches[i].allocs;
+		total.frees += caches[i].frees;
+		total.cacheHits += caches[i].hits;
+	}
+
+	return &total;
+}
+
+void palloc_dump(void)
+{
+	const PoolAllocStats *s = palloc_get_stats();
+	uint64_t used = 0;
+	uint32_t cached;
+	SceUID fd;
+
+	fd = stats_file_open("pool_alloc.csv");
+	if (fd < 0)
+		return;
+
+	for (uint32_t i = 0; i < SCLS_NUM_CLASSES; i++)
+		used += (uint64_t)heap.inUse[i] * scls_size(i);
+
+	stats_file_printf(fd, "allocs,%u\n", s->allocs);
+	stats_file_printf(fd, "frees,%u\n", s->frees);
+	stats_file_printf(fd, "cache_hits,%u\n", s->cacheHits);
+	stats_file_printf(fd, "cache_refills,%u\n", s->refills);
+	stats_file_printf(fd, "cache_flushes,%u\n", s->flushes);
+	stats_file_printf(fd, "reallocs,%u\n", s->reallocs);
+	stats_file_printf(fd, "realloc_moves,%u\n", s->reallocMoves);
+	stats_file_printf(fd, "large_allocs,%u\n", s->largeAllocs);
+	stats_file_printf(fd, "large_frees,%u\n", s->largeFrees);
+	stats_file_printf(fd, "large_live,%u\n", s->largeLive);
+	stats_file_printf(fd, "large_bytes,%llu\n", s->largeBytes);
+	stats_file_printf(fd, "large_peak_bytes,%llu\n", s->peakLargeBytes);
+	stats_file_printf(fd, "libc_fallbacks,%u\n", s->fallbacks);
+	stats_file_printf(fd, "libc_frees,%u\n", s->foreignFrees);
+	stats_file_printf(fd, "threads,%u\n", s->threads);
+	stats_file_printf(fd, "spans_live,%u\n", heap.liveSpans);
+	stats_file_printf(fd, "spans_peak,%u\n", heap.peakSpans);
+	stats_file_printf(fd, "spans_total,%u\n", heap.numSpans);
+	stats_file_printf(fd, "slab_bytes_used,%llu\n", used);
+	stats_file_printf(fd, "slab_bytes_live,%llu\n", (uint64_t)heap.liveSpans * SCLS_SPAN_SIZE);
+
+	stats_file_printf(fd, "class_size,objects,cached,spans\n");
+	for (uint32_t i = 0; i < SCLS_NUM_CLASSES; i++) {
+		if (heap.classSpans[i] == 0)
+			continue;
+
+		cached = 0;
+		for (int j = 0; j < PALLOC_MAX_THREADS; j++)
+			cached += caches[j].count[i];
+
+		stats_file_printf(fd, "%u,%u,%u,%u\n", scls_size(i), heap.inUse[i], cached, heap.classSpans[i]);
+	}
+
+	stats_file_close(fd);
+}
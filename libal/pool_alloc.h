@@ -0,0 +1,43 @@
+#ifndef __POOL_ALLOC_H__
+#define __POOL_ALLOC_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "size_class.h"
+
+// threads with their own object cache, more share the locked path
+#define PALLOC_MAX_THREADS	32
+
+// objects and bytes a thread keeps per class before giving them back
+#define PALLOC_CACHE_DEPTH	16
+#define PALLOC_CACHE_BYTES	(32 * 1024)
+
+// large objects live at the same time, power of two, more go to libc
+#define PALLOC_MAX_LARGE	1024
+
+typedef struct {
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t cacheHits;
+	uint32_t refills;
+	uint32_t flushes;
+	uint32_t reallocs;
+	uint32_t reallocMoves;
+	uint32_t largeAllocs;
+	uint32_t largeFrees;
+	uint32_t largeLive;
+	uint32_t fallbacks;
+	uint32_t foreignFrees;
+	uint32_t threads;
+	uint64_t largeBytes;
+	uint64_t peakLargeBytes;
+} PoolAllocStats;
+
+int palloc_bind(Symtable *table);
+int palloc_start(void);
+const SizeClassHeap *palloc_get_heap(void);
+const PoolAllocStats *palloc_get_stats(void);
+void palloc_dump(void);
+
+#endif
@@ -0,0 +1,206 @@
+/* pvrtc.c -- PVRTC 4bpp encoder
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// A plain two pass PVRTC1 4bpp encoder. The first pass stores the bounding
+// box of every 4x4 block as its A and B colour, the second one reproduces
+// the decoder's bilinear upscale of those colours and picks the closest of
+// the four modulation weights for every texel. Blocks without translucent
+// texels use the opaque colour encoding for the extra bit of precision.
+//
+// Blocks are stored in Morton order. Levels smaller than 8x8 are still
+// stored as 8x8, the missing texels repeat the edge.
+//
+
+#include "pvrtc.h"
+
+#define OPAQUE_A	0x8000
+#define OPAQUE_B	0x80000000
+
+typedef struct {
+	uint32_t modulation;
+	uint32_t color;
+} PvrtcBlock;
+
+static const int mod_weights[4] = { 0, 3, 5, 8 };
+
+static uint32_t twiddle(uint32_t width, uint32_t height, uint32_t x, uint32_t y)
+{
+	uint32_t min = width < height ? width : height;
+	uint32_t rest = width < height ? y : x;
+	uint32_t out = 0, shift = 0;
+
+	for (uint32_t bit = 1; bit < min; bit <<= 1, shift++) {
+		if (y & bit)
+			out |= 1 << (2 * shift);
+		if (x & bit)
+			out |= 2 << (2 * shift);
+	}
+
+	return out | ((rest >> shift) << (2 * shift));
+}
+
+static inline uint32_t quant(int value, int bits)
+{
+	return (value * ((1 << bits) - 1) + 127) / 255;
+}
+
+static inline int expand5(int value)
+{
+	return (value << 3) | (value >> 2);
+}
+
+static uint32_t pack_color(const int *a, const int *b, int opaque)
+{
+	if (opaque) {
+		return OPAQUE_A | (quant(a[0], 5) << 10) | (quant(a[1], 5) << 5) | (quant(a[2], 4) << 1) |
+			OPAQUE_B | (quant(b[0], 5) << 26) | (quant(b[1], 5) << 21) | (quant(b[2], 5) << 16);
+	}
+
+	return (quant(a[3], 3) << 12) | (quant(a[0], 4) << 8) | (quant(a[1], 4) << 4) | (quant(a[2], 3) << 1) |
+		(quant(b[3], 3) << 28) | (quant(b[0], 4) << 24) | (quant(b[1], 4) << 20) | (quant(b[2], 4) << 16);
+}
+
+// same expansion as the hardware, through 5 bits per colour and 4 for alpha
+static void unpack_color(uint32_t color, int *a, int *b)
+{
+	int v;
+
+	if (color & OPAQUE_A) {
+		a[0] = expand5((color >> 10) & 0x1F);
+		a[1] = expand5((color >> 5) & 0x1F);
+		v = (color >> 1) & 0xF;
+		a[2] = expand5((v << 1) | (v >> 3));
+		a[3] = 0xFF;
+	} else {
+		v = (color >> 8) & 0xF;
+		a[0] = expand5((v << 1) | (v >> 3));
+		v = (color >> 4) & 0xF;
+		a[1] = expand5((v << 1) | (v >> 3));
+		v = (color >> 1) & 0x7;
+		a[2] = expand5((v << 2) | (v >> 1));
+		v = ((color >> 12) & 0x7) << 1;
+		a[3] = (v << 4) | v;
+	}
+
+	if (color & OPAQUE_B) {
+		b[0] = expand5((color >> 26) & 0x1F);
+		b[1] = expand5((color >> 21) & 0x1F);
+		b[2] = expand5((color >> 16) & 0x1F);
+		b[3] = 0xFF;
+	} else {
+		v = (color >> 24) & 0xF;
+		b[0] = expand5((v << 1) | (v >> 3));
+		v = (color >> 20) & 0xF;
+		b[1] = expand5((v << 1) | (v >> 3));
+		v = (color >> 16) & 0xF;
+		b[2] = expand5((v << 1) | (v >> 3));
+		v = ((color >> 28) & 0x7) << 1;
+		b[3] = (v << 4) | v;
+	}
+}
+
+uint32_t pvrtc_size(int width, int height)
+{
+	if (width < 8)
+		width = 8;
+	if (height < 8)
+		height = 8;
+
+	return width * height / 2;
+}
+
+uint64_t pvrtc_encode(void *dst, int width, int height, PvrtcFetch fetch, const void *src)
+{
+	PvrtcBlock *blocks = (PvrtcBlock *)dst;
+	int bw = (width < 8 ? 8 : width) / 4;
+	int bh = (height < 8 ? 8 : height) / 4;
+	int ca[3][3][4], cb[3][3][4];
+	uint64_t error = 0;
+	uint8_t px[4];
+
+	for (int by = 0; by < bh; by++) {
+		for (int bx = 0; bx < bw; bx++) {
+			int lo[4] = { 255, 255, 255, 255 };
+			int hi[4] = { 0, 0, 0, 0 };
+
+			for (int y = 0; y < 4; y++) {
+				for (int x = 0; x < 4; x++) {
+					int sx = bx * 4 + x, sy = by * 4 + y;
+
+					fetch(src, sx < width ? sx : width - 1, sy < height ? sy : height - 1, px);
+					for (int c = 0; c < 4; c++) {
+						if (px[c] < lo[c])
+							lo[c] = px[c];
+						if (px[c] > hi[c])
+							hi[c] = px[c];
+					}
+				}
+			}
+
+			PvrtcBlock *block = &blocks[twiddle(bw, bh, bx, by)];
+			block->modulation = 0;
+			block->color = pack_color(lo, hi, lo[3] == 255);
+		}
+	}
+
+	for (int by = 0; by < bh; by++) {
+		for (int bx = 0; bx < bw; bx++) {
+			PvrtcBlock *block = &blocks[twiddle(bw, bh, bx, by)];
+
+			// the colours wrap around at the texture edges
+			for (int j = 0; j < 3; j++) {
+				for (int i = 0; i < 3; i++) {
+					uint32_t nx = (bx + i - 1 + bw) % bw, ny = (by + j - 1 + bh) % bh;
+					unpack_color(blocks[twiddle(bw, bh, nx, ny)].color, ca[j][i], cb[j][i]);
+				}
+			}
+
+			for (int y = 0; y < 4; y++) {
+				// block colours sit on the block centres, 2 texels in
+				int j0 = y < 2 ? 0 : 1, fy = y < 2 ? y + 2 : y - 2;
+
+				for (int x = 0; x < 4; x++) {
+					int i0 = x < 2 ? 0 : 1, fx = x < 2 ? x + 2 : x - 2;
+					int sx = bx * 4 + x, sy = by * 4 + y;
+					int a[4] = { 0, 0, 0, 0 }, b[4] = { 0, 0, 0, 0 };
+					uint32_t best = 0, best_err = 0xFFFFFFFF;
+
+					for (int j = 0; j < 2; j++) {
+						for (int i = 0; i < 2; i++) {
+							int w = (i ? fx : 4 - fx) * (j ? fy : 4 - fy);
+							for (int c = 0; c < 4; c++) {
+								a[c] += ca[j0 + j][i0 + i][c] * w;
+								b[c] += cb[j0 + j][i0 + i][c] * w;
+							}
+						}
+					}
+
+					fetch(src, sx < width ? sx : width - 1, sy < height ? sy : height - 1, px);
+
+					for (uint32_t m = 0; m < 4; m++) {
+						uint32_t err = 0;
+						for (int c = 0; c < 4; c++) {
+							int d = (a[c] * (8 - mod_weights[m]) + b[c] * mod_weights[m]) / 128 - px[c];
+							err += d * d;
+						}
+						if (err < best_err) {
+							best_err = err;
+							best = m;
+						}
+					}
+
+					block->modulation |= best << (2 * (y * 4 + x));
+					error += best_err;
+				}
+			}
+		}
+	}
+
+	return error;
+}
@@ -0,0 +1,12 @@
+#ifndef __PVRTC_H__
+#define __PVRTC_H__
+
+#include <stdint.h>
+
+// returns the source pixel at x, y as RGBA8888
+typedef void (*PvrtcFetch)(const void *src, int x, int y, uint8_t *rgba);
+
+uint32_t pvrtc_size(int width, int height);
+uint64_t pvrtc_encode(void *dst, int width, int height, PvrtcFetch fetch, const void *src);
+
+#endif
@@ -0,0 +1,152 @@
+/* settings.c -- runtime settings file
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// SETTINGS_PATH holds "key = value" lines, '#' starts a comment. Keys
+// outside of a section apply to every model, keys under [handheld] or [tv]
+// only to that one and win over the global ones wherever they appear. Keys
+// that are missing or out of range keep their defaults, which are the
+// values eglInit used to hard-code:
+//
+//   flip_buffers = 2	2 or 3
+//   msaa = 4			0, 2 or 4 samples
+//   swap_interval = 1	0 to 4 vblanks per frame
+//   pacer_fps = 0		30, 20 or 15 to lock the frame rate, 0 for off
+//   flip_affinity = 1	CPU core of the flip chain thread, 0 to 2
+//
+
+#include <kernel.h>
+
+#include <stdlib.h>
+
+#include "settings.h"
+#include "config.h"
+#include "al_error.h"
+
+static char text[SETT_MAX_FILE_SIZE];
+
+static char *trim(char *str)
+{
+	char *end;
+
+	while (*str == ' ' || *str == '\t')
+		str++;
+
+	end = str + sceClibStrnlen(str, SETT_MAX_FILE_SIZE);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		*--end = '\0';
+
+	return str;
+}
+
+static void apply(Settings *settings, const char *key, const char *str)
+{
+	char *end;
+	long value = strtol(str, &end, 10);
+
+	if (end == str || *end != '\0')
+		return;
+
+	if (sceClibStrcmp(key, "flip_buffers") == 0) {
+		if (value >= 2 && value <= 3)
+			settings->flipBuffers = value;
+	} else if (sceClibStrcmp(key, "msaa") == 0) {
+		if (value == 0 || value == 2 || value == 4)
+			settings->msaa = value;
+	} else if (sceClibStrcmp(key, "swap_interval") == 0) {
+		if (value >= 0 && value <= 4)
+			settings->swapInterval = value;
+	} else if (sceClibStrcmp(key, "pacer_fps") == 0) {
+		if (value == 0 || value == 30 || value == 20 || value == 15)
+			settings->pacerFps = value;
+	} else if (sceClibStrcmp(key, "flip_affinity") == 0) {
+		if (value >= 0 && value <= 2)
+			settings->flipAffinity = value;
+	}
+}
+
+// section NULL picks the global keys
+static void parse(Settings *settings, const char *section)
+{
+	const char *p = text;
+	char line[128], *key, *value, *sep;
+	int use = (section == NULL);
+
+	while (*p) {
+		size_t len = 0;
+
+		while (*p && *p != '\n') {
+			if (len < sizeof(line) - 1)
+				line[len++] = *p;
+			p++;
+		}
+		if (*p)
+			p++;
+		line[len] = '\0';
+
+		sep = sceClibStrchr(line, '#');
+		if (sep)
+			*sep = '\0';
+
+		key = trim(line);
+		if (*key == '\0')
+			continue;
+
+		if (*key == '[') {
+			sep = sceClibStrchr(key, ']');
+			if (sep)
+				*sep = '\0';
+			use = section != NULL && sceClibStrcmp(key + 1, section) == 0;
+			continue;
+		}
+
+		sep = sceClibStrchr(key, '=');
+		if (sep == NULL || !use)
+			continue;
+
+		*sep = '\0';
+		value = trim(sep + 1);
+		apply(settings, trim(key), value);
+	}
+}
+
+const char *sett_model_name(void)
+{
+	return sceKernelGetModel() == SCE_KERNEL_MODEL_VITATV ? "tv" : "handheld";
+}
+
+int sett_load(Settings *settings)
+{
+	SceUID fd;
+	int res;
+
+	if (settings == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	settings->flipBuffers = 2;
+	settings->msaa = 4;
+	settings->swapInterval = 1;
+	settings->pacerFps = 0;
+	settings->flipAffinity = 1;
+
+	fd = sceIoOpen(SETTINGS_PATH, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	res = sceIoRead(fd, text, sizeof(text) - 1);
+	sceIoClose(fd);
+
+	if (res < 0)
+		return res;
+	text[res] = '\0';
+
+	parse(settings, NULL);
+	parse(settings, sett_model_name());
+
+	return AL_OK;
+}
@@ -0,0 +1,19 @@
+#ifndef __SETTINGS_H__
+#define __SETTINGS_H__
+
+#include <kernel.h>
+
+#define SETT_MAX_FILE_SIZE	4096
+
+typedef struct {
+	int flipBuffers;
+	int msaa;
+	int swapInterval;
+	int pacerFps;
+	int flipAffinity;
+} Settings;
+
+int sett_load(Settings *settings);
+const char *sett_model_name(void);
+
+#endif
@@ -0,0 +1,223 @@
+/* size_class.c -- size class slabs for small allocations
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Only bookkeeping, no locking and no OS calls, so the same code runs in
+// libal/pool_alloc.c and in tools/allocbench.c.
+//
+// Sizes are rounded up to one of SCLS_NUM_CLASSES classes, 8 bytes and
+// then steps of 16 up to 128, four classes per power of two above, so at
+// most a fifth of an object is padding. Every class above 8 bytes is a
+// multiple of 16 and spans are aligned to their size, so objects are 16
+// byte aligned.
+//
+// The region is split into SCLS_SPAN_SIZE spans, each holding objects of
+// one class. A span hands out objects from its free list first, then
+// carves new ones, so untouched memory is never written. Spans with
+// objects left are on their class's partial list; a span whose objects
+// are all freed goes back to the free span list and may take another
+// class next.
+//
+
+#include <string.h>
+
+#include "size_class.h"
+
+static const uint32_t class_sizes[SCLS_NUM_CLASSES] = {
+	8, 16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+	2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192,
+	10240, 12288, 14336, 16384, 20480, 24576, 28672, 32768
+};
+
+// class of sizes up to 1024 by 16 byte step and up to SCLS_MAX_SIZE by 128
+static uint8_t small_lookup[1024 / 16 + 1];
+static uint8_t large_lookup[SCLS_MAX_SIZE / 128 + 1];
+static int lookup_ready = 0;
+
+static void build_lookup(void)
+{
+	uint32_t cls = 0;
+
+	for (uint32_t i = 0; i < sizeof(small_lookup); i++) {
+		while (class_sizes[cls] < i * 16)
+			cls++;
+		small_lookup[i] = cls;
+	}
+
+	cls = 0;
+	for (uint32_t i = 0; i < sizeof(large_lookup); i++) {
+		while (class_sizes[cls] < i * 128)
+			cls++;
+		large_lookup[i] = cls;
+	}
+
+	lookup_ready = 1;
+}
+
+uint32_t scls_class(uint32_t size)
+{
+	if (size <= 8)
+		return 0;
+	if (size <= 1024)
+		return small_lookup[(size + 15) >> 4];
+	if (size <= SCLS_MAX_SIZE)
+		return large_lookup[(size + 127) >> 7];
+
+	return SCLS_NONE;
+}
+
+uint32_t scls_size(uint32_t cls)
+{
+	return class_sizes[cls];
+}
+
+// bytes of span headers for a region of size bytes
+uint32_t scls_meta_size(uint32_t size)
+{
+	return (size / SCLS_SPAN_SIZE) * sizeof(SclsSpan);
+}
+
+// mem has to be aligned to SCLS_SPAN_SIZE
+void scls_init(SizeClassHeap *heap, void *meta, void *mem, uint32_t size)
+{
+	if (!lookup_ready)
+		build_lookup();
+
+	heap->base = (uint8_t *)mem;
+	heap->spans = (SclsSpan *)meta;
+	heap->numSpans = size / SCLS_SPAN_SIZE;
+	heap->spansUsed = 0;
+	heap->freeSpans = SCLS_NONE;
+	heap->liveSpans = 0;
+	heap->peakSpans = 0;
+
+	for (uint32_t i = 0; i < SCLS_NUM_CLASSES; i++) {
+		heap->partial[i] = SCLS_NONE;
+		heap->inUse[i] = 0;
+		heap->classSpans[i] = 0;
+	}
+}
+
+static void list_remove(SizeClassHeap *heap, uint32_t *head, uint32_t index)
+{
+	SclsSpan *s = &heap->spans[index];
+
+	if (s->prev != SCLS_NONE)
+		heap->spans[s->prev].next = s->next;
+	else
+		*head = s->next;
+
+	if (s->next != SCLS_NONE)
+		heap->spans[s->next].prev = s->prev;
+}
+
+static void list_push(SizeClassHeap *heap, uint32_t *head, uint32_t index)
+{
+	SclsSpan *s = &heap->spans[index];
+
+	s->prev = SCLS_NONE;
+	s->next = *head;
+	if (*head != SCLS_NONE)
+		heap->spans[*head].prev = index;
+	*head = index;
+}
+
+static uint32_t new_span(SizeClassHeap *heap, uint32_t cls)
+{
+	uint32_t index = heap->freeSpans;
+	SclsSpan *s;
+
+	if (index != SCLS_NONE)
+		list_remove(heap, &heap->freeSpans, index);
+	else if (heap->spansUsed < heap->numSpans)
+		index = heap->spansUsed++;
+	else
+		return SCLS_NONE;
+
+	s = &heap->spans[index];
+	s->cls = cls;
+	s->used = 0;
+	s->carve = 0;
+	s->free = NULL;
+	list_push(heap, &heap->partial[cls], index);
+
+	heap->classSpans[cls]++;
+	heap->liveSpans++;
+	if (heap->liveSpans > heap->peakSpans)
+		heap->peakSpans = heap->liveSpans;
+
+	return index;
+}
+
+// hands out up to count objects of class cls, fewer once the region is full
+uint32_t scls_alloc(SizeClassHeap *heap, uint32_t cls, void **objs, uint32_t count)
+{
+	uint32_t size = class_sizes[cls], capacity = SCLS_SPAN_SIZE / size;
+	uint32_t done = 0, index;
+	SclsSpan *s;
+
+	while (done < count) {
+		index = heap->partial[cls];
+		if (index == SCLS_NONE) {
+			index = new_span(heap, cls);
+			if (index == SCLS_NONE)
+				break;
+		}
+
+		s = &heap->spans[index];
+		while (done < count && s->used < capacity) {
+			if (s->free != NULL) {
+				objs[done] = s->free;
+				s->free = *(void **)s->free;
+			} else {
+				objs[done] = heap->base + index * SCLS_SPAN_SIZE + s->carve;
+				s->carve += size;
+			}
+			s->used++;
+			done++;
+		}
+
+		if (s->used == capacity)
+			list_remove(heap, &heap->partial[cls], index);
+	}
+
+	heap->inUse[cls] += done;
+
+	return done;
+}
+
+// ptr has to be an object handed out by scls_alloc
+void scls_free(SizeClassHeap *heap, void *ptr)
+{
+	uint32_t index = ((uint8_t *)ptr - heap->base) / SCLS_SPAN_SIZE;
+	SclsSpan *s = &heap->spans[index];
+	uint32_t cls = s->cls;
+
+	if (s->used == SCLS_SPAN_SIZE / class_sizes[cls])
+		list_push(heap, &heap->partial[cls], index);
+
+	*(void **)ptr = s->free;
+	s->free = ptr;
+	s->used--;
+	heap->inUse[cls]--;
+
+	if (s->used == 0) {
+		list_remove(heap, &heap->partial[cls], index);
+		s->cls = SCLS_NONE;
+		list_push(heap, &heap->freeSpans, index);
+		heap->classSpans[cls]--;
+		heap->liveSpans--;
+	}
+}
+
+uint32_t scls_class_of(const SizeClassHeap *heap, const void *ptr)
+{
+	return heap->spans[((const uint8_t *)ptr - heap->base) / SCLS_SPAN_SIZE].cls;
+}
@@ -0,0 +1,50 @@
+#ifndef __SIZE_CLASS_H__
+#define __SIZE_CLASS_H__
+
+#include <stdint.h>
+
+#define SCLS_NONE			0xFFFFFFFF
+
+// largest size served from slabs, bigger ones are the caller's
+#define SCLS_MAX_SIZE		(32 * 1024)
+#define SCLS_NUM_CLASSES	41
+
+// slabs are carved from spans of this size, aligned to it
+#define SCLS_SPAN_SIZE		(64 * 1024)
+
+typedef struct {
+	uint32_t cls;		// SCLS_NONE while the span is free
+	uint32_t used;		// objects handed out
+	uint32_t carve;		// offset of the first object never handed out
+	void *free;			// objects freed back, linked through their first word
+	uint32_t prev;
+	uint32_t next;
+} SclsSpan;
+
+typedef struct {
+	uint8_t *base;
+	SclsSpan *spans;
+	uint32_t numSpans;
+	uint32_t spansUsed;		// spans ever carved, the rest was never touched
+	uint32_t freeSpans;		// list of emptied spans
+	uint32_t partial[SCLS_NUM_CLASSES];	// spans of the class with objects left
+	uint32_t inUse[SCLS_NUM_CLASSES];
+	uint32_t classSpans[SCLS_NUM_CLASSES];
+	uint32_t liveSpans;
+	uint32_t peakSpans;
+} SizeClassHeap;
+
+uint32_t scls_class(uint32_t size);
+uint32_t scls_size(uint32_t cls);
+uint32_t scls_meta_size(uint32_t size);
+void scls_init(SizeClassHeap *heap, void *meta, void *mem, uint32_t size);
+uint32_t scls_alloc(SizeClassHeap *heap, uint32_t cls, void **objs, uint32_t count);
+void scls_free(SizeClassHeap *heap, void *ptr);
+uint32_t scls_class_of(const SizeClassHeap *heap, const void *ptr);
+
+static inline int scls_owns(const SizeClassHeap *heap, const void *ptr)
+{
+	return (const uint8_t *)ptr >= heap->base && (const uint8_t *)ptr < heap->base + heap->numSpans * SCLS_SPAN_SIZE;
+}
+
+#endif
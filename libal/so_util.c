@@ -297,9 +297,11 @@ int so_resolve(so_module *mod, DynLibFunction *funcs, int num_funcs, int taint_m
 				//printf("  { \"%s\", (uintptr_t)&%s },\n", mod->dynstr + sym->st_name, mod->dynstr + sym->st_name);
 
 				int found = 0;
+				const char *name = mod->dynstr + sym->st_name;
+				uint32_t len, hash = symt_hash(name, &len);
 
 				for (int j = 0; j < num_funcs; j++) {
-					if (strcmp(mod->dynstr + sym->st_name, funcs[j].symbol) == 0) {
+					if (funcs[j].hash == hash && funcs[j].len == len && memcmp(name, funcs[j].symbol, len) == 0) {
 						*ptr = funcs[j].func;
 						found = 1;
 						break;
@@ -383,3 +385,114 @@ int so_symbol(so_module *mod, const char *symbol, uintptr_t *res)
 
 	return AL_ERROR_SO_UTIL_SYMBOL_NOT_FOUND;
 }
+
+static int compare_symidx(const void *a, const void *b)
+{
+	const so_sym *sa = (const so_sym *)a, *sb = (const so_sym *)b;
+
+	if (sa->addr != sb->addr)
+		return sa->addr < sb->addr ? -1 : 1;
+
+	// aliases of one function, the sized one first
+	return sa->size > sb->size ? -1 : sa->size < sb->size;
+}
+
+// Sorts the functions the module defines by address so so_addr2sym can
+// search them. Functions without a size end where the next one starts.
+int so_build_symidx(so_module *mod)
+{
+	const Elf32_Sym *sym;
+	so_sym *idx;
+	uint32_t end;
+	int count = 0, n = 0;
+	int res;
+
+	if (mod == NULL || mod->dynsym == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	if (mod->symidx != NULL)
+		return AL_OK;
+
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		sym = &mod->dynsym[i];
+		if (ELF32_ST_TYPE(sym->st_info) == STT_FUNC && sym->st_shndx != SHN_UNDEF)
+			count++;
+	}
+
+	if (count == 0)
+		return AL_ERROR_SO_UTIL_SYMBOL_NOT_FOUND;
+
+	res = mod->symidx_blockid = sceKernelAllocMemBlock("AL::SoUtil::SymIndex", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(count * sizeof(so_sym), SCE_KERNEL_4KiB), NULL);
+	if (res < 0)
+		return res;
+
+	sceKernelGetMemBlockBase(mod->symidx_blockid, (void **)&idx);
+
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		sym = &mod->dynsym[i];
+		if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF)
+			continue;
+
+		// the low bit marks Thumb code
+		idx[n].addr = sym->st_value & ~1;
+		idx[n].size = sym->st_size;
+		idx[n].name = sym->st_name;
+		n++;
+	}
+
+	qsort(idx, n, sizeof(so_sym), compare_symidx);
+
+	// drop aliases and give unsized functions the gap up to the next one
+	count = 0;
+	for (int i = 0; i < n; i++) {
+		if (count > 0 && idx[count - 1].addr == idx[i].addr)
+			continue;
+		idx[count++] = idx[i];
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (idx[i].size != 0)
+			continue;
+
+		end = i + 1 < count ? idx[i + 1].addr : mod->text_size;
+		idx[i].size = end > idx[i].addr ? end - idx[i].addr : 0;
+	}
+
+	mod->symidx = idx;
+	mod->num_symidx = count;
+
+	return AL_OK;
+}
+
+// Function containing addr, Thumb bit or not. Lookups only read the index.
+int so_addr2sym(so_module *mod, uintptr_t addr, const so_sym **sym)
+{
+	uint32_t offset;
+	int lo = 0, hi, mid;
+
+	if (mod == NULL || sym == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	addr &= ~1;
+	if (mod->symidx == NULL || addr < mod->text_base || addr >= mod->text_base + mod->text_size)
+		return AL_ERROR_SO_UTIL_SYMBOL_NOT_FOUND;
+
+	offset = addr - mod->text_base;
+
+	// last function starting at or below offset
+	hi = mod->num_symidx;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (mod->symidx[mid].addr <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0 || offset - mod->symidx[lo - 1].addr >= mod->symidx[lo - 1].size)
+		return AL_ERROR_SO_UTIL_SYMBOL_NOT_FOUND;
+
+	*sym = &mod->symidx[lo - 1];
+
+	return AL_OK;
+}
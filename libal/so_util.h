@@ -14,6 +14,13 @@
 #define RW_MEMBLOCK		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW
 #endif
 
+// function defined by the module
+typedef struct {
+	uint32_t addr;		// offset in text, Thumb bit cleared
+	uint32_t size;
+	uint32_t name;		// offset in dynstr
+} so_sym;
+
 typedef struct {
 	SceUID text_blockid, data_blockid;
 	uintptr_t text_base, data_base;
@@ -40,6 +47,11 @@ typedef struct {
 	char *soname;
 	char *shstr;
 	char *dynstr;
+
+	// built by so_build_symidx, sorted by address
+	SceUID symidx_blockid;
+	so_sym *symidx;
+	int num_symidx;
 } so_module;
 
 int so_hook_thumb(uintptr_t addr, uintptr_t dst);
@@ -54,5 +66,7 @@ int so_resolve(so_module *mod, DynLibFunction *funcs, int num_funcs, int taint_m
 int so_initialize(so_module *mod);
 int so_hash(const uint8_t *name, uint32_t *hash);
 int so_symbol(so_module *mod, const char *symbol, uintptr_t *res);
+int so_build_symidx(so_module *mod);
+int so_addr2sym(so_module *mod, uintptr_t addr, const so_sym **sym);
 
 #endif
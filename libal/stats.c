@@ -0,0 +1,167 @@
+/* stats.c -- counters, histograms and savedata dumps for instrumentation
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <kernel.h>
+
+#include <stdarg.h>
+
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+
+static StatsDumpFunc dumpers[STATS_MAX_DUMPERS];
+static unsigned int num_dumpers = 0;
+
+// Values below STATS_HIST_LINEAR get a bucket each, larger values are split
+// into power of two ranges with (1 << STATS_HIST_SUB_BITS) buckets per range.
+static unsigned int hist_index(uint32_t value)
+{
+	unsigned int exp, sub, idx;
+
+	if (value < STATS_HIST_LINEAR)
+		return value;
+
+	exp = 31 - __builtin_clz(value);
+	sub = (value >> (exp - STATS_HIST_SUB_BITS)) & ((1 << STATS_HIST_SUB_BITS) - 1);
+	idx = STATS_HIST_LINEAR + ((exp - 3) << STATS_HIST_SUB_BITS) + sub;
+
+	if (idx >= STATS_HIST_BUCKETS)
+		idx = STATS_HIST_BUCKETS - 1;
+
+	return idx;
+}
+
+static uint32_t hist_upper_bound(unsigned int idx)
+{
+	unsigned int exp, sub;
+
+	if (idx < STATS_HIST_LINEAR)
+		return idx;
+
+	exp = 3 + ((idx - STATS_HIST_LINEAR) >> STATS_HIST_SUB_BITS);
+	sub = (idx - STATS_HIST_LINEAR) & ((1 << STATS_HIST_SUB_BITS) - 1);
+
+	return (((1 << STATS_HIST_SUB_BITS) + sub + 1) << (exp - STATS_HIST_SUB_BITS)) - 1;
+}
+
+void stats_hist_reset(StatsHist *hist)
+{
+	sceClibMemset(hist, 0, sizeof(StatsHist));
+	hist->min = 0xFFFFFFFF;
+}
+
+void stats_hist_add(StatsHist *hist, uint32_t value)
+{
+	hist->bucket[hist_index(value)]++;
+	hist->count++;
+	hist->sum += value;
+
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+uint32_t stats_hist_mean(const StatsHist *hist)
+{
+	if (hist->count == 0)
+		return 0;
+
+	return (uint32_t)(hist->sum / hist->count);
+}
+
+uint32_t stats_hist_percentile(const StatsHist *hist, uint32_t percent)
+{
+	uint32_t target, seen = 0;
+
+	if (hist->count == 0)
+		return 0;
+
+	target = (uint32_t)(((uint64_t)hist->count * percent + 99) / 100);
+	if (target == 0)
+		target = 1;
+
+	for (unsigned int i = 0; i < STATS_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= target) {
+			uint32_t bound = hist_upper_bound(i);
+			return bound < hist->max ? bound : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+SceUID stats_file_open(const char *name)
+{
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE];
+
+	if (name == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	sceIoMkdir(STATS_PATH, 0777);
+
+	sceClibSnprintf(path, sizeof(path), "%s/%s", STATS_PATH, name);
+
+	return sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+}
+
+int stats_file_printf(SceUID fd, const char *fmt, ...)
+{
+	va_list list;
+	char string[512];
+	int len;
+
+	va_start(list, fmt);
+	len = sceClibVsnprintf(string, sizeof(string), fmt, list);
+	va_end(list);
+
+	if (len <= 0)
+		return len;
+	if (len >= sizeof(string))
+		len = sizeof(string) - 1;
+
+	return sceIoWrite(fd, string, len);
+}
+
+int stats_file_write_hist(SceUID fd, const char *name, const StatsHist *hist)
+{
+	return stats_file_printf(fd, "%s,%u,%u,%u,%u,%u,%u,%u\n",
+		name,
+		hist->count,
+		hist->count ? hist->min : 0,
+		stats_hist_mean(hist),
+		stats_hist_percentile(hist, 50),
+		stats_hist_percentile(hist, 95),
+		stats_hist_percentile(hist, 99),
+		hist->max);
+}
+
+int stats_file_close(SceUID fd)
+{
+	return sceIoClose(fd);
+}
+
+int stats_register_dump(StatsDumpFunc func)
+{
+	if (func == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	if (num_dumpers >= STATS_MAX_DUMPERS)
+		return AL_ERROR_STATS_TOO_MANY_DUMPERS;
+
+	dumpers[num_dumpers++] = func;
+
+	return AL_OK;
+}
+
+void stats_dump_all(void)
+{
+	for (unsigned int i = 0; i < num_dumpers; i++)
+		dumpers[i]();
+}
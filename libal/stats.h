@@ -0,0 +1,35 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <kernel.h>
+
+#define STATS_HIST_LINEAR		8
+#define STATS_HIST_SUB_BITS		2
+#define STATS_HIST_BUCKETS		96
+
+#define STATS_MAX_DUMPERS		32
+
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t bucket[STATS_HIST_BUCKETS];
+} StatsHist;
+
+typedef void (*StatsDumpFunc)(void);
+
+void stats_hist_reset(StatsHist *hist);
+void stats_hist_add(StatsHist *hist, uint32_t value);
+uint32_t stats_hist_mean(const StatsHist *hist);
+uint32_t stats_hist_percentile(const StatsHist *hist, uint32_t percent);
+
+SceUID stats_file_open(const char *name);
+int stats_file_printf(SceUID fd, const char *fmt, ...);
+int stats_file_write_hist(SceUID fd, const char *name, const StatsHist *hist);
+int stats_file_close(SceUID fd);
+
+int stats_register_dump(StatsDumpFunc func);
+void stats_dump_all(void);
+
+#endif
@@ -152,22 +152,63 @@ void getsockname();
 
 /* SYMT IMPL */
 
-static char *newString(const char *s)
+// Names are interned in the table's memblock, growing down from its end
+// while entries grow up from the start, so a table is one allocation.
+// Every entry keeps the hash and length of its name and lookups compare
+// those before any bytes.
+
+static DynLibFunction *findEntry(Symtable *table, const char *symbol, uint32_t hash, uint32_t len)
+{
+	DynLibFunction *f;
+
+	for (unsigned int i = 0; i < table->count; i++) {
+		f = &table->funTable[i];
+		if (f->hash == hash && f->len == len && !sceClibMemcmp(f->symbol, symbol, len))
+			return f;
+	}
+
+	return NULL;
+}
+
+static char *internString(Symtable *table, const char *symbol, uint32_t hash, uint32_t len)
 {
-	unsigned int len = sceClibStrnlen(s, 256);
-	char *ret = (char *)calloc(1, len + 1);
-	strncpy(ret, s, len + 1);
+	DynLibFunction *f = findEntry(table, symbol, hash, len);
+	char *ret;
+
+	if (f != NULL)
+		return f->symbol;
+
+	if ((table->count + 1) * sizeof(DynLibFunction) + table->stringSize + len + 1 > table->size)
+		return NULL;
+
+	table->stringSize += len + 1;
+	ret = (char *)table->funTable + table->size - table->stringSize;
+	sceClibMemcpy(ret, symbol, len);
+	ret[len] = '\0';
 
 	return ret;
 }
 
 int symt_append(Symtable *table, const char *symbol, uintptr_t func)
 {
-	if (table->count * sizeof(DynLibFunction) > table->size)
+	DynLibFunction *f;
+	uint32_t hash, len;
+	char *name;
+
+	if (table == NULL || symbol == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	hash = symt_hash(symbol, &len);
+
+	name = internString(table, symbol, hash, len);
+	if (name == NULL || (table->count + 1) * sizeof(DynLibFunction) + table->stringSize > table->size)
 		return AL_ERROR_SYMT_TABLE_SIZE;
 
-	table->funTable[table->count].symbol = newString(symbol);
-	table->funTable[table->count].func = func;
+	f = &table->funTable[table->count];
+	f->symbol = name;
+	f->func = func;
+	f->hash = hash;
+	f->len = len;
 	table->count++;
 
 	return AL_OK;
@@ -196,6 +237,7 @@ int symt_create(Symtable *table, unsigned int size, uintptr_t *newlibFunctable)
 
 	table->size = alignedSize;
 	table->count = 0;
+	table->stringSize = 0;
 
 	sceKernelGetMemBlockBase(table->mbId, &table->funTable);
 
@@ -415,19 +457,78 @@ int symt_create(Symtable *table, unsigned int size, uintptr_t *newlibFunctable)
 	return AL_OK;
 }
 
+int symt_destroy(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	ret = sceKernelFreeMemBlock(table->mbId);
+	if (ret < 0)
+		return ret;
+
+	table->mbId = SCE_UID_INVALID_UID;
+	table->size = 0;
+	table->count = 0;
+	table->stringSize = 0;
+	table->funTable = NULL;
+
+	return AL_OK;
+}
+
 int symt_override(Symtable *table, const char *symbol, uintptr_t func)
 {
+	DynLibFunction *f;
+	uint32_t hash, len;
+
 	if (table == NULL || symbol == NULL)
 		return AL_ERROR_INVALID_POINTER;
 
-	for (int i = 0; i < table->count; i++) {
-		if (!strncmp(symbol, table->funTable[i].symbol, 256)) {
-			table->funTable[i].func = func;
-			return AL_OK;
-		}
-	}
+	hash = symt_hash(symbol, &len);
+
+	f = findEntry(table, symbol, hash, len);
+	if (f == NULL)
+		return AL_ERROR_SYMT_SYMBOL_NOT_FOUND;
+
+	f->func = func;
+
+	return AL_OK;
+}
+
+int symt_lookup(Symtable *table, const char *symbol, uintptr_t *func)
+{
+	DynLibFunction *f;
+	uint32_t hash, len;
+
+	if (table == NULL || symbol == NULL || func == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	hash = symt_hash(symbol, &len);
+
+	f = findEntry(table, symbol, hash, len);
+	if (f == NULL)
+		return AL_ERROR_SYMT_SYMBOL_NOT_FOUND;
+
+	*func = f->func;
+
+	return AL_OK;
+}
+
+// Replaces the binding of symbol and returns the previous one in orig, so
+// interposition layers can be stacked and forward to whatever was bound before.
+int symt_hook(Symtable *table, const char *symbol, uintptr_t func, uintptr_t *orig)
+{
+	int ret;
+
+	if (orig == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	ret = symt_lookup(table, symbol, orig);
+	if (ret < 0)
+		return ret;
 
-	return AL_ERROR_SYMT_SYMBOL_NOT_FOUND;
+	return symt_override(table, symbol, func);
 }
 
 int symt_load_deps()
@@ -3,22 +3,47 @@
 
 #include <kernel.h>
 
+// longest symbol name kept, longer ones are cut
+#define SYMT_MAX_NAME	256
+
 typedef struct {
 	char *symbol;
 	uintptr_t func;
+	uint32_t hash;
+	uint32_t len;
 } DynLibFunction;
 
 typedef struct {
 	SceUID mbId;
 	unsigned int size;
 	unsigned int count;
+	unsigned int stringSize;	// bytes of names, stored from the end of the block down
 
 	DynLibFunction *funTable;
 } Symtable;
 
+// 32-bit FNV-1a of the first SYMT_MAX_NAME bytes of symbol, their count in len
+static inline uint32_t symt_hash(const char *symbol, uint32_t *len)
+{
+	uint32_t h = 0x811C9DC5;
+	uint32_t i;
+
+	for (i = 0; i < SYMT_MAX_NAME && symbol[i] != '\0'; i++) {
+		h ^= (uint8_t)symbol[i];
+		h *= 0x01000193;
+	}
+
+	*len = i;
+
+	return h;
+}
+
 int symt_load_deps();
 int symt_create(Symtable *table, unsigned int size, uintptr_t *newlibFunctable);
+int symt_destroy(Symtable *table);
 int symt_append(Symtable *table, const char *symbol, uintptr_t func);
 int symt_override(Symtable *table, const char *symbol, uintptr_t func);
+int symt_lookup(Symtable *table, const char *symbol, uintptr_t *func);
+int symt_hook(Symtable *table, const char *symbol, uintptr_t func, uintptr_t *orig);
 
 #endif
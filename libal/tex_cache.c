@@ -0,0 +1,628 @@
+/* tex_cache.c -- persistent transcoded texture cache
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Texture uploads from libbc2.so are hashed and replaced by PVRTC 4bpp, the
+// SGX's native compressed format, so the driver no longer has to convert
+// the Android assets on every load and the textures take an eighth of the
+// memory and bandwidth. Encoding is slow, so it happens once: the result
+// is stored under TEX_CACHE_PATH keyed by the hash of the source data and
+// later loads read it back instead. The cache is bounded by
+// TEX_CACHE_MAX_SIZE and TEX_CACHE_MAX_ENTRIES and evicts the least
+// recently used textures first.
+//
+// Only power of two RGB/RGBA8888 and ETC1 textures between
+// TEX_CACHE_MIN_DIM and TEX_CACHE_MAX_DIM qualify. PVRTC is lossy, a texture
+// that does not encode within TEX_CACHE_MAX_MSE, typically UI art with hard
+// edges, is remembered as rejected and stays in its original format. Mip
+// levels follow whatever happened to level 0, as GL needs all levels in
+// one format, and textures with GL_GENERATE_MIPMAP set are left alone.
+//
+// The game never updates texture contents after the upload and keeps the
+// default unpack alignment, so neither needs handling here.
+//
+
+#include <kernel.h>
+
+#include <string.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "tex_cache.h"
+#include "pvrtc.h"
+#include "hash.h"
+#include "gl_util.h"
+#include "gl_defer.h"
+#include "so_util.h"
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+
+typedef struct {
+	uint64_t hash;
+	uint8_t transcoded;
+	uint8_t alpha;
+	uint8_t generateMipmap;
+	uint8_t reserved;
+} TexName;
+
+typedef struct {
+	const uint8_t *data;
+	uint32_t stride;
+} TexSource;
+
+static const int etc1_modifiers[8][2] = {
+	{ 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+	{ 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+};
+
+static int active = 0;
+
+static SceUID index_mbid = SCE_UID_INVALID_UID;
+static TexCacheHeader *header = NULL;
+static TexCacheEntry *entries = NULL;
+static int dirty = 0;
+static uint32_t idle_frames = 0;
+
+static SceUID buf_mbid = SCE_UID_INVALID_UID;
+static uint8_t *buffer = NULL;
+
+static TexName names[TEXC_MAX_NAMES];
+static GLuint bound[GLU_MAX_TEX_UNITS];
+static uint32_t active_unit = 0;
+
+static TexCacheStats stats;
+
+static void (* next_glActiveTexture)(GLenum texture);
+static void (* next_glBindTexture)(GLenum target, GLuint texture);
+static void (* next_glDeleteTextures)(GLsizei n, const GLuint *textures);
+static void (* next_glTexParameteri)(GLenum target, GLenum pname, GLint param);
+static void (* next_glTexImage2D)(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+static void (* next_glCompressedTexImage2D)(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+
+static inline int is_pot(int value)
+{
+	return value > 0 && (value & (value - 1)) == 0;
+}
+
+static inline uint8_t clamp_u8(int value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static void fetch_rgba(const void *src, int x, int y, uint8_t *rgba)
+{
+	const TexSource *s = (const TexSource *)src;
+	const uint8_t *p = s->data + y * s->stride + x * 4;
+
+	rgba[0] = p[0];
+	rgba[1] = p[1];
+	rgba[2] = p[2];
+	rgba[3] = p[3];
+}
+
+static void fetch_rgb(const void *src, int x, int y, uint8_t *rgba)
+{
+	const TexSource *s = (const TexSource *)src;
+	const uint8_t *p = s->data + y * s->stride + x * 3;
+
+	rgba[0] = p[0];
+	rgba[1] = p[1];
+	rgba[2] = p[2];
+	rgba[3] = 255;
+}
+
+// stride is in blocks here
+static void fetch_etc1(const void *src, int x, int y, uint8_t *rgba)
+{
+	const TexSource *s = (const TexSource *)src;
+	const uint8_t *b = s->data + ((y >> 2) * s->stride + (x >> 2)) * 8;
+	uint32_t bits = (b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7];
+	int px = x & 3, py = y & 3, k = px * 4 + py;
+	int sub = (b[3] & 1) ? py >= 2 : px >= 2;
+	int idx = (((bits >> (k + 16)) & 1) << 1) | ((bits >> k) & 1);
+	int mod = etc1_modifiers[sub ? (b[3] >> 2) & 7 : b[3] >> 5][idx & 1];
+
+	if (idx & 2)
+		mod = -mod;
+
+	for (int c = 0; c < 3; c++) {
+		int v;
+
+		if (b[3] & 2) {
+			v = b[c] >> 3;
+			if (sub)
+				v = (v + ((b[c] & 4) ? (b[c] & 7) - 8 : (b[c] & 7))) & 0x1F;
+			v = (v << 3) | (v >> 2);
+		} else {
+			v = sub ? b[c] & 0xF : b[c] >> 4;
+			v = (v << 4) | v;
+		}
+
+		rgba[c] = clamp_u8(v + mod);
+	}
+
+	rgba[3] = 255;
+}
+
+static TexName *current_name(void)
+{
+	GLuint name = bound[active_unit];
+
+	if (name == 0 || name >= TEXC_MAX_NAMES)
+		return NULL;
+
+	return &names[name];
+}
+
+static void payload_path(char *path, size_t size, uint64_t hash)
+{
+	sceClibSnprintf(path, size, TEX_CACHE_PATH "/" "%08X%08X.pvr", (uint32_t)(hash >> 32), (uint32_t)hash);
+}
+
+static TexCacheEntry *find_entry(uint64_t hash, int width, int height)
+{
+	for (uint32_t i = 0; i < header->count; i++) {
+		if (entries[i].hash == hash && entries[i].width == width && entries[i].height == height)
+			return &entries[i];
+	}
+
+	return NULL;
+}
+
+static void remove_entry(TexCacheEntry *entry)
+{
+	char path[64];
+
+	if (entry->size != 0) {
+		payload_path(path, sizeof(path), entry->hash);
+		sceIoRemove(path);
+		stats.cacheBytes -= entry->size;
+	}
+
+	*entry = entries[--header->count];
+	dirty = 1;
+}
+
+static void evict_lru(void)
+{
+	TexCacheEntry *oldest = &entries[0];
+
+	for (uint32_t i = 1; i < header->count; i++) {
+		if (entries[i].lastUse < oldest->lastUse)
+			oldest = &entries[i];
+	}
+
+	remove_entry(oldest);
+	stats.evictions++;
+}
+
+static TexCacheEntry *insert_entry(uint64_t hash, int width, int height, uint32_t size, uint32_t flags)
+{
+	TexCacheEntry *entry;
+
+	while (header->count > 0 && (header->count >= TEX_CACHE_MAX_ENTRIES || stats.cacheBytes + size > TEX_CACHE_MAX_SIZE))
+		evict_lru();
+
+	entry = &entries[header->count++];
+	entry->hash = hash;
+	entry->size = size;
+	entry->lastUse = ++header->clock;
+	entry->width = width;
+	entry->height = height;
+	entry->flags = flags;
+	entry->reserved = 0;
+
+	stats.cacheBytes += size;
+	dirty = 1;
+
+	return entry;
+}
+
+static int read_payload(const TexCacheEntry *entry)
+{
+	char path[64];
+	SceUID fd;
+	int res;
+
+	payload_path(path, sizeof(path), entry->hash);
+
+	fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	res = sceIoRead(fd, buffer, entry->size);
+	sceIoClose(fd);
+
+	return res == entry->size ? AL_OK : AL_ERROR_TEXC_INVALID_PAYLOAD;
+}
+
+static int write_payload(uint64_t hash, uint32_t size)
+{
+	char path[64];
+	SceUID fd;
+	int res;
+
+	payload_path(path, sizeof(path), hash);
+
+	fd = sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (fd < 0)
+		return fd;
+
+	res = sceIoWrite(fd, buffer, size);
+	sceIoClose(fd);
+
+	if (res != size) {
+		sceIoRemove(path);
+		return AL_ERROR_TEXC_INVALID_PAYLOAD;
+	}
+
+	return AL_OK;
+}
+
+static int load_index(void)
+{
+	SceUID fd;
+	int res;
+
+	fd = sceIoOpen(TEX_CACHE_PATH "/" "index.bin", SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	res = sceIoRead(fd, header, sizeof(TexCacheHeader));
+	if (res != sizeof(TexCacheHeader) || header->magic != TEXC_MAGIC || header->version != TEXC_VERSION || header->count > TEX_CACHE_MAX_ENTRIES) {
+		sceIoClose(fd);
+		return AL_ERROR_TEXC_INVALID_INDEX;
+	}
+
+	res = sceIoRead(fd, entries, header->count * sizeof(TexCacheEntry));
+	sceIoClose(fd);
+
+	if (res != header->count * sizeof(TexCacheEntry))
+		return AL_ERROR_TEXC_INVALID_INDEX;
+
+	return AL_OK;
+}
+
+static void write_index(void)
+{
+	SceUID fd;
+
+	fd = sceIoOpen(TEX_CACHE_PATH "/" "index.bin", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (fd < 0) {
+		stats.ioErrors++;
+		return;
+	}
+
+	if (sceIoWrite(fd, header, sizeof(TexCacheHeader) + header->count * sizeof(TexCacheEntry)) < 0)
+		stats.ioErrors++;
+	sceIoClose(fd);
+
+	dirty = 0;
+}
+
+static int has_alpha(const TexSource *src, int width, int height)
+{
+	for (int y = 0; y < height; y++) {
+		const uint8_t *p = src->data + y * src->stride + 3;
+		for (int x = 0; x < width; x++, p += 4) {
+			if (*p != 255)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+// returns 1 if the level went up as PVRTC, 0 if the caller has to upload the original
+static int upload(GLint level, GLsizei width, GLsizei height, int alpha, PvrtcFetch fetch, const TexSource *src, uint32_t size, uint32_t seed)
+{
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	TexName *tex = current_name();
+	TexCacheEntry *entry;
+	uint32_t payload_size;
+	uint64_t hash, error;
+	int store = 1, hit = 0;
+
+	if (tex == NULL)
+		return 0;
+
+	if (level == 0) {
+		tex->transcoded = 0;
+		if (tex->generateMipmap || !is_pot(width) || !is_pot(height) ||
+			width < TEX_CACHE_MIN_DIM || height < TEX_CACHE_MIN_DIM ||
+			width > TEX_CACHE_MAX_DIM || height > TEX_CACHE_MAX_DIM)
+			return 0;
+	} else if (!tex->transcoded || !is_pot(width) || !is_pot(height)) {
+		return 0;
+	}
+
+	hash = hash_data(src->data, size, seed ^ (width << 16) ^ height);
+	payload_size = pvrtc_size(width, height);
+	entry = find_entry(hash, width, height);
+
+	if (entry != NULL && (entry->flags & TEXC_FLAG_REJECTED)) {
+		entry->lastUse = ++header->clock;
+		dirty = 1;
+
+		// a mip level has to match level 0, encode it anyway but keep the verdict
+		if (level == 0)
+			return 0;
+		store = 0;
+		entry = NULL;
+	}
+
+	if (level == 0)
+		alpha = entry != NULL ? (entry->flags & TEXC_FLAG_ALPHA) != 0 : alpha;
+	else
+		alpha = tex->alpha;
+
+	if (entry != NULL && entry->size == payload_size && read_payload(entry) == AL_OK) {
+		entry->lastUse = ++header->clock;
+		dirty = 1;
+		hit = 1;
+		stats.hits++;
+	} else {
+		if (entry != NULL) {
+			remove_entry(entry);
+			stats.ioErrors++;
+		}
+
+		error = pvrtc_encode(buffer, width, height, fetch, src);
+		stats_hist_add(&stats.encodeUs, (uint32_t)(sceKernelGetProcessTimeWide() - start));
+
+		if (level == 0 && error / ((uint64_t)width * height * 4) > TEX_CACHE_MAX_MSE) {
+			insert_entry(hash, width, height, 0, TEXC_FLAG_REJECTED);
+			stats.rejected++;
+			return 0;
+		}
+
+		if (store) {
+			entry = insert_entry(hash, width, height, payload_size, alpha ? TEXC_FLAG_ALPHA : 0);
+			if (write_payload(hash, payload_size) < 0) {
+				remove_entry(entry);
+				stats.ioErrors++;
+			}
+		}
+
+		stats.misses++;
+	}
+
+	next_glCompressedTexImage2D(GL_TEXTURE_2D, level, alpha ? GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG : GL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG, width, height, 0, payload_size, buffer);
+
+	if (level == 0) {
+		tex->hash = hash;
+		tex->transcoded = 1;
+		tex->alpha = alpha;
+	}
+
+	if (hit)
+		stats_hist_add(&stats.hitUs, (uint32_t)(sceKernelGetProcessTimeWide() - start));
+
+	stats.sourceBytes += size;
+	stats.uploadBytes += payload_size;
+	idle_frames = 0;
+
+	return 1;
+}
+
+static void skip(GLint level)
+{
+	TexName *tex = current_name();
+
+	if (tex != NULL && level == 0)
+		tex->transcoded = 0;
+
+	stats.skipped++;
+}
+
+static void glActiveTexture_texc(GLenum texture)
+{
+	if (texture - GL_TEXTURE0 < GLU_MAX_TEX_UNITS)
+		active_unit = texture - GL_TEXTURE0;
+
+	next_glActiveTexture(texture);
+}
+
+static void glBindTexture_texc(GLenum target, GLuint texture)
+{
+	if (target == GL_TEXTURE_2D)
+		bound[active_unit] = texture;
+
+	next_glBindTexture(target, texture);
+}
+
+static void glDeleteTextures_texc(GLsizei n, const GLuint *textures)
+{
+	for (GLsizei i = 0; i < n; i++) {
+		if (textures[i] < TEXC_MAX_NAMES)
+			sceClibMemset(&names[textures[i]], 0, sizeof(TexName));
+		for (int u = 0; u < GLU_MAX_TEX_UNITS; u++) {
+			if (bound[u] == textures[i])
+				bound[u] = 0;
+		}
+	}
+
+	next_glDeleteTextures(n, textures);
+}
+
+static void glTexParameteri_texc(GLenum target, GLenum pname, GLint param)
+{
+	TexName *tex;
+
+	if (target == GL_TEXTURE_2D && pname == GL_GENERATE_MIPMAP) {
+		tex = current_name();
+		if (tex != NULL)
+			tex->generateMipmap = (param != GL_FALSE);
+	}
+
+	next_glTexParameteri(target, pname, param);
+}
+
+static void glTexImage2D_texc(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels)
+{
+	TexSource src;
+	int bpp = (format == GL_RGBA) ? 4 : 3;
+
+	stats.uploads++;
+
+	if (!active || target != GL_TEXTURE_2D || pixels == NULL || border != 0 || type != GL_UNSIGNED_BYTE ||
+		(format != GL_RGBA && format != GL_RGB) || internalformat != format) {
+		skip(level);
+		next_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+		return;
+	}
+
+	// GL_UNPACK_ALIGNMENT stays at its default of 4
+	src.data = (const uint8_t *)pixels;
+	src.stride = (width * bpp + 3) & ~3;
+
+	if (!upload(level, width, height, bpp == 4 && has_alpha(&src, width, height), bpp == 4 ? fetch_rgba : fetch_rgb, &src, src.stride * height, format))
+		next_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+static void glCompressedTexImage2D_texc(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	TexSource src;
+
+	stats.uploads++;
+
+	src.data = (const uint8_t *)data;
+	src.stride = (width + 3) / 4;
+
+	if (!active || target != GL_TEXTURE_2D || data == NULL || border != 0 || internalformat != GL_ETC1_RGB8_OES ||
+		imageSize < src.stride * ((height + 3) / 4) * 8) {
+		skip(level);
+		next_glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+		return;
+	}
+
+	if (!upload(level, width, height, 0, fetch_etc1, &src, imageSize, internalformat))
+		next_glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+static void check_extensions(void *arg)
+{
+	const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+
+	*(int *)arg = ext != NULL && strstr(ext, "GL_IMG_texture_compression_pvrtc") != NULL;
+}
+
+#define TEXC_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_texc, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int texc_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	TEXC_HOOK(glActiveTexture);
+	TEXC_HOOK(glBindTexture);
+	TEXC_HOOK(glDeleteTextures);
+	TEXC_HOOK(glTexParameteri);
+	TEXC_HOOK(glTexImage2D);
+	TEXC_HOOK(glCompressedTexImage2D);
+
+	sceClibMemset(&stats, 0, sizeof(TexCacheStats));
+	stats_hist_reset(&stats.hitUs);
+	stats_hist_reset(&stats.encodeUs);
+
+	return AL_OK;
+}
+
+// with GL_DEFERRED after gldf_start
+int texc_start(void)
+{
+	int supported = 0;
+
+	gldf_run_sync(check_extensions, &supported);
+	if (!supported)
+		return AL_ERROR_TEXC_UNSUPPORTED;
+
+	index_mbid = sceKernelAllocMemBlock("AL::TexCache::Index", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(sizeof(TexCacheHeader) + TEX_CACHE_MAX_ENTRIES * sizeof(TexCacheEntry), SCE_KERNEL_4KiB), NULL);
+	if (index_mbid < 0)
+		return index_mbid;
+
+	buf_mbid = sceKernelAllocMemBlock("AL::TexCache::Buffer", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(pvrtc_size(TEX_CACHE_MAX_DIM, TEX_CACHE_MAX_DIM), SCE_KERNEL_4KiB), NULL);
+	if (buf_mbid < 0) {
+		sceKernelFreeMemBlock(index_mbid);
+		return buf_mbid;
+	}
+
+	sceKernelGetMemBlockBase(index_mbid, (void **)&header);
+	sceKernelGetMemBlockBase(buf_mbid, (void **)&buffer);
+	entries = (TexCacheEntry *)(header + 1);
+
+	sceIoMkdir(TEX_CACHE_PATH, 0777);
+
+	if (load_index() != AL_OK) {
+		header->magic = TEXC_MAGIC;
+		header->version = TEXC_VERSION;
+		header->count = 0;
+		header->clock = 0;
+	}
+
+	stats.cacheBytes = 0;
+	for (uint32_t i = 0; i < header->count; i++)
+		stats.cacheBytes += entries[i].size;
+
+	active = 1;
+
+	return stats_register_dump(texc_dump);
+}
+
+void texc_end_frame(void)
+{
+	if (!active)
+		return;
+
+	// write the index back once a load is over rather than after every texture
+	if (dirty && ++idle_frames >= TEXC_FLUSH_FRAMES)
+		write_index();
+}
+
+const TexCacheStats *texc_get_stats(void)
+{
+	stats.entries = active ? header->count : 0;
+
+	return &stats;
+}
+
+void texc_dump(void)
+{
+	SceUID fd;
+
+	if (dirty)
+		write_index();
+
+	fd = stats_file_open("tex_cache.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "uploads,%u\n", stats.uploads);
+	stats_file_printf(fd, "hits,%u\n", stats.hits);
+	stats_file_printf(fd, "misses,%u\n", stats.misses);
+	stats_file_printf(fd, "rejected,%u\n", stats.rejected);
+	stats_file_printf(fd, "skipped,%u\n", stats.skipped);
+	stats_file_printf(fd, "evictions,%u\n", stats.evictions);
+	stats_file_printf(fd, "io_errors,%u\n", stats.ioErrors);
+	stats_file_printf(fd, "source_bytes,%llu\n", stats.sourceBytes);
+	stats_file_printf(fd, "upload_bytes,%llu\n", stats.uploadBytes);
+	stats_file_printf(fd, "cache_bytes,%llu\n", stats.cacheBytes);
+	stats_file_printf(fd, "cache_entries,%u\n", header->count);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "hit_us", &stats.hitUs);
+	stats_file_write_hist(fd, "encode_us", &stats.encodeUs);
+
+	stats_file_close(fd);
+}
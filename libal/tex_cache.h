@@ -0,0 +1,60 @@
+#ifndef __TEX_CACHE_H__
+#define __TEX_CACHE_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+#define TEXC_MAGIC		0x43584554 // 'TEXC'
+#define TEXC_VERSION	1
+
+#define TEXC_FLAG_ALPHA		0x1
+#define TEXC_FLAG_REJECTED	0x2
+
+// texture names tracked for their upload state, larger names are never transcoded
+#define TEXC_MAX_NAMES		4096
+
+// frames without uploads before a changed index is written back
+#define TEXC_FLUSH_FRAMES	60
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t clock;
+} TexCacheHeader;
+
+typedef struct {
+	uint64_t hash;
+	uint32_t size;
+	uint32_t lastUse;
+	uint16_t width;
+	uint16_t height;
+	uint16_t flags;
+	uint16_t reserved;
+} TexCacheEntry;
+
+typedef struct {
+	uint32_t uploads;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t rejected;
+	uint32_t skipped;
+	uint32_t evictions;
+	uint32_t ioErrors;
+	uint64_t sourceBytes;
+	uint64_t uploadBytes;
+	uint64_t cacheBytes;
+	uint32_t entries;
+	StatsHist hitUs;
+	StatsHist encodeUs;
+} TexCacheStats;
+
+int texc_bind(Symtable *table);
+int texc_start(void);
+void texc_end_frame(void);
+const TexCacheStats *texc_get_stats(void);
+void texc_dump(void);
+
+#endif
@@ -0,0 +1,551 @@
+/* vbo_cache.c -- client vertex array to buffer object cache
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// libbc2.so draws from client memory only, which the driver copies on every
+// draw. This layer hashes the vertex data a draw reads instead: data that
+// comes back unchanged in VBOC_PROMOTE_FRAMES frames gets a buffer object of
+// its own and later draws only bind it, everything else is streamed through
+// one buffer per frame in flight, orphaned at its first use in a frame.
+//
+// The layer sits directly above the driver, below GL_DEFERRED, so it always
+// runs on the thread owning the context. Behind GL_DEFERRED the arrays are
+// per-draw copies at changing addresses, which is why data is keyed by its
+// hash and size and not by the client pointer.
+//
+// Pointer calls are only recorded and applied at the next draw against a
+// shadow of the driver state, so interleaved arrays are uploaded once and
+// redundant binds are skipped. glDrawArrays is rebased to vertex 0, the
+// index data of glDrawElements stays in client memory.
+//
+
+#include <kernel.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "vbo_cache.h"
+#include "hash.h"
+#include "gl_util.h"
+#include "gl_defer.h"
+#include "so_util.h"
+#include "stats.h"
+#include "config.h"
+#include "al_error.h"
+
+typedef struct {
+	GLint size;
+	GLenum type;
+	GLsizei stride;
+	GLuint buffer;
+	const GLvoid *pointer;
+} ArrayPointer;
+
+typedef struct {
+	GLboolean enabled;
+	ArrayPointer game;
+	ArrayPointer driver;	// type 0 while unknown
+} ArrayState;
+
+typedef struct {
+	const uint8_t *start;
+	const uint8_t *end;
+	uint32_t arrays;
+} Region;
+
+typedef struct {
+	uint64_t hash;
+	uint32_t size;
+	uint32_t lastFrame;
+	uint32_t frames;
+	GLuint buffer;
+} VboEntry;
+
+static int active = 0;
+
+static ArrayState arrays[GLU_ARRAY_COUNT];
+static GLuint game_array_buffer = 0;
+static GLuint game_element_buffer = 0;
+static GLuint driver_array_buffer = 0;
+static uint32_t game_client_texture = 0;
+static uint32_t driver_client_texture = 0;
+
+static VboEntry table[VBOC_TABLE_SIZE];
+static GLuint rings[VBOC_RING_BUFFERS];
+static uint32_t ring_pos = 0;
+
+// starts at 1, lastFrame 0 marks a free slot
+static uint32_t frame = 1;
+static uint32_t frame_client = 0;
+static uint32_t frame_upload = 0;
+
+static VboCacheStats stats;
+
+static void (* next_glBindBuffer)(GLenum target, GLuint buffer);
+static void (* next_glClientActiveTexture)(GLenum texture);
+static void (* next_glEnableClientState)(GLenum array);
+static void (* next_glDisableClientState)(GLenum array);
+static void (* next_glVertexPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glColorPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glNormalPointer)(GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glTexCoordPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
+static void (* next_glDrawArrays)(GLenum mode, GLint first, GLsizei count);
+static void (* next_glDrawElements)(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+
+static void set_client_texture(uint32_t unit)
+{
+	if (driver_client_texture != unit) {
+		next_glClientActiveTexture(GL_TEXTURE0 + unit);
+		driver_client_texture = unit;
+	}
+}
+
+static void bind_array_buffer(GLuint buffer)
+{
+	if (driver_array_buffer != buffer) {
+		next_glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		driver_array_buffer = buffer;
+	}
+}
+
+static void apply_array(int index, GLuint buffer, const GLvoid *pointer)
+{
+	ArrayPointer *game = &arrays[index].game;
+	ArrayPointer *driver = &arrays[index].driver;
+
+	if (driver->buffer == buffer && driver->pointer == pointer && driver->size == game->size &&
+		driver->type == game->type && driver->stride == game->stride)
+		return;
+
+	bind_array_buffer(buffer);
+
+	switch (index) {
+	case GLU_ARRAY_VERTEX:
+		next_glVertexPointer(game->size, game->type, game->stride, pointer);
+		break;
+	case GLU_ARRAY_COLOR:
+		next_glColorPointer(game->size, game->type, game->stride, pointer);
+		break;
+	case GLU_ARRAY_NORMAL:
+		next_glNormalPointer(game->type, game->stride, pointer);
+		break;
+	default:
+		set_client_texture(index - GLU_ARRAY_TEX_COORD);
+		next_glTexCoordPointer(game->size, game->type, game->stride, pointer);
+		break;
+	}
+
+	*driver = *game;
+	driver->buffer = buffer;
+	driver->pointer = pointer;
+}
+
+static void release(VboEntry *entry)
+{
+	if (entry->buffer == 0)
+		return;
+
+	glDeleteBuffers(1, &entry->buffer);
+
+	// deleting a bound buffer resets the binding
+	if (driver_array_buffer == entry->buffer)
+		driver_array_buffer = 0;
+	for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+		if (arrays[i].driver.buffer == entry->buffer)
+			arrays[i].driver.type = 0;
+	}
+
+	stats.staticBuffers--;
+	stats.staticBytes -= entry->size;
+	entry->buffer = 0;
+}
+
+// returns the entry for the data, replacing the least recently drawn one in its probe range
+static VboEntry *find_entry(uint64_t hash, uint32_t size)
+{
+	VboEntry *victim = NULL;
+
+	for (uint32_t p = 0; p < VBOC_PROBE; p++) {
+		VboEntry *entry = &table[(hash + p) & (VBOC_TABLE_SIZE - 1)];
+
+		if (entry->hash == hash && entry->size == size && entry->lastFrame != 0)
+			return entry;
+		if (victim == NULL || entry->lastFrame < victim->lastFrame)
+			victim = entry;
+	}
+
+	if (victim->buffer != 0)
+		stats.evictions++;
+	release(victim);
+
+	victim->hash = hash;
+	victim->size = size;
+	victim->lastFrame = 0;
+	victim->frames = 0;
+
+	return victim;
+}
+
+static int ring_upload(const uint8_t *data, uint32_t size, GLuint *buffer, uint32_t *offset)
+{
+	uint32_t aligned = ALIGN_MEM(size, 16);
+
+	if (ring_pos + aligned > VBO_CACHE_RING_SIZE) {
+		stats.ringOverflows++;
+		return 0;
+	}
+
+	*buffer = rings[frame % VBOC_RING_BUFFERS];
+	bind_array_buffer(*buffer);
+
+	if (ring_pos == 0)
+		glBufferData(GL_ARRAY_BUFFER, VBO_CACHE_RING_SIZE, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, ring_pos, size, data);
+
+	*offset = ring_pos;
+	ring_pos += aligned;
+
+	stats.ringUploads++;
+	stats.uploadBytes += size;
+	frame_upload += size;
+
+	return 1;
+}
+
+static int lookup(const uint8_t *data, uint32_t size, GLuint *buffer, uint32_t *offset)
+{
+	VboEntry *entry = find_entry(hash_data(data, size, 0), size);
+
+	if (entry->lastFrame != frame) {
+		entry->lastFrame = frame;
+		entry->frames++;
+	}
+
+	if (entry->buffer != 0) {
+		stats.staticHits++;
+		*buffer = entry->buffer;
+		*offset = 0;
+		return 1;
+	}
+
+	if (entry->frames >= VBOC_PROMOTE_FRAMES && stats.staticBytes + size <= VBO_CACHE_MAX_BYTES) {
+		glGenBuffers(1, &entry->buffer);
+		bind_array_buffer(entry->buffer);
+		glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+
+		stats.promotions++;
+		stats.staticBuffers++;
+		stats.staticBytes += size;
+		stats.uploadBytes += size;
+		frame_upload += size;
+
+		*buffer = entry->buffer;
+		*offset = 0;
+		return 1;
+	}
+
+	return ring_upload(data, size, buffer, offset);
+}
+
+static void add_region(Region *regions, int *num, const uint8_t *start, const uint8_t *end, int index)
+{
+	Region *r = &regions[(*num)++];
+
+	r->start = start;
+	r->end = end;
+	r->arrays = 1 << index;
+
+	// interleaved arrays overlap, merge until every region is disjoint
+	for (int i = 0; i < *num; i++) {
+		for (int j = i + 1; j < *num; j++) {
+			if (regions[i].start < regions[j].end && regions[j].start < regions[i].end) {
+				if (regions[j].start < regions[i].start)
+					regions[i].start = regions[j].start;
+				if (regions[j].end > regions[i].end)
+					regions[i].end = regions[j].end;
+				regions[i].arrays |= regions[j].arrays;
+				regions[j] = regions[--(*num)];
+				i = -1;
+				break;
+			}
+		}
+	}
+}
+
+// sets up every enabled array for vertices [base, base + count) rebased to zero
+static void prepare(uint32_t base, uint32_t count)
+{
+	const uint8_t *pointers[GLU_ARRAY_COUNT];
+	Region regions[GLU_ARRAY_COUNT];
+	int num = 0;
+
+	for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+		ArrayPointer *game = &arrays[i].game;
+		uint32_t elem, stride;
+
+		if (!arrays[i].enabled)
+			continue;
+
+		elem = game->size * glu_type_size(game->type);
+		stride = game->stride ? game->stride : elem;
+		pointers[i] = (const uint8_t *)game->pointer + base * stride;
+
+		if (game->buffer != 0 || game->pointer == NULL)
+			apply_array(i, game->buffer, pointers[i]);
+		else
+			add_region(regions, &num, pointers[i], pointers[i] + (count - 1) * stride + elem, i);
+	}
+
+	for (int r = 0; r < num; r++) {
+		uint32_t size = regions[r].end - regions[r].start;
+		GLuint buffer = 0;
+		uint32_t offset = 0;
+		int cached;
+
+		stats.clientBytes += size;
+		frame_client += size;
+
+		cached = size >= VBOC_MIN_BYTES && lookup(regions[r].start, size, &buffer, &offset);
+		if (!cached) {
+			stats.clientArrays++;
+			stats.uploadBytes += size;
+			frame_upload += size;
+		}
+
+		for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+			if (!(regions[r].arrays & (1 << i)))
+				continue;
+
+			if (cached)
+				apply_array(i, buffer, (const GLvoid *)(offset + (pointers[i] - regions[r].start)));
+			else
+				apply_array(i, 0, pointers[i]);
+		}
+	}
+
+	stats.draws++;
+}
+
+static void apply_game_arrays(void)
+{
+	for (int i = 0; i < GLU_ARRAY_COUNT; i++) {
+		if (arrays[i].enabled)
+			apply_array(i, arrays[i].game.buffer, arrays[i].game.pointer);
+	}
+}
+
+static void glBindBuffer_vboc(GLenum target, GLuint buffer)
+{
+	if (target == GL_ARRAY_BUFFER) {
+		game_array_buffer = buffer;
+		return;
+	}
+
+	if (target == GL_ELEMENT_ARRAY_BUFFER)
+		game_element_buffer = buffer;
+
+	next_glBindBuffer(target, buffer);
+}
+
+static void glClientActiveTexture_vboc(GLenum texture)
+{
+	game_client_texture = texture - GL_TEXTURE0;
+}
+
+static void glEnableClientState_vboc(GLenum array)
+{
+	int index = glu_array_index(array, game_client_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = GL_TRUE;
+
+	set_client_texture(game_client_texture);
+	next_glEnableClientState(array);
+}
+
+static void glDisableClientState_vboc(GLenum array)
+{
+	int index = glu_array_index(array, game_client_texture);
+
+	if (index >= 0)
+		arrays[index].enabled = GL_FALSE;
+
+	set_client_texture(game_client_texture);
+	next_glDisableClientState(array);
+}
+
+static void set_pointer(int index, GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	ArrayPointer *game;
+
+	if (index < 0)
+		return;
+
+	game = &arrays[index].game;
+	game->size = size;
+	game->type = type;
+	game->stride = stride;
+	game->buffer = game_array_buffer;
+	game->pointer = pointer;
+}
+
+static void glVertexPointer_vboc(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_pointer(GLU_ARRAY_VERTEX, size, type, stride, pointer);
+}
+
+static void glColorPointer_vboc(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_pointer(GLU_ARRAY_COLOR, size, type, stride, pointer);
+}
+
+static void glNormalPointer_vboc(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_pointer(GLU_ARRAY_NORMAL, 3, type, stride, pointer);
+}
+
+static void glTexCoordPointer_vboc(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_pointer(glu_array_index(GL_TEXTURE_COORD_ARRAY, game_client_texture), size, type, stride, pointer);
+}
+
+static void glDrawArrays_vboc(GLenum mode, GLint first, GLsizei count)
+{
+	if (count <= 0)
+		return;
+
+	if (active) {
+		prepare(first, count);
+		next_glDrawArrays(mode, 0, count);
+	} else {
+		apply_game_arrays();
+		next_glDrawArrays(mode, first, count);
+	}
+}
+
+static void glDrawElements_vboc(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+	uint32_t max = 0;
+
+	if (count <= 0)
+		return;
+
+	if (!active || game_element_buffer != 0 || type == GL_UNSIGNED_INT) {
+		apply_game_arrays();
+	} else {
+		for (GLsizei i = 0; i < count; i++) {
+			uint32_t idx = (type == GL_UNSIGNED_BYTE) ? ((const uint8_t *)indices)[i] : ((const uint16_t *)indices)[i];
+			if (idx > max)
+				max = idx;
+		}
+
+		prepare(0, max + 1);
+	}
+
+	next_glDrawElements(mode, count, type, indices);
+}
+
+static void create_rings(void *arg)
+{
+	glGenBuffers(VBOC_RING_BUFFERS, rings);
+}
+
+#define VBOC_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_vboc, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int vboc_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	VBOC_HOOK(glBindBuffer);
+	VBOC_HOOK(glClientActiveTexture);
+	VBOC_HOOK(glEnableClientState);
+	VBOC_HOOK(glDisableClientState);
+	VBOC_HOOK(glVertexPointer);
+	VBOC_HOOK(glColorPointer);
+	VBOC_HOOK(glNormalPointer);
+	VBOC_HOOK(glTexCoordPointer);
+	VBOC_HOOK(glDrawArrays);
+	VBOC_HOOK(glDrawElements);
+
+	sceClibMemset(&stats, 0, sizeof(VboCacheStats));
+	stats_hist_reset(&stats.frameClientBytes);
+	stats_hist_reset(&stats.frameUploadBytes);
+
+	return AL_OK;
+}
+
+// with GL_DEFERRED after gldf_start
+int vboc_start(void)
+{
+	gldf_run_sync(create_rings, NULL);
+
+	active = 1;
+
+	return stats_register_dump(vboc_dump);
+}
+
+// runs on the GL thread, through gldf_run with GL_DEFERRED
+void vboc_end_frame(void)
+{
+	if (!active)
+		return;
+
+	stats_hist_add(&stats.frameClientBytes, frame_client);
+	stats_hist_add(&stats.frameUploadBytes, frame_upload);
+	frame_client = 0;
+	frame_upload = 0;
+	ring_pos = 0;
+
+	for (uint32_t i = 0; i < VBOC_TABLE_SIZE; i++) {
+		if (table[i].buffer != 0 && frame - table[i].lastFrame > VBOC_EVICT_FRAMES) {
+			release(&table[i]);
+			stats.evictions++;
+		}
+	}
+
+	frame++;
+	stats.frames++;
+}
+
+const VboCacheStats *vboc_get_stats(void)
+{
+	return &stats;
+}
+
+void vboc_dump(void)
+{
+	SceUID fd;
+
+	fd = stats_file_open("vbo_cache.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "frames,%u\n", stats.frames);
+	stats_file_printf(fd, "draws,%u\n", stats.draws);
+	stats_file_printf(fd, "static_hits,%u\n", stats.staticHits);
+	stats_file_printf(fd, "ring_uploads,%u\n", stats.ringUploads);
+	stats_file_printf(fd, "client_arrays,%u\n", stats.clientArrays);
+	stats_file_printf(fd, "promotions,%u\n", stats.promotions);
+	stats_file_printf(fd, "evictions,%u\n", stats.evictions);
+	stats_file_printf(fd, "ring_overflows,%u\n", stats.ringOverflows);
+	stats_file_printf(fd, "static_buffers,%u\n", stats.staticBuffers);
+	stats_file_printf(fd, "static_bytes,%u\n", stats.staticBytes);
+	stats_file_printf(fd, "client_bytes,%llu\n", stats.clientBytes);
+	stats_file_printf(fd, "copied_bytes,%llu\n", stats.uploadBytes);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "frame_bytes_uncached", &stats.frameClientBytes);
+	stats_file_write_hist(fd, "frame_bytes_cached", &stats.frameUploadBytes);
+
+	stats_file_close(fd);
+}
@@ -0,0 +1,48 @@
+#ifndef __VBO_CACHE_H__
+#define __VBO_CACHE_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+// vertex data seen so far, power of two, looked up with VBOC_PROBE slots of linear probing
+#define VBOC_TABLE_SIZE		4096
+#define VBOC_PROBE			8
+
+// frames the same data has to be drawn in before it gets its own buffer
+#define VBOC_PROMOTE_FRAMES	3
+
+// frames a cached buffer may go unused before it is deleted
+#define VBOC_EVICT_FRAMES	300
+
+// streaming buffers, one per frame in flight
+#define VBOC_RING_BUFFERS	3
+
+// smaller draws stay client arrays, hashing would cost more than the copy
+#define VBOC_MIN_BYTES		256
+
+typedef struct {
+	uint32_t frames;
+	uint32_t draws;
+	uint32_t staticHits;
+	uint32_t ringUploads;
+	uint32_t clientArrays;
+	uint32_t promotions;
+	uint32_t evictions;
+	uint32_t ringOverflows;
+	uint32_t staticBuffers;
+	uint32_t staticBytes;
+	uint64_t clientBytes;
+	uint64_t uploadBytes;
+	StatsHist frameClientBytes;
+	StatsHist frameUploadBytes;
+} VboCacheStats;
+
+int vboc_bind(Symtable *table);
+int vboc_start(void);
+void vboc_end_frame(void);
+const VboCacheStats *vboc_get_stats(void);
+void vboc_dump(void);
+
+#endif
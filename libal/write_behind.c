@@ -0,0 +1,808 @@
+/* write_behind.c -- buffer the game's savedata writes and commit them atomically
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Streams the game opens with "w" or "wb" under DATA_PATH end up on
+// SAVEDATA_PATH through the overlay. Instead, libal opens a temporary file
+// next to the real one on SAVEDATA_PATH and hands out a FILE pointer into
+// its own table. fwrite and fprintf only copy into WBUF_CHUNK_SIZE chunks,
+// a seek inside or right after the current chunk keeps writing into it.
+// Chunks go to a writer thread once full, on fflush and on fclose, which
+// writes each with a single sceIoPwrite at its offset.
+//
+// fclose returns once the last chunk is queued. The writer thread then
+// syncs and closes the temporary file and renames it over the real one,
+// so a crash leaves either the old file or the new one. Should the rename
+// not replace existing files, the new file is first renamed to its
+// WBUF_NEW_SUFFIX name, the old one removed, and the new one renamed
+// again; a .wbnew file found at boot is such an interrupted commit and is
+// finished then, a .wbtmp file is the remains of a stream that never
+// closed and is removed. A failed write drops the new file and keeps the
+// old one.
+//
+// Until its commit is done, a file looks unchanged: fopen of the path,
+// stat, lstat and unlink wait for it, opendir and rmdir for all pending
+// commits, and the block cache calls wbuf_wait() before opening a file.
+// Streams opened with other modes are left to libc, after waiting too.
+//
+// fileno of a buffered stream is a placeholder descriptor that only fstat
+// understands: the stream's chunks are written out and the temporary file
+// is stat'ed. Any other call on it fails as on a closed descriptor.
+//
+// The hooks are bound first, so the metadata cache, the block cache and
+// the asset pack still see every fopen and fclose for writing.
+//
+
+#include <kernel.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "write_behind.h"
+#include "fs_overlay.h"
+#include "hash.h"
+#include "config.h"
+#include "so_util.h"
+#include "al_error.h"
+
+#define WBUF_CHUNKS (WRITE_BEHIND_SIZE / WBUF_CHUNK_SIZE)
+
+typedef struct {
+	int16_t next;
+	uint32_t length;
+	SceOff offset;
+} WbufChunk;
+
+typedef struct {
+	int used;
+	int closing;
+	int error;
+	uint64_t key;
+	SceUID fd;
+	SceOff pos;
+	SceOff size;
+	int16_t current;	// chunk being filled, -1 if none
+	int16_t head;		// chunks queued for the writer thread
+	int16_t tail;
+	int writing;		// the writer thread has one of its chunks
+	SceUInt64 closeTime;
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE];
+} WbufFile;
+
+static WbufFile files[WBUF_MAX_FILES];
+static WbufChunk chunks[WBUF_CHUNKS];
+static uint8_t *data;
+static int16_t free_chunks = -1;
+static uint32_t next_file = 0;
+
+static SceKernelLwMutexWork lock;
+static SceKernelLwCondWork work_cond;
+static SceKernelLwCondWork done_cond;
+static int running = 0;
+
+static WriteBehindStats stats;
+
+// libal's own directories are not searched for interrupted commits
+static const char *own_paths[] = {
+	STATS_PATH, INPUT_PATH, CAPTURE_PATH, TEX_CACHE_PATH, LOAD_TRACE_PATH
+};
+
+static FILE *(* next_fopen)(const char *filename, const char *mode);
+static size_t (* next_fread)(void *ptr, size_t size, size_t count, FILE *stream);
+static size_t (* next_fwrite)(const void *ptr, size_t size, size_t count, FILE *stream);
+static int (* next_fseek)(FILE *stream, long offset, int whence);
+static long (* next_ftell)(FILE *stream);
+static char *(* next_fgets)(char *s, int n, FILE *stream);
+static int (* next_fflush)(FILE *stream);
+static int (* next_fileno)(FILE *stream);
+static int (* next_fclose)(FILE *stream);
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+static int (* next_stat)(const char *path, void *buf);
+static int (* next_lstat)(const char *path, void *buf);
+static void *(* next_opendir)(const char *path);
+static int (* next_rmdir)(const char *path);
+static int (* next_unlink)(const char *path);
+static int (* next_fstat)(int fd, void *buf);
+#endif
+
+static inline WbufFile *lookup(FILE *stream)
+{
+	WbufFile *f = (WbufFile *)stream;
+
+	if (f >= files && f < files + WBUF_MAX_FILES)
+		return f;
+
+	return NULL;
+}
+
+// the file on SAVEDATA_PATH the overlay writes path to, returns its key
+// or 0 for paths outside of DATA_PATH
+static uint64_t real_path(const char *path, char *out)
+{
+	char norm[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	int len;
+
+	if (path == NULL)
+		return 0;
+
+	len = fsov_normalize(path, norm);
+	if (len <= 0 || sizeof(SAVEDATA_PATH) + len + sizeof(WBUF_TMP_SUFFIX) >= SCE_IO_MAX_PATH_BUFFER_SIZE)
+		return 0;
+
+	len = sceClibSnprintf(out, SCE_IO_MAX_PATH_BUFFER_SIZE, SAVEDATA_PATH "/" "%s", norm);
+
+	return hash_data(out, len, 0);
+}
+
+// called with the lock held, waits until no commit of key is pending,
+// of any file for key 0
+static void wait_commit(uint64_t key)
+{
+	int pending;
+
+	do {
+		pending = 0;
+		for (int i = 0; i < WBUF_MAX_FILES; i++) {
+			if (files[i].used && files[i].closing && (key == 0 || files[i].key == key))
+				pending = 1;
+		}
+
+		if (pending) {
+			stats.waits++;
+			sceKernelWaitLwCond(&done_cond, NULL);
+		}
+	} while (pending);
+}
+
+// called with the lock held, waits for the writer thread when all chunks
+// are in use
+static int16_t alloc_chunk(void)
+{
+	int16_t c;
+
+	while (free_chunks < 0) {
+		stats.stalls++;
+		sceKernelWaitLwCond(&done_cond, NULL);
+	}
+
+	c = free_chunks;
+	free_chunks = chunks[c].next;
+
+	return c;
+}
+
+// called with the lock held
+static void free_chunk(int16_t c)
+{
+	chunks[c].next = free_chunks;
+	free_chunks = c;
+}
+
+// called with the lock held, hands the current chunk to the writer thread
+static void queue_current(WbufFile *f)
+{
+	int16_t c = f->current;
+
+	if (c < 0)
+		return;
+
+	f->current = -1;
+
+	if (chunks[c].length == 0) {
+		free_chunk(c);
+		return;
+	}
+
+	chunks[c].next = -1;
+	if (f->tail >= 0)
+		chunks[f->tail].next = c;
+	else
+		f->head = c;
+	f->tail = c;
+
+	sceKernelSignalLwCond(&work_cond);
+}
+
+// called with the lock held
+static void write_data(WbufFile *f, const uint8_t *src, uint32_t size)
+{
+	WbufChunk *c;
+	uint32_t at, n;
+
+	stats.writes++;
+	stats.bytes += size;
+
+	while (size > 0) {
+		c = f->current >= 0 ? &chunks[f->current] : NULL;
+
+		if (c == NULL || f->pos < c->offset || f->pos > c->offset + c->length || f->pos - c->offset >= WBUF_CHUNK_SIZE) {
+			queue_current(f);
+			f->current = alloc_chunk();
+			c = &chunks[f->current];
+			c->offset = f->pos;
+			c->length = 0;
+		}
+
+		at = (uint32_t)(f->pos - c->offset);
+		n = size < WBUF_CHUNK_SIZE - at ? size : WBUF_CHUNK_SIZE - at;
+		sceClibMemcpy(data + f->current * WBUF_CHUNK_SIZE + at, src, n);
+
+		if (at + n > c->length)
+			c->length = at + n;
+		f->pos += n;
+		src += n;
+		size -= n;
+	}
+
+	if (f->pos > f->size)
+		f->size = f->pos;
+}
+
+// makes the temporary file the real one, the old file stays until the new
+// one is complete on disk
+static int commit(WbufFile *f)
+{
+	char tmp[SCE_IO_MAX_PATH_BUFFER_SIZE], done[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	int ret;
+
+	sceClibSnprintf(tmp, sizeof(tmp), "%s" WBUF_TMP_SUFFIX, f->path);
+
+	ret = f->error ? -1 : sceIoSyncByFd(f->fd, 0);
+	sceIoClose(f->fd);
+
+	if (ret < 0) {
+		sceIoRemove(tmp);
+		return ret;
+	}
+
+	ret = sceIoRename(tmp, f->path);
+	if (ret >= 0)
+		return 0;
+
+	// the rename does not replace existing files
+	sceClibSnprintf(done, sizeof(done), "%s" WBUF_NEW_SUFFIX, f->path);
+
+	ret = sceIoRename(tmp, done);
+	if (ret < 0) {
+		sceIoRemove(tmp);
+		return ret;
+	}
+
+	sceIoRemove(f->path);
+
+	return sceIoRename(done, f->path);
+}
+
+static int writer_thread(SceSize args, void *argp)
+{
+	WbufFile *f;
+	int16_t c;
+	int ret;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	while (1) {
+		f = NULL;
+		for (int i = 0; i < WBUF_MAX_FILES && f == NULL; i++) {
+			WbufFile *w = &files[(next_file + i) % WBUF_MAX_FILES];
+
+			if (w->used && (w->head >= 0 || w->closing))
+				f = w;
+		}
+
+		if (f == NULL) {
+			sceKernelWaitLwCond(&work_cond, NULL);
+			continue;
+		}
+
+		// one chunk per turn, so a big file does not hold up the others
+		next_file = (f - files) + 1;
+
+		c = f->head;
+		if (c >= 0) {
+			f->head = chunks[c].next;
+			if (f->head < 0)
+				f->tail = -1;
+			f->writing = 1;
+			sceKernelUnlockLwMutex(&lock, 1);
+
+			ret = f->error ? -1 : sceIoPwrite(f->fd, data + c * WBUF_CHUNK_SIZE, chunks[c].length, chunks[c].offset);
+
+			sceKernelLockLwMutex(&lock, 1, NULL);
+			f->writing = 0;
+			if (ret != (int)chunks[c].length)
+				f->error = 1;
+			else
+				stats.ioWrites++;
+			free_chunk(c);
+		} else {
+			sceKernelUnlockLwMutex(&lock, 1);
+
+			ret = commit(f);
+
+			sceKernelLockLwMutex(&lock, 1, NULL);
+			if (ret < 0) {
+				stats.errors++;
+			} else {
+				stats.commits++;
+				stats_hist_add(&stats.commitTime, (uint32_t)(sceKernelGetProcessTimeWide() - f->closeTime));
+			}
+			f->used = 0;
+		}
+
+		sceKernelSignalLwCondAll(&done_cond);
+	}
+
+	return 0;
+}
+
+static FILE *fopen_wbuf(const char *filename, const char *mode)
+{
+	char tmp[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	WbufFile *f = NULL;
+	int writing, buffered;
+	uint64_t key;
+
+	if (!running || filename == NULL || mode == NULL)
+		return next_fopen(filename, mode);
+
+	key = real_path(filename, tmp);
+	if (key == 0)
+		return next_fopen(filename, mode);
+
+	writing = mode[0] != 'r' || sceClibStrchr(mode, '+') != NULL;
+	buffered = mode[0] == 'w' && sceClibStrchr(mode, '+') == NULL;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+
+	// an earlier stream on the same file is committed first
+	wait_commit(key);
+
+	// a second stream on a file being written is left to libc
+	for (int i = 0; i < WBUF_MAX_FILES; i++) {
+		if (files[i].used && files[i].key == key)
+			buffered = 0;
+	}
+
+	for (int i = 0; i < WBUF_MAX_FILES && buffered; i++) {
+		if (!files[i].used) {
+			f = &files[i];
+			f->used = 1;
+			f->closing = 0;
+			f->key = key;
+			break;
+		}
+	}
+
+	if (writing && f == NULL)
+		stats.passthrough++;
+
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	if (f == NULL)
+		return next_fopen(filename, mode);
+
+	sceClibStrncpy(f->path, tmp, sizeof(f->path));
+	sceClibSnprintf(tmp, sizeof(tmp), "%s" WBUF_TMP_SUFFIX, f->path);
+
+	f->fd = sceIoOpen(tmp, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (f->fd < 0) {
+		f->used = 0;
+		stats.passthrough++;
+		return next_fopen(filename, mode);
+	}
+
+	f->error = 0;
+	f->pos = 0;
+	f->size = 0;
+	f->current = -1;
+	f->head = -1;
+	f->tail = -1;
+	f->writing = 0;
+
+	stats.opens++;
+
+	return (FILE *)f;
+}
+
+static size_t fread_wbuf(void *ptr, size_t size, size_t count, FILE *stream)
+{
+	if (lookup(stream) != NULL)
+		return 0;
+
+	return next_fread(ptr, size, count, stream);
+}
+
+static char *fgets_wbuf(char *s, int n, FILE *stream)
+{
+	if (lookup(stream) != NULL)
+		return NULL;
+
+	return next_fgets(s, n, stream);
+}
+
+static size_t fwrite_wbuf(const void *ptr, size_t size, size_t count, FILE *stream)
+{
+	WbufFile *f = lookup(stream);
+
+	if (f == NULL)
+		return next_fwrite(ptr, size, count, stream);
+
+	if (size == 0 || count == 0)
+		return 0;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	write_data(f, (const uint8_t *)ptr, size * count);
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return count;
+}
+
+// variadic, so other streams cannot be forwarded and go to vfprintf
+static int fprintf_wbuf(FILE *stream, const char *format, ...)
+{
+	WbufFile *f = lookup(stream);
+	char string[512];
+	char *text = string;
+	va_list list;
+	int len;
+
+	va_start(list, format);
+	len = f == NULL ? vfprintf(stream, format, list) : sceClibVsnprintf(string, sizeof(string), format, list);
+	va_end(list);
+
+	if (f == NULL || len <= 0)
+		return len;
+
+	// too long for the stack, formatted again on the heap, write_data
+	// spreads it over as many chunks as it takes
+	if (len >= (int)sizeof(string)) {
+		text = malloc(len + 1);
+		if (text == NULL)
+			return -1;
+
+		va_start(list, format);
+		sceClibVsnprintf(text, len + 1, format, list);
+		va_end(list);
+	}
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	write_data(f, (const uint8_t *)text, len);
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	if (text != string)
+		free(text);
+
+	return len;
+}
+
+static int fseek_wbuf(FILE *stream, long offset, int whence)
+{
+	WbufFile *f = lookup(stream);
+	SceOff pos;
+
+	if (f == NULL)
+		return next_fseek(stream, offset, whence);
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = f->pos + offset;
+		break;
+	case SEEK_END:
+		pos = f->size + offset;
+		break;
+	default:
+		return -1;
+	}
+
+	if (pos < 0)
+		return -1;
+
+	// a new chunk is started on the next write if pos is outside the current one
+	f->pos = pos;
+
+	return 0;
+}
+
+static long ftell_wbuf(FILE *stream)
+{
+	WbufFile *f = lookup(stream);
+
+	if (f == NULL)
+		return next_ftell(stream);
+
+	return (long)f->pos;
+}
+
+static int fflush_wbuf(FILE *stream)
+{
+	WbufFile *f = lookup(stream);
+
+	if (f == NULL)
+		return next_fflush(stream);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	queue_current(f);
+	stats.flushes++;
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return 0;
+}
+
+static int fileno_wbuf(FILE *stream)
+{
+	WbufFile *f = lookup(stream);
+
+	if (f != NULL)
+		return WBUF_FD_BASE + (int)(f - files);
+
+	return next_fileno(stream);
+}
+
+static int fclose_wbuf(FILE *stream)
+{
+	WbufFile *f = lookup(stream);
+
+	if (f == NULL)
+		return next_fclose(stream);
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	queue_current(f);
+	f->closing = 1;
+	f->closeTime = sceKernelGetProcessTimeWide();
+	sceKernelSignalLwCond(&work_cond);
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	return 0;
+}
+
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+
+static int stat_wbuf(const char *path, void *buf)
+{
+	wbuf_wait(path);
+
+	return next_stat(path, buf);
+}
+
+static int lstat_wbuf(const char *path, void *buf)
+{
+	wbuf_wait(path);
+
+	return next_lstat(path, buf);
+}
+
+static void *opendir_wbuf(const char *path)
+{
+	if (running) {
+		sceKernelLockLwMutex(&lock, 1, NULL);
+		wait_commit(0);
+		sceKernelUnlockLwMutex(&lock, 1);
+	}
+
+	return next_opendir(path);
+}
+
+static int rmdir_wbuf(const char *path)
+{
+	if (running) {
+		sceKernelLockLwMutex(&lock, 1, NULL);
+		wait_commit(0);
+		sceKernelUnlockLwMutex(&lock, 1);
+	}
+
+	return next_rmdir(path);
+}
+
+static int unlink_wbuf(const char *path)
+{
+	wbuf_wait(path);
+
+	return next_unlink(path);
+}
+
+static int fstat_wbuf(int fd, void *buf)
+{
+	char tmp[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	uint32_t slot = (uint32_t)(fd - WBUF_FD_BASE);
+	WbufFile *f;
+
+	if (slot >= WBUF_MAX_FILES || !files[slot].used || files[slot].closing)
+		return next_fstat(fd, buf);
+
+	f = &files[slot];
+
+	// the temporary file has all that was written once no chunk is left
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	queue_current(f);
+	while (f->head >= 0 || f->writing) {
+		stats.waits++;
+		sceKernelWaitLwCond(&done_cond, NULL);
+	}
+	sceKernelUnlockLwMutex(&lock, 1);
+
+	sceClibSnprintf(tmp, sizeof(tmp), "%s" WBUF_TMP_SUFFIX, f->path);
+
+	return next_stat(tmp, buf);
+}
+
+#endif
+
+#define WBUF_HOOK(name) \
+	ret = symt_hook(table, #name, (uintptr_t)&name##_wbuf, (uintptr_t *)&next_##name); \
+	if (ret < 0) \
+		return ret;
+
+int wbuf_bind(Symtable *table)
+{
+	int ret;
+
+	if (table == NULL)
+		return AL_ERROR_INVALID_POINTER;
+
+	WBUF_HOOK(fopen);
+	WBUF_HOOK(fread);
+	WBUF_HOOK(fwrite);
+	WBUF_HOOK(fseek);
+	WBUF_HOOK(ftell);
+	WBUF_HOOK(fgets);
+	WBUF_HOOK(fflush);
+	WBUF_HOOK(fileno);
+	WBUF_HOOK(fclose);
+#ifdef SYMT_HAS_SCE_PSP2COMPAT
+	WBUF_HOOK(stat);
+	WBUF_HOOK(lstat);
+	WBUF_HOOK(opendir);
+	WBUF_HOOK(rmdir);
+	WBUF_HOOK(unlink);
+	WBUF_HOOK(fstat);
+#endif
+
+	ret = symt_override(table, "fprintf", (uintptr_t)&fprintf_wbuf);
+	if (ret < 0)
+		return ret;
+
+	return AL_OK;
+}
+
+// finishes commits interrupted between removing the old file and renaming
+// the new one, and removes the temporary files of streams never closed
+static void recover(const char *dir, int depth)
+{
+	char path[SCE_IO_MAX_PATH_BUFFER_SIZE], target[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	uint32_t len, tmp_len = sizeof(WBUF_TMP_SUFFIX) - 1, new_len = sizeof(WBUF_NEW_SUFFIX) - 1;
+	SceIoDirent ent;
+	SceUID dfd;
+	int own;
+
+	dfd = sceIoDopen(dir);
+	if (dfd < 0)
+		return;
+
+	while (sceIoDread(dfd, &ent) > 0) {
+		len = sceClibSnprintf(path, sizeof(path), "%s/%s", dir, ent.d_name);
+		if (len >= sizeof(path))
+			continue;
+
+		if (SCE_STM_ISDIR(ent.d_stat.st_mode)) {
+			own = 0;
+			for (uint32_t i = 0; i < sizeof(own_paths) / sizeof(own_paths[0]); i++) {
+				if (sceClibStrcmp(path, own_paths[i]) == 0)
+					own = 1;
+			}
+
+			if (!own && depth > 0)
+				recover(path, depth - 1);
+		} else if (len > tmp_len && sceClibStrcmp(path + len - tmp_len, WBUF_TMP_SUFFIX) == 0) {
+			sceIoRemove(path);
+		} else if (len > new_len && sceClibStrcmp(path + len - new_len, WBUF_NEW_SUFFIX) == 0) {
+			sceClibMemcpy(target, path, len - new_len);
+			target[len - new_len] = '\0';
+			sceIoRemove(target);
+			if (sceIoRename(path, target) >= 0)
+				stats.recovered++;
+		}
+	}
+
+	sceIoDclose(dfd);
+}
+
+int wbuf_start(void)
+{
+	SceUID mbid, thid;
+	int ret;
+
+	mbid = sceKernelAllocMemBlock("AL::WriteBehind::Chunks", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, ALIGN_MEM(WBUF_CHUNKS * WBUF_CHUNK_SIZE, SCE_KERNEL_4KiB), NULL);
+	if (mbid < 0)
+		return mbid;
+
+	sceKernelGetMemBlockBase(mbid, (void **)&data);
+
+	for (int i = WBUF_CHUNKS - 1; i >= 0; i--)
+		free_chunk(i);
+
+	ret = sceKernelCreateLwMutex(&lock, "AL::WriteBehind::Lock", 0, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	ret = sceKernelCreateLwCond(&work_cond, "AL::WriteBehind::Work", 0, &lock, NULL);
+	if (ret < 0)
+		return ret;
+
+	ret = sceKernelCreateLwCond(&done_cond, "AL::WriteBehind::Done", 0, &lock, NULL);
+	if (ret < 0)
+		return ret;
+
+	sceClibMemset(&stats, 0, sizeof(WriteBehindStats));
+	stats_hist_reset(&stats.commitTime);
+
+	recover(SAVEDATA_PATH, WBUF_RECOVER_DEPTH);
+
+	thid = sceKernelCreateThread("write_thread", (SceKernelThreadEntry)writer_thread, 96, 16 * 1024, 0, SCE_KERNEL_CPU_MASK_USER_2, NULL);
+	if (thid < 0)
+		return thid;
+
+	sceKernelStartThread(thid, 0, NULL);
+
+	running = 1;
+
+	return stats_register_dump(wbuf_dump);
+}
+
+// returns once path has no commit pending, called before opening it
+void wbuf_wait(const char *path)
+{
+	char real[SCE_IO_MAX_PATH_BUFFER_SIZE];
+	uint64_t key;
+
+	if (!running)
+		return;
+
+	key = real_path(path, real);
+	if (key == 0)
+		return;
+
+	sceKernelLockLwMutex(&lock, 1, NULL);
+	wait_commit(key);
+	sceKernelUnlockLwMutex(&lock, 1);
+}
+
+const WriteBehindStats *wbuf_get_stats(void)
+{
+	return &stats;
+}
+
+void wbuf_dump(void)
+{
+	SceUID fd;
+
+	fd = stats_file_open("write_behind.csv");
+	if (fd < 0)
+		return;
+
+	stats_file_printf(fd, "opens,%u\n", stats.opens);
+	stats_file_printf(fd, "passthrough_opens,%u\n", stats.passthrough);
+	stats_file_printf(fd, "writes,%u\n", stats.writes);
+	stats_file_printf(fd, "bytes,%llu\n", stats.bytes);
+	stats_file_printf(fd, "flushes,%u\n", stats.flushes);
+	stats_file_printf(fd, "io_writes,%u\n", stats.ioWrites);
+	stats_file_printf(fd, "io_writes_saved,%u\n", stats.writes > stats.ioWrites ? stats.writes - stats.ioWrites : 0);
+	stats_file_printf(fd, "commits,%u\n", stats.commits);
+	stats_file_printf(fd, "errors,%u\n", stats.errors);
+	stats_file_printf(fd, "chunk_stalls,%u\n", stats.stalls);
+	stats_file_printf(fd, "commit_waits,%u\n", stats.waits);
+	stats_file_printf(fd, "recovered,%u\n", stats.recovered);
+	stats_file_printf(fd, "metric,count,min,mean,p50,p95,p99,max\n");
+	stats_file_write_hist(fd, "commit_us", &stats.commitTime);
+
+	stats_file_close(fd);
+}
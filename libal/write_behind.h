@@ -0,0 +1,48 @@
+#ifndef __WRITE_BEHIND_H__
+#define __WRITE_BEHIND_H__
+
+#include <kernel.h>
+
+#include "symtable.h"
+#include "stats.h"
+
+// streams buffered at the same time, more are left to libc
+#define WBUF_MAX_FILES		8
+
+// unit of buffering and of the writes issued, WRITE_BEHIND_SIZE holds
+// more of them than WBUF_MAX_FILES
+#define WBUF_CHUNK_SIZE		(32 * 1024)
+
+// fileno of a buffered stream is WBUF_FD_BASE plus its slot, far above any
+// descriptor the compat library hands out
+#define WBUF_FD_BASE		0x7FE00000
+
+// written while the stream is open, complete but not renamed yet
+#define WBUF_TMP_SUFFIX		".wbtmp"
+#define WBUF_NEW_SUFFIX		".wbnew"
+
+// directory levels below SAVEDATA_PATH searched for interrupted commits
+#define WBUF_RECOVER_DEPTH	4
+
+typedef struct {
+	uint32_t opens;
+	uint32_t passthrough;
+	uint32_t writes;
+	uint32_t flushes;
+	uint32_t ioWrites;
+	uint32_t commits;
+	uint32_t errors;
+	uint32_t stalls;
+	uint32_t waits;
+	uint32_t recovered;
+	uint64_t bytes;
+	StatsHist commitTime;
+} WriteBehindStats;
+
+int wbuf_bind(Symtable *table);
+int wbuf_start(void);
+void wbuf_wait(const char *path);
+const WriteBehindStats *wbuf_get_stats(void);
+void wbuf_dump(void);
+
+#endif
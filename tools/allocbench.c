@@ -0,0 +1,415 @@
+/* allocbench.c -- replay an allocation trace against the pool allocator
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: allocbench [-n runs] trace
+//
+// The trace is a text file with one call per line:
+//
+//   m id size     malloc or operator new
+//   r id size     realloc of the block allocated as id, size 0 frees it
+//   f id          free or operator delete
+//
+// ids are chosen by whoever wrote the trace and may be reused once freed.
+// libal writes such traces to alloc_trace.txt with ALLOC_PROF_TRACE.
+// Every call is replayed with the host's malloc, then through
+// libal/size_class.c with one thread cache working the same way as
+// libal/pool_alloc.c, large objects getting page aligned blocks of their
+// own like the memblocks there. The host heap stands in for the SCE libc
+// heap, which cannot run here.
+//
+// For both, the best time of the runs is printed next to the peak of
+// live requested bytes and the peak memory the heap held for them: for
+// the host heap what mallinfo2 reports as arena and mmapped bytes above
+// what it held before, for the pool live spans and large blocks.
+//
+// Build: gcc -O2 -o allocbench allocbench.c ../libal/size_class.c
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "../libal/size_class.h"
+
+// same as libal/pool_alloc.h
+#define PALLOC_CACHE_DEPTH	16
+#define PALLOC_CACHE_BYTES	(32 * 1024)
+
+#define POOL_SIZE			(256 * 1024 * 1024)
+#define PAGE_SIZE			4096
+#define SAMPLE_INTERVAL		1024
+
+enum {
+	OP_MALLOC = 0,
+	OP_REALLOC,
+	OP_FREE
+};
+
+typedef struct {
+	uint8_t op;
+	uint32_t id;
+	uint32_t size;
+} TraceOp;
+
+typedef struct {
+	void *ptr;
+	uint32_t size;
+} Slot;
+
+typedef struct {
+	void *(* alloc)(uint32_t size);
+	void (* release)(void *ptr, uint32_t size);
+	void *(* resize)(void *ptr, uint32_t old, uint32_t size);
+	uint64_t (* footprint)(void);
+} Heap;
+
+static TraceOp *ops = NULL;
+static uint32_t num_ops = 0;
+static uint32_t num_ids = 0;
+static Slot *slots;
+
+static SizeClassHeap pool;
+static uint8_t *pool_mem;
+static void *cache[SCLS_NUM_CLASSES][PALLOC_CACHE_DEPTH];
+static uint32_t cache_count[SCLS_NUM_CLASSES];
+static uint32_t cache_limit[SCLS_NUM_CLASSES];
+static uint64_t large_bytes = 0;
+static uint64_t peak_large = 0;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int load_trace(const char *name)
+{
+	uint32_t cap = 0, id, size;
+	char line[128], op;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (f == NULL) {
+		fprintf(stderr, "cannot open %s\n", name);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		size = 0;
+		if (sscanf(line, " %c %u %u", &op, &id, &size) < 2)
+			continue;
+
+		if (num_ops == cap) {
+			cap = cap ? cap * 2 : 65536;
+			ops = realloc(ops, cap * sizeof(TraceOp));
+		}
+
+		ops[num_ops].op = op == 'm' ? OP_MALLOC : op == 'r' ? OP_REALLOC : OP_FREE;
+		ops[num_ops].id = id;
+		ops[num_ops].size = size;
+		num_ops++;
+
+		if (id >= num_ids)
+			num_ids = id + 1;
+	}
+
+	fclose(f);
+
+	slots = calloc(num_ids, sizeof(Slot));
+
+	return 0;
+}
+
+static void *host_alloc(uint32_t size)
+{
+	return malloc(size);
+}
+
+static void host_release(void *ptr, uint32_t size)
+{
+	(void)size;
+	free(ptr);
+}
+
+// a resize to 0 frees the block, as realloc_palloc does
+static void *host_resize(void *ptr, uint32_t old, uint32_t size)
+{
+	(void)old;
+
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, size);
+}
+
+static uint64_t host_footprint(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.arena + mi.hblkhd;
+}
+
+static void *large_alloc(uint32_t size)
+{
+	uint32_t total = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	void *ptr = aligned_alloc(PAGE_SIZE, total);
+
+	large_bytes += total;
+	if (large_bytes > peak_large)
+		peak_large = large_bytes;
+
+	return ptr;
+}
+
+static void *pool_alloc(uint32_t size)
+{
+	uint32_t cls = scls_class(size), n;
+
+	if (cls == SCLS_NONE)
+		return large_alloc(size);
+
+	if (cache_count[cls] == 0) {
+		n = scls_alloc(&pool, cls, cache[cls], (cache_limit[cls] + 1) / 2);
+		if (n == 0)
+			return NULL;
+		cache_count[cls] = n;
+	}
+
+	return cache[cls][--cache_count[cls]];
+}
+
+static void pool_release(void *ptr, uint32_t size)
+{
+	uint32_t cls;
+
+	if (!scls_owns(&pool, ptr)) {
+		large_bytes -= (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		free(ptr);
+		return;
+	}
+
+	cls = scls_class_of(&pool, ptr);
+	if (cache_count[cls] == cache_limit[cls]) {
+		while (cache_count[cls] > cache_limit[cls] / 2)
+			scls_free(&pool, cache[cls][--cache_count[cls]]);
+		scls_free(&pool, ptr);
+		return;
+	}
+
+	cache[cls][cache_count[cls]++] = ptr;
+}
+
+static void *pool_resize(void *ptr, uint32_t old, uint32_t size)
+{
+	uint32_t usable;
+	void *ret;
+
+	if (ptr == NULL)
+		return pool_alloc(size);
+
+	if (size == 0) {
+		pool_release(ptr, old);
+		return NULL;
+	}
+
+	if (scls_owns(&pool, ptr)) {
+		usable = scls_size(scls_class_of(&pool, ptr));
+		if (size <= usable && size > usable / 2)
+			return ptr;
+	} else {
+		// blocks are accounted by the size in the trace, keep that right
+		usable = (old + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		if (size <= usable && size > usable - PAGE_SIZE)
+			return ptr;
+	}
+
+	ret = pool_alloc(size);
+	if (ret != NULL) {
+		memcpy(ret, ptr, old < size ? old : size);
+		pool_release(ptr, old);
+	}
+
+	return ret;
+}
+
+static uint64_t pool_footprint(void)
+{
+	return (uint64_t)pool.liveSpans * SCLS_SPAN_SIZE + large_bytes;
+}
+
+static void pool_reset(void)
+{
+	uint32_t limit;
+
+	scls_init(&pool, realloc(pool.spans, scls_meta_size(POOL_SIZE)), pool_mem, POOL_SIZE);
+
+	for (uint32_t i = 0; i < SCLS_NUM_CLASSES; i++) {
+		limit = PALLOC_CACHE_BYTES / scls_size(i);
+		cache_limit[i] = limit > PALLOC_CACHE_DEPTH ? PALLOC_CACHE_DEPTH : limit > 0 ? limit : 1;
+		cache_count[i] = 0;
+	}
+
+	large_bytes = 0;
+	peak_large = 0;
+}
+
+// returns the replay time, fills the peaks
+static uint64_t replay(const Heap *heap, uint64_t *peak_live, uint64_t *peak_held, uint32_t *failed)
+{
+	uint64_t live = 0, held, start, time = 0;
+	uint64_t base = heap->footprint();
+	Slot *s;
+	void *p;
+
+	*peak_live = 0;
+	*peak_held = 0;
+	*failed = 0;
+
+	for (uint32_t i = 0; i < num_ops; i++) {
+		const TraceOp *o = &ops[i];
+
+		s = &slots[o->id];
+		start = now_ns();
+
+		switch (o->op) {
+		case OP_MALLOC:
+			if (s->ptr != NULL)
+				heap->release(s->ptr, s->size);
+			live -= s->ptr != NULL ? s->size : 0;
+			p = heap->alloc(o->size);
+			s->ptr = p;
+			s->size = p != NULL ? o->size : 0;
+			break;
+		case OP_REALLOC:
+			p = heap->resize(s->ptr, s->size, o->size);
+			if (o->size == 0) {
+				// freed, not a failure
+				live -= s->size;
+				s->ptr = NULL;
+				s->size = 0;
+				p = (void *)1;
+			} else if (p != NULL) {
+				live -= s->size;
+				s->ptr = p;
+				s->size = o->size;
+			}
+			break;
+		default:
+			if (s->ptr != NULL)
+				heap->release(s->ptr, s->size);
+			live -= s->size;
+			s->ptr = NULL;
+			s->size = 0;
+			p = (void *)1;
+			break;
+		}
+
+		// the game writes what it allocates
+		if (o->op != OP_FREE && o->size > 0 && p != NULL)
+			memset(p, 0xA5, o->size < 64 ? o->size : 64);
+
+		time += now_ns() - start;
+
+		if (p == NULL) {
+			(*failed)++;
+			continue;
+		}
+
+		if (o->op != OP_FREE)
+			live += o->size;
+
+		if (live > *peak_live || i % SAMPLE_INTERVAL == 0) {
+			held = heap->footprint();
+			held = held > base ? held - base : 0;
+			if (held > *peak_held)
+				*peak_held = held;
+			if (live > *peak_live)
+				*peak_live = live;
+		}
+	}
+
+	for (uint32_t i = 0; i < num_ids; i++) {
+		if (slots[i].ptr != NULL)
+			heap->release(slots[i].ptr, slots[i].size);
+		slots[i].ptr = NULL;
+		slots[i].size = 0;
+	}
+
+	return time;
+}
+
+static void run(const char *name, const Heap *heap, uint32_t runs)
+{
+	uint64_t best = UINT64_MAX, time, live, held, peak_live = 0, peak_held = 0;
+	uint32_t failed = 0;
+
+	// a heap may keep memory for the next run, take the peaks of all runs
+	for (uint32_t r = 0; r < runs; r++) {
+		if (heap->alloc == pool_alloc)
+			pool_reset();
+
+		time = replay(heap, &live, &held, &failed);
+		if (time < best)
+			best = time;
+		if (live > peak_live)
+			peak_live = live;
+		if (held > peak_held)
+			peak_held = held;
+	}
+
+	printf("%-6s %10.1f %8.1f %12llu %12llu %8.1f%%", name, best / 1000000.0, (double)best / num_ops,
+		(unsigned long long)peak_live, (unsigned long long)peak_held,
+		peak_live ? 100.0 * ((double)peak_held - peak_live) / peak_live : 0.0);
+	if (failed > 0)
+		printf("  %u failed", failed);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const Heap host = { host_alloc, host_release, host_resize, host_footprint };
+	static const Heap slab = { pool_alloc, pool_release, pool_resize, pool_footprint };
+	uint32_t runs = 5;
+	int arg = 1;
+
+	if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+		runs = strtoul(argv[arg + 1], NULL, 10);
+		arg += 2;
+	}
+
+	if (arg + 1 != argc || runs == 0) {
+		fprintf(stderr, "usage: %s [-n runs] trace\n", argv[0]);
+		return 1;
+	}
+
+	if (load_trace(argv[arg]) < 0)
+		return 1;
+
+	pool_mem = aligned_alloc(SCLS_SPAN_SIZE, POOL_SIZE);
+	if (pool_mem == NULL) {
+		fprintf(stderr, "cannot allocate the pool\n");
+		return 1;
+	}
+
+	printf("%s: %u calls, %u ids\n\n", argv[arg], num_ops, num_ids);
+	printf("heap     total ms  ns/call    peak live    peak held  overhead\n");
+	run("host", &host, runs);
+	run("pool", &slab, runs);
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+/* allocprof.c -- report on allocation profiles
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: allocprof [-n top] alloc_prof.bin
+//
+// Reads a profile written by libal/alloc_prof.c
+// (savedata0:/stats/alloc_prof.bin) and prints:
+//
+//   the totals, peak live bytes and the allocation rate per frame
+//   call sites by calls and by bytes
+//   churn: call sites whose blocks are freed in the frame they were
+//          allocated in, the ones worth a pool or a per-frame arena
+//   allocations and live bytes per size class, and per thread
+//
+// Per frame figures are averages over all profiled frames, percentiles
+// come from the last frames the profile kept.
+//
+// Build: gcc -O2 -o allocprof allocprof.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../libal/alloc_prof_format.h"
+
+// sites freeing less than this many blocks per frame in the frame they were
+// allocated in are not churn
+#define CHURN_MIN_PER_FRAME	1.0
+
+static AllocProfHeader hdr;
+static char *names;
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+static int compare_calls(const void *a, const void *b)
+{
+	const AllocProfSite *sa = *(const AllocProfSite **)a, *sb = *(const AllocProfSite **)b;
+	uint32_t ca = sa->allocs + sa->reallocs, cb = sb->allocs + sb->reallocs;
+
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+	const AllocProfSite *sa = *(const AllocProfSite **)a, *sb = *(const AllocProfSite **)b;
+
+	return sa->bytes < sb->bytes ? 1 : sa->bytes > sb->bytes ? -1 : 0;
+}
+
+static int compare_churn(const void *a, const void *b)
+{
+	const AllocProfSite *sa = *(const AllocProfSite **)a, *sb = *(const AllocProfSite **)b;
+
+	return sa->frameLocal < sb->frameLocal ? 1 : sa->frameLocal > sb->frameLocal ? -1 : 0;
+}
+
+static const char *site_name(const AllocProfSite *s)
+{
+	static char buf[512];
+
+	if (s->address == APRF_OTHER_SITE)
+		return "(other sites)";
+	if (s->name == APRF_NO_NAME)
+		snprintf(buf, sizeof(buf), "0x%08x", s->address);
+	else
+		snprintf(buf, sizeof(buf), "%.480s+0x%x", names + s->name, s->symOffset);
+
+	return buf;
+}
+
+static double per_frame(uint64_t count)
+{
+	return hdr.frames > 0 ? (double)count / hdr.frames : 0.0;
+}
+
+static void print_site_header(const char *title)
+{
+	printf("\n%-48s %9s %8s %11s %6s %7s %9s %10s %10s\n", title,
+		"calls", "/frame", "bytes", "local", "size50", "life50us", "live", "peak live");
+}
+
+static void print_site(const AllocProfSite *s)
+{
+	uint32_t calls = s->allocs + s->reallocs;
+
+	printf("%-48.48s %9u %8.1f %11llu %5.0f%% %7u %9u %10u %10u\n", site_name(s), calls, per_frame(calls),
+		(unsigned long long)s->bytes, s->frees > 0 ? 100.0 * s->frameLocal / s->frees : 0.0,
+		s->sizeP50, s->lifetimeP50, s->liveBytes, s->peakLiveBytes);
+}
+
+static void print_percentiles(const char *name, uint32_t *values, uint32_t n)
+{
+	qsort(values, n, sizeof(uint32_t), compare_u32);
+	printf("%-14s %10u %10u %10u %10u\n", name, values[n / 2], values[(uint64_t)n * 95 / 100],
+		values[(uint64_t)n * 99 / 100], values[n - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+	AllocProfSite *sites, **order;
+	AllocProfThread *threads;
+	AllocProfFrame *frames;
+	AllocProfBin *bins;
+	uint32_t *values, top = 20, shown;
+	int arg = 1;
+	FILE *f;
+
+	if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+		top = strtoul(argv[arg + 1], NULL, 10);
+		arg += 2;
+	}
+
+	if (arg + 1 != argc) {
+		fprintf(stderr, "usage: %s [-n top] alloc_prof.bin\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[arg], "rb");
+	if (f == NULL) {
+		fprintf(stderr, "cannot open %s\n", argv[arg]);
+		return 1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != APRF_MAGIC || hdr.version != APRF_VERSION) {
+		fprintf(stderr, "%s: not an allocation profile\n", argv[arg]);
+		fclose(f);
+		return 1;
+	}
+
+	names = malloc(hdr.nameBytes + 1);
+	sites = malloc(hdr.numSites * sizeof(AllocProfSite) + 1);
+	order = malloc(hdr.numSites * sizeof(AllocProfSite *) + 1);
+	bins = malloc(hdr.numBins * sizeof(AllocProfBin) + 1);
+	threads = malloc(hdr.numThreads * sizeof(AllocProfThread) + 1);
+	frames = malloc(hdr.numFrames * sizeof(AllocProfFrame) + 1);
+	values = malloc(hdr.numFrames * sizeof(uint32_t) + 1);
+
+	if (fread(names, 1, hdr.nameBytes, f) != hdr.nameBytes ||
+		fread(sites, sizeof(AllocProfSite), hdr.numSites, f) != hdr.numSites ||
+		fread(bins, sizeof(AllocProfBin), hdr.numBins, f) != hdr.numBins ||
+		fread(threads, sizeof(AllocProfThread), hdr.numThreads, f) != hdr.numThreads ||
+		fread(frames, sizeof(AllocProfFrame), hdr.numFrames, f) != hdr.numFrames) {
+		fprintf(stderr, "%s: truncated\n", argv[arg]);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	names[hdr.nameBytes] = '\0';
+
+	for (uint32_t i = 0; i < hdr.numSites; i++) {
+		if (sites[i].name != APRF_NO_NAME && sites[i].name >= hdr.nameBytes) {
+			fprintf(stderr, "%s: bad site %u\n", argv[arg], i);
+			return 1;
+		}
+		order[i] = &sites[i];
+	}
+
+	printf("%s: %u allocs, %u reallocs, %u frees, %llu bytes over %u frames, %u call sites\n", argv[arg],
+		hdr.allocs, hdr.reallocs, hdr.frees, (unsigned long long)hdr.bytes, hdr.frames, hdr.numSites);
+	printf("per frame: %.1f allocs, %.1f frees, %.0f bytes\n",
+		per_frame(hdr.allocs + hdr.reallocs), per_frame(hdr.frees), per_frame(hdr.bytes));
+	printf("live: %u blocks, %u bytes, peak %u bytes at frame %u\n", hdr.liveCount, hdr.liveBytes, hdr.peakLiveBytes, hdr.peakFrame);
+	if (hdr.untrackedFrees > 0)
+		printf("%u frees of blocks allocated before profiling started or not tracked\n", hdr.untrackedFrees);
+	if (hdr.dropped > 0)
+		printf("%u blocks were not tracked, raise ALLOC_PROF_SIZE to track them\n", hdr.dropped);
+
+	if (hdr.numFrames > 0) {
+		printf("\nlast %u frames     p50        p95        p99        max\n", hdr.numFrames);
+		for (uint32_t i = 0; i < hdr.numFrames; i++)
+			values[i] = frames[i].allocs;
+		print_percentiles("allocs", values, hdr.numFrames);
+		for (uint32_t i = 0; i < hdr.numFrames; i++)
+			values[i] = frames[i].frees;
+		print_percentiles("frees", values, hdr.numFrames);
+		for (uint32_t i = 0; i < hdr.numFrames; i++)
+			values[i] = frames[i].bytes;
+		print_percentiles("bytes", values, hdr.numFrames);
+		for (uint32_t i = 0; i < hdr.numFrames; i++)
+			values[i] = frames[i].liveBytes;
+		print_percentiles("live bytes", values, hdr.numFrames);
+	}
+
+	qsort(order, hdr.numSites, sizeof(AllocProfSite *), compare_calls);
+	print_site_header("call sites by calls");
+	for (uint32_t i = 0; i < hdr.numSites && i < top; i++)
+		print_site(order[i]);
+
+	qsort(order, hdr.numSites, sizeof(AllocProfSite *), compare_bytes);
+	print_site_header("call sites by bytes");
+	for (uint32_t i = 0; i < hdr.numSites && i < top; i++)
+		print_site(order[i]);
+
+	// local is the share of the site's freed blocks that died in their frame
+	qsort(order, hdr.numSites, sizeof(AllocProfSite *), compare_churn);
+	print_site_header("churn, freed in the same frame");
+	shown = 0;
+	for (uint32_t i = 0; i < hdr.numSites && shown < top; i++) {
+		if (per_frame(order[i]->frameLocal) < CHURN_MIN_PER_FRAME)
+			break;
+		print_site(order[i]);
+		shown++;
+	}
+	if (shown == 0)
+		printf("(none above %.1f per frame)\n", CHURN_MIN_PER_FRAME);
+
+	printf("\n%-10s %10s %8s %13s %6s %10s %12s %12s\n", "size", "allocs", "/frame", "bytes", "local", "live", "live bytes", "peak live");
+	for (uint32_t i = 0; i < hdr.numBins; i++) {
+		const AllocProfBin *b = &bins[i];
+		char size[16];
+
+		if (b->allocs == 0)
+			continue;
+
+		if (b->size != 0)
+			snprintf(size, sizeof(size), "%u", b->size);
+		else
+			snprintf(size, sizeof(size), "larger");
+
+		printf("%-10s %10u %8.1f %13llu %5.0f%% %10u %12u %12u\n", size, b->allocs, per_frame(b->allocs),
+			(unsigned long long)b->bytes, 100.0 * b->frameLocal / b->allocs, b->liveCount, b->liveBytes, b->peakLiveBytes);
+	}
+
+	printf("\n%-32s %10s %10s %10s %13s\n", "thread", "allocs", "reallocs", "frees", "bytes");
+	for (uint32_t i = 0; i < hdr.numThreads; i++) {
+		const AllocProfThread *t = &threads[i];
+
+		printf("%-32.32s %10u %10u %10u %13llu\n", t->name, t->allocs, t->reallocs, t->frees, (unsigned long long)t->bytes);
+	}
+
+	free(values);
+	free(frames);
+	free(threads);
+	free(bins);
+	free(order);
+	free(sites);
+	free(names);
+
+	return 0;
+}
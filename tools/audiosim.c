@@ -0,0 +1,153 @@
+/* audiosim.c -- replay a recorded mixer timing trace against simulated audio sinks
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: audiosim audio_trace.bin [samples_per_buf:queue_depth ...]
+//
+// The trace holds the mixer time of every buffer as recorded by
+// libal/audio_stats.c. Mixer cost is assumed to scale linearly with the
+// number of samples per buffer. The sink plays buffers back to back in real
+// time and holds at most queue_depth of them, the producer blocks when it is
+// full. Any gap between two buffers is counted as a glitch.
+//
+// Build: gcc -O2 -o audiosim audiosim.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AUST_TRACE_MAGIC	0x43525441 // 'ATRC'
+#define AUST_TRACE_VERSION	1
+
+#define MAX_QUEUE_DEPTH		16
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sampleRate;
+	uint32_t samplesPerBuf;
+	uint32_t count;
+} AudioTraceHeader;
+
+typedef struct {
+	uint32_t samplesPerBuf;
+	uint32_t queueDepth;
+} SinkConfig;
+
+static const SinkConfig default_configs[] = {
+	{ 1024, 2 }, { 1024, 3 }, { 1024, 4 },
+	{ 2048, 2 }, { 2048, 3 },
+	{ 4096, 2 }, { 4096, 3 },
+	{ 8192, 2 }, { 8192, 3 },
+};
+
+static void simulate(const AudioTraceHeader *hdr, const uint32_t *trace, const SinkConfig *cfg)
+{
+	double play_end[MAX_QUEUE_DEPTH];
+	double scale = (double)cfg->samplesPerBuf / hdr->samplesPerBuf;
+	double buf_us = (double)cfg->samplesPerBuf * 1000000.0 / hdr->sampleRate;
+	double total_us = (double)hdr->count * hdr->samplesPerBuf * 1000000.0 / hdr->sampleRate;
+	double now = 0.0, last_end = 0.0, gap_us = 0.0;
+	uint64_t buffers = 0, glitches = 0;
+	uint32_t head = 0;
+
+	memset(play_end, 0, sizeof(play_end));
+
+	while (last_end < total_us) {
+		// mixer cost of the recorded buffer covering the same stretch of audio
+		uint32_t src = (uint32_t)(buffers * scale) % hdr->count;
+		now += trace[src] * scale;
+
+		// the oldest slot is reusable once it finished playing
+		if (buffers >= cfg->queueDepth && play_end[head] > now)
+			now = play_end[head];
+
+		double start = now > last_end ? now : last_end;
+		if (buffers > 0 && now > last_end) {
+			glitches++;
+			gap_us += now - last_end;
+		}
+
+		last_end = start + buf_us;
+		play_end[head] = last_end;
+		head = (head + 1) % cfg->queueDepth;
+		buffers++;
+	}
+
+	printf("%8u %5u %10.1f %10llu %10llu %12.3f %10.1f\n",
+		cfg->samplesPerBuf,
+		cfg->queueDepth,
+		buf_us * cfg->queueDepth / 1000.0,
+		(unsigned long long)buffers,
+		(unsigned long long)glitches,
+		glitches * 60000000.0 / total_us,
+		gap_us / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+	AudioTraceHeader hdr;
+	uint32_t *trace;
+	FILE *f;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s audio_trace.bin [samples_per_buf:queue_depth ...]\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != AUST_TRACE_MAGIC || hdr.version != AUST_TRACE_VERSION) {
+		fprintf(stderr, "%s: not an audio trace\n", argv[1]);
+		fclose(f);
+		return 1;
+	}
+
+	if (hdr.count == 0 || hdr.sampleRate == 0 || hdr.samplesPerBuf == 0) {
+		fprintf(stderr, "%s: empty trace\n", argv[1]);
+		fclose(f);
+		return 1;
+	}
+
+	trace = malloc(hdr.count * sizeof(uint32_t));
+	if (fread(trace, sizeof(uint32_t), hdr.count, f) != hdr.count) {
+		fprintf(stderr, "%s: truncated trace\n", argv[1]);
+		free(trace);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	printf("trace: %u buffers of %u samples at %u Hz\n\n", hdr.count, hdr.samplesPerBuf, hdr.sampleRate);
+	printf("%8s %5s %10s %10s %10s %12s %10s\n", "samples", "depth", "latency_ms", "buffers", "glitches", "glitch/min", "gap_ms");
+
+	if (argc > 2) {
+		for (int i = 2; i < argc; i++) {
+			SinkConfig cfg;
+			if (sscanf(argv[i], "%u:%u", &cfg.samplesPerBuf, &cfg.queueDepth) != 2 ||
+				cfg.samplesPerBuf == 0 || cfg.queueDepth == 0 || cfg.queueDepth > MAX_QUEUE_DEPTH) {
+				fprintf(stderr, "bad config: %s\n", argv[i]);
+				continue;
+			}
+			simulate(&hdr, trace, &cfg);
+		}
+	} else {
+		for (size_t i = 0; i < sizeof(default_configs) / sizeof(SinkConfig); i++)
+			simulate(&hdr, trace, &default_configs[i]);
+	}
+
+	free(trace);
+
+	return 0;
+}
@@ -0,0 +1,545 @@
+/* fcbench.c -- replay a file access trace against the stdio block cache
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: fcbench [-r root] trace [block_kb:cache_kb:ahead ...]
+//
+// The trace is either a load trace written by libal/load_trace.c or a text
+// file with one "path,offset,length" line per read. Paths starting
+// with app0:gamedata are looked up under root (default .), so an extracted
+// OBB tree can stand in for the game data. Every read is first replayed
+// with plain pread, then through libal/block_cache.c with a read-ahead
+// thread working the same way as libal/file_cache.c, once per cache
+// configuration (default 64:4096:4).
+//
+// The page cache of every file in the trace is dropped before each run so
+// the numbers reflect the disk, not memory.
+//
+// Build: gcc -O2 -o fcbench fcbench.c ../libal/block_cache.c -lpthread
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../libal/block_cache.h"
+#include "../libal/load_trace_format.h"
+
+#define DATA_PREFIX		"app0:gamedata"
+#define QUEUE_SIZE		64
+#define MAX_CONFIGS		16
+
+typedef struct {
+	uint32_t file;
+	uint64_t offset;
+	uint32_t length;
+} TraceRead;
+
+typedef struct {
+	char *path;
+	int fd;
+	uint64_t size;
+	BcacheStream stream;
+} TraceFile;
+
+typedef struct {
+	uint32_t blockSize;
+	uint32_t cacheSize;
+	uint32_t ahead;
+} CacheConfig;
+
+typedef struct {
+	uint32_t file;
+	uint32_t index;
+} AheadRequest;
+
+typedef struct {
+	uint64_t hits;
+	uint64_t aheadHits;
+	uint64_t lateHits;
+	uint64_t misses;
+	uint64_t bytesRead;
+	uint64_t bytesDirect;
+	uint64_t diskReads;
+	uint64_t waitTime;
+} RunStats;
+
+static TraceRead *reads = NULL;
+static uint32_t num_reads = 0;
+static TraceFile *files = NULL;
+static uint32_t num_files = 0;
+
+static BlockCache cache;
+static CacheConfig config;
+static AheadRequest queue[QUEUE_SIZE];
+static uint32_t queue_head, queue_tail;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int quit;
+static RunStats run;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t file_id(const char *root, const char *path)
+{
+	char full[8192];
+	struct stat st;
+
+	for (uint32_t i = 0; i < num_files; i++) {
+		if (strcmp(files[i].path, path) == 0)
+			return i;
+	}
+
+	if (strncmp(path, DATA_PREFIX, strlen(DATA_PREFIX)) == 0)
+		snprintf(full, sizeof(full), "%s%s", root, path + strlen(DATA_PREFIX));
+	else
+		snprintf(full, sizeof(full), "%s/%s", root, path);
+
+	files = realloc(files, (num_files + 1) * sizeof(TraceFile));
+	files[num_files].path = strdup(path);
+	files[num_files].fd = open(full, O_RDONLY);
+	files[num_files].size = 0;
+
+	if (files[num_files].fd < 0) {
+		fprintf(stderr, "cannot open %s\n", full);
+		exit(1);
+	}
+
+	fstat(files[num_files].fd, &st);
+	files[num_files].size = st.st_size;
+
+	return num_files++;
+}
+
+static void load_binary_trace(const char *root, FILE *f)
+{
+	LoadTraceHeader hdr;
+	uint32_t *ids;
+	char *paths, *p;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.version != LDTR_VERSION) {
+		fprintf(stderr, "unsupported trace\n");
+		exit(1);
+	}
+
+	paths = malloc(hdr.pathBytes + 1);
+	ids = malloc((hdr.numFiles + 1) * sizeof(uint32_t));
+	reads = malloc((hdr.numReads + 1) * sizeof(TraceRead));
+
+	if (fread(paths, 1, hdr.pathBytes, f) != hdr.pathBytes) {
+		fprintf(stderr, "truncated trace\n");
+		exit(1);
+	}
+	paths[hdr.pathBytes] = '\0';
+
+	p = paths;
+	for (uint32_t i = 0; i < hdr.numFiles; i++) {
+		ids[i] = file_id(root, p);
+		p += strlen(p) + 1;
+	}
+
+	for (uint32_t i = 0; i < hdr.numReads; i++) {
+		LoadTraceRead r;
+
+		if (fread(&r, sizeof(r), 1, f) != 1 || r.file >= hdr.numFiles) {
+			fprintf(stderr, "truncated trace\n");
+			exit(1);
+		}
+
+		reads[i].file = ids[r.file];
+		reads[i].offset = r.offset;
+		reads[i].length = r.length;
+	}
+
+	num_reads = hdr.numReads;
+
+	free(ids);
+	free(paths);
+}
+
+static void load_trace(const char *root, const char *name)
+{
+	char line[4096], *sep;
+	uint32_t capacity = 0, magic = 0;
+	FILE *f = fopen(name, "rb");
+
+	if (f == NULL) {
+		fprintf(stderr, "cannot open %s\n", name);
+		exit(1);
+	}
+
+	if (fread(&magic, sizeof(magic), 1, f) == 1 && magic == LDTR_MAGIC) {
+		rewind(f);
+		load_binary_trace(root, f);
+		fclose(f);
+		return;
+	}
+	rewind(f);
+
+	while (fgets(line, sizeof(line), f)) {
+		sep = strrchr(line, ',');
+		if (sep == NULL)
+			continue;
+		*sep = '\0';
+		uint32_t length = strtoul(sep + 1, NULL, 10);
+
+		sep = strrchr(line, ',');
+		if (sep == NULL)
+			continue;
+		*sep = '\0';
+		uint64_t offset = strtoull(sep + 1, NULL, 10);
+
+		if (num_reads == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			reads = realloc(reads, capacity * sizeof(TraceRead));
+		}
+
+		reads[num_reads].file = file_id(root, line);
+		reads[num_reads].offset = offset;
+		reads[num_reads].length = length;
+		num_reads++;
+	}
+
+	fclose(f);
+}
+
+static void drop_page_cache(void)
+{
+	for (uint32_t i = 0; i < num_files; i++)
+		posix_fadvise(files[i].fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static uint32_t block_size(uint32_t file, uint32_t index)
+{
+	uint64_t left = files[file].size - (uint64_t)index * config.blockSize;
+
+	return left < config.blockSize ? (uint32_t)left : config.blockSize;
+}
+
+static void queue_ahead(uint32_t file, uint32_t index)
+{
+	uint32_t ahead = bcache_stream_ahead(&files[file].stream, index, config.ahead);
+	uint32_t last = (files[file].size - 1) / config.blockSize;
+
+	for (uint32_t i = index + 1; i <= index + ahead && i <= last; i++) {
+		if (bcache_find(&cache, file, i) != NULL)
+			continue;
+		if (queue_tail - queue_head == QUEUE_SIZE)
+			break;
+
+		queue[queue_tail % QUEUE_SIZE].file = file;
+		queue[queue_tail % QUEUE_SIZE].index = i;
+		queue_tail++;
+	}
+
+	pthread_cond_signal(&work_cond);
+}
+
+static void *io_thread(void *arg)
+{
+	AheadRequest req;
+	BcacheBlock *block;
+	uint32_t size;
+	ssize_t res;
+
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+
+	while (1) {
+		while (queue_head == queue_tail && !quit)
+			pthread_cond_wait(&work_cond, &lock);
+
+		if (quit)
+			break;
+
+		req = queue[queue_head % QUEUE_SIZE];
+		queue_head++;
+
+		if (bcache_find(&cache, req.file, req.index) != NULL)
+			continue;
+
+		block = bcache_claim(&cache, req.file, req.index);
+		if (block == NULL)
+			continue;
+
+		size = block_size(req.file, req.index);
+
+		pthread_mutex_unlock(&lock);
+		res = pread(files[req.file].fd, block->data, size, (off_t)req.index * config.blockSize);
+		pthread_mutex_lock(&lock);
+
+		bcache_release(&cache, block, res == size ? size : 0);
+		if (block->state == BCACHE_VALID) {
+			block->flags |= BCACHE_PREFETCHED;
+			run.bytesRead += size;
+			run.diskReads++;
+		}
+
+		pthread_cond_broadcast(&done_cond);
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static BcacheBlock *get_block(uint32_t file, uint32_t index)
+{
+	uint32_t size = block_size(file, index);
+	BcacheBlock *block;
+	uint64_t start;
+	int late = 0;
+	ssize_t res;
+
+	while (1) {
+		block = bcache_find(&cache, file, index);
+		if (block != NULL && block->state == BCACHE_VALID) {
+			if (late)
+				run.lateHits++;
+			else if (block->flags & BCACHE_PREFETCHED)
+				run.aheadHits++;
+			else
+				run.hits++;
+
+			block->flags &= ~BCACHE_PREFETCHED;
+			return block;
+		}
+
+		if (block == NULL) {
+			block = bcache_claim(&cache, file, index);
+			if (block != NULL)
+				break;
+		}
+
+		late = 1;
+		start = now_us();
+		pthread_cond_wait(&done_cond, &lock);
+		run.waitTime += now_us() - start;
+	}
+
+	run.misses++;
+
+	pthread_mutex_unlock(&lock);
+	start = now_us();
+	res = pread(files[file].fd, block->data, size, (off_t)index * config.blockSize);
+	run.waitTime += now_us() - start;
+	pthread_mutex_lock(&lock);
+
+	bcache_release(&cache, block, res == size ? size : 0);
+	pthread_cond_broadcast(&done_cond);
+
+	if (res != size)
+		return NULL;
+
+	run.bytesRead += size;
+	run.diskReads++;
+
+	return block;
+}
+
+// same policy as cache_read() in libal/file_cache.c
+static void cached_read(const TraceRead *r, uint8_t *dst)
+{
+	uint32_t bs = config.blockSize;
+	uint64_t pos = r->offset, start;
+	uint32_t size = r->length, done = 0, index, offset, count, n;
+	BcacheBlock *block;
+	ssize_t res;
+
+	if (pos >= files[r->file].size)
+		return;
+	if (size > files[r->file].size - pos)
+		size = files[r->file].size - pos;
+
+	while (done < size) {
+		index = pos / bs;
+		offset = pos % bs;
+
+		if (offset == 0 && size - done >= bs && bcache_find(&cache, r->file, index) == NULL) {
+			count = 1;
+			while ((count + 1) * bs <= size - done && bcache_find(&cache, r->file, index + count) == NULL)
+				count++;
+
+			pthread_mutex_unlock(&lock);
+			start = now_us();
+			res = pread(files[r->file].fd, dst + done, count * bs, pos);
+			run.waitTime += now_us() - start;
+			pthread_mutex_lock(&lock);
+
+			if (res <= 0)
+				break;
+
+			run.bytesDirect += res;
+			run.bytesRead += res;
+			run.diskReads++;
+			pos += res;
+			done += res;
+
+			for (uint32_t i = 0; i < count - 1; i++)
+				bcache_stream_ahead(&files[r->file].stream, index + i, config.ahead);
+			queue_ahead(r->file, index + count - 1);
+			continue;
+		}
+
+		block = get_block(r->file, index);
+		if (block == NULL || offset >= block->size)
+			break;
+
+		n = block->size - offset;
+		if (n > size - done)
+			n = size - done;
+
+		memcpy(dst + done, block->data + offset, n);
+		pos += n;
+		done += n;
+
+		queue_ahead(r->file, index);
+	}
+}
+
+static uint32_t max_length(void)
+{
+	uint32_t max = 0;
+
+	for (uint32_t i = 0; i < num_reads; i++) {
+		if (reads[i].length > max)
+			max = reads[i].length;
+	}
+
+	return max;
+}
+
+static void run_direct(uint8_t *buf)
+{
+	uint64_t bytes = 0, start;
+
+	drop_page_cache();
+	start = now_us();
+
+	for (uint32_t i = 0; i < num_reads; i++) {
+		ssize_t res = pread(files[reads[i].file].fd, buf, reads[i].length, reads[i].offset);
+		if (res > 0)
+			bytes += res;
+	}
+
+	printf("direct: %u reads, %llu bytes, %.1f ms\n", num_reads, (unsigned long long)bytes, (now_us() - start) / 1000.0);
+}
+
+static void run_cached(const CacheConfig *cfg, uint8_t *buf)
+{
+	uint32_t count = cfg->cacheSize / cfg->blockSize;
+	uint64_t start, total, lookups;
+	pthread_t thread;
+	void *mem;
+
+	config = *cfg;
+	mem = aligned_alloc(4096, (bcache_mem_size(count, cfg->blockSize) + 4095) & ~4095);
+	bcache_init(&cache, mem, count, cfg->blockSize);
+
+	memset(&run, 0, sizeof(run));
+	queue_head = queue_tail = 0;
+	quit = 0;
+	for (uint32_t i = 0; i < num_files; i++)
+		bcache_stream_reset(&files[i].stream);
+
+	drop_page_cache();
+	pthread_create(&thread, NULL, io_thread, NULL);
+
+	start = now_us();
+	pthread_mutex_lock(&lock);
+	for (uint32_t i = 0; i < num_reads; i++)
+		cached_read(&reads[i], buf);
+	total = now_us() - start;
+
+	quit = 1;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	lookups = run.hits + run.aheadHits + run.lateHits + run.misses;
+
+	printf("cache %uK blocks, %uK, %u ahead: %.1f ms, wait %.1f ms, hit rate %.1f%% (%llu hits, %llu read ahead, %llu late, %llu misses), %llu disk reads, %llu bytes read, %llu direct\n",
+		cfg->blockSize / 1024, cfg->cacheSize / 1024, cfg->ahead,
+		total / 1000.0, run.waitTime / 1000.0,
+		lookups ? 100.0 * (lookups - run.misses) / lookups : 0.0,
+		(unsigned long long)run.hits, (unsigned long long)run.aheadHits,
+		(unsigned long long)run.lateHits, (unsigned long long)run.misses,
+		(unsigned long long)run.diskReads, (unsigned long long)run.bytesRead,
+		(unsigned long long)run.bytesDirect);
+
+	free(mem);
+}
+
+int main(int argc, char *argv[])
+{
+	CacheConfig configs[MAX_CONFIGS];
+	uint32_t num_configs = 0;
+	const char *root = ".";
+	uint8_t *buf;
+	int arg = 1;
+
+	if (arg + 1 < argc && strcmp(argv[arg], "-r") == 0) {
+		root = argv[arg + 1];
+		arg += 2;
+	}
+
+	if (arg >= argc) {
+		fprintf(stderr, "usage: %s [-r root] trace [block_kb:cache_kb:ahead ...]\n", argv[0]);
+		return 1;
+	}
+
+	load_trace(root, argv[arg++]);
+
+	for (; arg < argc && num_configs < MAX_CONFIGS; arg++) {
+		CacheConfig *c = &configs[num_configs];
+
+		if (sscanf(argv[arg], "%u:%u:%u", &c->blockSize, &c->cacheSize, &c->ahead) != 3 || c->blockSize == 0 || c->cacheSize < c->blockSize) {
+			fprintf(stderr, "invalid cache config %s\n", argv[arg]);
+			return 1;
+		}
+
+		c->blockSize *= 1024;
+		c->cacheSize *= 1024;
+		num_configs++;
+	}
+
+	if (num_configs == 0) {
+		configs[0].blockSize = 64 * 1024;
+		configs[0].cacheSize = 4096 * 1024;
+		configs[0].ahead = 4;
+		num_configs = 1;
+	}
+
+	printf("%u reads over %u files\n", num_reads, num_files);
+
+	buf = malloc(max_length() + 1);
+
+	run_direct(buf);
+	for (uint32_t i = 0; i < num_configs; i++)
+		run_cached(&configs[i], buf);
+
+	free(buf);
+
+	return 0;
+}
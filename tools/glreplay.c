@@ -0,0 +1,737 @@
+/* glreplay.c -- replay a GL capture on the host and report per frame costs
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: glreplay [-n] [-c frames.csv] gl.bin
+//
+// Replays a capture written by libal/gl_capture.c into an offscreen EGL
+// pbuffer with a GLES1 context (Mesa llvmpipe works) and prints per call
+// type counts, draw calls, bytes uploaded and state changes, in total and
+// per frame. -n only parses the capture and skips GL entirely.
+//
+// A state change is a state setting call whose value differs from the last
+// one set for the same piece of state, which is what a perfect redundancy
+// filter would leave in the stream. Client array pointers, framebuffer and
+// buffer object binds and queries are not replayed. Compressed formats the
+// host driver does not support (PVRTC) are counted and leave the texture
+// incomplete.
+//
+// Build: gcc -O2 -o glreplay glreplay.c -lEGL -lGLESv1_CM
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "../libal/gl_capture_format.h"
+
+#define STATE_SLOTS		16384
+#define MAX_TEX_NAME	(1 << 20)
+
+#define GLCAP_OP_NAME(name, args) #name,
+#define GLCAP_OP_ARGS(name, args) args,
+
+static const char *op_names[GLCAP_OP_COUNT] = { GLCAP_OPS(GLCAP_OP_NAME) };
+static const uint32_t op_args[GLCAP_OP_COUNT] = { GLCAP_OPS(GLCAP_OP_ARGS) };
+
+typedef struct {
+	const uint8_t *p;
+	const uint8_t *end;
+	int bad;
+} Reader;
+
+typedef struct {
+	uint64_t calls;
+	uint64_t draws;
+	uint64_t skippedDraws;
+	uint64_t vertices;
+	uint64_t stateCalls;
+	uint64_t stateChanges;
+	uint64_t textureBytes;
+	uint64_t vertexBytes;
+	uint64_t indexBytes;
+	uint64_t unsupportedUploads;
+	double replayMs;
+} Counters;
+
+typedef struct {
+	uint64_t key;
+	uint32_t value;
+	uint32_t used;
+} StateSlot;
+
+typedef struct {
+	uint32_t size;
+	uint32_t type;
+	uint32_t bytes;
+	const uint8_t *data;
+} VertexArray;
+
+static int use_gl = 1;
+static uint64_t op_counts[GLCAP_OP_COUNT];
+static Counters total, frame;
+
+static StateSlot state[STATE_SLOTS];
+static uint32_t active_texture = 0;
+static uint32_t client_active_texture = 0;
+static uint32_t matrix_mode = GL_MODELVIEW;
+static uint32_t bound_texture[GLCAP_ARRAY_COUNT - GLCAP_ARRAY_TEX_COORD];
+
+static GLuint *tex_map = NULL;
+static uint16_t *index_scratch = NULL;
+static uint32_t index_scratch_size = 0;
+static uint8_t *read_scratch = NULL;
+static size_t read_scratch_size = 0;
+
+static uint32_t rd_u32(Reader *r)
+{
+	uint32_t v;
+
+	if (r->end - r->p < 4) {
+		r->bad = 1;
+		r->p = r->end;
+		return 0;
+	}
+
+	memcpy(&v, r->p, 4);
+	r->p += 4;
+	return v;
+}
+
+static const uint8_t *rd_blob(Reader *r, uint32_t *size)
+{
+	const uint8_t *data;
+
+	*size = rd_u32(r);
+	if ((size_t)(r->end - r->p) < *size) {
+		r->bad = 1;
+		r->p = r->end;
+		*size = 0;
+		return NULL;
+	}
+
+	data = *size ? r->p : NULL;
+	r->p += *size;
+	return data;
+}
+
+static float fbits(uint32_t v)
+{
+	float f;
+
+	memcpy(&f, &v, 4);
+	return f;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint32_t hash_words(const uint32_t *words, uint32_t count, const uint8_t *blob, uint32_t size)
+{
+	uint32_t h = 2166136261u;
+
+	for (uint32_t i = 0; i < count; i++)
+		h = (h ^ words[i]) * 16777619u;
+	for (uint32_t i = 0; i < size; i++)
+		h = (h ^ blob[i]) * 16777619u;
+
+	return h;
+}
+
+static void set_state(uint32_t group, uint32_t unit, uint32_t selector, uint32_t value)
+{
+	uint64_t key = ((uint64_t)group << 48) ^ ((uint64_t)unit << 32) ^ selector;
+	uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 50) % STATE_SLOTS;
+
+	frame.stateCalls++;
+
+	for (uint32_t i = 0; i < STATE_SLOTS; i++) {
+		StateSlot *s = &state[(slot + i) % STATE_SLOTS];
+
+		if (!s->used) {
+			s->used = 1;
+			s->key = key;
+			s->value = value;
+			frame.stateChanges++;
+			return;
+		}
+
+		if (s->key == key) {
+			if (s->value != value) {
+				s->value = value;
+				frame.stateChanges++;
+			}
+			return;
+		}
+	}
+}
+
+static void track_state(int op, const uint32_t *a, const uint8_t *blob, uint32_t size)
+{
+	uint32_t unit = active_texture < 4 ? active_texture : 0;
+	uint32_t one = 1, zero = 0;
+
+	switch (op) {
+	case GLCAP_OP_glEnable:
+	case GLCAP_OP_glDisable:
+		set_state(GLCAP_OP_glEnable, a[0] == GL_TEXTURE_2D ? unit : 0, a[0], hash_words(op == GLCAP_OP_glEnable ? &one : &zero, 1, NULL, 0));
+		break;
+	case GLCAP_OP_glEnableClientState:
+	case GLCAP_OP_glDisableClientState:
+		set_state(GLCAP_OP_glEnableClientState, a[0] == GL_TEXTURE_COORD_ARRAY ? client_active_texture : 0, a[0], hash_words(op == GLCAP_OP_glEnableClientState ? &one : &zero, 1, NULL, 0));
+		break;
+	case GLCAP_OP_glBindTexture:
+		set_state(op, unit, a[0], hash_words(&a[1], 1, NULL, 0));
+		break;
+	case GLCAP_OP_glBindBuffer:
+		set_state(op, 0, a[0], hash_words(&a[1], 1, NULL, 0));
+		break;
+	case GLCAP_OP_glTexEnvf:
+	case GLCAP_OP_glTexEnvfv:
+		set_state(GLCAP_OP_glTexEnvf, unit, a[1], op == GLCAP_OP_glTexEnvf ? hash_words(&a[2], 1, NULL, 0) : hash_words(NULL, 0, blob, size));
+		break;
+	case GLCAP_OP_glTexParameteri:
+		set_state(op, bound_texture[unit], a[1], hash_words(&a[2], 1, NULL, 0));
+		break;
+	case GLCAP_OP_glFogf:
+	case GLCAP_OP_glFogfv:
+		set_state(GLCAP_OP_glFogf, 0, a[0], op == GLCAP_OP_glFogf ? hash_words(&a[1], 1, NULL, 0) : hash_words(NULL, 0, blob, size));
+		break;
+	case GLCAP_OP_glTexCoordPointer:
+		set_state(op, client_active_texture, 0, hash_words(a, op_args[op], NULL, 0));
+		break;
+	case GLCAP_OP_glLoadIdentity:
+	case GLCAP_OP_glLoadMatrixf:
+		set_state(GLCAP_OP_glLoadMatrixf, 0, matrix_mode, op == GLCAP_OP_glLoadIdentity ? 0 : hash_words(NULL, 0, blob, size));
+		break;
+	case GLCAP_OP_glAlphaFunc:
+	case GLCAP_OP_glClearDepthf:
+	case GLCAP_OP_glDepthRangef:
+	case GLCAP_OP_glActiveTexture:
+	case GLCAP_OP_glBindFramebufferOES:
+	case GLCAP_OP_glBlendFunc:
+	case GLCAP_OP_glClearColor:
+	case GLCAP_OP_glClearStencil:
+	case GLCAP_OP_glClientActiveTexture:
+	case GLCAP_OP_glColorMask:
+	case GLCAP_OP_glColorPointer:
+	case GLCAP_OP_glCullFace:
+	case GLCAP_OP_glDepthFunc:
+	case GLCAP_OP_glDepthMask:
+	case GLCAP_OP_glFrontFace:
+	case GLCAP_OP_glMatrixMode:
+	case GLCAP_OP_glNormalPointer:
+	case GLCAP_OP_glScissor:
+	case GLCAP_OP_glStencilFunc:
+	case GLCAP_OP_glStencilOp:
+	case GLCAP_OP_glVertexPointer:
+	case GLCAP_OP_glViewport:
+		set_state(op, 0, 0, hash_words(a, op_args[op], NULL, 0));
+		break;
+	default:
+		break;
+	}
+}
+
+static GLuint map_texture(uint32_t name)
+{
+	return name < MAX_TEX_NAME ? tex_map[name] : 0;
+}
+
+static void gen_textures(const uint8_t *blob, uint32_t size)
+{
+	uint32_t n = size / 4, name;
+	GLuint host;
+
+	for (uint32_t i = 0; i < n; i++) {
+		memcpy(&name, blob + i * 4, 4);
+		if (name >= MAX_TEX_NAME)
+			continue;
+
+		glGenTextures(1, &host);
+		tex_map[name] = host;
+	}
+}
+
+static void delete_textures(const uint8_t *blob, uint32_t size)
+{
+	uint32_t n = size / 4, name;
+
+	for (uint32_t i = 0; i < n; i++) {
+		memcpy(&name, blob + i * 4, 4);
+		if (name >= MAX_TEX_NAME || tex_map[name] == 0)
+			continue;
+
+		glDeleteTextures(1, &tex_map[name]);
+		tex_map[name] = 0;
+	}
+}
+
+// returns 0 if an enabled array could not be captured
+static int read_vertices(Reader *r, uint32_t *first, uint32_t *count, VertexArray *arrays, uint32_t *mask)
+{
+	int complete = 1;
+
+	*mask = rd_u32(r);
+	*first = rd_u32(r);
+	*count = rd_u32(r);
+
+	for (int i = 0; i < GLCAP_ARRAY_COUNT; i++) {
+		if (!(*mask & (1 << i)))
+			continue;
+
+		arrays[i].size = rd_u32(r);
+		arrays[i].type = rd_u32(r);
+		arrays[i].data = rd_blob(r, &arrays[i].bytes);
+
+		frame.vertexBytes += arrays[i].bytes;
+		if (arrays[i].bytes == 0 && *count != 0)
+			complete = 0;
+	}
+
+	return complete && !r->bad;
+}
+
+static void bind_vertices(const VertexArray *arrays, uint32_t mask)
+{
+	for (int i = 0; i < GLCAP_ARRAY_COUNT; i++) {
+		const VertexArray *a = &arrays[i];
+
+		if (!(mask & (1 << i)))
+			continue;
+
+		switch (i) {
+		case GLCAP_ARRAY_VERTEX:
+			glVertexPointer(a->size, a->type, 0, a->data);
+			break;
+		case GLCAP_ARRAY_COLOR:
+			glColorPointer(a->size, a->type, 0, a->data);
+			break;
+		case GLCAP_ARRAY_NORMAL:
+			glNormalPointer(a->type, 0, a->data);
+			break;
+		default:
+			glClientActiveTexture(GL_TEXTURE0 + i - GLCAP_ARRAY_TEX_COORD);
+			glTexCoordPointer(a->size, a->type, 0, a->data);
+			glClientActiveTexture(GL_TEXTURE0 + client_active_texture);
+			break;
+		}
+	}
+}
+
+static void draw_arrays(Reader *r, const uint32_t *a)
+{
+	VertexArray arrays[GLCAP_ARRAY_COUNT];
+	uint32_t first, count, mask;
+
+	frame.draws++;
+
+	if (!read_vertices(r, &first, &count, arrays, &mask)) {
+		frame.skippedDraws++;
+		return;
+	}
+
+	frame.vertices += count;
+
+	if (use_gl && count != 0) {
+		bind_vertices(arrays, mask);
+		glDrawArrays(a[0], 0, count);
+	}
+}
+
+// indices are rebased to the first vertex the capture kept
+static void draw_elements(Reader *r, const uint32_t *a)
+{
+	VertexArray arrays[GLCAP_ARRAY_COUNT];
+	const uint8_t *indices;
+	uint32_t size, first, count, mask, n = a[1], idx;
+
+	frame.draws++;
+
+	indices = rd_blob(r, &size);
+	frame.indexBytes += size;
+
+	if (!read_vertices(r, &first, &count, arrays, &mask) || indices == NULL) {
+		frame.skippedDraws++;
+		return;
+	}
+
+	frame.vertices += n;
+
+	if (!use_gl || n == 0)
+		return;
+
+	if (n > index_scratch_size) {
+		index_scratch_size = n;
+		index_scratch = realloc(index_scratch, n * sizeof(uint16_t));
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		if (a[2] == GL_UNSIGNED_BYTE)
+			idx = indices[i];
+		else if (a[2] == GL_UNSIGNED_SHORT)
+			idx = ((const uint16_t *)indices)[i];
+		else
+			idx = ((const uint32_t *)indices)[i];
+
+		index_scratch[i] = (uint16_t)(idx - first);
+	}
+
+	bind_vertices(arrays, mask);
+	glDrawElements(a[0], n, GL_UNSIGNED_SHORT, index_scratch);
+}
+
+// libal hands out capturing entry points for the calls it knows, calls
+// through any other proc are missing from the capture
+static void check_proc(const uint8_t *name, uint32_t size)
+{
+	for (int i = 0; i < GLCAP_OP_COUNT; i++) {
+		if (strlen(op_names[i]) == size && memcmp(op_names[i], name, size) == 0)
+			return;
+	}
+
+	fprintf(stderr, "%.*s was not captured, calls made through it are missing\n", (int)size, (const char *)name);
+}
+
+static void replay(int op, const uint32_t *a, Reader *r)
+{
+	const uint8_t *blob = NULL;
+	uint32_t size = 0;
+
+	switch (op) {
+	case GLCAP_OP_glCompressedTexImage2D:
+	case GLCAP_OP_glTexImage2D:
+	case GLCAP_OP_glDeleteTextures:
+	case GLCAP_OP_glDeleteBuffers:
+	case GLCAP_OP_glGenTextures:
+	case GLCAP_OP_glFogfv:
+	case GLCAP_OP_glTexEnvfv:
+	case GLCAP_OP_glLoadMatrixf:
+	case GLCAP_OP_eglGetProcAddress:
+		blob = rd_blob(r, &size);
+		break;
+	case GLCAP_OP_glDrawArrays:
+		draw_arrays(r, a);
+		return;
+	case GLCAP_OP_glDrawElements:
+		draw_elements(r, a);
+		return;
+	default:
+		break;
+	}
+
+	if (r->bad)
+		return;
+
+	track_state(op, a, blob, size);
+
+	switch (op) {
+	case GLCAP_OP_glActiveTexture:
+		active_texture = a[0] - GL_TEXTURE0;
+		break;
+	case GLCAP_OP_glClientActiveTexture:
+		client_active_texture = a[0] - GL_TEXTURE0;
+		break;
+	case GLCAP_OP_glMatrixMode:
+		matrix_mode = a[0];
+		break;
+	case GLCAP_OP_glBindTexture:
+		if (active_texture < 4)
+			bound_texture[active_texture] = a[1];
+		break;
+	case GLCAP_OP_glCompressedTexImage2D:
+	case GLCAP_OP_glTexImage2D:
+		frame.textureBytes += size;
+		break;
+	case GLCAP_OP_eglGetProcAddress:
+		check_proc(blob, size);
+		break;
+	default:
+		break;
+	}
+
+	if (!use_gl)
+		return;
+
+	switch (op) {
+	case GLCAP_OP_glAlphaFunc:				glAlphaFunc(a[0], fbits(a[1])); break;
+	case GLCAP_OP_glClearDepthf:			glClearDepthf(fbits(a[0])); break;
+	case GLCAP_OP_glDepthRangef:			glDepthRangef(fbits(a[0]), fbits(a[1])); break;
+	case GLCAP_OP_glFogf:					glFogf(a[0], fbits(a[1])); break;
+	case GLCAP_OP_glTexEnvf:				glTexEnvf(a[0], a[1], fbits(a[2])); break;
+	case GLCAP_OP_glActiveTexture:			glActiveTexture(a[0]); break;
+	case GLCAP_OP_glBindTexture:			glBindTexture(a[0], map_texture(a[1])); break;
+	case GLCAP_OP_glBlendFunc:				glBlendFunc(a[0], a[1]); break;
+	case GLCAP_OP_glClear:					glClear(a[0]); break;
+	case GLCAP_OP_glClearColor:				glClearColor(fbits(a[0]), fbits(a[1]), fbits(a[2]), fbits(a[3])); break;
+	case GLCAP_OP_glClearStencil:			glClearStencil(a[0]); break;
+	case GLCAP_OP_glClientActiveTexture:	glClientActiveTexture(a[0]); break;
+	case GLCAP_OP_glColorMask:				glColorMask(a[0], a[1], a[2], a[3]); break;
+	case GLCAP_OP_glCullFace:				glCullFace(a[0]); break;
+	case GLCAP_OP_glDeleteTextures:			delete_textures(blob, size); break;
+	case GLCAP_OP_glDepthFunc:				glDepthFunc(a[0]); break;
+	case GLCAP_OP_glDepthMask:				glDepthMask(a[0]); break;
+	case GLCAP_OP_glDisable:				glDisable(a[0]); break;
+	case GLCAP_OP_glDisableClientState:		glDisableClientState(a[0]); break;
+	case GLCAP_OP_glEnable:					glEnable(a[0]); break;
+	case GLCAP_OP_glEnableClientState:		glEnableClientState(a[0]); break;
+	case GLCAP_OP_glFogfv:					if (blob) glFogfv(a[0], (const GLfloat *)blob); break;
+	case GLCAP_OP_glFrontFace:				glFrontFace(a[0]); break;
+	case GLCAP_OP_glGenTextures:			gen_textures(blob, size); break;
+	case GLCAP_OP_glLoadIdentity:			glLoadIdentity(); break;
+	case GLCAP_OP_glLoadMatrixf:			if (blob) glLoadMatrixf((const GLfloat *)blob); break;
+	case GLCAP_OP_glMatrixMode:				glMatrixMode(a[0]); break;
+	case GLCAP_OP_glScissor:				glScissor(a[0], a[1], a[2], a[3]); break;
+	case GLCAP_OP_glStencilFunc:			glStencilFunc(a[0], a[1], a[2]); break;
+	case GLCAP_OP_glStencilOp:				glStencilOp(a[0], a[1], a[2]); break;
+	case GLCAP_OP_glTexEnvfv:				if (blob) glTexEnvfv(a[0], a[1], (const GLfloat *)blob); break;
+	case GLCAP_OP_glTexParameteri:			glTexParameteri(a[0], a[1], a[2]); break;
+	case GLCAP_OP_glViewport:				glViewport(a[0], a[1], a[2], a[3]); break;
+	case GLCAP_OP_glCompressedTexImage2D:
+		while (glGetError() != GL_NO_ERROR);
+		glCompressedTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], size, blob);
+		if (glGetError() != GL_NO_ERROR)
+			frame.unsupportedUploads++;
+		break;
+	case GLCAP_OP_glTexImage2D:
+		glTexImage2D(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], blob);
+		break;
+	case GLCAP_OP_glReadPixels:
+		if ((size_t)a[2] * a[3] * 4 > read_scratch_size) {
+			read_scratch_size = (size_t)a[2] * a[3] * 4;
+			read_scratch = realloc(read_scratch, read_scratch_size);
+		}
+		glReadPixels(a[0], a[1], a[2], a[3], GL_RGBA, GL_UNSIGNED_BYTE, read_scratch);
+		break;
+	default:
+		break;
+	}
+}
+
+static void add_counters(Counters *dst, const Counters *src)
+{
+	dst->calls += src->calls;
+	dst->draws += src->draws;
+	dst->skippedDraws += src->skippedDraws;
+	dst->vertices += src->vertices;
+	dst->stateCalls += src->stateCalls;
+	dst->stateChanges += src->stateChanges;
+	dst->textureBytes += src->textureBytes;
+	dst->vertexBytes += src->vertexBytes;
+	dst->indexBytes += src->indexBytes;
+	dst->unsupportedUploads += src->unsupportedUploads;
+	dst->replayMs += src->replayMs;
+}
+
+static int egl_setup(uint32_t width, uint32_t height)
+{
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+		EGL_NONE
+	};
+	static const EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 1, EGL_NONE };
+	EGLint surface_attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+	EGLDisplay dpy = EGL_NO_DISPLAY;
+	EGLConfig config;
+	EGLSurface surface;
+	EGLContext context;
+	EGLint num;
+
+	get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display)
+		dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL)) {
+		dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL))
+			return -1;
+	}
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+
+	if (!eglChooseConfig(dpy, config_attribs, &config, 1, &num) || num == 0)
+		return -1;
+
+	surface = eglCreatePbufferSurface(dpy, config, surface_attribs);
+	if (surface == EGL_NO_SURFACE)
+		return -1;
+
+	context = eglCreateContext(dpy, config, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT)
+		return -1;
+
+	if (!eglMakeCurrent(dpy, surface, surface, context))
+		return -1;
+
+	printf("renderer: %s\n", glGetString(GL_RENDERER));
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *csv_path = NULL;
+	GlCaptureHeader hdr;
+	FILE *fp, *csv = NULL;
+	uint8_t *data;
+	long size;
+	uint32_t frames = 0, a[8];
+	double frame_start;
+	Reader r;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "nc:")) != -1) {
+		switch (opt) {
+		case 'n':
+			use_gl = 0;
+			break;
+		case 'c':
+			csv_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n] [-c frames.csv] gl.bin\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-n] [-c frames.csv] gl.bin\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[optind], "rb");
+	if (!fp) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(size);
+	if (!data || fread(data, 1, size, fp) != (size_t)size || size < (long)sizeof(hdr)) {
+		fprintf(stderr, "%s: read failed\n", argv[optind]);
+		return 1;
+	}
+	fclose(fp);
+
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.magic != GLCAP_MAGIC || hdr.version != GLCAP_VERSION) {
+		fprintf(stderr, "%s: not a version %d GL capture\n", argv[optind], GLCAP_VERSION);
+		return 1;
+	}
+
+	if (use_gl) {
+		tex_map = calloc(MAX_TEX_NAME, sizeof(GLuint));
+		if (egl_setup(hdr.width ? hdr.width : 960, hdr.height ? hdr.height : 544) < 0) {
+			fprintf(stderr, "EGL/GLES1 setup failed, use -n to only parse the capture\n");
+			return 1;
+		}
+	}
+
+	if (csv_path) {
+		csv = fopen(csv_path, "w");
+		if (!csv) {
+			perror(csv_path);
+			return 1;
+		}
+		fprintf(csv, "frame,calls,draws,skipped_draws,vertices,state_calls,state_changes,texture_bytes,vertex_bytes,index_bytes,replay_ms\n");
+	}
+
+	r.p = data + sizeof(hdr);
+	r.end = data + size;
+	r.bad = 0;
+
+	memset(&frame, 0, sizeof(frame));
+	frame_start = now_ms();
+
+	while (r.p < r.end && !r.bad) {
+		int op = *r.p++;
+
+		if (op >= GLCAP_OP_COUNT) {
+			fprintf(stderr, "unknown opcode %d at offset %ld, stopping\n", op, (long)(r.p - 1 - data));
+			break;
+		}
+
+		for (uint32_t i = 0; i < op_args[op]; i++)
+			a[i] = rd_u32(&r);
+
+		if (r.bad)
+			break;
+
+		op_counts[op]++;
+
+		if (op == GLCAP_OP_FRAME) {
+			if (use_gl)
+				glFinish();
+
+			frame.replayMs = now_ms() - frame_start;
+			if (csv) {
+				fprintf(csv, "%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.3f\n", frames,
+					(unsigned long long)frame.calls, (unsigned long long)frame.draws, (unsigned long long)frame.skippedDraws,
+					(unsigned long long)frame.vertices, (unsigned long long)frame.stateCalls, (unsigned long long)frame.stateChanges,
+					(unsigned long long)frame.textureBytes, (unsigned long long)frame.vertexBytes, (unsigned long long)frame.indexBytes,
+					frame.replayMs);
+			}
+
+			add_counters(&total, &frame);
+			memset(&frame, 0, sizeof(frame));
+			frames++;
+			frame_start = now_ms();
+			continue;
+		}
+
+		frame.calls++;
+		replay(op, a, &r);
+	}
+
+	if (r.bad)
+		fprintf(stderr, "capture truncated, the last frame is incomplete\n");
+
+	if (csv)
+		fclose(csv);
+
+	printf("frames:              %u\n", frames);
+	printf("calls:               %llu (%.1f/frame)\n", (unsigned long long)total.calls, frames ? (double)total.calls / frames : 0.0);
+	printf("draw calls:          %llu (%.1f/frame), %llu not replayable\n", (unsigned long long)total.draws,
+		frames ? (double)total.draws / frames : 0.0, (unsigned long long)total.skippedDraws);
+	printf("vertices:            %llu\n", (unsigned long long)total.vertices);
+	printf("state calls:         %llu, %llu change state (%.1f%% redundant)\n", (unsigned long long)total.stateCalls,
+		(unsigned long long)total.stateChanges, total.stateCalls ? 100.0 * (total.stateCalls - total.stateChanges) / total.stateCalls : 0.0);
+	printf("texture upload:      %llu bytes, %llu unsupported compressed uploads\n", (unsigned long long)total.textureBytes,
+		(unsigned long long)total.unsupportedUploads);
+	printf("vertex upload:       %llu bytes\n", (unsigned long long)total.vertexBytes);
+	printf("index upload:        %llu bytes\n", (unsigned long long)total.indexBytes);
+	if (use_gl)
+		printf("replay time:         %.1f ms (%.3f ms/frame)\n", total.replayMs, frames ? total.replayMs / frames : 0.0);
+
+	printf("\n%-24s %12s %10s\n", "call", "count", "per frame");
+	for (int i = 1; i < GLCAP_OP_COUNT; i++) {
+		if (op_counts[i] == 0)
+			continue;
+		printf("%-24s %12llu %10.1f\n", op_names[i], (unsigned long long)op_counts[i], frames ? (double)op_counts[i] / frames : 0.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,872 @@
+/* glstatetest.c -- check that the redundant GL state filter keeps the GL state
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: glstatetest [gl.bin ...]
+//        glstatetest -s seed [-n calls]
+//
+// Replays a capture written by libal/gl_capture.c twice into a model of the
+// GLES1 state: once as captured, once through libal/gl_state.c. Both models
+// must be identical after every call, or the filter dropped a call that
+// would have changed something. The first difference is printed and the
+// exit status is 1.
+//
+// Without a capture, or with -s, a random stream of state calls is
+// generated instead, with small value ranges so most calls repeat the
+// current state, texture units beyond the filter's and both glTexEnvf and
+// glTexEnvfv setting the env mode.
+//
+// Build: gcc -O2 -I host -o glstatetest glstatetest.c ../libal/gl_state.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include "../libal/gl_state.h"
+#include "../libal/gl_capture_format.h"
+
+#define MODEL_UNITS		8
+#define MAP_SIZE		64
+
+#define GLCAP_OP_NAME(name, args) #name,
+#define GLCAP_OP_ARGS(name, args) args,
+
+static const char *op_names[GLCAP_OP_COUNT] = { GLCAP_OPS(GLCAP_OP_NAME) };
+static const uint32_t op_args[GLCAP_OP_COUNT] = { GLCAP_OPS(GLCAP_OP_ARGS) };
+
+typedef struct {
+	const uint8_t *p;
+	const uint8_t *end;
+	int bad;
+} Reader;
+
+typedef struct {
+	uint32_t key;
+	uint32_t value;
+} MapEntry;
+
+// sorted by key, so equal states compare equal whatever order they were set in
+typedef struct {
+	uint32_t count;
+	MapEntry e[MAP_SIZE];
+} StateMap;
+
+typedef struct {
+	uint32_t size;
+	uint32_t type;
+	uint32_t stride;
+	uint32_t buffer;
+	uint64_t pointer;
+} ModelArray;
+
+typedef struct {
+	StateMap caps;
+	StateMap client;
+	StateMap texEnv;
+	uint32_t activeTexture;
+	uint32_t clientActiveTexture;
+	uint32_t texture[MODEL_UNITS];
+	uint32_t arrayBuffer;
+	uint32_t elementBuffer;
+	uint32_t framebuffer;
+	uint32_t blend[2];
+	uint32_t depthFunc;
+	uint32_t depthMask;
+	uint32_t alpha[2];
+	uint32_t cullFace;
+	uint32_t frontFace;
+	uint32_t colorMask[4];
+	uint32_t stencilFunc[3];
+	uint32_t stencilOp[3];
+	uint32_t scissor[4];
+	uint32_t viewport[4];
+	uint32_t matrixMode;
+	uint32_t overflow;
+	ModelArray arrays[3 + MODEL_UNITS];
+} Model;
+
+static Model models[2];
+static Model *cur;
+
+// driver entry points by opcode, and the filter's hooks once glst_bind ran
+static uintptr_t driver[GLCAP_OP_COUNT];
+static uintptr_t hooks[GLCAP_OP_COUNT];
+
+/* MODEL */
+
+static void map_set(StateMap *m, uint32_t key, uint32_t value)
+{
+	uint32_t i;
+
+	for (i = 0; i < m->count && m->e[i].key < key; i++);
+
+	if (i < m->count && m->e[i].key == key) {
+		m->e[i].value = value;
+		return;
+	}
+
+	if (m->count == MAP_SIZE) {
+		cur->overflow++;
+		return;
+	}
+
+	memmove(&m->e[i + 1], &m->e[i], (m->count - i) * sizeof(MapEntry));
+	m->e[i].key = key;
+	m->e[i].value = value;
+	m->count++;
+}
+
+static uint32_t unit_of(uint32_t texture)
+{
+	uint32_t unit = texture - GL_TEXTURE0;
+
+	if (unit >= MODEL_UNITS) {
+		cur->overflow++;
+		return MODEL_UNITS - 1;
+	}
+
+	return unit;
+}
+
+static void set_cap(GLenum cap, uint32_t value)
+{
+	uint32_t unit = cap == GL_TEXTURE_2D ? unit_of(cur->activeTexture) : 0;
+
+	map_set(&cur->caps, cap | unit << 16, value);
+}
+
+static void set_client(GLenum array, uint32_t value)
+{
+	uint32_t unit = array == GL_TEXTURE_COORD_ARRAY ? unit_of(cur->clientActiveTexture) : 0;
+
+	map_set(&cur->client, array | unit << 16, value);
+}
+
+static void set_array(ModelArray *array, GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	array->size = size;
+	array->type = type;
+	array->stride = stride;
+	array->buffer = cur->arrayBuffer;
+	array->pointer = (uintptr_t)pointer;
+}
+
+static uint32_t hash_floats(const GLfloat *params, uint32_t count)
+{
+	uint32_t h = 2166136261u, v;
+
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(&v, &params[i], 4);
+		h = (h ^ v) * 16777619u;
+	}
+
+	return h;
+}
+
+static void drv_glEnable(GLenum cap) { set_cap(cap, 1); }
+static void drv_glDisable(GLenum cap) { set_cap(cap, 0); }
+static void drv_glEnableClientState(GLenum array) { set_client(array, 1); }
+static void drv_glDisableClientState(GLenum array) { set_client(array, 0); }
+static void drv_glActiveTexture(GLenum texture) { cur->activeTexture = texture; }
+static void drv_glClientActiveTexture(GLenum texture) { cur->clientActiveTexture = texture; }
+
+static void drv_glBindTexture(GLenum target, GLuint texture)
+{
+	if (target == GL_TEXTURE_2D)
+		cur->texture[unit_of(cur->activeTexture)] = texture;
+}
+
+static void drv_glDeleteTextures(GLsizei n, const GLuint *textures)
+{
+	for (GLsizei i = 0; i < n; i++) {
+		for (int j = 0; j < MODEL_UNITS; j++) {
+			if (textures[i] != 0 && cur->texture[j] == textures[i])
+				cur->texture[j] = 0;
+		}
+	}
+}
+
+static void drv_glBindBuffer(GLenum target, GLuint buffer)
+{
+	if (target == GL_ARRAY_BUFFER)
+		cur->arrayBuffer = buffer;
+	else if (target == GL_ELEMENT_ARRAY_BUFFER)
+		cur->elementBuffer = buffer;
+}
+
+static void drv_glDeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+	for (GLsizei i = 0; i < n; i++) {
+		if (buffers[i] == 0)
+			continue;
+		if (cur->arrayBuffer == buffers[i])
+			cur->arrayBuffer = 0;
+		if (cur->elementBuffer == buffers[i])
+			cur->elementBuffer = 0;
+	}
+}
+
+static void drv_glBindFramebufferOES(GLenum target, GLuint framebuffer)
+{
+	(void)target;
+	cur->framebuffer = framebuffer;
+}
+
+static void drv_glBlendFunc(GLenum sfactor, GLenum dfactor) { cur->blend[0] = sfactor; cur->blend[1] = dfactor; }
+static void drv_glDepthFunc(GLenum func) { cur->depthFunc = func; }
+static void drv_glDepthMask(GLboolean flag) { cur->depthMask = flag; }
+static void drv_glAlphaFunc(GLenum func, int ref) { cur->alpha[0] = func; cur->alpha[1] = ref; }
+static void drv_glCullFace(GLenum mode) { cur->cullFace = mode; }
+static void drv_glFrontFace(GLenum mode) { cur->frontFace = mode; }
+
+static void drv_glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	cur->colorMask[0] = red;
+	cur->colorMask[1] = green;
+	cur->colorMask[2] = blue;
+	cur->colorMask[3] = alpha;
+}
+
+static void drv_glStencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+	cur->stencilFunc[0] = func;
+	cur->stencilFunc[1] = ref;
+	cur->stencilFunc[2] = mask;
+}
+
+static void drv_glStencilOp(GLenum fail, GLenum zfail, GLenum zpass)
+{
+	cur->stencilOp[0] = fail;
+	cur->stencilOp[1] = zfail;
+	cur->stencilOp[2] = zpass;
+}
+
+static void drv_glScissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	cur->scissor[0] = x;
+	cur->scissor[1] = y;
+	cur->scissor[2] = width;
+	cur->scissor[3] = height;
+}
+
+static void drv_glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	cur->viewport[0] = x;
+	cur->viewport[1] = y;
+	cur->viewport[2] = width;
+	cur->viewport[3] = height;
+}
+
+static void drv_glMatrixMode(GLenum mode) { cur->matrixMode = mode; }
+
+static void drv_glTexEnvf(GLenum target, GLenum pname, int param)
+{
+	float value;
+
+	memcpy(&value, &param, 4);
+	if (target == GL_TEXTURE_ENV)
+		map_set(&cur->texEnv, pname | unit_of(cur->activeTexture) << 16, pname == GL_TEXTURE_ENV_MODE ? (uint32_t)value : (uint32_t)param);
+}
+
+static void drv_glTexEnvfv(GLenum target, GLenum pname, const GLfloat *params)
+{
+	uint32_t value;
+
+	if (target != GL_TEXTURE_ENV)
+		return;
+
+	// a single value is stored the way glTexEnvf stores it
+	if (pname == GL_TEXTURE_ENV_MODE)
+		value = (uint32_t)params[0];
+	else if (pname == GL_TEXTURE_ENV_COLOR)
+		value = hash_floats(params, 4);
+	else
+		memcpy(&value, &params[0], 4);
+
+	map_set(&cur->texEnv, pname | unit_of(cur->activeTexture) << 16, value);
+}
+
+static void drv_glVertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(&cur->arrays[0], size, type, stride, pointer);
+}
+
+static void drv_glColorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(&cur->arrays[1], size, type, stride, pointer);
+}
+
+static void drv_glNormalPointer(GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(&cur->arrays[2], 3, type, stride, pointer);
+}
+
+static void drv_glTexCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer)
+{
+	set_array(&cur->arrays[3 + unit_of(cur->clientActiveTexture)], size, type, stride, pointer);
+}
+
+#define DRIVER(name) driver[GLCAP_OP_##name] = (uintptr_t)&drv_##name;
+
+static void init_driver(void)
+{
+	DRIVER(glEnable);
+	DRIVER(glDisable);
+	DRIVER(glEnableClientState);
+	DRIVER(glDisableClientState);
+	DRIVER(glActiveTexture);
+	DRIVER(glClientActiveTexture);
+	DRIVER(glBindTexture);
+	DRIVER(glDeleteTextures);
+	DRIVER(glBindBuffer);
+	DRIVER(glDeleteBuffers);
+	DRIVER(glBindFramebufferOES);
+	DRIVER(glBlendFunc);
+	DRIVER(glDepthFunc);
+	DRIVER(glDepthMask);
+	DRIVER(glAlphaFunc);
+	DRIVER(glCullFace);
+	DRIVER(glFrontFace);
+	DRIVER(glColorMask);
+	DRIVER(glStencilFunc);
+	DRIVER(glStencilOp);
+	DRIVER(glScissor);
+	DRIVER(glViewport);
+	DRIVER(glMatrixMode);
+	DRIVER(glTexEnvf);
+	DRIVER(glTexEnvfv);
+	DRIVER(glVertexPointer);
+	DRIVER(glColorPointer);
+	DRIVER(glNormalPointer);
+	DRIVER(glTexCoordPointer);
+}
+
+/* LIBAL */
+
+// gl_state.c binds through these, the rest of symtable.c and stats.c is
+// not needed on the host
+
+int symt_hook(Symtable *table, const char *symbol, uintptr_t func, uintptr_t *orig)
+{
+	(void)table;
+
+	for (int i = 0; i < GLCAP_OP_COUNT; i++) {
+		if (strcmp(op_names[i], symbol) != 0)
+			continue;
+
+		if (driver[i] == 0) {
+			fprintf(stderr, "gl_state.c hooks %s, the model does not implement it\n", symbol);
+			exit(1);
+		}
+
+		*orig = driver[i];
+		hooks[i] = func;
+		return 0;
+	}
+
+	fprintf(stderr, "gl_state.c hooks %s, which the capture format does not know\n", symbol);
+	exit(1);
+}
+
+void stats_hist_reset(StatsHist *hist) { memset(hist, 0, sizeof(StatsHist)); }
+void stats_hist_add(StatsHist *hist, uint32_t value) { hist->count++; hist->sum += value; }
+SceUID stats_file_open(const char *name) { (void)name; return -1; }
+int stats_file_printf(SceUID fd, const char *fmt, ...) { (void)fd; (void)fmt; return 0; }
+int stats_file_write_hist(SceUID fd, const char *name, const StatsHist *hist) { (void)fd; (void)name; (void)hist; return 0; }
+int stats_file_close(SceUID fd) { (void)fd; return 0; }
+int stats_register_dump(StatsDumpFunc func) { (void)func; return 0; }
+
+/* REPLAY */
+
+static uint32_t rd_u32(Reader *r)
+{
+	uint32_t v;
+
+	if (r->end - r->p < 4) {
+		r->bad = 1;
+		r->p = r->end;
+		return 0;
+	}
+
+	memcpy(&v, r->p, 4);
+	r->p += 4;
+	return v;
+}
+
+static const uint8_t *rd_blob(Reader *r, uint32_t *size)
+{
+	const uint8_t *data;
+
+	*size = rd_u32(r);
+	if ((size_t)(r->end - r->p) < *size) {
+		r->bad = 1;
+		r->p = r->end;
+		*size = 0;
+		return NULL;
+	}
+
+	data = *size ? r->p : NULL;
+	r->p += *size;
+	return data;
+}
+
+static void skip_vertices(Reader *r)
+{
+	uint32_t mask = rd_u32(r), size;
+
+	rd_u32(r);
+	rd_u32(r);
+
+	for (int i = 0; i < GLCAP_ARRAY_COUNT; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		rd_u32(r);
+		rd_u32(r);
+		rd_blob(r, &size);
+	}
+}
+
+// blobs are copied so GLfloat and GLuint arrays are aligned
+static void *copy_blob(const uint8_t *blob, uint32_t size)
+{
+	static uint32_t scratch[4096];
+
+	if (size > sizeof(scratch))
+		size = sizeof(scratch);
+	if (blob != NULL)
+		memcpy(scratch, blob, size);
+
+	return scratch;
+}
+
+#define CALL(op, type) ((type)(filtered && hooks[op] ? hooks[op] : driver[op]))
+
+static void apply(int op, const uint32_t *a, const uint8_t *blob, uint32_t size, int filtered)
+{
+	if (driver[op] == 0)
+		return;
+
+	cur = &models[filtered];
+
+	switch (op) {
+	case GLCAP_OP_glEnable:				CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glDisable:			CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glEnableClientState:	CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glDisableClientState:	CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glActiveTexture:		CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glClientActiveTexture:	CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glBindTexture:		CALL(op, void (*)(GLenum, GLuint))(a[0], a[1]); break;
+	case GLCAP_OP_glDeleteTextures:		CALL(op, void (*)(GLsizei, const GLuint *))(size / 4, copy_blob(blob, size)); break;
+	case GLCAP_OP_glBindBuffer:			CALL(op, void (*)(GLenum, GLuint))(a[0], a[1]); break;
+	case GLCAP_OP_glDeleteBuffers:		CALL(op, void (*)(GLsizei, const GLuint *))(size / 4, copy_blob(blob, size)); break;
+	case GLCAP_OP_glBindFramebufferOES:	CALL(op, void (*)(GLenum, GLuint))(a[0], a[1]); break;
+	case GLCAP_OP_glBlendFunc:			CALL(op, void (*)(GLenum, GLenum))(a[0], a[1]); break;
+	case GLCAP_OP_glDepthFunc:			CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glDepthMask:			CALL(op, void (*)(GLboolean))(a[0]); break;
+	case GLCAP_OP_glAlphaFunc:			CALL(op, void (*)(GLenum, int))(a[0], a[1]); break;
+	case GLCAP_OP_glCullFace:			CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glFrontFace:			CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glColorMask:			CALL(op, void (*)(GLboolean, GLboolean, GLboolean, GLboolean))(a[0], a[1], a[2], a[3]); break;
+	case GLCAP_OP_glStencilFunc:		CALL(op, void (*)(GLenum, GLint, GLuint))(a[0], a[1], a[2]); break;
+	case GLCAP_OP_glStencilOp:			CALL(op, void (*)(GLenum, GLenum, GLenum))(a[0], a[1], a[2]); break;
+	case GLCAP_OP_glScissor:			CALL(op, void (*)(GLint, GLint, GLsizei, GLsizei))(a[0], a[1], a[2], a[3]); break;
+	case GLCAP_OP_glViewport:			CALL(op, void (*)(GLint, GLint, GLsizei, GLsizei))(a[0], a[1], a[2], a[3]); break;
+	case GLCAP_OP_glMatrixMode:			CALL(op, void (*)(GLenum))(a[0]); break;
+	case GLCAP_OP_glTexEnvf:			CALL(op, void (*)(GLenum, GLenum, int))(a[0], a[1], a[2]); break;
+	case GLCAP_OP_glTexEnvfv:
+		if (size >= 4)
+			CALL(op, void (*)(GLenum, GLenum, const GLfloat *))(a[0], a[1], copy_blob(blob, size));
+		break;
+	case GLCAP_OP_glVertexPointer:		CALL(op, void (*)(GLint, GLenum, GLsizei, const GLvoid *))(a[0], a[1], a[2], (const GLvoid *)(uintptr_t)a[3]); break;
+	case GLCAP_OP_glColorPointer:		CALL(op, void (*)(GLint, GLenum, GLsizei, const GLvoid *))(a[0], a[1], a[2], (const GLvoid *)(uintptr_t)a[3]); break;
+	case GLCAP_OP_glNormalPointer:		CALL(op, void (*)(GLenum, GLsizei, const GLvoid *))(a[0], a[1], (const GLvoid *)(uintptr_t)a[2]); break;
+	case GLCAP_OP_glTexCoordPointer:	CALL(op, void (*)(GLint, GLenum, GLsizei, const GLvoid *))(a[0], a[1], a[2], (const GLvoid *)(uintptr_t)a[3]); break;
+	default:
+		break;
+	}
+}
+
+static void print_words(const char *name, const uint32_t *a, const uint32_t *b, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (a[i] != b[i])
+			fprintf(stderr, "  %s[%u]: 0x%x as captured, 0x%x filtered\n", name, i, a[i], b[i]);
+	}
+}
+
+static void print_map(const char *name, const StateMap *a, const StateMap *b)
+{
+	for (uint32_t i = 0; i < a->count || i < b->count; i++) {
+		if (i < a->count && i < b->count && !memcmp(&a->e[i], &b->e[i], sizeof(MapEntry)))
+			continue;
+
+		fprintf(stderr, "  %s: ", name);
+		if (i < a->count)
+			fprintf(stderr, "0x%x unit %u = 0x%x as captured", a->e[i].key & 0xFFFF, a->e[i].key >> 16, a->e[i].value);
+		if (i < b->count)
+			fprintf(stderr, "%s0x%x unit %u = 0x%x filtered", i < a->count ? ", " : "", b->e[i].key & 0xFFFF, b->e[i].key >> 16, b->e[i].value);
+		fprintf(stderr, "\n");
+		return;
+	}
+}
+
+static void print_difference(const Model *a, const Model *b)
+{
+	print_map("caps", &a->caps, &b->caps);
+	print_map("client state", &a->client, &b->client);
+	print_map("texture env", &a->texEnv, &b->texEnv);
+	print_words("active texture", &a->activeTexture, &b->activeTexture, 1);
+	print_words("client active texture", &a->clientActiveTexture, &b->clientActiveTexture, 1);
+	print_words("texture", a->texture, b->texture, MODEL_UNITS);
+	print_words("array buffer", &a->arrayBuffer, &b->arrayBuffer, 1);
+	print_words("element buffer", &a->elementBuffer, &b->elementBuffer, 1);
+	print_words("framebuffer", &a->framebuffer, &b->framebuffer, 1);
+	print_words("blend func", a->blend, b->blend, 2);
+	print_words("depth func", &a->depthFunc, &b->depthFunc, 1);
+	print_words("depth mask", &a->depthMask, &b->depthMask, 1);
+	print_words("alpha func", a->alpha, b->alpha, 2);
+	print_words("cull face", &a->cullFace, &b->cullFace, 1);
+	print_words("front face", &a->frontFace, &b->frontFace, 1);
+	print_words("color mask", a->colorMask, b->colorMask, 4);
+	print_words("stencil func", a->stencilFunc, b->stencilFunc, 3);
+	print_words("stencil op", a->stencilOp, b->stencilOp, 3);
+	print_words("scissor", a->scissor, b->scissor, 4);
+	print_words("viewport", a->viewport, b->viewport, 4);
+	print_words("matrix mode", &a->matrixMode, &b->matrixMode, 1);
+
+	for (int i = 0; i < 3 + MODEL_UNITS; i++) {
+		if (memcmp(&a->arrays[i], &b->arrays[i], sizeof(ModelArray)) != 0)
+			fprintf(stderr, "  array %d: size %u type 0x%x stride %u buffer %u pointer 0x%llx as captured, size %u type 0x%x stride %u buffer %u pointer 0x%llx filtered\n", i,
+				a->arrays[i].size, a->arrays[i].type, a->arrays[i].stride, a->arrays[i].buffer, (unsigned long long)a->arrays[i].pointer,
+				b->arrays[i].size, b->arrays[i].type, b->arrays[i].stride, b->arrays[i].buffer, (unsigned long long)b->arrays[i].pointer);
+	}
+}
+
+// returns the number of calls replayed, -1 if the models diverged
+static long run(const char *name, const uint8_t *data, size_t size)
+{
+	const uint8_t *blob;
+	uint32_t a[8], blob_size, frames = 0;
+	long calls = 0;
+	Reader r;
+
+	memset(models, 0, sizeof(models));
+	for (int i = 0; i < 2; i++) {
+		models[i].activeTexture = GL_TEXTURE0;
+		models[i].clientActiveTexture = GL_TEXTURE0;
+	}
+	glst_invalidate();
+
+	r.p = data;
+	r.end = data + size;
+	r.bad = 0;
+
+	while (r.p < r.end && !r.bad) {
+		int op = *r.p++;
+
+		if (op >= GLCAP_OP_COUNT) {
+			fprintf(stderr, "%s: unknown opcode %d at offset %ld, stopping\n", name, op, (long)(r.p - 1 - data));
+			break;
+		}
+
+		for (uint32_t i = 0; i < op_args[op]; i++)
+			a[i] = rd_u32(&r);
+
+		blob = NULL;
+		blob_size = 0;
+
+		switch (op) {
+		case GLCAP_OP_glCompressedTexImage2D:
+		case GLCAP_OP_glTexImage2D:
+		case GLCAP_OP_glDeleteTextures:
+		case GLCAP_OP_glDeleteBuffers:
+		case GLCAP_OP_glGenTextures:
+		case GLCAP_OP_glFogfv:
+		case GLCAP_OP_glTexEnvfv:
+		case GLCAP_OP_glLoadMatrixf:
+		case GLCAP_OP_eglGetProcAddress:
+			blob = rd_blob(&r, &blob_size);
+			break;
+		case GLCAP_OP_glDrawElements:
+			rd_blob(&r, &blob_size);
+			skip_vertices(&r);
+			break;
+		case GLCAP_OP_glDrawArrays:
+			skip_vertices(&r);
+			break;
+		default:
+			break;
+		}
+
+		if (r.bad)
+			break;
+
+		if (op == GLCAP_OP_FRAME) {
+			glst_end_frame();
+			frames++;
+			continue;
+		}
+
+		apply(op, a, blob, blob_size, 0);
+		apply(op, a, blob, blob_size, 1);
+		calls++;
+
+		if (memcmp(&models[0], &models[1], sizeof(Model)) != 0) {
+			fprintf(stderr, "%s: state differs after call %ld (%s) in frame %u\n", name, calls, op_names[op], frames);
+			print_difference(&models[0], &models[1]);
+			return -1;
+		}
+	}
+
+	if (r.bad)
+		fprintf(stderr, "%s: capture truncated, checked up to the last complete call\n", name);
+	if (models[0].overflow)
+		fprintf(stderr, "%s: %u states beyond the model were merged\n", name, models[0].overflow);
+
+	return calls;
+}
+
+/* SYNTHETIC STREAM */
+
+static uint8_t *out;
+static size_t out_size, out_cap;
+
+static void put_bytes(const void *data, size_t size)
+{
+	if (out_size + size > out_cap) {
+		out_cap = (out_size + size) * 2;
+		out = realloc(out, out_cap);
+	}
+
+	memcpy(out + out_size, data, size);
+	out_size += size;
+}
+
+static void put_op(int op, const uint32_t *a)
+{
+	uint8_t code = op;
+
+	put_bytes(&code, 1);
+	put_bytes(a, op_args[op] * 4);
+}
+
+static void put_blob(const void *data, uint32_t size)
+{
+	put_bytes(&size, 4);
+	put_bytes(data, size);
+}
+
+static uint32_t pick(const uint32_t *values, uint32_t count)
+{
+	return values[rand() % count];
+}
+
+#define PICK(values) pick(values, sizeof(values) / sizeof(values[0]))
+
+static void generate(uint32_t calls)
+{
+	static const uint32_t caps[] = { GL_BLEND, GL_DEPTH_TEST, GL_ALPHA_TEST, GL_CULL_FACE, GL_TEXTURE_2D, GL_TEXTURE_2D, GL_FOG, GL_LIGHT0, GL_SCISSOR_TEST };
+	static const uint32_t clients[] = { GL_VERTEX_ARRAY, GL_COLOR_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY, GL_TEXTURE_COORD_ARRAY };
+	static const uint32_t units[] = { GL_TEXTURE0, GL_TEXTURE0, GL_TEXTURE1, GL_TEXTURE1, GL_TEXTURE5 };
+	static const uint32_t blends[] = { GL_ONE, GL_ZERO, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA };
+	static const uint32_t funcs[] = { GL_LESS, GL_LEQUAL, GL_ALWAYS };
+	static const uint32_t faces[] = { GL_FRONT, GL_BACK };
+	static const uint32_t windings[] = { GL_CW, GL_CCW };
+	static const uint32_t stencil_ops[] = { GL_KEEP, GL_REPLACE, GL_INCR };
+	static const uint32_t matrix_modes[] = { GL_MODELVIEW, GL_PROJECTION, GL_TEXTURE };
+	static const uint32_t env_modes[] = { GL_MODULATE, GL_REPLACE, GL_DECAL };
+	static const uint32_t types[] = { GL_FLOAT, GL_SHORT, GL_UNSIGNED_BYTE };
+	static const uint32_t pointers[] = { 0x81000000, 0x81000100, 0x81002000 };
+	static const uint32_t targets[] = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER };
+	static const uint32_t refs[] = { 0x00000000, 0x3F000000 }; // 0.0f, 0.5f
+	GlCaptureHeader hdr = { GLCAP_MAGIC, GLCAP_VERSION, 960, 544 };
+	uint32_t a[8] = { 0 }, name;
+	GLfloat params[4];
+
+	out_size = 0;
+	put_bytes(&hdr, sizeof(hdr));
+
+	for (uint32_t i = 0; i < calls; i++) {
+		int op;
+
+		memset(a, 0, sizeof(a));
+
+		switch (rand() % 26) {
+		case 0:  op = GLCAP_OP_glEnable; a[0] = PICK(caps); break;
+		case 1:  op = GLCAP_OP_glDisable; a[0] = PICK(caps); break;
+		case 2:  op = GLCAP_OP_glEnableClientState; a[0] = PICK(clients); break;
+		case 3:  op = GLCAP_OP_glDisableClientState; a[0] = PICK(clients); break;
+		case 4:  op = GLCAP_OP_glActiveTexture; a[0] = PICK(units); break;
+		case 5:  op = GLCAP_OP_glClientActiveTexture; a[0] = PICK(units); break;
+		case 6:  op = GLCAP_OP_glBindTexture; a[0] = GL_TEXTURE_2D; a[1] = rand() % 4; break;
+		case 7:  op = GLCAP_OP_glBindBuffer; a[0] = PICK(targets); a[1] = rand() % 3; break;
+		case 8:  op = GLCAP_OP_glBindFramebufferOES; a[0] = GL_FRAMEBUFFER_OES; a[1] = rand() % 2; break;
+		case 9:  op = GLCAP_OP_glBlendFunc; a[0] = PICK(blends); a[1] = PICK(blends); break;
+		case 10: op = GLCAP_OP_glDepthFunc; a[0] = PICK(funcs); break;
+		case 11: op = GLCAP_OP_glDepthMask; a[0] = rand() % 2; break;
+		case 12: op = GLCAP_OP_glAlphaFunc; a[0] = PICK(funcs); a[1] = PICK(refs); break;
+		case 13: op = GLCAP_OP_glCullFace; a[0] = PICK(faces); break;
+		case 14: op = GLCAP_OP_glFrontFace; a[0] = PICK(windings); break;
+		case 15: op = GLCAP_OP_glColorMask; a[0] = 1; a[1] = 1; a[2] = 1; a[3] = rand() % 2; break;
+		case 16: op = GLCAP_OP_glStencilFunc; a[0] = PICK(funcs); a[1] = rand() % 2; a[2] = 0xFF; break;
+		case 17: op = GLCAP_OP_glStencilOp; a[0] = PICK(stencil_ops); a[1] = PICK(stencil_ops); a[2] = PICK(stencil_ops); break;
+		case 18: op = rand() % 2 ? GLCAP_OP_glScissor : GLCAP_OP_glViewport; a[2] = 960 >> (rand() % 2); a[3] = 544; break;
+		case 19: op = GLCAP_OP_glMatrixMode; a[0] = PICK(matrix_modes); break;
+		case 20:
+			op = GLCAP_OP_glTexEnvf;
+			params[0] = PICK(env_modes);
+			a[0] = GL_TEXTURE_ENV;
+			a[1] = GL_TEXTURE_ENV_MODE;
+			memcpy(&a[2], &params[0], 4);
+			break;
+		case 21:
+			op = rand() % 2 ? GLCAP_OP_glVertexPointer : GLCAP_OP_glTexCoordPointer;
+			a[0] = 2 + rand() % 3;
+			a[1] = PICK(types);
+			a[2] = rand() % 2 * 16;
+			a[3] = PICK(pointers);
+			break;
+		case 22:
+			if (rand() % 2) {
+				op = GLCAP_OP_glColorPointer;
+				a[0] = 4;
+				a[1] = PICK(types);
+				a[3] = PICK(pointers);
+			} else {
+				op = GLCAP_OP_glNormalPointer;
+				a[0] = PICK(types);
+				a[2] = PICK(pointers);
+			}
+			break;
+		case 23:
+			// mostly the mode, the env color goes through the same entry point
+			op = GLCAP_OP_glTexEnvfv;
+			a[0] = GL_TEXTURE_ENV;
+			a[1] = rand() % 4 ? GL_TEXTURE_ENV_MODE : GL_TEXTURE_ENV_COLOR;
+			params[0] = PICK(env_modes);
+			params[1] = params[2] = params[3] = 1.0f;
+			put_op(op, a);
+			put_blob(params, (a[1] == GL_TEXTURE_ENV_MODE ? 1 : 4) * sizeof(GLfloat));
+			continue;
+		case 24:
+			op = rand() % 2 ? GLCAP_OP_glDeleteTextures : GLCAP_OP_glDeleteBuffers;
+			name = 1 + rand() % 3;
+			a[0] = 1;
+			put_op(op, a);
+			put_blob(&name, 4);
+			continue;
+		default:
+			op = GLCAP_OP_glDrawArrays;
+			a[0] = GL_TRIANGLES;
+			put_op(op, a);
+			// empty vertex block
+			put_bytes((uint32_t[3]){ 0, 0, 0 }, 12);
+			if (rand() % 8 == 0)
+				put_op(GLCAP_OP_FRAME, a);
+			continue;
+		}
+
+		put_op(op, a);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const GlStateStats *stats;
+	GlCaptureHeader hdr;
+	Symtable table = { 0 };
+	uint64_t forwarded = 0, filtered = 0;
+	uint32_t calls = 200000;
+	int seed = -1, opt, failed = 0;
+	long checked;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'n':
+			calls = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [gl.bin ...] | -s seed [-n calls]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	init_driver();
+
+	if (glst_bind(&table) < 0) {
+		fprintf(stderr, "glst_bind failed\n");
+		return 1;
+	}
+
+	if (optind >= argc || seed >= 0) {
+		seed = seed >= 0 ? seed : 1;
+		srand(seed);
+		generate(calls);
+
+		checked = run("synthetic", out + sizeof(hdr), out_size - sizeof(hdr));
+		if (checked < 0)
+			failed = 1;
+		else
+			printf("synthetic (seed %d): %ld calls, same state after every call\n", seed, checked);
+	}
+
+	for (int i = optind; i < argc && seed < 0; i++) {
+		FILE *fp = fopen(argv[i], "rb");
+		uint8_t *data;
+		long size;
+
+		if (fp == NULL) {
+			perror(argv[i]);
+			return 1;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		data = malloc(size);
+		if (data == NULL || size < (long)sizeof(hdr) || fread(data, 1, size, fp) != (size_t)size) {
+			fprintf(stderr, "%s: read failed\n", argv[i]);
+			return 1;
+		}
+		fclose(fp);
+
+		memcpy(&hdr, data, sizeof(hdr));
+		if (hdr.magic != GLCAP_MAGIC || hdr.version != GLCAP_VERSION) {
+			fprintf(stderr, "%s: not a version %d GL capture\n", argv[i], GLCAP_VERSION);
+			return 1;
+		}
+
+		checked = run(argv[i], data + sizeof(hdr), size - sizeof(hdr));
+		if (checked < 0)
+			failed = 1;
+		else
+			printf("%s: %ld calls, same state after every call\n", argv[i], checked);
+
+		free(data);
+	}
+
+	stats = glst_get_stats();
+	for (int i = 0; i < GLST_CALL_COUNT; i++) {
+		forwarded += stats->forwarded[i];
+		filtered += stats->filtered[i];
+	}
+	printf("filter: %llu calls forwarded, %llu dropped\n", (unsigned long long)forwarded, (unsigned long long)filtered);
+
+	return failed;
+}
@@ -0,0 +1,21 @@
+#ifndef __KERNEL_H__
+#define __KERNEL_H__
+
+//
+// The few SDK declarations the SDK-independent libal sources need, so the
+// host tools can build them as they are. Not a port of the SDK.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef int SceUID;
+typedef unsigned int SceSize;
+
+#define sceClibMemset	memset
+#define sceClibMemcpy	memcpy
+#define sceClibMemcmp	memcmp
+#define sceClibPrintf	printf
+
+#endif
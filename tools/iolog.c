@@ -0,0 +1,302 @@
+/* iolog.c -- report on file call logs
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: iolog [-n top] io_log.bin
+//
+// Reads a log written by libal/io_log.c (savedata0:/stats/io_log.bin) and
+// prints per operation and per file call counts and latency percentiles,
+// the slowest calls, and where the time went:
+//
+//   small reads     fread/fgets of less than 4KB
+//   large reads     fread of 4KB and more
+//   savedata writes fopen/fwrite/fflush/fclose of streams opened for
+//                   writing, mkdir, rmdir and unlink
+//   metadata        fopen of read-only streams, fseek/ftell, stat/lstat
+//                   and directory listings
+//
+// Everything is in wall time as the game saw it, so calls made from
+// several threads at once add up to more than the elapsed time.
+//
+// Build: gcc -O2 -o iolog iolog.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../libal/io_log_format.h"
+
+#define SMALL_READ		4096
+
+enum {
+	CLASS_SMALL_READ = 0,
+	CLASS_LARGE_READ,
+	CLASS_SAVEDATA,
+	CLASS_METADATA,
+	NUM_CLASSES
+};
+
+typedef struct {
+	const char *name;
+	uint32_t *latencies;
+	uint32_t calls;
+	uint64_t bytes;
+	uint64_t time;
+} Summary;
+
+static const char *op_names[IOLG_NUM_OPS] = {
+	"fopen", "fread", "fwrite", "fseek", "ftell", "fgets", "fflush", "fclose",
+	"stat", "lstat", "opendir", "readdir", "closedir", "mkdir", "rmdir", "unlink"
+};
+
+static const char *class_names[NUM_CLASSES] = {
+	"small reads", "large reads", "savedata writes", "metadata"
+};
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+static int compare_time(const void *a, const void *b)
+{
+	const Summary *sa = a, *sb = b;
+
+	if (sa->time != sb->time)
+		return sa->time < sb->time ? 1 : -1;
+
+	return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	const IoLogRecord *ra = *(const IoLogRecord **)a, *rb = *(const IoLogRecord **)b;
+
+	return ra->latency < rb->latency ? 1 : ra->latency > rb->latency ? -1 : 0;
+}
+
+static int classify(const IoLogRecord *r)
+{
+	switch (r->op) {
+	case IOLG_FREAD:
+		return r->size < SMALL_READ ? CLASS_SMALL_READ : CLASS_LARGE_READ;
+	case IOLG_FGETS:
+		return CLASS_SMALL_READ;
+	case IOLG_FWRITE:
+	case IOLG_MKDIR:
+	case IOLG_RMDIR:
+	case IOLG_UNLINK:
+		return CLASS_SAVEDATA;
+	case IOLG_FOPEN:
+	case IOLG_FFLUSH:
+	case IOLG_FCLOSE:
+		return (r->flags & IOLG_WRITE) ? CLASS_SAVEDATA : CLASS_METADATA;
+	default:
+		return CLASS_METADATA;
+	}
+}
+
+static void add(Summary *s, const IoLogRecord *r)
+{
+	s->latencies[s->calls++] = r->latency;
+	if (r->op != IOLG_FSEEK)
+		s->bytes += r->size;
+	s->time += r->latency;
+}
+
+// sorts the latencies
+static void print_row(const Summary *s, int width)
+{
+	uint32_t *l = s->latencies;
+	uint32_t n = s->calls;
+
+	qsort(l, n, sizeof(uint32_t), compare_u32);
+	printf("%-*s %8u %11llu %10.1f %7u %7u %7u %8u\n", width, s->name, n,
+		(unsigned long long)s->bytes, s->time / 1000.0,
+		l[n / 2], l[(uint64_t)n * 95 / 100], l[(uint64_t)n * 99 / 100], l[n - 1]);
+}
+
+static void print_header(const char *first, int width)
+{
+	printf("%-*s %8s %11s %10s %7s %7s %7s %8s\n", width, first,
+		"calls", "bytes", "total ms", "p50 us", "p95 us", "p99 us", "max us");
+}
+
+int main(int argc, char *argv[])
+{
+	Summary ops[IOLG_NUM_OPS] = { 0 }, classes[NUM_CLASSES] = { 0 };
+	Summary *files, untracked = { 0 };
+	IoLogHeader hdr;
+	IoLogRecord *records, **slowest;
+	uint64_t total = 0;
+	uint32_t top = 20;
+	char *paths, *p;
+	int arg = 1;
+	FILE *f;
+
+	if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+		top = strtoul(argv[arg + 1], NULL, 10);
+		arg += 2;
+	}
+
+	if (arg + 1 != argc) {
+		fprintf(stderr, "usage: %s [-n top] io_log.bin\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[arg], "rb");
+	if (f == NULL) {
+		fprintf(stderr, "cannot open %s\n", argv[arg]);
+		return 1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != IOLG_MAGIC || hdr.version != IOLG_VERSION) {
+		fprintf(stderr, "%s: not a file call log\n", argv[arg]);
+		fclose(f);
+		return 1;
+	}
+
+	paths = malloc(hdr.pathBytes + 1);
+	records = malloc(hdr.numRecords * sizeof(IoLogRecord) + 1);
+	slowest = malloc(hdr.numRecords * sizeof(IoLogRecord *) + 1);
+	files = calloc(hdr.numFiles + 1, sizeof(Summary));
+
+	if (fread(paths, 1, hdr.pathBytes, f) != hdr.pathBytes ||
+		fread(records, sizeof(IoLogRecord), hdr.numRecords, f) != hdr.numRecords) {
+		fprintf(stderr, "%s: truncated\n", argv[arg]);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	paths[hdr.pathBytes] = '\0';
+
+	p = paths;
+	for (uint32_t i = 0; i < hdr.numFiles; i++) {
+		files[i].name = p;
+		p += strlen(p) + 1;
+		if (p > paths + hdr.pathBytes + 1) {
+			fprintf(stderr, "%s: bad path table\n", argv[arg]);
+			return 1;
+		}
+	}
+
+	// count first, so every summary gets an array of the right size
+	for (uint32_t i = 0; i < hdr.numRecords; i++) {
+		const IoLogRecord *r = &records[i];
+
+		if (r->op >= IOLG_NUM_OPS || (r->file != IOLG_NO_FILE && r->file >= hdr.numFiles)) {
+			fprintf(stderr, "%s: bad record %u\n", argv[arg], i);
+			return 1;
+		}
+
+		ops[r->op].calls++;
+		classes[classify(r)].calls++;
+		if (r->file != IOLG_NO_FILE)
+			files[r->file].calls++;
+		else
+			untracked.calls++;
+	}
+
+	for (uint32_t i = 0; i < IOLG_NUM_OPS; i++) {
+		ops[i].name = op_names[i];
+		ops[i].latencies = malloc(ops[i].calls * sizeof(uint32_t) + 1);
+		ops[i].calls = 0;
+	}
+	for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+		classes[i].name = class_names[i];
+		classes[i].latencies = malloc(classes[i].calls * sizeof(uint32_t) + 1);
+		classes[i].calls = 0;
+	}
+	for (uint32_t i = 0; i < hdr.numFiles; i++) {
+		files[i].latencies = malloc(files[i].calls * sizeof(uint32_t) + 1);
+		files[i].calls = 0;
+	}
+	untracked.name = "(untracked)";
+	untracked.latencies = malloc(untracked.calls * sizeof(uint32_t) + 1);
+	untracked.calls = 0;
+
+	for (uint32_t i = 0; i < hdr.numRecords; i++) {
+		const IoLogRecord *r = &records[i];
+
+		add(&ops[r->op], r);
+		add(&classes[classify(r)], r);
+		add(r->file != IOLG_NO_FILE ? &files[r->file] : &untracked, r);
+		slowest[i] = &records[i];
+		total += r->latency;
+	}
+
+	printf("%s: %u calls, %u files, %.1f ms in file calls", argv[arg], hdr.numRecords, hdr.numFiles, total / 1000.0);
+	if (hdr.numRecords > 0)
+		printf(" over %.1f s", (records[hdr.numRecords - 1].time - records[0].time) / 1000000.0);
+	printf("\n");
+	if (hdr.dropped > 0)
+		printf("%u older calls were overwritten, raise IO_LOG_SIZE to keep them\n", hdr.dropped);
+
+	printf("\n");
+	print_header("time spent in", 16);
+	for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+		if (classes[i].calls > 0)
+			print_row(&classes[i], 16);
+	}
+	for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+		if (classes[i].calls > 0 && total > 0)
+			printf("%s %.1f%%%s", class_names[i], 100.0 * classes[i].time / total, i == NUM_CLASSES - 1 ? "" : ", ");
+	}
+	printf("\n\n");
+
+	print_header("op", 16);
+	for (uint32_t i = 0; i < IOLG_NUM_OPS; i++) {
+		if (ops[i].calls > 0)
+			print_row(&ops[i], 16);
+	}
+
+	qsort(files, hdr.numFiles, sizeof(Summary), compare_time);
+
+	printf("\n");
+	print_header("file", 40);
+	// files whose calls were all overwritten sort last
+	for (uint32_t i = 0; i < hdr.numFiles && i < top && files[i].calls > 0; i++)
+		print_row(&files[i], 40);
+	if (untracked.calls > 0)
+		print_row(&untracked, 40);
+
+	// the file table was just sorted, look names up in the path table
+	qsort(slowest, hdr.numRecords, sizeof(IoLogRecord *), compare_latency);
+
+	printf("\n%-10s %-8s %8s %8s %9s  %s\n", "at ms", "op", "us", "size", "result", "file");
+	for (uint32_t i = 0; i < hdr.numRecords && i < top; i++) {
+		const IoLogRecord *r = slowest[i];
+		const char *name = "(untracked)";
+
+		if (r->file != IOLG_NO_FILE) {
+			name = paths;
+			for (uint32_t j = 0; j < r->file; j++)
+				name += strlen(name) + 1;
+		}
+
+		printf("%-10.1f %-8s %8u %8u %9d  %s\n", r->time / 1000.0, op_names[r->op], r->latency, r->size, r->result, name);
+	}
+
+	for (uint32_t i = 0; i < IOLG_NUM_OPS; i++)
+		free(ops[i].latencies);
+	for (uint32_t i = 0; i < NUM_CLASSES; i++)
+		free(classes[i].latencies);
+	for (uint32_t i = 0; i < hdr.numFiles; i++)
+		free(files[i].latencies);
+	free(untracked.latencies);
+	free(files);
+	free(slowest);
+	free(records);
+	free(paths);
+
+	return 0;
+}
@@ -0,0 +1,264 @@
+/* iotrace.c -- summarise level load traces
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: iotrace [-n top] trace.bin ...
+//
+// Reads traces written by libal/load_trace.c (savedata0:/iotrace) and
+// prints, for each of them, the read size distribution, the seek distance
+// distribution and the working set: bytes touched at 4KB page granularity
+// per file, with the top files by bytes read.
+//
+// The seek distance of a read is measured from the end of the previous
+// read of the same file, 0 is a sequential read. Reads switching to
+// another file than the one before are counted separately.
+//
+// Build: gcc -O2 -o iotrace iotrace.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../libal/load_trace_format.h"
+
+#define PAGE_SIZE		4096
+#define SIZE_BUCKETS	16
+#define SEEK_BUCKETS	12
+
+typedef struct {
+	const char *path;
+	uint32_t reads;
+	uint64_t bytes;
+	uint64_t lastEnd;
+	uint64_t extent;
+	uint8_t *pages;
+	uint32_t numPages;
+	uint64_t touched;
+} FileSummary;
+
+// 64 bytes and below, then powers of two up to 1MB and above
+static uint32_t size_bucket(uint32_t size)
+{
+	uint32_t b = 0;
+
+	while (b < SIZE_BUCKETS - 1 && size > (64u << b))
+		b++;
+
+	return b;
+}
+
+// 4KB and below, then powers of four up to 16MB and above
+static uint32_t seek_bucket(uint64_t dist)
+{
+	uint32_t b = 0;
+
+	while (b < SEEK_BUCKETS / 2 - 1 && dist > (4096ull << (2 * b)))
+		b++;
+
+	return b;
+}
+
+static void print_size(uint64_t size)
+{
+	if (size >= 1024 * 1024)
+		printf("%lluM", (unsigned long long)(size / (1024 * 1024)));
+	else if (size >= 1024)
+		printf("%lluK", (unsigned long long)(size / 1024));
+	else
+		printf("%llu", (unsigned long long)size);
+}
+
+static void touch(FileSummary *f, uint64_t offset, uint32_t length)
+{
+	uint64_t end = offset + length;
+	uint32_t last;
+
+	if (length == 0)
+		return;
+
+	if (end > f->extent)
+		f->extent = end;
+
+	last = (end - 1) / PAGE_SIZE;
+	if (last >= f->numPages) {
+		uint32_t n = last + 1 + 64;
+
+		f->pages = realloc(f->pages, n);
+		memset(f->pages + f->numPages, 0, n - f->numPages);
+		f->numPages = n;
+	}
+
+	for (uint32_t p = offset / PAGE_SIZE; p <= last; p++) {
+		if (!f->pages[p]) {
+			f->pages[p] = 1;
+			f->touched += PAGE_SIZE;
+		}
+	}
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+	const FileSummary *fa = a, *fb = b;
+
+	if (fa->bytes != fb->bytes)
+		return fa->bytes < fb->bytes ? 1 : -1;
+
+	return 0;
+}
+
+static int summarise(const char *name, uint32_t top)
+{
+	uint64_t sizes[SIZE_BUCKETS] = { 0 };
+	uint64_t forward[SEEK_BUCKETS / 2] = { 0 }, backward[SEEK_BUCKETS / 2] = { 0 };
+	uint64_t sequential = 0, switches = 0, bytes = 0, touched = 0;
+	uint32_t prev = 0xFFFFFFFF;
+	LoadTraceHeader hdr;
+	LoadTraceRead *reads;
+	FileSummary *files;
+	char *paths, *p;
+	FILE *f;
+
+	f = fopen(name, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "cannot open %s\n", name);
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != LDTR_MAGIC || hdr.version != LDTR_VERSION) {
+		fprintf(stderr, "%s: not a load trace\n", name);
+		fclose(f);
+		return -1;
+	}
+
+	paths = malloc(hdr.pathBytes + 1);
+	reads = malloc(hdr.numReads * sizeof(LoadTraceRead) + 1);
+	files = calloc(hdr.numFiles + 1, sizeof(FileSummary));
+
+	if (fread(paths, 1, hdr.pathBytes, f) != hdr.pathBytes ||
+		fread(reads, sizeof(LoadTraceRead), hdr.numReads, f) != hdr.numReads) {
+		fprintf(stderr, "%s: truncated\n", name);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	paths[hdr.pathBytes] = '\0';
+
+	p = paths;
+	for (uint32_t i = 0; i < hdr.numFiles; i++) {
+		files[i].path = p;
+		p += strlen(p) + 1;
+		if (p > paths + hdr.pathBytes + 1) {
+			fprintf(stderr, "%s: bad path table\n", name);
+			return -1;
+		}
+	}
+
+	for (uint32_t i = 0; i < hdr.numReads; i++) {
+		const LoadTraceRead *r = &reads[i];
+		FileSummary *fs;
+
+		if (r->file >= hdr.numFiles) {
+			fprintf(stderr, "%s: bad file index in read %u\n", name, i);
+			return -1;
+		}
+
+		fs = &files[r->file];
+		sizes[size_bucket(r->length)]++;
+		bytes += r->length;
+
+		if (prev != r->file && prev != 0xFFFFFFFF)
+			switches++;
+		prev = r->file;
+
+		if (fs->reads > 0) {
+			if (r->offset == fs->lastEnd)
+				sequential++;
+			else if (r->offset > fs->lastEnd)
+				forward[seek_bucket(r->offset - fs->lastEnd)]++;
+			else
+				backward[seek_bucket(fs->lastEnd - r->offset)]++;
+		}
+
+		fs->reads++;
+		fs->bytes += r->length;
+		fs->lastEnd = (uint64_t)r->offset + r->length;
+		touch(fs, r->offset, r->length);
+	}
+
+	for (uint32_t i = 0; i < hdr.numFiles; i++)
+		touched += files[i].touched;
+
+	printf("%s: key %016llX, %u reads, %u files, ", name, (unsigned long long)hdr.key, hdr.numReads, hdr.numFiles);
+	print_size(bytes);
+	printf(" read, ");
+	print_size(touched);
+	printf(" working set, %.1f ms\n", hdr.duration / 1000.0);
+
+	printf("\nread size        reads\n");
+	for (uint32_t b = 0; b < SIZE_BUCKETS; b++) {
+		if (sizes[b] == 0)
+			continue;
+		printf("%s", b == SIZE_BUCKETS - 1 ? "> " : "<= ");
+		print_size(64ull << (b == SIZE_BUCKETS - 1 ? b - 1 : b));
+		printf("\t\t%llu (%.1f%%)\n", (unsigned long long)sizes[b], 100.0 * sizes[b] / hdr.numReads);
+	}
+
+	printf("\nseek distance    forward    backward\n");
+	printf("sequential\t%llu\n", (unsigned long long)sequential);
+	for (uint32_t b = 0; b < SEEK_BUCKETS / 2; b++) {
+		if (forward[b] == 0 && backward[b] == 0)
+			continue;
+		printf("%s", b == SEEK_BUCKETS / 2 - 1 ? "> " : "<= ");
+		print_size(4096ull << (2 * (b == SEEK_BUCKETS / 2 - 1 ? b - 1 : b)));
+		printf("\t\t%llu\t%llu\n", (unsigned long long)forward[b], (unsigned long long)backward[b]);
+	}
+	printf("file switches\t%llu\n", (unsigned long long)switches);
+
+	qsort(files, hdr.numFiles, sizeof(FileSummary), compare_bytes);
+
+	printf("\nfile                                      reads      read   touched    extent\n");
+	for (uint32_t i = 0; i < hdr.numFiles && i < top; i++) {
+		printf("%-40s %6u %9llu %9llu %9llu\n", files[i].path, files[i].reads,
+			(unsigned long long)files[i].bytes, (unsigned long long)files[i].touched,
+			(unsigned long long)files[i].extent);
+	}
+	printf("\n");
+
+	for (uint32_t i = 0; i < hdr.numFiles; i++)
+		free(files[i].pages);
+	free(files);
+	free(reads);
+	free(paths);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t top = 20;
+	int arg = 1, ret = 0;
+
+	if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+		top = strtoul(argv[arg + 1], NULL, 10);
+		arg += 2;
+	}
+
+	if (arg >= argc) {
+		fprintf(stderr, "usage: %s [-n top] trace.bin ...\n", argv[0]);
+		return 1;
+	}
+
+	for (; arg < argc; arg++) {
+		if (summarise(argv[arg], top) < 0)
+			ret = 1;
+	}
+
+	return ret;
+}
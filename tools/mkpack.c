@@ -0,0 +1,858 @@
+/* mkpack.c -- build asset packs for libal
+ *
+ * Copyright (C) 2021 GrapheneCt
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+//
+// Usage: mkpack build [-z] [-b block_kb] gamedata assets.pak
+//        mkpack verify gamedata assets.pak
+//        mkpack list assets.pak
+//        mkpack bench [-m MB/s] gamedata assets.pak
+//
+// build packs every file and directory below gamedata into the format of
+// libal/pack_format.h, verify checks that a pack holds exactly the tree it
+// was built from, byte for byte, and list prints its directory.
+//
+// With -z files are LZ4 compressed in blocks of block_kb (default 64, it
+// has to match FILE_CACHE_BLOCK_SIZE), files that shrink by less than a
+// sixteenth are stored as they are. The compressor is a plain greedy one
+// with a single hash probe, the format is standard LZ4.
+//
+// bench reads every file once from gamedata and once from the pack, with
+// the page cache dropped before each pass, and prints both times next to
+// the compression ratio and the decode time. Since the host's disk is not
+// a memory card, -m projects both load times at the given read bandwidth.
+//
+// Paths whose hashes collide cannot be told apart by the loader's binary
+// search and are refused.
+//
+// Build: gcc -O2 -o mkpack mkpack.c ../libal/lz4.c
+//
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../libal/pack_format.h"
+#include "../libal/lz4.h"
+
+#define COPY_SIZE		(1024 * 1024)
+#define MAX_BLOCK_SIZE	(1024 * 1024)
+
+#define MIN_MATCH		4
+#define LAST_LITERALS	5	// a block ends with at least 5 literals
+#define MATCH_LIMIT		12	// and its last match starts 12 bytes before the end
+#define HASH_BITS		16
+
+typedef struct {
+	char *path;
+	uint32_t flags;
+	uint64_t size;
+	uint32_t first;
+	uint32_t count;
+	uint64_t stored;
+	uint32_t numBlocks;
+	uint32_t firstBlock;
+	uint32_t *blockSizes;
+} Node;
+
+static Node *nodes;
+static uint32_t num_nodes = 0;
+static uint32_t max_nodes = 0;
+
+static uint32_t add_node(const char *path, uint32_t flags, uint64_t size)
+{
+	Node *n;
+
+	if (num_nodes == max_nodes) {
+		max_nodes = max_nodes ? max_nodes * 2 : 1024;
+		nodes = realloc(nodes, max_nodes * sizeof(Node));
+	}
+
+	n = &nodes[num_nodes];
+	memset(n, 0, sizeof(Node));
+	n->path = strdup(path);
+	n->flags = flags;
+	n->size = size;
+
+	return num_nodes++;
+}
+
+static const char *base_name(const char *path)
+{
+	const char *s = strrchr(path, '/');
+
+	return s ? s + 1 : path;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// adds the children of directory node dir, sorted by name, then recurses
+static int walk(const char *root, uint32_t dir)
+{
+	char full[8192], rel[4096];
+	char **list = NULL;
+	uint32_t count = 0, max = 0;
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+
+	snprintf(full, sizeof(full), "%s/%s", root, nodes[dir].path);
+
+	d = opendir(full);
+	if (d == NULL) {
+		fprintf(stderr, "cannot open %s\n", full);
+		return -1;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		if (count == max) {
+			max = max ? max * 2 : 64;
+			list = realloc(list, max * sizeof(char *));
+		}
+		list[count++] = strdup(de->d_name);
+	}
+	closedir(d);
+
+	qsort(list, count, sizeof(char *), compare_names);
+
+	nodes[dir].first = num_nodes;
+	nodes[dir].count = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (nodes[dir].path[0])
+			snprintf(rel, sizeof(rel), "%s/%s", nodes[dir].path, list[i]);
+		else
+			snprintf(rel, sizeof(rel), "%s", list[i]);
+		snprintf(full, sizeof(full), "%s/%s", root, rel);
+
+		if (stat(full, &st) < 0) {
+			fprintf(stderr, "cannot stat %s\n", full);
+			return -1;
+		}
+
+		if (S_ISDIR(st.st_mode))
+			add_node(rel, APAK_DIR, 0);
+		else if (S_ISREG(st.st_mode))
+			add_node(rel, 0, st.st_size);
+		else
+			continue;
+
+		nodes[dir].count++;
+	}
+
+	// children are added first so they stay contiguous
+	for (uint32_t i = nodes[dir].first, end = i + nodes[dir].count; i < end; i++) {
+		if ((nodes[i].flags & APAK_DIR) && walk(root, i) < 0)
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+		free(list[i]);
+	free(list);
+
+	return 0;
+}
+
+static PackEntry *sort_entries;
+
+static int compare_hash(const void *a, const void *b)
+{
+	uint64_t ha = sort_entries[*(const uint32_t *)a].hash, hb = sort_entries[*(const uint32_t *)b].hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint8_t *put_length(uint8_t *op, uint32_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+// dst needs room for size + size / 255 + 16 bytes
+static uint32_t lz4_encode(const uint8_t *src, uint32_t size, uint8_t *dst)
+{
+	static uint32_t table[1 << HASH_BITS];
+	const uint8_t *ip = src, *anchor = src, *end = src + size;
+	uint8_t *op = dst, *token;
+	uint32_t lit, len, h, ref;
+
+	memset(table, 0, sizeof(table));
+
+	while (size > MATCH_LIMIT && ip <= end - MATCH_LIMIT) {
+		const uint8_t *match;
+
+		h = (read32(ip) * 2654435761u) >> (32 - HASH_BITS);
+		ref = table[h];
+		table[h] = ip - src + 1;
+
+		match = src + ref - 1;
+		if (ref == 0 || ip - match > 0xFFFF || read32(match) != read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		len = MIN_MATCH;
+		while (ip + len < end - LAST_LITERALS && ip[len] == match[len])
+			len++;
+
+		lit = ip - anchor;
+		token = op++;
+		*token = (lit < 15 ? lit : 15) << 4 | (len - MIN_MATCH < 15 ? len - MIN_MATCH : 15);
+		if (lit >= 15)
+			op = put_length(op, lit - 15);
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		*op++ = (ip - match) & 0xFF;
+		*op++ = (ip - match) >> 8;
+		if (len - MIN_MATCH >= 15)
+			op = put_length(op, len - MIN_MATCH - 15);
+
+		ip += len;
+		anchor = ip;
+	}
+
+	lit = end - anchor;
+	*op++ = (lit < 15 ? lit : 15) << 4;
+	if (lit >= 15)
+		op = put_length(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return op - dst;
+}
+
+// compresses path block by block, writing the stored blocks to out if
+// given, returns the stored size
+static int64_t encode_file(const char *path, uint64_t size, uint32_t blockSize, uint32_t *blockSizes, FILE *out)
+{
+	static uint8_t raw[MAX_BLOCK_SIZE], enc[MAX_BLOCK_SIZE + MAX_BLOCK_SIZE / 255 + 16];
+	uint64_t stored = 0;
+	uint32_t len, n;
+	FILE *in;
+
+	in = fopen(path, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return -1;
+	}
+
+	for (uint32_t b = 0; (uint64_t)b * blockSize < size; b++) {
+		len = size - (uint64_t)b * blockSize < blockSize ? size - (uint64_t)b * blockSize : blockSize;
+		if (fread(raw, 1, len, in) != len) {
+			fprintf(stderr, "%s changed while packing\n", path);
+			fclose(in);
+			return -1;
+		}
+
+		n = lz4_encode(raw, len, enc);
+		if (n >= len)
+			n = len;
+
+		if (out != NULL && fwrite(n == len ? raw : enc, 1, n, out) != n) {
+			fclose(in);
+			return -1;
+		}
+
+		blockSizes[b] = n;
+		stored += n;
+	}
+	fclose(in);
+
+	return stored;
+}
+
+static int copy_file(FILE *out, const char *path, uint64_t size)
+{
+	static uint8_t buf[COPY_SIZE];
+	uint64_t done = 0;
+	size_t n;
+	FILE *in;
+
+	in = fopen(path, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return -1;
+	}
+
+	while (done < size && (n = fread(buf, 1, size - done < COPY_SIZE ? size - done : COPY_SIZE, in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n) {
+			fclose(in);
+			return -1;
+		}
+		done += n;
+	}
+	fclose(in);
+
+	if (done != size) {
+		fprintf(stderr, "%s changed while packing\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int build(const char *root, const char *name, int compress, uint32_t blockSize)
+{
+	static const uint8_t zero[APAK_ALIGN] = { 0 };
+	PackHeader hdr;
+	PackEntry *entries;
+	uint32_t *order, *rank, *children;
+	uint64_t *blocks;
+	uint64_t dataSize = 0, storedSize = 0, offset;
+	uint32_t nameBytes = 0, numBlocks = 0, numCompressed = 0, pos = 0;
+	char full[8192];
+	char *names;
+	FILE *out;
+
+	add_node("", APAK_DIR, 0);
+	if (walk(root, 0) < 0)
+		return -1;
+
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		Node *n = &nodes[i];
+		int64_t stored;
+
+		nameBytes += strlen(n->path) + 1;
+
+		if (!compress || (n->flags & APAK_DIR) || n->size == 0)
+			continue;
+
+		n->numBlocks = (n->size + blockSize - 1) / blockSize;
+		n->blockSizes = malloc(n->numBlocks * sizeof(uint32_t));
+
+		snprintf(full, sizeof(full), "%s/%s", root, n->path);
+		stored = encode_file(full, n->size, blockSize, n->blockSizes, NULL);
+		if (stored < 0)
+			return -1;
+
+		// not worth decoding
+		if ((uint64_t)stored >= n->size - n->size / 16)
+			continue;
+
+		n->flags |= APAK_LZ4;
+		n->stored = stored;
+		n->firstBlock = numBlocks;
+		numBlocks += n->numBlocks + 1;
+		numCompressed++;
+	}
+
+	entries = calloc(num_nodes, sizeof(PackEntry));
+	order = malloc(num_nodes * sizeof(uint32_t));
+	rank = malloc(num_nodes * sizeof(uint32_t));
+	children = malloc(num_nodes * sizeof(uint32_t));
+	blocks = malloc(numBlocks * sizeof(uint64_t) + 1);
+	names = malloc(nameBytes);
+
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		entries[i].hash = apak_hash(nodes[i].path, strlen(nodes[i].path));
+		entries[i].name = pos;
+		entries[i].flags = nodes[i].flags;
+		strcpy(names + pos, nodes[i].path);
+		pos += strlen(nodes[i].path) + 1;
+		order[i] = i;
+	}
+
+	sort_entries = entries;
+	qsort(order, num_nodes, sizeof(uint32_t), compare_hash);
+
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		if (i > 0 && entries[order[i]].hash == entries[order[i - 1]].hash) {
+			fprintf(stderr, "hash collision: %s and %s\n", nodes[order[i]].path, nodes[order[i - 1]].path);
+			return -1;
+		}
+		rank[order[i]] = i;
+	}
+
+	// children[] in node order, which keeps every directory's contiguous
+	for (uint32_t i = 1; i < num_nodes; i++)
+		children[i - 1] = rank[i];
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = APAK_MAGIC;
+	hdr.version = APAK_VERSION;
+	hdr.numEntries = num_nodes;
+	hdr.numChildren = num_nodes - 1;
+	hdr.nameBytes = nameBytes;
+	hdr.blockSize = numBlocks ? blockSize : 0;
+	hdr.numBlocks = numBlocks;
+	hdr.dataOffset = sizeof(PackHeader) + num_nodes * sizeof(PackEntry) + numBlocks * sizeof(uint64_t) +
+		hdr.numChildren * sizeof(uint32_t) + nameBytes;
+
+	offset = (hdr.dataOffset + APAK_ALIGN - 1) & ~(uint64_t)(APAK_ALIGN - 1);
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		Node *n = &nodes[i];
+
+		if (n->flags & APAK_DIR) {
+			entries[i].offset = n->first - 1;
+			entries[i].size = n->count;
+			continue;
+		}
+
+		entries[i].size = n->size;
+		dataSize += n->size;
+
+		if (n->flags & APAK_LZ4) {
+			entries[i].offset = n->firstBlock;
+			for (uint32_t b = 0; b < n->numBlocks; b++) {
+				blocks[n->firstBlock + b] = offset;
+				offset += n->blockSizes[b];
+			}
+			blocks[n->firstBlock + n->numBlocks] = offset;
+			storedSize += n->stored;
+		} else {
+			entries[i].offset = offset;
+			offset += n->size;
+			storedSize += n->size;
+		}
+
+		offset = (offset + APAK_ALIGN - 1) & ~(uint64_t)(APAK_ALIGN - 1);
+	}
+
+	out = fopen(name, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "cannot create %s\n", name);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	for (uint32_t i = 0; i < num_nodes; i++)
+		fwrite(&entries[order[i]], sizeof(PackEntry), 1, out);
+	fwrite(blocks, sizeof(uint64_t), numBlocks, out);
+	fwrite(children, sizeof(uint32_t), hdr.numChildren, out);
+	fwrite(names, 1, nameBytes, out);
+
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		Node *n = &nodes[i];
+		uint64_t start;
+		int ret;
+
+		if (n->flags & APAK_DIR)
+			continue;
+
+		start = (n->flags & APAK_LZ4) ? blocks[n->firstBlock] : entries[i].offset;
+		fwrite(zero, 1, start - ftello(out), out);
+
+		snprintf(full, sizeof(full), "%s/%s", root, n->path);
+		if (n->flags & APAK_LZ4)
+			ret = encode_file(full, n->size, blockSize, n->blockSizes, out) == (int64_t)n->stored ? 0 : -1;
+		else
+			ret = copy_file(out, full, n->size);
+
+		if (ret < 0) {
+			fclose(out);
+			return -1;
+		}
+	}
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "cannot write %s\n", name);
+		return -1;
+	}
+
+	printf("%s: %u entries, %llu bytes of data, %llu byte directory\n", name, num_nodes,
+		(unsigned long long)dataSize, (unsigned long long)hdr.dataOffset);
+	if (compress) {
+		printf("%u files compressed, %llu bytes stored, ratio %.3f\n", numCompressed,
+			(unsigned long long)storedSize, dataSize ? (double)storedSize / dataSize : 1.0);
+	}
+
+	return 0;
+}
+
+typedef struct {
+	PackHeader hdr;
+	PackEntry *entries;
+	uint64_t *blocks;
+	uint32_t *children;
+	char *names;
+	int fd;
+	uint32_t blockSize;
+	double decodeTime;
+} Pack;
+
+static int load(const char *name, Pack *p)
+{
+	uint64_t size;
+	uint8_t *dir;
+
+	p->fd = open(name, O_RDONLY);
+	if (p->fd < 0) {
+		fprintf(stderr, "cannot open %s\n", name);
+		return -1;
+	}
+
+	if (pread(p->fd, &p->hdr, sizeof(PackHeader), 0) != sizeof(PackHeader) ||
+		p->hdr.magic != APAK_MAGIC || p->hdr.version != APAK_VERSION) {
+		fprintf(stderr, "%s: not an asset pack\n", name);
+		close(p->fd);
+		return -1;
+	}
+
+	size = p->hdr.dataOffset - sizeof(PackHeader);
+	dir = malloc(size);
+	if (pread(p->fd, dir, size, sizeof(PackHeader)) != (ssize_t)size) {
+		fprintf(stderr, "%s: truncated\n", name);
+		close(p->fd);
+		return -1;
+	}
+
+	p->entries = (PackEntry *)dir;
+	p->blocks = (uint64_t *)(p->entries + p->hdr.numEntries);
+	p->children = (uint32_t *)(p->blocks + p->hdr.numBlocks);
+	p->names = (char *)(p->children + p->hdr.numChildren);
+	p->blockSize = p->hdr.blockSize ? p->hdr.blockSize : 64 * 1024;
+	p->decodeTime = 0;
+
+	if (p->blockSize > MAX_BLOCK_SIZE) {
+		fprintf(stderr, "%s: block size too large\n", name);
+		close(p->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const PackEntry *find(const Pack *p, const char *path)
+{
+	uint64_t hash = apak_hash(path, strlen(path));
+	uint32_t lo = 0, hi = p->hdr.numEntries, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (p->entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == p->hdr.numEntries || p->entries[lo].hash != hash || strcmp(p->names + p->entries[lo].name, path) != 0)
+		return NULL;
+
+	return &p->entries[lo];
+}
+
+// reads block index of a packed file the way libal does, returns its size
+static int read_block(Pack *p, const PackEntry *e, uint32_t index, uint8_t *dst)
+{
+	static uint8_t tmp[MAX_BLOCK_SIZE];
+	uint64_t pos = (uint64_t)index * p->blockSize;
+	uint32_t len = e->size - pos < p->blockSize ? e->size - pos : p->blockSize;
+	uint64_t start, stored;
+	double t;
+
+	if (!(e->flags & APAK_LZ4))
+		return pread(p->fd, dst, len, e->offset + pos) == len ? (int)len : -1;
+
+	start = p->blocks[e->offset + index];
+	stored = p->blocks[e->offset + index + 1] - start;
+
+	if (stored == len)
+		return pread(p->fd, dst, len, start) == len ? (int)len : -1;
+
+	if (stored > len || pread(p->fd, tmp, stored, start) != (ssize_t)stored)
+		return -1;
+
+	t = now();
+	if (lz4_decode(tmp, stored, dst, len) != (int)len)
+		return -1;
+	p->decodeTime += now() - t;
+
+	return len;
+}
+
+static int verify(const char *root, const char *name)
+{
+	static uint8_t a[MAX_BLOCK_SIZE], b[MAX_BLOCK_SIZE];
+	char full[8192];
+	uint32_t errors = 0;
+	Pack p;
+	FILE *in;
+
+	add_node("", APAK_DIR, 0);
+	if (walk(root, 0) < 0)
+		return -1;
+
+	if (load(name, &p) < 0)
+		return -1;
+
+	if (p.hdr.numEntries != num_nodes) {
+		fprintf(stderr, "%u entries in the pack, %u in %s\n", p.hdr.numEntries, num_nodes, root);
+		errors++;
+	}
+
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		const Node *n = &nodes[i];
+		const PackEntry *e = find(&p, n->path);
+		int len;
+
+		if (e == NULL || (e->flags & APAK_DIR) != n->flags) {
+			fprintf(stderr, "missing: %s\n", n->path);
+			errors++;
+			continue;
+		}
+
+		if (n->flags & APAK_DIR) {
+			if (e->size != n->count) {
+				fprintf(stderr, "%s: %llu children, expected %u\n", n->path, (unsigned long long)e->size, n->count);
+				errors++;
+				continue;
+			}
+			for (uint32_t c = 0; c < n->count; c++) {
+				const PackEntry *child = &p.entries[p.children[e->offset + c]];
+
+				if (strcmp(p.names + child->name, nodes[n->first + c].path) != 0) {
+					fprintf(stderr, "%s: children out of order\n", n->path);
+					errors++;
+					break;
+				}
+			}
+			continue;
+		}
+
+		if (e->size != n->size) {
+			fprintf(stderr, "%s: size %llu, expected %llu\n", n->path, (unsigned long long)e->size, (unsigned long long)n->size);
+			errors++;
+			continue;
+		}
+
+		snprintf(full, sizeof(full), "%s/%s", root, n->path);
+		in = fopen(full, "rb");
+		if (in == NULL) {
+			errors++;
+			continue;
+		}
+
+		for (uint32_t k = 0; (uint64_t)k * p.blockSize < n->size; k++) {
+			len = read_block(&p, e, k, b);
+			if (len < 0 || fread(a, 1, len, in) != (size_t)len || memcmp(a, b, len) != 0) {
+				fprintf(stderr, "%s: data differs\n", n->path);
+				errors++;
+				break;
+			}
+		}
+		fclose(in);
+	}
+
+	close(p.fd);
+
+	if (errors) {
+		fprintf(stderr, "%s: %u errors\n", name, errors);
+		return -1;
+	}
+
+	printf("%s: %u entries ok\n", name, num_nodes);
+
+	return 0;
+}
+
+static int bench(const char *root, const char *name, double bandwidth)
+{
+	static uint8_t buf[MAX_BLOCK_SIZE];
+	uint64_t bytes = 0, stored = 0;
+	double looseTime, packTime;
+	char full[8192];
+	Pack p;
+	int fd;
+
+	add_node("", APAK_DIR, 0);
+	if (walk(root, 0) < 0)
+		return -1;
+
+	if (load(name, &p) < 0)
+		return -1;
+
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		snprintf(full, sizeof(full), "%s/%s", root, nodes[i].path);
+		fd = open(full, O_RDONLY);
+		if (fd >= 0) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+
+	looseTime = now();
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		const Node *n = &nodes[i];
+
+		if (n->flags & APAK_DIR)
+			continue;
+
+		snprintf(full, sizeof(full), "%s/%s", root, n->path);
+		fd = open(full, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "cannot open %s\n", full);
+			return -1;
+		}
+		for (uint64_t pos = 0; pos < n->size; pos += p.blockSize) {
+			if (pread(fd, buf, p.blockSize, pos) <= 0)
+				break;
+		}
+		close(fd);
+		bytes += n->size;
+	}
+	looseTime = now() - looseTime;
+
+	posix_fadvise(p.fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	packTime = now();
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		const PackEntry *e = &p.entries[i];
+
+		if (e->flags & APAK_DIR)
+			continue;
+
+		for (uint32_t k = 0; (uint64_t)k * p.blockSize < e->size; k++) {
+			if (read_block(&p, e, k, buf) < 0) {
+				fprintf(stderr, "%s: bad block %u of %s\n", name, k, p.names + e->name);
+				return -1;
+			}
+		}
+
+		if (e->flags & APAK_LZ4)
+			stored += p.blocks[e->offset + (e->size + p.blockSize - 1) / p.blockSize] - p.blocks[e->offset];
+		else
+			stored += e->size;
+	}
+	packTime = now() - packTime;
+
+	close(p.fd);
+
+	printf("%llu bytes in %u entries, %llu stored, ratio %.3f\n", (unsigned long long)bytes, num_nodes,
+		(unsigned long long)stored, bytes ? (double)stored / bytes : 1.0);
+	printf("loose files  %8.1f ms  %7.1f MB/s\n", looseTime * 1000, bytes / looseTime / 1e6);
+	printf("pack         %8.1f ms  %7.1f MB/s, %.1f ms decoding (%.1f MB/s)\n", packTime * 1000, bytes / packTime / 1e6,
+		p.decodeTime * 1000, p.decodeTime > 0 ? bytes / p.decodeTime / 1e6 : 0.0);
+
+	if (bandwidth > 0) {
+		printf("at %.1f MB/s: loose %.1f ms, pack %.1f ms\n", bandwidth, bytes / bandwidth / 1e3,
+			stored / bandwidth / 1e3 + p.decodeTime * 1000);
+	}
+
+	return 0;
+}
+
+static void list_dir(const Pack *p, const PackEntry *dir, int depth)
+{
+	for (uint64_t c = 0; c < dir->size; c++) {
+		const PackEntry *e = &p->entries[p->children[dir->offset + c]];
+
+		if (e->flags & APAK_DIR) {
+			printf("%*s%s/\n", depth * 2, "", base_name(p->names + e->name));
+			list_dir(p, e, depth + 1);
+		} else if (e->flags & APAK_LZ4) {
+			uint64_t first = p->blocks[e->offset];
+			uint64_t last = p->blocks[e->offset + (e->size + p->blockSize - 1) / p->blockSize];
+
+			printf("%*s%-*s %12llu @ %llu, lz4 %llu\n", depth * 2, "", 40 - depth * 2, base_name(p->names + e->name),
+				(unsigned long long)e->size, (unsigned long long)first, (unsigned long long)(last - first));
+		} else {
+			printf("%*s%-*s %12llu @ %llu\n", depth * 2, "", 40 - depth * 2, base_name(p->names + e->name),
+				(unsigned long long)e->size, (unsigned long long)e->offset);
+		}
+	}
+}
+
+static int list(const char *name)
+{
+	const PackEntry *root;
+	Pack p;
+
+	if (load(name, &p) < 0)
+		return -1;
+	close(p.fd);
+
+	root = find(&p, "");
+	if (root == NULL) {
+		fprintf(stderr, "%s: no root directory\n", name);
+		return -1;
+	}
+
+	list_dir(&p, root, 0);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t blockSize = 64 * 1024;
+	double bandwidth = 0;
+	int compress = 0, arg = 2;
+
+	if (argc >= 2 && strcmp(argv[1], "build") == 0) {
+		for (; arg < argc; arg++) {
+			if (strcmp(argv[arg], "-z") == 0)
+				compress = 1;
+			else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+				blockSize = strtoul(argv[++arg], NULL, 10) * 1024;
+			else
+				break;
+		}
+
+		if (arg + 2 == argc && blockSize > 0 && blockSize <= MAX_BLOCK_SIZE)
+			return build(argv[arg], argv[arg + 1], compress, blockSize) < 0;
+	}
+
+	if (argc == 4 && strcmp(argv[1], "verify") == 0)
+		return verify(argv[2], argv[3]) < 0;
+
+	if (argc == 3 && strcmp(argv[1], "list") == 0)
+		return list(argv[2]) < 0;
+
+	if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+		if (arg + 1 < argc && strcmp(argv[arg], "-m") == 0) {
+			bandwidth = strtod(argv[arg + 1], NULL);
+			arg += 2;
+		}
+
+		if (arg + 2 == argc)
+			return bench(argv[arg], argv[arg + 1], bandwidth) < 0;
+	}
+
+	fprintf(stderr, "usage: %s build [-z] [-b block_kb] gamedata assets.pak\n", argv[0]);
+	fprintf(stderr, "       %s verify gamedata assets.pak\n", argv[0]);
+	fprintf(stderr, "       %s list assets.pak\n", argv[0]);
+	fprintf(stderr, "       %s bench [-m MB/s] gamedata assets.pak\n", argv[0]);
+
+	return 1;
+}